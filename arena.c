@@ -0,0 +1,53 @@
+//
+// Bump allocator owning many buffers that are all released together with one free.
+//
+
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+size_t arena_size_of(size_t size) {
+    return (size + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+}
+
+size_t arena_size_of_matrix(int rows, int cols) {
+    return arena_size_of(sizeof(Matrix)) + arena_size_of((size_t) rows * matrix_stride_for(cols) * sizeof(MatrixValue));
+}
+
+Arena *create_arena(size_t capacity) {
+    size_t header = arena_size_of(sizeof(Arena));
+    Arena *arena = aligned_malloc(header + capacity);
+    arena->capacity = capacity;
+    arena->used = 0;
+    arena->memory = (char *) arena + header;
+    //zeroed once here, so allocations need no memset
+    memset(arena->memory, 0, capacity);
+    return arena;
+}
+
+void free_arena(Arena *arena) {
+    aligned_free(arena);
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = arena_size_of(size);
+    if (size > arena->capacity - arena->used) {
+        printf("Error: Arena is too small!\n");
+        exit(1);
+    }
+    void *pointer = arena->memory + arena->used;
+    arena->used += size;
+    return pointer;
+}
+
+Matrix *arena_create_matrix(Arena *arena, int rows, int cols) {
+    Matrix *matrix = arena_alloc(arena, sizeof(Matrix));
+    matrix->rows = rows;
+    matrix->cols = cols;
+    matrix->stride = matrix_stride_for(cols);
+    matrix->values = arena_alloc(arena, (size_t) rows * matrix->stride * sizeof(MatrixValue));
+    matrix->owns_values = 0;
+    matrix->in_arena = 1;
+    return matrix;
+}
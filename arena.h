@@ -0,0 +1,35 @@
+//
+// Bump allocator owning many buffers that are all released together with one free.
+//
+
+#ifndef SEM2LAB2_ARENA_H
+#define SEM2LAB2_ARENA_H
+
+#include <stddef.h>
+#include "matrix_utils.h"
+
+// the arena header sits at the start of its own buffer, every allocation is MATRIX_ALIGNMENT aligned
+struct Arena {
+    size_t capacity;
+    size_t used;
+    char *memory;
+} typedef Arena;
+
+// bytes an allocation of size takes in an arena, including the alignment padding
+size_t arena_size_of(size_t size);
+
+// bytes arena_create_matrix takes for a rows x cols matrix
+size_t arena_size_of_matrix(int rows, int cols);
+
+// one buffer for capacity bytes, sum arena_size_of over everything that will be allocated
+Arena *create_arena(size_t capacity);
+
+void free_arena(Arena *arena);
+
+// zeroed, aligned memory from the arena, exits when the arena is too small like aligned_malloc does
+void *arena_alloc(Arena *arena, size_t size);
+
+// a zeroed matrix whose struct and values live in the arena, free_matrix leaves it alone
+Matrix *arena_create_matrix(Arena *arena, int rows, int cols);
+
+#endif //SEM2LAB2_ARENA_H
@@ -0,0 +1,202 @@
+//
+// Asynchronous (Hogwild) training: lock-free updates of the shared weights by every thread.
+//
+
+#include "async_training.h"
+#include <stdlib.h>
+#include <math.h>
+
+AsyncTrainer *create_async_trainer(Network *network, int update_size, int number_of_threads, uint64_t seed) {
+    if (number_of_threads < 1) {
+        number_of_threads = 1;
+    }
+    if (update_size < 1) {
+        update_size = 1;
+    }
+    AsyncTrainer *trainer = calloc(1, sizeof(AsyncTrainer));
+    trainer->network = network;
+    trainer->number_of_threads = number_of_threads;
+    trainer->update_size = update_size;
+    trainer->pool = create_thread_pool(number_of_threads);
+    trainer->batches = malloc(number_of_threads * sizeof(Batch *));
+    trainer->randoms = malloc(number_of_threads * sizeof(Random));
+    trainer->indices = malloc(number_of_threads * sizeof(int *));
+    trainer->packets = malloc(number_of_threads * sizeof(TrainingDataPacket **));
+    for (int i = 0; i < number_of_threads; i++) {
+        //private gradients, the forward and backward pass never write to the layers
+        trainer->batches[i] = create_batch_with_gradients(network, update_size);
+        random_seed(&trainer->randoms[i], seed, i + 1);
+        trainer->indices[i] = malloc(update_size * sizeof(int));
+        trainer->packets[i] = malloc(update_size * sizeof(TrainingDataPacket *));
+    }
+    trainer->thread_norms = calloc(number_of_threads, sizeof(double));
+    trainer->thread_skipped = calloc(number_of_threads, sizeof(long));
+    trainer->thread_seconds = calloc(4 * number_of_threads, sizeof(double));
+    return trainer;
+}
+
+void free_async_trainer(AsyncTrainer *trainer) {
+    for (int i = 0; i < trainer->number_of_threads; i++) {
+        free_batch(trainer->batches[i]);
+        free(trainer->indices[i]);
+        free(trainer->packets[i]);
+    }
+    free(trainer->batches);
+    free(trainer->randoms);
+    free(trainer->indices);
+    free(trainer->packets);
+    free(trainer->thread_norms);
+    free(trainer->thread_skipped);
+    free(trainer->thread_seconds);
+    free_thread_pool(trainer->pool);
+    free(trainer);
+}
+
+// L2 norm of the batch's gradients averaged over number_of_samples
+static double batch_gradient_norm(Network *network, Batch *batch, int number_of_samples) {
+    double sum = 0;
+    for (int k = 1; k < network->number_of_layers; k++) {
+        Layer *layer = network->layers[k];
+        for (int i = 0; i < layer->layer_size; i++) {
+            const MatrixValue *delta_weights_row = matrix_row(batch->delta_weights[k], i);
+            MatrixAccumulator row_sum = 0;
+            for (int j = 0; j < layer->input_size; j++) {
+                row_sum += (MatrixAccumulator) delta_weights_row[j] * delta_weights_row[j];
+            }
+            MatrixValue delta_bias = MATRIX_AT(batch->delta_biases[k], i, 0);
+            sum += (double) row_sum + (double) delta_bias * delta_bias;
+        }
+    }
+    return sqrt(sum) / number_of_samples;
+}
+
+// w -= step * g on the shared weights and biases, zeroing the batch's gradients in the same sweep
+// other threads read and write the same weights meanwhile, every value is loaded and stored once
+static void subtract_gradient(Network *network, Batch *batch, double step) {
+    MatrixValue value_step = (MatrixValue) step;
+    for (int k = 1; k < network->number_of_layers; k++) {
+        Layer *layer = network->layers[k];
+        for (int i = 0; i < layer->layer_size; i++) {
+            MatrixValue *weights_row = matrix_row(layer->weights, i);
+            MatrixValue *delta_weights_row = matrix_row(batch->delta_weights[k], i);
+            for (int j = 0; j < layer->input_size; j++) {
+                weights_row[j] -= value_step * delta_weights_row[j];
+                delta_weights_row[j] = 0;
+            }
+            MATRIX_AT(layer->biases, i, 0) -= value_step * MATRIX_AT(batch->delta_biases[k], i, 0);
+            MATRIX_AT(batch->delta_biases[k], i, 0) = 0;
+        }
+    }
+}
+
+// one thread's share of the round, an update after every update_size samples
+static void async_task(void *context, int thread_index, int number_of_threads) {
+    AsyncTrainer *trainer = context;
+    Network *network = trainer->network;
+    Batch *batch = trainer->batches[thread_index];
+    Random *random = &trainer->randoms[thread_index];
+    int *indices = trainer->indices[thread_index];
+    TrainingDataPacket **packets = trainer->packets[thread_index];
+    double *seconds = trainer->thread_seconds + 4 * thread_index;
+    seconds[0] = seconds[1] = seconds[2] = seconds[3] = 0;
+    double mark = profile_begin(trainer->profiler);
+    SampleRows rows;
+    if (trainer->rows != NULL) {
+        rows = *trainer->rows;
+        rows.indices = indices;
+    }
+    double largest_norm = 0;
+    long skipped = 0;
+    int count;
+    for (long done = 0; done < trainer->samples_per_thread; done += count) {
+        long left = trainer->samples_per_thread - done;
+        count = left < trainer->update_size ? (int) left : trainer->update_size;
+        for (int j = 0; j < count; j++) {
+            int sample = (int) random_below(random, (uint32_t) trainer->length_of_data);
+            if (trainer->rows != NULL) {
+                indices[j] = trainer->rows->indices != NULL ? trainer->rows->indices[sample] : sample;
+            } else {
+                packets[j] = trainer->data[sample];
+            }
+        }
+        if (trainer->rows != NULL) {
+            load_batch_rows(batch, &rows, 0, count);
+        } else {
+            load_batch(batch, packets, count);
+        }
+        seconds[0] += profile_lap(trainer->profiler, &mark);
+        propagate_forward_batch(network, batch);
+        seconds[1] += profile_lap(trainer->profiler, &mark);
+        propagate_backward_batch(network, batch);
+        seconds[2] += profile_lap(trainer->profiler, &mark);
+
+        //the iteration the threads reached together, assuming they run at the same speed
+        int iteration = trainer->first_iteration + (int) (done * number_of_threads / trainer->split_size);
+        double rate = scheduled_learning_rate(trainer->schedule, trainer->learning_rate, iteration);
+        double norm = batch_gradient_norm(network, batch, count);
+        if (!isfinite(norm)) {
+            //an overflowed gradient would turn every weight into NaN
+            zero_batch_gradients(batch);
+            skipped++;
+        } else {
+            double scale = trainer->max_gradient_norm > 0 && norm > trainer->max_gradient_norm
+                           ? trainer->max_gradient_norm / norm : 1;
+            subtract_gradient(network, batch, rate * scale / count);
+            largest_norm = norm > largest_norm ? norm : largest_norm;
+        }
+        seconds[3] += profile_lap(trainer->profiler, &mark);
+    }
+    trainer->thread_norms[thread_index] = largest_norm;
+    trainer->thread_skipped[thread_index] = skipped;
+}
+
+static void run_round(AsyncTrainer *trainer, int first_iteration, int iterations, int split_size,
+                      double learning_rate, const LearningRateSchedule *schedule) {
+    trainer->first_iteration = first_iteration;
+    trainer->split_size = split_size;
+    trainer->learning_rate = learning_rate;
+    trainer->schedule = schedule;
+    long samples = (long) iterations * split_size;
+    trainer->samples_per_thread = (samples + trainer->number_of_threads - 1) / trainer->number_of_threads;
+    thread_pool_run(trainer->pool, async_task, trainer);
+
+    trainer->gradient_norm = 0;
+    for (int i = 0; i < trainer->number_of_threads; i++) {
+        if (trainer->thread_norms[i] > trainer->gradient_norm) {
+            trainer->gradient_norm = trainer->thread_norms[i];
+        }
+        trainer->skipped_steps += trainer->thread_skipped[i];
+    }
+    Profiler *profiler = trainer->profiler;
+    if (profiler != NULL) {
+        //the round lasts as long as its slowest thread
+        ProfilePhase phases[] = {PROFILE_SAMPLING, PROFILE_FORWARD, PROFILE_BACKWARD, PROFILE_UPDATE};
+        for (int p = 0; p < 4; p++) {
+            double slowest = 0;
+            for (int i = 0; i < trainer->number_of_threads; i++) {
+                double seconds = trainer->thread_seconds[4 * i + p];
+                slowest = seconds > slowest ? seconds : slowest;
+            }
+            profile_add(profiler, phases[p], slowest);
+        }
+        for (int i = 0; i < iterations; i++) {
+            profile_step(profiler, split_size);
+        }
+    }
+}
+
+void train_async_round(AsyncTrainer *trainer, TrainingDataPacket **data, int length_of_data, int first_iteration,
+                       int iterations, int split_size, double learning_rate, const LearningRateSchedule *schedule) {
+    trainer->data = data;
+    trainer->rows = NULL;
+    trainer->length_of_data = length_of_data;
+    run_round(trainer, first_iteration, iterations, split_size, learning_rate, schedule);
+}
+
+void train_async_round_rows(AsyncTrainer *trainer, const SampleRows *rows, int first_iteration, int iterations,
+                            int split_size, double learning_rate, const LearningRateSchedule *schedule) {
+    trainer->data = NULL;
+    trainer->rows = rows;
+    trainer->length_of_data = rows->number_of_samples;
+    run_round(trainer, first_iteration, iterations, split_size, learning_rate, schedule);
+}
@@ -0,0 +1,67 @@
+//
+// Asynchronous (Hogwild) training: every thread draws its own samples, runs them through its
+// own batch buffers and subtracts its gradient from the shared weights and biases directly,
+// without locks and without waiting for the other threads. Updates of different threads may
+// interleave and overwrite each other's last write to a weight, which plain SGD tolerates.
+//
+
+#ifndef SEM2LAB2_ASYNC_TRAINING_H
+#define SEM2LAB2_ASYNC_TRAINING_H
+
+#include "network.h"
+#include "thread_pool.h"
+#include "sampler.h"
+#include "profiler.h"
+
+struct AsyncTrainer {
+    Network *network;
+    ThreadPool *pool;
+    int number_of_threads;
+    //samples of one update of one thread
+    int update_size;
+    //per thread: activations, deltas and gradients, random numbers and the drawn samples
+    Batch **batches;
+    Random *randoms;
+    int **indices;
+    TrainingDataPacket ***packets;
+    //state of the round currently being run
+    TrainingDataPacket **data;
+    const SampleRows *rows;
+    int length_of_data;
+    long samples_per_thread;
+    //learning rate of an update, the schedule is evaluated at the iteration the update falls in
+    double learning_rate;
+    const LearningRateSchedule *schedule;
+    int first_iteration;
+    int split_size;
+    //every update's gradient is clipped to this norm, 0 disables clipping
+    double max_gradient_norm;
+    //largest norm of an update's gradient in the last round
+    double gradient_norm;
+    //updates whose gradient was not finite and were dropped
+    long skipped_steps;
+    double *thread_norms;
+    long *thread_skipped;
+    //borrowed, times the phases of every thread when set
+    Profiler *profiler;
+    //sampling, forward, backward and update seconds of every thread in the current round
+    double *thread_seconds;
+} typedef AsyncTrainer;
+
+// create a trainer whose threads update the network after every update_size samples
+// thread t draws its samples from stream t + 1 of seed
+AsyncTrainer *create_async_trainer(Network *network, int update_size, int number_of_threads, uint64_t seed);
+
+void free_async_trainer(AsyncTrainer *trainer);
+
+// train on iterations * split_size random samples of data, split evenly over the threads, and return once
+// every thread finished its share, updates during the round use the learning rate of schedule at the
+// iteration first_iteration + samples so far / split_size
+void train_async_round(AsyncTrainer *trainer, TrainingDataPacket **data, int length_of_data, int first_iteration,
+                       int iterations, int split_size, double learning_rate, const LearningRateSchedule *schedule);
+
+// same as train_async_round for samples stored as rows
+void train_async_round_rows(AsyncTrainer *trainer, const SampleRows *rows, int first_iteration, int iterations,
+                            int split_size, double learning_rate, const LearningRateSchedule *schedule);
+
+#endif //SEM2LAB2_ASYNC_TRAINING_H
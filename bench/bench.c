@@ -0,0 +1,462 @@
+//
+// Benchmark suite: matrix kernels at the layer shapes of the lab and MNIST networks,
+// propagate_forward latency, training throughput and model load time, all on synthetic
+// data so it runs offline. Every case is warmed up, then timed in repetitions whose
+// median and 99th percentile are reported, optionally as JSON for comparing runs:
+//
+//   bench [seconds per case] [results.json]
+//   bench --compare before.json after.json
+//
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../network.h"
+#include "../parallel_training.h"
+#include "../model_io.h"
+#include "../thread_pool.h"
+
+#define MAX_RESULTS 64
+#define MAX_REPETITIONS 20000
+#define MIN_REPETITIONS 20
+// the operations of one repetition should take at least this long for the clock to be accurate
+#define REPETITION_SECONDS 1e-3
+#define TRAINING_BATCH 100
+
+struct Topology {
+    const char *name;
+    int number_of_layers;
+    int layer_sizes[8];
+} typedef Topology;
+
+static const Topology topologies[] = {
+        {"lab",   5, {3, 10, 16, 20, 16}},
+        {"mnist", 4, {784, 24, 24, 10}},
+};
+
+struct BenchResult {
+    char name[96];
+    long repetitions;
+    //operations per repetition
+    long inner;
+    double median_ns;
+    double p99_ns;
+    double min_ns;
+    //0 where the case has no natural unit of work
+    double items_per_second;
+    double gflops;
+} typedef BenchResult;
+
+static BenchResult results[MAX_RESULTS];
+static int number_of_results = 0;
+
+static double now_seconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec * 1e-9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+// time run(context) for about seconds, items and flops are the work of one call
+static void measure(const char *name, void (*run)(void *), void *context, double seconds, double items,
+                    double flops) {
+    //warmup, which also estimates the time of one call
+    double start = now_seconds();
+    long calls = 0;
+    while (now_seconds() - start < seconds * 0.1 || calls < 2) {
+        run(context);
+        calls++;
+    }
+    double single = (now_seconds() - start) / calls;
+    long inner = single >= REPETITION_SECONDS ? 1 : (long) (REPETITION_SECONDS / single) + 1;
+    long repetitions = (long) (seconds * 0.9 / (single * inner));
+    repetitions = repetitions < MIN_REPETITIONS ? MIN_REPETITIONS : repetitions;
+    repetitions = repetitions > MAX_REPETITIONS ? MAX_REPETITIONS : repetitions;
+
+    double *times = malloc(sizeof(double) * repetitions);
+    for (long r = 0; r < repetitions; r++) {
+        double begin = now_seconds();
+        for (long i = 0; i < inner; i++) {
+            run(context);
+        }
+        times[r] = (now_seconds() - begin) / inner * 1e9;
+    }
+    qsort(times, repetitions, sizeof(double), compare_doubles);
+
+    BenchResult *result = &results[number_of_results++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->repetitions = repetitions;
+    result->inner = inner;
+    result->median_ns = times[repetitions / 2];
+    result->p99_ns = times[(long) (repetitions * 0.99) < repetitions ? (long) (repetitions * 0.99) : repetitions - 1];
+    result->min_ns = times[0];
+    result->items_per_second = items > 0 ? items / result->median_ns * 1e9 : 0;
+    result->gflops = flops > 0 ? flops / result->median_ns : 0;
+    free(times);
+    printf("%-44s %12.1f %12.1f %12.1f", result->name, result->median_ns, result->p99_ns, result->min_ns);
+    if (result->gflops > 0) {
+        printf(" %9.2f GFLOP/s", result->gflops);
+    } else if (result->items_per_second > 0) {
+        printf(" %9.0f /s", result->items_per_second);
+    }
+    printf("\n");
+}
+
+// kernels
+
+struct GemmCase {
+    Matrix *a;
+    Matrix *b;
+    Matrix *c;
+    int transpose_a;
+    int transpose_b;
+    double beta;
+} typedef GemmCase;
+
+static void run_gemm(void *context) {
+    GemmCase *gemm = context;
+    matrix_gemm(gemm->a, gemm->transpose_a, gemm->b, gemm->transpose_b, 1, gemm->beta, gemm->c);
+}
+
+static Matrix *random_matrix(int rows, int cols) {
+    Matrix *matrix = create_matrix(rows, cols);
+    randomize_matrix(matrix);
+    return matrix;
+}
+
+// c = a * b with a rows x inner, b inner x cols, either stored transposed
+static void bench_gemm(const char *label, int rows, int inner, int cols, int transpose_a, int transpose_b,
+                       double beta, double seconds) {
+    GemmCase gemm;
+    gemm.a = transpose_a ? random_matrix(inner, rows) : random_matrix(rows, inner);
+    gemm.b = transpose_b ? random_matrix(cols, inner) : random_matrix(inner, cols);
+    gemm.c = random_matrix(rows, cols);
+    gemm.transpose_a = transpose_a;
+    gemm.transpose_b = transpose_b;
+    gemm.beta = beta;
+    char name[96];
+    snprintf(name, sizeof(name), "gemm %s %dx%d*%dx%d", label, rows, inner, inner, cols);
+    measure(name, run_gemm, &gemm, seconds, 0, 2.0 * rows * inner * cols);
+    free_matrix(gemm.a);
+    free_matrix(gemm.b);
+    free_matrix(gemm.c);
+}
+
+static void run_add(void *context) {
+    Matrix **matrices = context;
+    add_matrices(matrices[0], matrices[1], matrices[0]);
+}
+
+static void run_add_column_vector(void *context) {
+    Matrix **matrices = context;
+    add_column_vector(matrices[0], matrices[1], matrices[0]);
+}
+
+static void run_add_row_sums(void *context) {
+    Matrix **matrices = context;
+    add_row_sums(matrices[0], matrices[1]);
+}
+
+static void run_transpose(void *context) {
+    Matrix **matrices = context;
+    matrix_transpose(matrices[0], matrices[1]);
+}
+
+static void bench_kernels(double seconds) {
+    //the shapes the first mnist layer and the largest lab layer run at
+    bench_gemm("forward", 24, 784, 1, 0, 0, 0, seconds);
+    bench_gemm("forward", 20, 16, 1, 0, 0, 0, seconds);
+    bench_gemm("batch forward", 24, 784, TRAINING_BATCH, 0, 1, 0, seconds);
+    bench_gemm("batch forward", 20, 16, TRAINING_BATCH, 0, 0, 0, seconds);
+    bench_gemm("backward deltas", 24, 24, TRAINING_BATCH, 1, 0, 0, seconds);
+    bench_gemm("weight gradients", 24, TRAINING_BATCH, 784, 0, 0, 1, seconds);
+
+    Matrix *matrices[2];
+    matrices[0] = random_matrix(24, 784);
+    matrices[1] = random_matrix(24, 784);
+    measure("add_matrices 24x784", run_add, matrices, seconds, 0, 0);
+    free_matrix(matrices[1]);
+    matrices[1] = random_matrix(784, 24);
+    measure("matrix_transpose 24x784", run_transpose, matrices, seconds, 0, 0);
+    free_matrix(matrices[0]);
+    free_matrix(matrices[1]);
+
+    matrices[0] = random_matrix(24, TRAINING_BATCH);
+    matrices[1] = random_matrix(24, 1);
+    measure("add_column_vector 24x100", run_add_column_vector, matrices, seconds, 0, 0);
+    measure("add_row_sums 24x100", run_add_row_sums, matrices, seconds, 0, 0);
+    free_matrix(matrices[0]);
+    free_matrix(matrices[1]);
+}
+
+// inference
+
+struct ForwardCase {
+    Network *network;
+    Matrix *input;
+    Batch *batch;
+} typedef ForwardCase;
+
+static void run_forward(void *context) {
+    ForwardCase *forward = context;
+    propagate_forward(forward->network, forward->input);
+}
+
+static void run_forward_batch(void *context) {
+    ForwardCase *forward = context;
+    propagate_forward_batch(forward->network, forward->batch);
+}
+
+// random inputs in [0, scale) with random classes, stored like a binary data set
+static SampleRows synthetic_rows(int number_of_samples, int number_of_features, int number_of_classes,
+                                 MatrixValue *features, int32_t *labels, double scale) {
+    for (long i = 0; i < (long) number_of_samples * number_of_features; i++) {
+        features[i] = (MatrixValue) (scale * rand() / RAND_MAX);
+    }
+    for (int i = 0; i < number_of_samples; i++) {
+        labels[i] = rand() % number_of_classes;
+    }
+    SampleRows rows;
+    rows.number_of_samples = number_of_samples;
+    rows.number_of_features = number_of_features;
+    rows.number_of_classes = number_of_classes;
+    rows.features = features;
+    rows.feature_stride = number_of_features;
+    rows.labels = labels;
+    rows.indices = NULL;
+    return rows;
+}
+
+static double forward_flops(const Topology *topology) {
+    double flops = 0;
+    for (int i = 1; i < topology->number_of_layers; i++) {
+        flops += 2.0 * topology->layer_sizes[i] * topology->layer_sizes[i - 1];
+    }
+    return flops;
+}
+
+static void bench_forward(const Topology *topology, double seconds) {
+    int inputs = topology->layer_sizes[0];
+    int classes = topology->layer_sizes[topology->number_of_layers - 1];
+    ForwardCase forward;
+    forward.network = create_network(topology->number_of_layers, (int *) topology->layer_sizes);
+    forward.input = random_matrix(inputs, 1);
+    char name[96];
+    snprintf(name, sizeof(name), "propagate_forward %s", topology->name);
+    measure(name, run_forward, &forward, seconds, 1, forward_flops(topology));
+
+    MatrixValue *features = malloc(sizeof(MatrixValue) * inputs * TRAINING_BATCH);
+    int32_t *labels = malloc(sizeof(int32_t) * TRAINING_BATCH);
+    SampleRows rows = synthetic_rows(TRAINING_BATCH, inputs, classes, features, labels, 1);
+    forward.batch = create_batch(forward.network, TRAINING_BATCH);
+    load_batch_rows(forward.batch, &rows, 0, TRAINING_BATCH);
+    snprintf(name, sizeof(name), "propagate_forward_batch %s n=%d", topology->name, TRAINING_BATCH);
+    measure(name, run_forward_batch, &forward, seconds, TRAINING_BATCH, TRAINING_BATCH * forward_flops(topology));
+
+    free_batch(forward.batch);
+    free(features);
+    free(labels);
+    free_matrix(forward.input);
+    free_network(forward.network);
+}
+
+// training
+
+struct TrainingCase {
+    ParallelTrainer *trainer;
+    SampleRows rows;
+    SampleRows batch;
+    int next;
+} typedef TrainingCase;
+
+// one step on the next TRAINING_BATCH samples, wrapping around the data
+static void run_training_step(void *context) {
+    TrainingCase *training = context;
+    if (training->next + TRAINING_BATCH > training->rows.number_of_samples) {
+        training->next = 0;
+    }
+    training->batch.features = training->rows.features + (size_t) training->next * training->rows.feature_stride;
+    training->batch.labels = training->rows.labels + training->next;
+    training->next += TRAINING_BATCH;
+    train_network_parallel_rows(training->trainer, &training->batch, 0.01);
+}
+
+static void bench_training(const Topology *topology, int number_of_threads, double seconds) {
+    int inputs = topology->layer_sizes[0];
+    int classes = topology->layer_sizes[topology->number_of_layers - 1];
+    int number_of_samples = 100 * TRAINING_BATCH;
+    MatrixValue *features = malloc(sizeof(MatrixValue) * inputs * number_of_samples);
+    int32_t *labels = malloc(sizeof(int32_t) * number_of_samples);
+    Network *network = create_network(topology->number_of_layers, (int *) topology->layer_sizes);
+    TrainingCase training;
+    //small inputs keep the 784 wide first layer from saturating during the run
+    training.rows = synthetic_rows(number_of_samples, inputs, classes, features, labels, inputs > 100 ? 0.2 : 1);
+    training.batch = training.rows;
+    training.batch.number_of_samples = TRAINING_BATCH;
+    training.next = 0;
+    training.trainer = create_parallel_trainer(network, TRAINING_BATCH, number_of_threads);
+    char name[96];
+    snprintf(name, sizeof(name), "training step %s n=%d threads=%d", topology->name, TRAINING_BATCH,
+             number_of_threads);
+    measure(name, run_training_step, &training, seconds, TRAINING_BATCH,
+            TRAINING_BATCH * training_flops_per_sample(network));
+    free_parallel_trainer(training.trainer);
+    free_network(network);
+    free(features);
+    free(labels);
+}
+
+// model loading
+
+struct LoadCase {
+    char *file_name;
+    int binary;
+    int verify_checksum;
+} typedef LoadCase;
+
+static void run_load(void *context) {
+    LoadCase *load = context;
+    Network *network = load->binary ? load_network_binary(load->file_name, load->verify_checksum)
+                                    : load_network_from_file(load->file_name);
+    free_network(network);
+}
+
+static void bench_load(const Topology *topology, double seconds) {
+    char text_name[] = "bench_model.tmp.txt";
+    char binary_name[] = "bench_model.tmp.bin";
+    Network *network = create_network(topology->number_of_layers, (int *) topology->layer_sizes);
+    randomize_matrix(network->layers[1]->biases);
+    int failed = save_network_to_file(network, text_name) || save_network_binary(network, binary_name);
+    free_network(network);
+    if (!failed) {
+        char name[96];
+        LoadCase load = {text_name, 0, 0};
+        snprintf(name, sizeof(name), "load text %s", topology->name);
+        measure(name, run_load, &load, seconds, 0, 0);
+        load.file_name = binary_name;
+        load.binary = 1;
+        snprintf(name, sizeof(name), "load binary %s", topology->name);
+        measure(name, run_load, &load, seconds, 0, 0);
+        load.verify_checksum = 1;
+        snprintf(name, sizeof(name), "load binary+crc %s", topology->name);
+        measure(name, run_load, &load, seconds, 0, 0);
+    }
+    remove(text_name);
+    remove(binary_name);
+}
+
+// results
+
+static int write_json(char *file_name, double seconds) {
+    FILE *file = fopen(file_name, "w");
+    if (file == NULL) {
+        printf("Error: Could not create file!\n");
+        return 1;
+    }
+    fprintf(file, "{\"precision\":\"%s\",\"isa\":\"%s\",\"threads\":%d,\"seconds_per_case\":%g,\"results\":[\n",
+            sizeof(MatrixValue) == sizeof(float) ? "float32" : "float64", matrix_isa_name(matrix_active_isa()),
+            default_thread_count(), seconds);
+    //one result per line, which is what --compare reads back
+    for (int i = 0; i < number_of_results; i++) {
+        BenchResult *result = &results[i];
+        fprintf(file, "{\"name\":\"%s\",\"median_ns\":%.1f,\"p99_ns\":%.1f,\"min_ns\":%.1f,\"repetitions\":%ld,"
+                      "\"inner\":%ld,\"items_per_second\":%.1f,\"gflops\":%.4f}%s\n", result->name,
+                result->median_ns, result->p99_ns, result->min_ns, result->repetitions, result->inner,
+                result->items_per_second, result->gflops, i + 1 < number_of_results ? "," : "");
+    }
+    fprintf(file, "]}\n");
+    fclose(file);
+    return 0;
+}
+
+// names and medians of a file written by write_json, returns the number of results read
+static int read_json(char *file_name, char names[][96], double *medians) {
+    FILE *file = fopen(file_name, "r");
+    if (file == NULL) {
+        printf("Error: Could not open file!\n");
+        return -1;
+    }
+    char line[512];
+    int count = 0;
+    while (count < MAX_RESULTS && fgets(line, sizeof(line), file) != NULL) {
+        char *name = strstr(line, "{\"name\":\"");
+        char *median = strstr(line, "\"median_ns\":");
+        if (name == NULL || median == NULL) {
+            continue;
+        }
+        name += strlen("{\"name\":\"");
+        char *end = strchr(name, '"');
+        size_t length = end - name < 95 ? (size_t) (end - name) : 95;
+        memcpy(names[count], name, length);
+        names[count][length] = '\0';
+        medians[count] = atof(median + strlen("\"median_ns\":"));
+        count++;
+    }
+    fclose(file);
+    return count;
+}
+
+static int compare_runs(char *before_name, char *after_name) {
+    static char before[MAX_RESULTS][96], after[MAX_RESULTS][96];
+    double before_medians[MAX_RESULTS], after_medians[MAX_RESULTS];
+    int before_count = read_json(before_name, before, before_medians);
+    int after_count = read_json(after_name, after, after_medians);
+    if (before_count < 0 || after_count < 0) {
+        return 1;
+    }
+    printf("%-44s %12s %12s %8s\n", "case", "before ns", "after ns", "speedup");
+    for (int i = 0; i < after_count; i++) {
+        for (int j = 0; j < before_count; j++) {
+            if (strcmp(after[i], before[j]) == 0) {
+                printf("%-44s %12.1f %12.1f %7.2fx\n", after[i], before_medians[j], after_medians[i],
+                       before_medians[j] / after_medians[i]);
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "--compare") == 0) {
+        if (argc < 4) {
+            printf("usage: %s --compare <before.json> <after.json>\n", argv[0]);
+            return 1;
+        }
+        return compare_runs(argv[2], argv[3]);
+    }
+    double seconds = argc > 1 ? atof(argv[1]) : 0.3;
+    if (seconds <= 0) {
+        printf("usage: %s [seconds per case] [results.json]\n       %s --compare <before.json> <after.json>\n",
+               argv[0], argv[0]);
+        return 1;
+    }
+    srand(1);
+    printf("%s, %s kernels, %d threads\n", sizeof(MatrixValue) == sizeof(float) ? "float32" : "float64",
+           matrix_isa_name(matrix_active_isa()), default_thread_count());
+    printf("%-44s %12s %12s %12s\n", "case", "median ns", "p99 ns", "min ns");
+    bench_kernels(seconds);
+    int number_of_topologies = sizeof(topologies) / sizeof(topologies[0]);
+    for (int t = 0; t < number_of_topologies; t++) {
+        bench_forward(&topologies[t], seconds);
+    }
+    for (int t = 0; t < number_of_topologies; t++) {
+        bench_training(&topologies[t], 1, seconds);
+        if (default_thread_count() > 1) {
+            bench_training(&topologies[t], default_thread_count(), seconds);
+        }
+    }
+    for (int t = 0; t < number_of_topologies; t++) {
+        bench_load(&topologies[t], seconds);
+    }
+    if (argc > 2) {
+        return write_json(argv[2], seconds);
+    }
+    return 0;
+}
@@ -0,0 +1,233 @@
+//
+// Convergence per second of asynchronous (Hogwild) training against the synchronous loop of
+// train_stochastic_rows. Every run starts from the same weights and trains for the same wall
+// time, the held-out accuracy is measured at checkpoints outside of the timed training.
+// bench_async [seconds per run] [data.bin], a colour-like task on 3 features without a data set.
+//
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../network.h"
+#include "../parallel_training.h"
+#include "../async_training.h"
+#include "../evaluation.h"
+#include "../dataset.h"
+#include "../sampler.h"
+
+#define SYNTHETIC_SAMPLES 30000
+#define SYNTHETIC_CLASSES 16
+#define CHECKPOINTS 20
+#define LEARNING_RATE 0.1
+// samples of every asynchronous round, the threads only meet between rounds
+#define ROUND_SAMPLES 1000
+
+static const double targets[] = {0.7, 0.8, 0.85, 0.9};
+#define NUMBER_OF_TARGETS 4
+
+struct Run {
+    const char *name;
+    int asynchronous;
+    //samples per step, or per update of one thread when asynchronous
+    int batch_size;
+    int number_of_threads;
+} typedef Run;
+
+struct Result {
+    double samples_per_second;
+    double final_accuracy;
+    //training seconds until the held-out accuracy first reached each target, negative when it never did
+    double seconds_to_target[NUMBER_OF_TARGETS];
+} typedef Result;
+
+static double now_seconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec * 1e-9;
+}
+
+// inputs shaped like Lab colours, each labelled with the nearest of a fixed set of centres
+static SampleRows synthetic_colours(MatrixValue *features, int32_t *labels) {
+    Random random;
+    random_seed(&random, 7, 0);
+    double centres[SYNTHETIC_CLASSES][3];
+    for (int c = 0; c < SYNTHETIC_CLASSES; c++) {
+        centres[c][0] = random_uniform(&random);
+        centres[c][1] = 2 * random_uniform(&random) - 1;
+        centres[c][2] = 2 * random_uniform(&random) - 1;
+    }
+    for (int i = 0; i < SYNTHETIC_SAMPLES; i++) {
+        double sample[3] = {random_uniform(&random), 2 * random_uniform(&random) - 1,
+                            2 * random_uniform(&random) - 1};
+        int best = 0;
+        double best_distance = 1e300;
+        for (int c = 0; c < SYNTHETIC_CLASSES; c++) {
+            double distance = 0;
+            for (int k = 0; k < 3; k++) {
+                distance += (sample[k] - centres[c][k]) * (sample[k] - centres[c][k]);
+            }
+            if (distance < best_distance) {
+                best_distance = distance;
+                best = c;
+            }
+        }
+        for (int k = 0; k < 3; k++) {
+            features[i * 3 + k] = (MatrixValue) sample[k];
+        }
+        labels[i] = best;
+    }
+    SampleRows rows;
+    rows.number_of_samples = SYNTHETIC_SAMPLES;
+    rows.number_of_features = 3;
+    rows.number_of_classes = SYNTHETIC_CLASSES;
+    rows.features = features;
+    rows.feature_stride = 3;
+    rows.labels = labels;
+    rows.indices = NULL;
+    return rows;
+}
+
+// record the checkpoint at training time elapsed
+static void checkpoint(Evaluator *evaluator, const SampleRows *test, double elapsed, Result *result) {
+    double accuracy = evaluate_rows(evaluator, test)->success_rate;
+    for (int t = 0; t < NUMBER_OF_TARGETS; t++) {
+        if (result->seconds_to_target[t] < 0 && accuracy >= targets[t]) {
+            result->seconds_to_target[t] = elapsed;
+        }
+    }
+    result->final_accuracy = accuracy;
+}
+
+static Result run(const Run *config, const SampleRows *training, const SampleRows *test, double seconds) {
+    int layer_sizes[] = {training->number_of_features, 10, 16, 20, training->number_of_classes};
+    //the same initial weights for every run
+    srand(1);
+    Network *network = create_network(5, layer_sizes);
+    Evaluator *evaluator = create_evaluator(network, NULL);
+    Result result;
+    for (int t = 0; t < NUMBER_OF_TARGETS; t++) {
+        result.seconds_to_target[t] = -1;
+    }
+    checkpoint(evaluator, test, 0, &result);
+
+    ParallelTrainer *synchronous = NULL;
+    AsyncTrainer *asynchronous = NULL;
+    Sampler *sampler = NULL;
+    LearningRateSchedule schedule = default_learning_rate_schedule();
+    SampleRows batch = *training;
+    if (config->asynchronous) {
+        asynchronous = create_async_trainer(network, config->batch_size, config->number_of_threads, 1);
+    } else {
+        synchronous = create_parallel_trainer(network, config->batch_size, config->number_of_threads);
+        sampler = create_sampler(training->number_of_samples, config->batch_size, 1);
+    }
+
+    double elapsed = 0;
+    double next_checkpoint = seconds / CHECKPOINTS;
+    long samples = 0;
+    while (elapsed < seconds) {
+        double start = now_seconds();
+        if (config->asynchronous) {
+            train_async_round_rows(asynchronous, training, 0, 1, ROUND_SAMPLES, LEARNING_RATE, &schedule);
+            samples += ROUND_SAMPLES;
+        } else {
+            batch.indices = sampler_next_batch(sampler, &batch.number_of_samples);
+            train_network_parallel_rows(synchronous, &batch, LEARNING_RATE);
+            samples += batch.number_of_samples;
+        }
+        elapsed += now_seconds() - start;
+        if (elapsed >= next_checkpoint || elapsed >= seconds) {
+            checkpoint(evaluator, test, elapsed, &result);
+            next_checkpoint += seconds / CHECKPOINTS;
+        }
+    }
+    result.samples_per_second = samples / elapsed;
+
+    if (asynchronous != NULL) {
+        free_async_trainer(asynchronous);
+    }
+    if (synchronous != NULL) {
+        free_parallel_trainer(synchronous);
+        free_sampler(sampler);
+    }
+    free_evaluator(evaluator);
+    free_network(network);
+    return result;
+}
+
+static void print_result(const Run *config, const Result *result) {
+    char threads[16];
+    snprintf(threads, sizeof(threads), "%d", config->number_of_threads);
+    printf("%-13s %7s %5d %11.0f %9.2f%%", config->name, threads, config->batch_size, result->samples_per_second,
+           result->final_accuracy * 100);
+    for (int t = 0; t < NUMBER_OF_TARGETS; t++) {
+        if (result->seconds_to_target[t] < 0) {
+            printf(" %8s", "-");
+        } else {
+            printf(" %7.3fs", result->seconds_to_target[t]);
+        }
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 2;
+    Dataset *dataset = NULL;
+    MatrixValue *features = NULL;
+    int32_t *labels = NULL;
+    SampleRows rows;
+    if (argc > 2) {
+        dataset = open_dataset(argv[2]);
+        if (dataset == NULL) {
+            return 1;
+        }
+        rows = dataset_rows(dataset);
+    } else {
+        features = malloc(sizeof(MatrixValue) * SYNTHETIC_SAMPLES * 3);
+        labels = malloc(sizeof(int32_t) * SYNTHETIC_SAMPLES);
+        rows = synthetic_colours(features, labels);
+    }
+    //the last sixth is held out
+    int test_samples = rows.number_of_samples / 6;
+    SampleRows training = rows;
+    training.number_of_samples -= test_samples;
+    SampleRows test = rows;
+    test.features += (size_t) training.number_of_samples * rows.feature_stride;
+    test.labels += training.number_of_samples;
+    test.number_of_samples = test_samples;
+
+    int most_threads = default_thread_count();
+    printf("%d training and %d held-out samples, %.1f s per run, learning rate %.2f, %d processors\n",
+           training.number_of_samples, test.number_of_samples, seconds, LEARNING_RATE, most_threads);
+    printf("%-13s %7s %5s %11s %10s", "mode", "threads", "batch", "samples/s", "accuracy");
+    for (int t = 0; t < NUMBER_OF_TARGETS; t++) {
+        printf("   to %.0f%%", targets[t] * 100);
+    }
+    printf("\n");
+
+    //the loop of train_stochastic_rows with its default batch, then barriers as often as Hogwild updates
+    Run runs[16];
+    int number_of_runs = 0;
+    runs[number_of_runs++] = (Run) {"serial", 0, 1000, 1};
+    if (most_threads > 1) {
+        runs[number_of_runs++] = (Run) {"synchronous", 0, 1000, most_threads};
+    }
+    runs[number_of_runs++] = (Run) {"synchronous", 0, 16, most_threads};
+    for (int threads = 1; threads < most_threads && number_of_runs < 15; threads *= 2) {
+        runs[number_of_runs++] = (Run) {"asynchronous", 1, 16, threads};
+    }
+    runs[number_of_runs++] = (Run) {"asynchronous", 1, 16, most_threads};
+    for (int r = 0; r < number_of_runs; r++) {
+        Result result = run(&runs[r], &training, &test, seconds);
+        print_result(&runs[r], &result);
+    }
+
+    free(features);
+    free(labels);
+    if (dataset != NULL) {
+        close_dataset(dataset);
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+//
+// GFLOP/s of matrix_gemm for the shapes the shipped networks multiply, for every
+// instruction set the CPU supports. Each result is also checked against plain loops.
+//
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "../matrix_utils.h"
+
+struct Shape {
+    const char *name;
+    int rows;
+    int cols;
+    int inner;
+    int transpose_m1;
+    int transpose_m2;
+} typedef Shape;
+
+// rows x inner times inner x cols, after the transposes
+static const Shape shapes[] = {
+        {"mnist W1 * x      784x24 ", 24,  1,    784,  0, 0},
+        {"mnist W2 * x      24x24  ", 24,  1,    24,   0, 0},
+        {"lab   W3 * x      16x20  ", 20,  1,    16,   0, 0},
+        {"mnist W1 * X      b=1000 ", 24,  1000, 784,  0, 0},
+        {"mnist W2 * X      b=1000 ", 24,  1000, 24,   0, 0},
+        {"lab   W3 * X      b=1000 ", 20,  1000, 16,   0, 0},
+        {"mnist W2^T * D    b=1000 ", 24,  1000, 24,   1, 0},
+        {"mnist D * X^T     b=1000 ", 24,  784,  1000, 0, 1},
+        {"lab   D * A^T     b=1000 ", 20,  16,   1000, 0, 1},
+};
+
+static double now_seconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec * 1e-9;
+}
+
+static double reference_error(const Shape *shape, Matrix *m1, Matrix *m2, Matrix *result) {
+    double error = 0;
+    for (int i = 0; i < shape->rows; i++) {
+        for (int j = 0; j < shape->cols; j++) {
+            double sum = 0;
+            for (int k = 0; k < shape->inner; k++) {
+                double a = shape->transpose_m1 ? MATRIX_AT(m1, k, i) : MATRIX_AT(m1, i, k);
+                double b = shape->transpose_m2 ? MATRIX_AT(m2, j, k) : MATRIX_AT(m2, k, j);
+                sum += a * b;
+            }
+            double difference = fabs(sum - MATRIX_AT(result, i, j));
+            if (difference > error) {
+                error = difference;
+            }
+        }
+    }
+    return error;
+}
+
+static void bench_shape(const Shape *shape, double min_seconds) {
+    Matrix *m1 = shape->transpose_m1 ? create_matrix(shape->inner, shape->rows)
+                                     : create_matrix(shape->rows, shape->inner);
+    Matrix *m2 = shape->transpose_m2 ? create_matrix(shape->cols, shape->inner)
+                                     : create_matrix(shape->inner, shape->cols);
+    Matrix *result = create_matrix(shape->rows, shape->cols);
+    randomize_matrix(m1);
+    randomize_matrix(m2);
+
+    matrix_gemm(m1, shape->transpose_m1, m2, shape->transpose_m2, 1, 0, result);
+    double error = reference_error(shape, m1, m2, result);
+
+    long repetitions = 0;
+    double start = now_seconds();
+    double elapsed = 0;
+    while (elapsed < min_seconds) {
+        for (int r = 0; r < 16; r++) {
+            matrix_gemm(m1, shape->transpose_m1, m2, shape->transpose_m2, 1, 0, result);
+        }
+        repetitions += 16;
+        elapsed = now_seconds() - start;
+    }
+    double flops = 2.0 * shape->rows * shape->cols * shape->inner * repetitions;
+    printf("  %s %9.3f us  %7.2f GFLOP/s  max error %.1e\n", shape->name, elapsed / repetitions * 1e6,
+           flops / elapsed * 1e-9, error);
+
+    free_matrix(m1);
+    free_matrix(m2);
+    free_matrix(result);
+}
+
+int main(int argc, char **argv) {
+    double min_seconds = argc > 1 ? atof(argv[1]) : 0.2;
+    srand(1);
+    MatrixIsa best = matrix_active_isa();
+    printf("detected: %s\n", matrix_isa_name(best));
+    for (int isa = MATRIX_ISA_SCALAR; isa <= (int) best; isa++) {
+        matrix_select_isa((MatrixIsa) isa);
+        printf("%s\n", matrix_isa_name((MatrixIsa) isa));
+        for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+            bench_shape(&shapes[s], min_seconds);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+//
+// Benchmark of the matrix_utils kernels on the layer shapes of the shipped networks.
+// Only uses the public matrix API so the same file can be built against older versions
+// of matrix_utils.c for before/after comparisons.
+//
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../matrix_utils.h"
+
+struct Topology {
+    const char *name;
+    int number_of_layers;
+    int layer_sizes[8];
+} typedef Topology;
+
+static const Topology topologies[] = {
+        {"mnist 784-24-24-10", 4, {784, 24, 24, 10}},
+        {"lab 3-10-16-20-16",  5, {3, 10, 16, 20, 16}},
+};
+
+static double now_seconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec * 1e-9;
+}
+
+static double leaky_relu(double x) {
+    return x < 0 ? x * 0.1 : x;
+}
+
+// the same sequence of kernels propagate_forward runs for every sample
+static double bench_forward(const Topology *topology, int repetitions) {
+    int n = topology->number_of_layers;
+    Matrix *weights[8], *biases[8], *sums[8], *activations[8];
+    activations[0] = create_matrix(topology->layer_sizes[0], 1);
+    randomize_matrix(activations[0]);
+    for (int i = 1; i < n; i++) {
+        weights[i] = create_matrix(topology->layer_sizes[i], topology->layer_sizes[i - 1]);
+        biases[i] = create_matrix(topology->layer_sizes[i], 1);
+        sums[i] = create_matrix(topology->layer_sizes[i], 1);
+        activations[i] = create_matrix(topology->layer_sizes[i], 1);
+        randomize_matrix(weights[i]);
+        randomize_matrix(biases[i]);
+    }
+    double start = now_seconds();
+    for (int r = 0; r < repetitions; r++) {
+        for (int i = 1; i < n; i++) {
+            matrix_multiply(weights[i], activations[i - 1], sums[i]);
+            add_matrices(sums[i], biases[i], sums[i]);
+            matrix_apply_function(sums[i], leaky_relu, activations[i]);
+        }
+    }
+    double elapsed = now_seconds() - start;
+    free_matrix(activations[0]);
+    for (int i = 1; i < n; i++) {
+        free_matrix(weights[i]);
+        free_matrix(biases[i]);
+        free_matrix(sums[i]);
+        free_matrix(activations[i]);
+    }
+    return elapsed / repetitions;
+}
+
+// allocate and release every matrix create_network allocates
+static double bench_allocation(const Topology *topology, int repetitions) {
+    int n = topology->number_of_layers;
+    Matrix *matrices[8 * 7];
+    double start = now_seconds();
+    for (int r = 0; r < repetitions; r++) {
+        int count = 0;
+        for (int i = 0; i < n; i++) {
+            int input_size = i == 0 ? 0 : topology->layer_sizes[i - 1];
+            matrices[count++] = create_matrix(topology->layer_sizes[i], input_size);
+            matrices[count++] = create_matrix(topology->layer_sizes[i], input_size);
+            for (int k = 0; k < 5; k++) {
+                matrices[count++] = create_matrix(topology->layer_sizes[i], 1);
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            free_matrix(matrices[i]);
+        }
+    }
+    return (now_seconds() - start) / repetitions;
+}
+
+int main(int argc, char **argv) {
+    int repetitions = argc > 1 ? atoi(argv[1]) : 20000;
+    srand(1);
+    for (size_t t = 0; t < sizeof(topologies) / sizeof(topologies[0]); t++) {
+        // warm up caches and the allocator before timing
+        bench_forward(&topologies[t], repetitions / 10 + 1);
+        double forward = bench_forward(&topologies[t], repetitions);
+        double allocation = bench_allocation(&topologies[t], repetitions / 10 + 1);
+        printf("%-20s forward: %9.3f us/sample  create+free: %9.3f us/network\n",
+               topologies[t].name, forward * 1e6, allocation * 1e6);
+    }
+    return 0;
+}
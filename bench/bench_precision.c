@@ -0,0 +1,266 @@
+//
+// Accuracy and throughput of the precision this build was compiled with. The shipped
+// models are also evaluated in plain double loops as the reference, a build agrees with
+// it when it picks the same class. Training starts from scratch on inputs labeled by
+// the reference model, so every precision learns the same task from the same data.
+//
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "../network.h"
+#include "../inference.h"
+#include "../parallel_training.h"
+#include "../evaluation.h"
+#include "../sampler.h"
+
+struct Config {
+    const char *name;
+    char *model_file;
+    int training_samples;
+    int training_iterations;
+    double learning_rate;
+    //inputs are uniform in [0, input_scale), small enough not to saturate a freshly randomized network
+    double input_scale;
+} typedef Config;
+
+static Config configs[] = {
+        {"lab",   "network_90.02acc_lab.txt",  20000, 2000, 0.1,  1.0},
+        {"mnist", "network_87.3acc_mnist.txt", 4000,  300,  0.01, 0.2},
+};
+
+#define TEST_SAMPLES 2000
+#define BATCH_SIZE 256
+
+// the text model kept in double no matter what MatrixValue is
+struct ReferenceModel {
+    int number_of_layers;
+    int *layer_sizes;
+    double **weights;
+    double **biases;
+} typedef ReferenceModel;
+
+static double now_seconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec * 1e-9;
+}
+
+static ReferenceModel *load_reference(const char *file_name) {
+    FILE *file = fopen(file_name, "r");
+    if (file == NULL) {
+        printf("Error: Could not open file!\n");
+        return NULL;
+    }
+    ReferenceModel *model = malloc(sizeof(ReferenceModel));
+    fscanf(file, "%d", &model->number_of_layers);
+    model->layer_sizes = malloc(sizeof(int) * model->number_of_layers);
+    model->weights = calloc(model->number_of_layers, sizeof(double *));
+    model->biases = calloc(model->number_of_layers, sizeof(double *));
+    for (int i = 0; i < model->number_of_layers; i++) {
+        fscanf(file, "%d", &model->layer_sizes[i]);
+    }
+    for (int i = 1; i < model->number_of_layers; i++) {
+        int count = model->layer_sizes[i] * model->layer_sizes[i - 1];
+        model->weights[i] = malloc(sizeof(double) * count);
+        for (int j = 0; j < count; j++) {
+            fscanf(file, "%lf", &model->weights[i][j]);
+        }
+    }
+    for (int i = 1; i < model->number_of_layers; i++) {
+        model->biases[i] = malloc(sizeof(double) * model->layer_sizes[i]);
+        for (int j = 0; j < model->layer_sizes[i]; j++) {
+            fscanf(file, "%lf", &model->biases[i][j]);
+        }
+    }
+    fclose(file);
+    return model;
+}
+
+static void free_reference(ReferenceModel *model) {
+    for (int i = 1; i < model->number_of_layers; i++) {
+        free(model->weights[i]);
+        free(model->biases[i]);
+    }
+    free(model->weights);
+    free(model->biases);
+    free(model->layer_sizes);
+    free(model);
+}
+
+// leaky ReLU hidden layers and a softmax output, like propagate_forward
+static void reference_forward(const ReferenceModel *model, const double *input, double *output) {
+    int largest = 0;
+    for (int i = 0; i < model->number_of_layers; i++) {
+        largest = model->layer_sizes[i] > largest ? model->layer_sizes[i] : largest;
+    }
+    double *current = malloc(sizeof(double) * largest);
+    double *next = malloc(sizeof(double) * largest);
+    for (int j = 0; j < model->layer_sizes[0]; j++) {
+        current[j] = input[j];
+    }
+    for (int i = 1; i < model->number_of_layers; i++) {
+        int inputs = model->layer_sizes[i - 1];
+        for (int j = 0; j < model->layer_sizes[i]; j++) {
+            double sum = model->biases[i][j];
+            for (int k = 0; k < inputs; k++) {
+                sum += model->weights[i][j * inputs + k] * current[k];
+            }
+            next[j] = i < model->number_of_layers - 1 ? ReLU(sum) : sum;
+        }
+        double *swap = current;
+        current = next;
+        next = swap;
+    }
+    int outputs = model->layer_sizes[model->number_of_layers - 1];
+    double max = current[0];
+    for (int j = 1; j < outputs; j++) {
+        max = current[j] > max ? current[j] : max;
+    }
+    double sum = 0;
+    for (int j = 0; j < outputs; j++) {
+        output[j] = exp(current[j] - max);
+        sum += output[j];
+    }
+    for (int j = 0; j < outputs; j++) {
+        output[j] /= sum;
+    }
+    free(current);
+    free(next);
+}
+
+static int argmax(const double *values, int count) {
+    int best = 0;
+    for (int i = 1; i < count; i++) {
+        if (values[i] > values[best]) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// uniform inputs labeled by the reference, the same values in every precision
+static SampleRows create_rows(const ReferenceModel *model, const Config *config, int number_of_samples, uint64_t seed,
+                              double **reference_outputs) {
+    int features = model->layer_sizes[0];
+    int classes = model->layer_sizes[model->number_of_layers - 1];
+    MatrixValue *values = malloc(sizeof(MatrixValue) * features * number_of_samples);
+    int32_t *labels = malloc(sizeof(int32_t) * number_of_samples);
+    double *input = malloc(sizeof(double) * features);
+    double *outputs = malloc(sizeof(double) * classes * number_of_samples);
+    Random random;
+    random_seed(&random, seed, 0);
+    for (int i = 0; i < number_of_samples; i++) {
+        for (int j = 0; j < features; j++) {
+            //rounded first so the reference sees exactly what the build sees
+            values[i * features + j] = (MatrixValue) (random_uniform(&random) * config->input_scale);
+            input[j] = values[i * features + j];
+        }
+        reference_forward(model, input, outputs + i * classes);
+        labels[i] = argmax(outputs + i * classes, classes);
+    }
+    free(input);
+    *reference_outputs = outputs;
+    SampleRows rows = {number_of_samples, features, classes, values, features, labels, NULL};
+    return rows;
+}
+
+static void free_rows(SampleRows *rows) {
+    free((void *) rows->features);
+    free((void *) rows->labels);
+}
+
+static void bench_config(const Config *config, double min_seconds) {
+    ReferenceModel *reference = load_reference(config->model_file);
+    if (reference == NULL) {
+        return;
+    }
+    int classes = reference->layer_sizes[reference->number_of_layers - 1];
+    double *test_outputs;
+    double *training_outputs;
+    SampleRows test = create_rows(reference, config, TEST_SAMPLES, 1, &test_outputs);
+    SampleRows training = create_rows(reference, config, config->training_samples, 2, &training_outputs);
+
+    //agreement of the shipped model loaded in this precision
+    Network *network = load_network_from_file(config->model_file);
+    InferenceModel *model = create_inference_model(network);
+    free_network(network);
+    InferenceScratch *scratch = create_inference_scratch(model, BATCH_SIZE);
+    MatrixValue *outputs = malloc(sizeof(MatrixValue) * classes * TEST_SAMPLES);
+    infer_batch(model, scratch, test.features, TEST_SAMPLES, outputs);
+    int agreeing = 0;
+    double max_difference = 0;
+    double *probabilities = malloc(sizeof(double) * classes);
+    for (int i = 0; i < TEST_SAMPLES; i++) {
+        for (int j = 0; j < classes; j++) {
+            probabilities[j] = outputs[i * classes + j];
+            double difference = fabs(probabilities[j] - test_outputs[i * classes + j]);
+            max_difference = difference > max_difference ? difference : max_difference;
+        }
+        agreeing += argmax(probabilities, classes) == test.labels[i];
+    }
+
+    long inferred = 0;
+    double start = now_seconds();
+    double inference_seconds = 0;
+    while (inference_seconds < min_seconds) {
+        infer_batch(model, scratch, test.features, TEST_SAMPLES, outputs);
+        inferred += TEST_SAMPLES;
+        inference_seconds = now_seconds() - start;
+    }
+
+    //training from the same random start on the same batches
+    srand(1);
+    network = create_network(reference->number_of_layers, reference->layer_sizes);
+    ParallelTrainer *trainer = create_parallel_trainer(network, BATCH_SIZE, 1);
+    Sampler *sampler = create_sampler(training.number_of_samples, BATCH_SIZE, 3);
+    SampleRows packets = training;
+    start = now_seconds();
+    for (int i = 0; i < config->training_iterations; i++) {
+        packets.indices = sampler_next_batch(sampler, &packets.number_of_samples);
+        train_network_parallel_rows(trainer, &packets, config->learning_rate);
+    }
+    double training_seconds = now_seconds() - start;
+    Evaluator *evaluator = create_evaluator(network, NULL);
+    Evaluation *evaluation = evaluate_rows(evaluator, &test);
+
+    printf("  %-5s  %7.2f%%  %9.1e  %12.0f  %12.0f  %8.2f%%\n", config->name, 100.0 * agreeing / TEST_SAMPLES,
+           max_difference, inferred / inference_seconds,
+           (double) config->training_iterations * BATCH_SIZE / training_seconds,
+           100.0 * evaluation->success_rate);
+
+    free_evaluator(evaluator);
+    free_sampler(sampler);
+    free_parallel_trainer(trainer);
+    free_network(network);
+    free(probabilities);
+    free(outputs);
+    free_inference_scratch(scratch);
+    free_inference_model(model);
+    free(test_outputs);
+    free(training_outputs);
+    free_rows(&test);
+    free_rows(&training);
+    free_reference(reference);
+}
+
+int main(int argc, char **argv) {
+    double min_seconds = argc > 1 ? atof(argv[1]) : 0.5;
+#ifdef MATRIX_FLOAT32
+#ifdef MATRIX_FLOAT64_ACCUMULATION
+    printf("precision: float32 storage, float64 accumulation\n");
+#else
+    printf("precision: float32\n");
+#endif
+#else
+    printf("precision: float64\n");
+#endif
+    printf("  config  agreement  max |dp|  infer samples/s  train samples/s  trained accuracy\n");
+    for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+        bench_config(&configs[c], min_seconds);
+    }
+    return 0;
+}
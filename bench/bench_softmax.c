@@ -0,0 +1,153 @@
+//
+// Cost of the output layer of the 16-class lab network: layer_softmax against the former
+// softmax without the max subtraction and two exp calls per element, and both losses.
+// Also checks the exp of this build against libm and the softmax of large logits.
+//
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "../layer_kernels.h"
+
+#define CLASSES 16
+
+static double now_seconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec * 1e-9;
+}
+
+static void scale(Matrix *matrix, double factor) {
+    for (int i = 0; i < matrix->rows; i++) {
+        for (int j = 0; j < matrix->cols; j++) {
+            MATRIX_AT(matrix, i, j) *= (MatrixValue) factor;
+        }
+    }
+}
+
+// the softmax of every column as network.c computed it before
+static void former_softmax(Matrix *matrix, Matrix *result) {
+    for (int j = 0; j < matrix->cols; j++) {
+        double sum = 0;
+        for (int i = 0; i < matrix->rows; i++) {
+            sum += exp(MATRIX_AT(matrix, i, j));
+        }
+        for (int i = 0; i < matrix->rows; i++) {
+            MATRIX_AT(result, i, j) = exp(MATRIX_AT(matrix, i, j)) / sum;
+        }
+    }
+}
+
+// nanoseconds per element of softmax over a CLASSES x columns matrix
+static double bench_softmax(void (*function)(Matrix *, Matrix *), int columns, double min_seconds) {
+    Matrix *logits = create_matrix(CLASSES, columns);
+    Matrix *result = create_matrix(CLASSES, columns);
+    randomize_matrix(logits);
+    scale(logits, 8);
+    long repetitions = 0;
+    double start = now_seconds();
+    double elapsed = 0;
+    while (elapsed < min_seconds) {
+        for (int r = 0; r < 64; r++) {
+            function(logits, result);
+        }
+        repetitions += 64;
+        elapsed = now_seconds() - start;
+    }
+    free_matrix(logits);
+    free_matrix(result);
+    return elapsed / repetitions / ((double) CLASSES * columns) * 1e9;
+}
+
+static double bench_loss(LossFunction loss, int columns, double min_seconds) {
+    Matrix *outputs = create_matrix(CLASSES, columns);
+    Matrix *targets = create_matrix(CLASSES, columns);
+    randomize_matrix(outputs);
+    layer_softmax(outputs, outputs);
+    fill_matrix(targets, 0);
+    for (int j = 0; j < columns; j++) {
+        MATRIX_AT(targets, rand() % CLASSES, j) = 1;
+    }
+    long repetitions = 0;
+    double sum = 0;
+    double start = now_seconds();
+    double elapsed = 0;
+    while (elapsed < min_seconds) {
+        for (int r = 0; r < 64; r++) {
+            sum += layer_loss(loss, outputs, targets);
+        }
+        repetitions += 64;
+        elapsed = now_seconds() - start;
+    }
+    free_matrix(outputs);
+    free_matrix(targets);
+    //keeps the loop from being removed
+    return sum > 0 ? elapsed / repetitions / ((double) CLASSES * columns) * 1e9 : 0;
+}
+
+// largest relative error of the softmax probabilities against libm over logits spanning [-range, range]
+static double softmax_error(double range) {
+    Matrix *logits = create_matrix(CLASSES, 1000);
+    Matrix *result = create_matrix(CLASSES, 1000);
+    randomize_matrix(logits);
+    scale(logits, range);
+    layer_softmax(logits, result);
+    double error = 0;
+    for (int j = 0; j < logits->cols; j++) {
+        double max = -INFINITY, sum = 0;
+        for (int i = 0; i < CLASSES; i++) {
+            max = fmax(max, MATRIX_AT(logits, i, j));
+        }
+        for (int i = 0; i < CLASSES; i++) {
+            sum += exp(MATRIX_AT(logits, i, j) - max);
+        }
+        for (int i = 0; i < CLASSES; i++) {
+            double expected = exp(MATRIX_AT(logits, i, j) - max) / sum;
+            if (expected > 1e-30) {
+                error = fmax(error, fabs(MATRIX_AT(result, i, j) - expected) / expected);
+            }
+        }
+    }
+    free_matrix(logits);
+    free_matrix(result);
+    return error;
+}
+
+int main(int argc, char **argv) {
+    double min_seconds = argc > 1 ? atof(argv[1]) : 0.2;
+    srand(1);
+#ifdef LAYER_FAST_EXP
+    printf("exp: polynomial approximation\n");
+#else
+    printf("exp: libm\n");
+#endif
+    printf("softmax ns/element     former    layer_softmax\n");
+    int columns[] = {1, 1000};
+    for (int c = 0; c < 2; c++) {
+        printf("  %4d x %-4d       %9.3f %12.3f\n", CLASSES, columns[c],
+               bench_softmax(former_softmax, columns[c], min_seconds),
+               bench_softmax(layer_softmax, columns[c], min_seconds));
+    }
+    printf("loss ns/element   squared error  cross entropy\n");
+    printf("  %4d x %-4d       %9.3f %12.3f\n", CLASSES, 1000, bench_loss(LOSS_MEAN_SQUARED_ERROR, 1000, min_seconds),
+           bench_loss(LOSS_CROSS_ENTROPY, 1000, min_seconds));
+    printf("max relative error of the probabilities: %.1e for logits in [-8, 8], %.1e in [-100, 100]\n",
+           softmax_error(8), softmax_error(100));
+
+    //logits far beyond the range of exp
+    Matrix *large = create_matrix(CLASSES, 1);
+    for (int i = 0; i < CLASSES; i++) {
+        MATRIX_AT(large, i, 0) = 1000 + i;
+    }
+    Matrix *probabilities = create_matrix(CLASSES, 1);
+    former_softmax(large, probabilities);
+    printf("logits 1000..1015: former p[15] = %g, ", MATRIX_AT(probabilities, CLASSES - 1, 0));
+    layer_softmax(large, probabilities);
+    printf("layer_softmax p[15] = %g\n", MATRIX_AT(probabilities, CLASSES - 1, 0));
+    free_matrix(large);
+    free_matrix(probabilities);
+    return 0;
+}
@@ -0,0 +1,215 @@
+//
+// Packed binary data set: a fixed header followed by every sample's features, one row per
+// sample, and then every sample's class index. The file is memory mapped and its rows are
+// handed to the batched training code without copying.
+//
+
+#include "dataset.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define DATASET_NO_MMAP
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + DATASET_ALIGNMENT - 1) / DATASET_ALIGNMENT * DATASET_ALIGNMENT;
+}
+
+static void write_padding(FILE *file, uint64_t from, uint64_t to) {
+    for (uint64_t i = from; i < to; i++) {
+        fputc(0, file);
+    }
+}
+
+long convert_text_dataset(char *text_file_name, char *binary_file_name, int number_of_features,
+                          int number_of_classes, double max_value_of_input) {
+    FILE *input = fopen(text_file_name, "r");
+    if (input == NULL) {
+        printf("Error: Could not open file!\n");
+        return -1;
+    }
+    FILE *output = fopen(binary_file_name, "wb");
+    if (output == NULL) {
+        printf("Error: Could not open file!\n");
+        fclose(input);
+        return -1;
+    }
+    DatasetHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DATASET_MAGIC, 4);
+    header.version = DATASET_VERSION;
+    header.number_of_features = number_of_features;
+    header.number_of_classes = number_of_classes;
+    header.dtype = DATASET_VALUE_DTYPE;
+    header.feature_stride = number_of_features;
+    header.features_offset = align_offset(sizeof(DatasetHeader));
+    //the header is rewritten once the number of samples is known
+    fwrite(&header, sizeof(header), 1, output);
+    write_padding(output, sizeof(header), header.features_offset);
+
+    //features are streamed straight to the file, labels are kept until the end
+    size_t labels_capacity = 1024;
+    int32_t *labels = malloc(labels_capacity * sizeof(int32_t));
+    MatrixValue *row = malloc(number_of_features * sizeof(MatrixValue));
+    long number_of_samples = 0;
+    while (1) {
+        int complete = 1;
+        for (int j = 0; j < number_of_features && complete; j++) {
+            double value;
+            complete = fscanf(input, "%lf", &value) == 1;
+            row[j] = (MatrixValue) (value / max_value_of_input);
+        }
+        int label;
+        if (!complete || fscanf(input, "%d", &label) != 1) {
+            break;
+        }
+        if (label < 0 || label >= number_of_classes) {
+            printf("Error: Class index %d of sample %ld is out of range!\n", label, number_of_samples);
+            number_of_samples = -1;
+            break;
+        }
+        if ((size_t) number_of_samples == labels_capacity) {
+            labels_capacity *= 2;
+            labels = realloc(labels, labels_capacity * sizeof(int32_t));
+        }
+        labels[number_of_samples++] = label;
+        fwrite(row, sizeof(MatrixValue), number_of_features, output);
+    }
+    if (number_of_samples >= 0) {
+        uint64_t features_end = header.features_offset +
+                                (uint64_t) number_of_samples * number_of_features * sizeof(MatrixValue);
+        header.number_of_samples = number_of_samples;
+        header.labels_offset = align_offset(features_end);
+        write_padding(output, features_end, header.labels_offset);
+        fwrite(labels, sizeof(int32_t), number_of_samples, output);
+        fseek(output, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, output);
+    }
+    free(row);
+    free(labels);
+    fclose(input);
+    fclose(output);
+    return number_of_samples;
+}
+
+static int valid_header(const DatasetHeader *header, size_t file_size) {
+    if (memcmp(header->magic, DATASET_MAGIC, 4) != 0 || header->version != DATASET_VERSION) {
+        return 0;
+    }
+    if ((header->dtype != DATASET_FLOAT64 && header->dtype != DATASET_FLOAT32) ||
+        header->feature_stride < header->number_of_features || header->number_of_classes == 0 ||
+        header->labels_offset % sizeof(int32_t) != 0) {
+        return 0;
+    }
+    //samples are indexed with int, every block lies in the file and is checked by division so nothing wraps
+    if (header->number_of_samples > INT_MAX || header->features_offset < sizeof(DatasetHeader) ||
+        header->features_offset % DATASET_ALIGNMENT != 0 || header->features_offset > header->labels_offset ||
+        header->labels_offset > file_size) {
+        return 0;
+    }
+    uint64_t row_size = (uint64_t) header->feature_stride * (header->dtype == DATASET_FLOAT32 ? sizeof(float)
+                                                                                               : sizeof(double));
+    if (row_size != 0 && header->number_of_samples > (header->labels_offset - header->features_offset) / row_size) {
+        return 0;
+    }
+    return header->number_of_samples <= (file_size - header->labels_offset) / sizeof(int32_t);
+}
+
+Dataset *open_dataset(char *file_name) {
+    Dataset *dataset = malloc(sizeof(Dataset));
+#ifdef DATASET_NO_MMAP
+    FILE *file = fopen(file_name, "rb");
+    if (file == NULL) {
+        printf("Error: Could not open file!\n");
+        free(dataset);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    dataset->mapping_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    dataset->mapping = aligned_malloc(dataset->mapping_size);
+    if (fread(dataset->mapping, 1, dataset->mapping_size, file) != dataset->mapping_size) {
+        dataset->mapping_size = 0;
+    }
+    fclose(file);
+#else
+    int descriptor = open(file_name, O_RDONLY);
+    if (descriptor < 0) {
+        printf("Error: Could not open file!\n");
+        free(dataset);
+        return NULL;
+    }
+    struct stat status;
+    fstat(descriptor, &status);
+    dataset->mapping_size = status.st_size;
+    dataset->mapping = dataset->mapping_size == 0 ? MAP_FAILED :
+                       mmap(NULL, dataset->mapping_size, PROT_READ, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if (dataset->mapping == MAP_FAILED) {
+        printf("Error: Could not map file!\n");
+        free(dataset);
+        return NULL;
+    }
+#endif
+    if (dataset->mapping_size < sizeof(DatasetHeader)) {
+        printf("Error: Not a data set file!\n");
+        close_dataset(dataset);
+        return NULL;
+    }
+    memcpy(&dataset->header, dataset->mapping, sizeof(DatasetHeader));
+    if (!valid_header(&dataset->header, dataset->mapping_size)) {
+        printf("Error: Not a data set file!\n");
+        close_dataset(dataset);
+        return NULL;
+    }
+    if (dataset->header.dtype != DATASET_VALUE_DTYPE) {
+        printf("Error: Data set values are not in the precision of this build, convert it again!\n");
+        close_dataset(dataset);
+        return NULL;
+    }
+    dataset->features = (const MatrixValue *) ((const char *) dataset->mapping + dataset->header.features_offset);
+    dataset->labels = (const int32_t *) ((const char *) dataset->mapping + dataset->header.labels_offset);
+    //the labels index the one-hot targets, one out of range would write past them
+    for (uint64_t i = 0; i < dataset->header.number_of_samples; i++) {
+        if (dataset->labels[i] < 0 || (uint32_t) dataset->labels[i] >= dataset->header.number_of_classes) {
+            printf("Error: Class index %d of sample %llu is out of range!\n", (int) dataset->labels[i],
+                   (unsigned long long) i);
+            close_dataset(dataset);
+            return NULL;
+        }
+    }
+    return dataset;
+}
+
+void close_dataset(Dataset *dataset) {
+#ifdef DATASET_NO_MMAP
+    aligned_free(dataset->mapping);
+#else
+    munmap(dataset->mapping, dataset->mapping_size);
+#endif
+    free(dataset);
+}
+
+SampleRows dataset_rows(Dataset *dataset) {
+    return dataset_slice(dataset, 0, (int) dataset->header.number_of_samples);
+}
+
+SampleRows dataset_slice(Dataset *dataset, int first, int count) {
+    SampleRows rows;
+    rows.number_of_samples = count;
+    rows.number_of_features = (int) dataset->header.number_of_features;
+    rows.number_of_classes = (int) dataset->header.number_of_classes;
+    rows.feature_stride = (int) dataset->header.feature_stride;
+    rows.features = dataset->features + (size_t) first * rows.feature_stride;
+    rows.labels = dataset->labels + first;
+    rows.indices = NULL;
+    return rows;
+}
@@ -0,0 +1,70 @@
+//
+// Packed binary data set: a fixed header followed by every sample's features, one row per
+// sample, and then every sample's class index. The file is memory mapped and its rows are
+// handed to the batched training code without copying.
+//
+
+#ifndef SEM2LAB2_DATASET_H
+#define SEM2LAB2_DATASET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "network.h"
+
+#define DATASET_MAGIC "NNDS"
+#define DATASET_VERSION 1
+// feature rows and the label array start on this boundary
+#define DATASET_ALIGNMENT 64
+
+enum DatasetDtype {
+    DATASET_FLOAT64 = 1,
+    DATASET_FLOAT32 = 2
+} typedef DatasetDtype;
+
+// features are stored in the precision of the matrices so they can be used in place
+#ifdef MATRIX_FLOAT32
+#define DATASET_VALUE_DTYPE DATASET_FLOAT32
+#else
+#define DATASET_VALUE_DTYPE DATASET_FLOAT64
+#endif
+
+// on-disk header, little endian, DATASET_ALIGNMENT bytes long
+struct DatasetHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t number_of_samples;
+    uint32_t number_of_features;
+    uint32_t number_of_classes;
+    uint32_t dtype;
+    uint32_t feature_stride;
+    uint64_t features_offset;
+    uint64_t labels_offset;
+    uint8_t reserved[16];
+} typedef DatasetHeader;
+
+struct Dataset {
+    DatasetHeader header;
+    void *mapping;
+    size_t mapping_size;
+    const MatrixValue *features;
+    const int32_t *labels;
+} typedef Dataset;
+
+// convert a text file of "values... class_index" lines into the binary format
+// the values are divided by max_value_of_input and stored as DATASET_VALUE_DTYPE
+// returns the number of samples or -1 on error
+long convert_text_dataset(char *text_file_name, char *binary_file_name, int number_of_features,
+                          int number_of_classes, double max_value_of_input);
+
+// map a binary data set, returns NULL when the file is missing, malformed or of another precision
+Dataset *open_dataset(char *file_name);
+
+void close_dataset(Dataset *dataset);
+
+// all samples of the data set in file order
+SampleRows dataset_rows(Dataset *dataset);
+
+// samples [first, first + count) of the data set
+SampleRows dataset_slice(Dataset *dataset, int first, int count);
+
+#endif //SEM2LAB2_DATASET_H
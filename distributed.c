@@ -0,0 +1,637 @@
+//
+// Ring all-reduce over shared memory or TCP for data parallel training in several processes.
+//
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "distributed.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+Communicator *create_communicator(Transport *transport, int rank, int world_size) {
+    Communicator *communicator = calloc(1, sizeof(Communicator));
+    communicator->rank = rank;
+    communicator->world_size = world_size;
+    communicator->transport = transport;
+    return communicator;
+}
+
+void free_communicator(Communicator *communicator) {
+    if (communicator == NULL) {
+        return;
+    }
+    if (communicator->transport != NULL) {
+        communicator->transport->close(communicator->transport);
+    }
+    free(communicator->values);
+    free(communicator->received);
+    free(communicator);
+}
+
+// room for count values to pack into values
+static void reserve_values(Communicator *communicator, size_t count) {
+    if (count > communicator->capacity) {
+        free(communicator->values);
+        communicator->values = malloc(count * sizeof(double));
+        communicator->capacity = count;
+    }
+}
+
+// values [begin, end) of the chunk-th of world_size chunks
+static void chunk_range(size_t count, int chunk, int world_size, size_t *begin, size_t *end) {
+    size_t base = count / world_size;
+    size_t remainder = count % world_size;
+    *begin = chunk * base + ((size_t) chunk < remainder ? (size_t) chunk : remainder);
+    *end = *begin + base + ((size_t) chunk < remainder ? 1 : 0);
+}
+
+int all_reduce(Communicator *communicator, double *values, size_t count) {
+    int world_size = communicator->world_size;
+    int rank = communicator->rank;
+    if (world_size == 1) {
+        return 0;
+    }
+    //the received chunks are added from a separate buffer
+    size_t largest = count / world_size + 1;
+    if (largest > communicator->received_capacity) {
+        free(communicator->received);
+        communicator->received = malloc(largest * sizeof(double));
+        communicator->received_capacity = largest;
+    }
+    double *received = communicator->received;
+    Transport *transport = communicator->transport;
+    //reduce-scatter: after world_size - 1 steps chunk rank + 1 holds the sum of every process
+    for (int step = 0; step < world_size - 1; step++) {
+        int send_chunk = (rank - step + world_size) % world_size;
+        int receive_chunk = (rank - step - 1 + world_size) % world_size;
+        size_t send_begin, send_end, receive_begin, receive_end;
+        chunk_range(count, send_chunk, world_size, &send_begin, &send_end);
+        chunk_range(count, receive_chunk, world_size, &receive_begin, &receive_end);
+        if (transport->exchange(transport, values + send_begin, (send_end - send_begin) * sizeof(double),
+                                received, (receive_end - receive_begin) * sizeof(double)) != 0) {
+            return 1;
+        }
+        for (size_t i = receive_begin; i < receive_end; i++) {
+            values[i] += received[i - receive_begin];
+        }
+    }
+    //all-gather: the summed chunks travel once around the ring and are copied, not added again
+    for (int step = 0; step < world_size - 1; step++) {
+        int send_chunk = (rank + 1 - step + world_size) % world_size;
+        int receive_chunk = (rank - step + world_size) % world_size;
+        size_t send_begin, send_end, receive_begin, receive_end;
+        chunk_range(count, send_chunk, world_size, &send_begin, &send_end);
+        chunk_range(count, receive_chunk, world_size, &receive_begin, &receive_end);
+        if (transport->exchange(transport, values + send_begin, (send_end - send_begin) * sizeof(double),
+                                values + receive_begin, (receive_end - receive_begin) * sizeof(double)) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// weights and biases or their accumulators in one flat array, in layer order
+static size_t parameter_count(Network *network) {
+    size_t count = 0;
+    for (int k = 1; k < network->number_of_layers; k++) {
+        count += (size_t) network->layers[k]->layer_size * (network->layers[k]->input_size + 1);
+    }
+    return count;
+}
+
+static void pack(Network *network, int gradients, double *values) {
+    for (int k = 1; k < network->number_of_layers; k++) {
+        Layer *layer = network->layers[k];
+        Matrix *weights = gradients ? layer->delta_weights : layer->weights;
+        Matrix *biases = gradients ? layer->delta_biases : layer->biases;
+        for (int i = 0; i < layer->layer_size; i++) {
+            const MatrixValue *row = matrix_row(weights, i);
+            for (int j = 0; j < layer->input_size; j++) {
+                *values++ = row[j];
+            }
+            *values++ = MATRIX_AT(biases, i, 0);
+        }
+    }
+}
+
+static void unpack(Network *network, int gradients, const double *values) {
+    for (int k = 1; k < network->number_of_layers; k++) {
+        Layer *layer = network->layers[k];
+        Matrix *weights = gradients ? layer->delta_weights : layer->weights;
+        Matrix *biases = gradients ? layer->delta_biases : layer->biases;
+        for (int i = 0; i < layer->layer_size; i++) {
+            MatrixValue *row = matrix_row(weights, i);
+            for (int j = 0; j < layer->input_size; j++) {
+                row[j] = (MatrixValue) *values++;
+            }
+            MATRIX_AT(biases, i, 0) = (MatrixValue) *values++;
+        }
+    }
+}
+
+int all_reduce_gradients(Communicator *communicator, Network *network, int *number_of_samples) {
+    if (communicator->world_size == 1) {
+        return 0;
+    }
+    size_t count = parameter_count(network);
+    reserve_values(communicator, count + 1);
+    pack(network, 1, communicator->values);
+    communicator->values[count] = *number_of_samples;
+    if (all_reduce(communicator, communicator->values, count + 1) != 0) {
+        return 1;
+    }
+    unpack(network, 1, communicator->values);
+    *number_of_samples = (int) communicator->values[count];
+    return 0;
+}
+
+int broadcast_network(Communicator *communicator, Network *network) {
+    if (communicator->world_size == 1) {
+        return 0;
+    }
+    size_t count = parameter_count(network);
+    reserve_values(communicator, count);
+    //the sum of rank 0's weights and zeros is exactly rank 0's weights
+    if (communicator->rank == 0) {
+        pack(network, 0, communicator->values);
+    } else {
+        memset(communicator->values, 0, count * sizeof(double));
+    }
+    if (all_reduce(communicator, communicator->values, count) != 0) {
+        return 1;
+    }
+    unpack(network, 0, communicator->values);
+    return 0;
+}
+
+int all_reduce_evaluation(Communicator *communicator, Evaluation *evaluation) {
+    if (communicator->world_size == 1) {
+        return 0;
+    }
+    size_t cells = (size_t) evaluation->number_of_classes * evaluation->number_of_classes;
+    reserve_values(communicator, cells + 3);
+    double *values = communicator->values;
+    values[0] = evaluation->number_of_samples;
+    values[1] = evaluation->average_loss * evaluation->number_of_samples;
+    values[2] = round(evaluation->success_rate * evaluation->number_of_samples);
+    for (size_t i = 0; i < cells; i++) {
+        values[3 + i] = (double) evaluation->confusion_matrix[i];
+    }
+    if (all_reduce(communicator, values, cells + 3) != 0) {
+        return 1;
+    }
+    evaluation->number_of_samples = (int) values[0];
+    evaluation->average_loss = values[0] > 0 ? values[1] / values[0] : 0;
+    evaluation->success_rate = values[0] > 0 ? values[2] / values[0] : 0;
+    for (size_t i = 0; i < cells; i++) {
+        evaluation->confusion_matrix[i] = (long) values[3 + i];
+    }
+    return 0;
+}
+
+#ifdef _WIN32
+
+Communicator *create_shm_communicator(char *name, int rank, int world_size) {
+    printf("Error: Shared memory transport is not supported on this platform!\n");
+    return NULL;
+}
+
+Communicator *create_tcp_communicator(char *host, int base_port, int rank, int world_size) {
+    printf("Error: TCP transport is not supported on this platform!\n");
+    return NULL;
+}
+
+#else
+
+static double now_seconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec * 1e-9;
+}
+
+static void sleep_briefly() {
+    struct timespec pause = {0, 10 * 1000 * 1000};
+    nanosleep(&pause, NULL);
+}
+
+// shared memory: every process owns the mailbox its previous neighbour writes into
+
+struct ShmMailbox {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    int full;
+    size_t length;
+    unsigned char data[SHM_MESSAGE_CAPACITY];
+} typedef ShmMailbox;
+
+struct ShmRegion {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    int world_size;
+    //set by rank 0 once the region is initialized
+    int initialized;
+    //processes other than rank 0 that attached, rank 0 starts the ring once all of them did
+    int attached;
+    int started;
+    ShmMailbox mailboxes[];
+} typedef ShmRegion;
+
+struct ShmState {
+    char name[256];
+    int rank;
+    int world_size;
+    ShmRegion *region;
+    size_t size;
+} typedef ShmState;
+
+// wait on cond until *flag is at least value, returns 0 on success and 1 on timeout
+static int wait_for(pthread_mutex_t *mutex, pthread_cond_t *cond, volatile int *flag, int value) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += DISTRIBUTED_TIMEOUT_SECONDS;
+    int result = 0;
+    pthread_mutex_lock(mutex);
+    while (*flag < value && result == 0) {
+        result = pthread_cond_timedwait(cond, mutex, &deadline);
+    }
+    int reached = *flag >= value;
+    pthread_mutex_unlock(mutex);
+    return !reached;
+}
+
+static int shm_exchange(Transport *transport, const void *outgoing, size_t send_length, void *incoming,
+                        size_t receive_length) {
+    ShmState *state = transport->state;
+    ShmMailbox *next = &state->region->mailboxes[(state->rank + 1) % state->world_size];
+    ShmMailbox *own = &state->region->mailboxes[state->rank];
+    const unsigned char *send_bytes = outgoing;
+    unsigned char *receive_bytes = incoming;
+    //one mailbox sized piece each way per round, the neighbour drains the previous piece meanwhile
+    while (send_length > 0 || receive_length > 0) {
+        if (send_length > 0) {
+            size_t piece = send_length < SHM_MESSAGE_CAPACITY ? send_length : SHM_MESSAGE_CAPACITY;
+            pthread_mutex_lock(&next->mutex);
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += DISTRIBUTED_TIMEOUT_SECONDS;
+            int result = 0;
+            while (next->full && result == 0) {
+                result = pthread_cond_timedwait(&next->changed, &next->mutex, &deadline);
+            }
+            if (next->full) {
+                pthread_mutex_unlock(&next->mutex);
+                printf("Error: Process %d stopped receiving!\n", (state->rank + 1) % state->world_size);
+                return 1;
+            }
+            memcpy(next->data, send_bytes, piece);
+            next->length = piece;
+            next->full = 1;
+            pthread_cond_broadcast(&next->changed);
+            pthread_mutex_unlock(&next->mutex);
+            send_bytes += piece;
+            send_length -= piece;
+        }
+        if (receive_length > 0) {
+            pthread_mutex_lock(&own->mutex);
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += DISTRIBUTED_TIMEOUT_SECONDS;
+            int result = 0;
+            while (!own->full && result == 0) {
+                result = pthread_cond_timedwait(&own->changed, &own->mutex, &deadline);
+            }
+            if (!own->full || own->length > receive_length) {
+                pthread_mutex_unlock(&own->mutex);
+                printf("Error: Process %d stopped sending!\n",
+                       (state->rank + state->world_size - 1) % state->world_size);
+                return 1;
+            }
+            memcpy(receive_bytes, own->data, own->length);
+            receive_bytes += own->length;
+            receive_length -= own->length;
+            own->full = 0;
+            pthread_cond_broadcast(&own->changed);
+            pthread_mutex_unlock(&own->mutex);
+        }
+    }
+    return 0;
+}
+
+static void shm_close(Transport *transport) {
+    ShmState *state = transport->state;
+    munmap(state->region, state->size);
+    if (state->rank == 0) {
+        shm_unlink(state->name);
+    }
+    free(state);
+    free(transport);
+}
+
+// rank 0 creates and initializes the region, removing one left behind by an earlier run
+static ShmRegion *create_shm_region(char *name, int world_size, size_t size) {
+    shm_unlink(name);
+    int file = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (file < 0 || ftruncate(file, (off_t) size) != 0) {
+        if (file >= 0) {
+            close(file);
+        }
+        printf("Error: Could not create shared memory %s!\n", name);
+        return NULL;
+    }
+    ShmRegion *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    close(file);
+    if (region == MAP_FAILED) {
+        printf("Error: Could not map shared memory %s!\n", name);
+        return NULL;
+    }
+    pthread_mutexattr_t mutex_attributes;
+    pthread_condattr_t cond_attributes;
+    pthread_mutexattr_init(&mutex_attributes);
+    pthread_mutexattr_setpshared(&mutex_attributes, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_init(&cond_attributes);
+    pthread_condattr_setpshared(&cond_attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&region->mutex, &mutex_attributes);
+    pthread_cond_init(&region->changed, &cond_attributes);
+    for (int i = 0; i < world_size; i++) {
+        pthread_mutex_init(&region->mailboxes[i].mutex, &mutex_attributes);
+        pthread_cond_init(&region->mailboxes[i].changed, &cond_attributes);
+        region->mailboxes[i].full = 0;
+    }
+    pthread_mutexattr_destroy(&mutex_attributes);
+    pthread_condattr_destroy(&cond_attributes);
+    region->world_size = world_size;
+    region->attached = 0;
+    region->started = 0;
+    __atomic_store_n(&region->initialized, 1, __ATOMIC_RELEASE);
+    return region;
+}
+
+// the other ranks wait for rank 0 to create and initialize the region
+static ShmRegion *attach_shm_region(char *name, int world_size, size_t size) {
+    double deadline = now_seconds() + DISTRIBUTED_TIMEOUT_SECONDS;
+    while (now_seconds() < deadline) {
+        int file = shm_open(name, O_RDWR, 0600);
+        struct stat status;
+        if (file >= 0 && fstat(file, &status) == 0 && (size_t) status.st_size >= size) {
+            ShmRegion *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+            close(file);
+            if (region == MAP_FAILED) {
+                break;
+            }
+            while (!__atomic_load_n(&region->initialized, __ATOMIC_ACQUIRE) && now_seconds() < deadline) {
+                sleep_briefly();
+            }
+            if (region->initialized && region->world_size == world_size) {
+                return region;
+            }
+            munmap(region, size);
+            break;
+        }
+        if (file >= 0) {
+            close(file);
+        }
+        sleep_briefly();
+    }
+    printf("Error: Could not attach to shared memory %s!\n", name);
+    return NULL;
+}
+
+Communicator *create_shm_communicator(char *name, int rank, int world_size) {
+    if (world_size == 1) {
+        return create_communicator(NULL, 0, 1);
+    }
+    ShmState *state = calloc(1, sizeof(ShmState));
+    snprintf(state->name, sizeof(state->name), "/%s", name);
+    state->rank = rank;
+    state->world_size = world_size;
+    state->size = sizeof(ShmRegion) + world_size * sizeof(ShmMailbox);
+    state->region = rank == 0 ? create_shm_region(state->name, world_size, state->size)
+                              : attach_shm_region(state->name, world_size, state->size);
+    if (state->region == NULL) {
+        free(state);
+        return NULL;
+    }
+    ShmRegion *region = state->region;
+    int failed;
+    if (rank == 0) {
+        //a process that attached to a stale region of an earlier run never shows up here
+        failed = wait_for(&region->mutex, &region->changed, &region->attached, world_size - 1);
+        pthread_mutex_lock(&region->mutex);
+        region->started = 1;
+        pthread_cond_broadcast(&region->changed);
+        pthread_mutex_unlock(&region->mutex);
+    } else {
+        pthread_mutex_lock(&region->mutex);
+        region->attached++;
+        pthread_cond_broadcast(&region->changed);
+        pthread_mutex_unlock(&region->mutex);
+        failed = wait_for(&region->mutex, &region->changed, &region->started, 1);
+    }
+    if (failed) {
+        printf("Error: Not every process joined %s!\n", state->name);
+        munmap(region, state->size);
+        if (rank == 0) {
+            shm_unlink(state->name);
+        }
+        free(state);
+        return NULL;
+    }
+    Transport *transport = malloc(sizeof(Transport));
+    transport->exchange = shm_exchange;
+    transport->close = shm_close;
+    transport->state = state;
+    return create_communicator(transport, rank, world_size);
+}
+
+// TCP: every process connects to the next one and accepts the previous one
+
+struct TcpState {
+    int next;
+    int previous;
+} typedef TcpState;
+
+static int tcp_exchange(Transport *transport, const void *outgoing, size_t send_length, void *incoming,
+                        size_t receive_length) {
+    TcpState *state = transport->state;
+    const char *send_bytes = outgoing;
+    char *receive_bytes = incoming;
+    //both directions at once, a blocking send could wait on a neighbour that is itself blocked sending
+    while (send_length > 0 || receive_length > 0) {
+        struct pollfd descriptors[2];
+        int count = 0;
+        if (send_length > 0) {
+            descriptors[count].fd = state->next;
+            descriptors[count].events = POLLOUT;
+            count++;
+        }
+        if (receive_length > 0) {
+            descriptors[count].fd = state->previous;
+            descriptors[count].events = POLLIN;
+            count++;
+        }
+        int ready = poll(descriptors, count, DISTRIBUTED_TIMEOUT_SECONDS * 1000);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            printf("Error: A neighbour in the ring stopped answering!\n");
+            return 1;
+        }
+        for (int i = 0; i < count; i++) {
+            if (descriptors[i].revents == 0) {
+                continue;
+            }
+            if (descriptors[i].fd == state->next && send_length > 0) {
+                ssize_t sent = send(state->next, send_bytes, send_length, MSG_NOSIGNAL);
+                if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    printf("Error: Could not send to the next process!\n");
+                    return 1;
+                }
+                if (sent > 0) {
+                    send_bytes += sent;
+                    send_length -= (size_t) sent;
+                }
+            } else if (descriptors[i].fd == state->previous && receive_length > 0) {
+                ssize_t received = recv(state->previous, receive_bytes, receive_length, 0);
+                if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                    printf("Error: The previous process closed the connection!\n");
+                    return 1;
+                }
+                if (received > 0) {
+                    receive_bytes += received;
+                    receive_length -= (size_t) received;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static void tcp_close(Transport *transport) {
+    TcpState *state = transport->state;
+    close(state->next);
+    close(state->previous);
+    free(state);
+    free(transport);
+}
+
+static void configure_socket(int socket) {
+    int enabled = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) | O_NONBLOCK);
+}
+
+static struct addrinfo *resolve(char *host, int port, int passive) {
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    struct addrinfo *addresses = NULL;
+    if (getaddrinfo(host, service, &hints, &addresses) != 0) {
+        return NULL;
+    }
+    return addresses;
+}
+
+static int listen_on(char *host, int port) {
+    struct addrinfo *address = resolve(host, port, 1);
+    if (address == NULL) {
+        return -1;
+    }
+    int listener = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    int enabled = 1;
+    if (listener >= 0) {
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled));
+        if (bind(listener, address->ai_addr, address->ai_addrlen) != 0 || listen(listener, 1) != 0) {
+            close(listener);
+            listener = -1;
+        }
+    }
+    freeaddrinfo(address);
+    return listener;
+}
+
+// connect to host:port, retrying until the process behind it listens
+static int connect_to(char *host, int port) {
+    double deadline = now_seconds() + DISTRIBUTED_TIMEOUT_SECONDS;
+    while (now_seconds() < deadline) {
+        struct addrinfo *address = resolve(host, port, 0);
+        if (address != NULL) {
+            int connection = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (connection >= 0 && connect(connection, address->ai_addr, address->ai_addrlen) == 0) {
+                freeaddrinfo(address);
+                return connection;
+            }
+            if (connection >= 0) {
+                close(connection);
+            }
+            freeaddrinfo(address);
+        }
+        sleep_briefly();
+    }
+    return -1;
+}
+
+Communicator *create_tcp_communicator(char *host, int base_port, int rank, int world_size) {
+    if (world_size == 1) {
+        return create_communicator(NULL, 0, 1);
+    }
+    int listener = listen_on(host, base_port + rank);
+    if (listener < 0) {
+        printf("Error: Could not listen on %s:%d!\n", host, base_port + rank);
+        return NULL;
+    }
+    //the connection completes in the backlog of the next process before it accepts it
+    int next = connect_to(host, base_port + (rank + 1) % world_size);
+    int previous = -1;
+    if (next >= 0) {
+        struct pollfd descriptor = {listener, POLLIN, 0};
+        if (poll(&descriptor, 1, DISTRIBUTED_TIMEOUT_SECONDS * 1000) == 1) {
+            previous = accept(listener, NULL, NULL);
+        }
+    }
+    close(listener);
+    if (next < 0 || previous < 0) {
+        printf("Error: Could not connect the ring of %d processes on %s!\n", world_size, host);
+        if (next >= 0) {
+            close(next);
+        }
+        return NULL;
+    }
+    configure_socket(next);
+    configure_socket(previous);
+    TcpState *state = malloc(sizeof(TcpState));
+    state->next = next;
+    state->previous = previous;
+    Transport *transport = malloc(sizeof(Transport));
+    transport->exchange = tcp_exchange;
+    transport->close = tcp_close;
+    transport->state = state;
+    return create_communicator(transport, rank, world_size);
+}
+
+#endif
@@ -0,0 +1,70 @@
+//
+// Data parallel training over several processes. Every process trains on its own shard of the
+// data, and before every step the processes sum their gradients with a ring all-reduce, so all
+// of them apply the same update and their weights stay identical. The processes of the ring
+// talk through a pluggable transport: POSIX shared memory on one host, or TCP sockets.
+//
+
+#ifndef SEM2LAB2_DISTRIBUTED_H
+#define SEM2LAB2_DISTRIBUTED_H
+
+#include <stddef.h>
+#include "network.h"
+#include "evaluation.h"
+
+// a peer that does not answer for this long is taken as dead
+#define DISTRIBUTED_TIMEOUT_SECONDS 60
+// bytes of one shared memory message, longer ones are sent in pieces
+#define SHM_MESSAGE_CAPACITY (1 << 20)
+
+// link of one process to its neighbours in the ring
+struct Transport {
+    //send send_length bytes to the next process while receiving receive_length bytes from the previous one
+    //returns 0 on success
+    int (*exchange)(struct Transport *transport, const void *outgoing, size_t send_length, void *incoming,
+                    size_t receive_length);
+    void (*close)(struct Transport *transport);
+    void *state;
+} typedef Transport;
+
+struct Communicator {
+    int rank;
+    int world_size;
+    //NULL for a single process
+    Transport *transport;
+    //flattened gradients, weights or evaluation counts
+    double *values;
+    size_t capacity;
+    //one chunk of the ring
+    double *received;
+    size_t received_capacity;
+} typedef Communicator;
+
+// join the ring of world_size processes that share name on this host, rank 0 creates the shared memory
+// returns NULL when the ring cannot be set up within DISTRIBUTED_TIMEOUT_SECONDS
+Communicator *create_shm_communicator(char *name, int rank, int world_size);
+
+// join the ring of world_size processes where process r listens on host:base_port + r and connects to
+// process r + 1, returns NULL when the ring cannot be set up within DISTRIBUTED_TIMEOUT_SECONDS
+Communicator *create_tcp_communicator(char *host, int base_port, int rank, int world_size);
+
+// a communicator around any other transport, which it closes when freed
+Communicator *create_communicator(Transport *transport, int rank, int world_size);
+
+void free_communicator(Communicator *communicator);
+
+// replace values with their sum over every process, every process ends with bitwise equal sums
+// returns 0 on success
+int all_reduce(Communicator *communicator, double *values, size_t count);
+
+// sum the layers' gradient accumulators and *number_of_samples over every process, returns 0 on success
+int all_reduce_gradients(Communicator *communicator, Network *network, int *number_of_samples);
+
+// copy the weights and biases of rank 0 to every process, returns 0 on success
+int broadcast_network(Communicator *communicator, Network *network);
+
+// turn an evaluation of this process's samples into the evaluation of every process's samples
+// returns 0 on success
+int all_reduce_evaluation(Communicator *communicator, Evaluation *evaluation);
+
+#endif //SEM2LAB2_DISTRIBUTED_H
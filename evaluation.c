@@ -0,0 +1,149 @@
+//
+// Loss, success rate and confusion matrix of a network over a data set in one batched pass.
+//
+
+#include "evaluation.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Evaluator *create_evaluator(Network *network, ThreadPool *pool) {
+    Evaluator *evaluator = malloc(sizeof(Evaluator));
+    evaluator->network = network;
+    evaluator->pool = pool;
+    evaluator->number_of_threads = pool == NULL ? 1 : pool->number_of_threads;
+    int classes = network->layers[network->number_of_layers - 1]->layer_size;
+    evaluator->batches = malloc(evaluator->number_of_threads * sizeof(Batch *));
+    evaluator->losses = malloc(evaluator->number_of_threads * sizeof(double));
+    evaluator->successes = malloc(evaluator->number_of_threads * sizeof(long));
+    evaluator->confusion_matrices = malloc(evaluator->number_of_threads * sizeof(long *));
+    for (int i = 0; i < evaluator->number_of_threads; i++) {
+        evaluator->batches[i] = create_batch(network, EVALUATION_BATCH_SIZE);
+        evaluator->confusion_matrices[i] = malloc((size_t) classes * classes * sizeof(long));
+    }
+    evaluator->result.number_of_classes = classes;
+    evaluator->result.number_of_samples = 0;
+    evaluator->result.average_loss = 0;
+    evaluator->result.success_rate = 0;
+    evaluator->result.confusion_matrix = calloc((size_t) classes * classes, sizeof(long));
+    return evaluator;
+}
+
+void free_evaluator(Evaluator *evaluator) {
+    for (int i = 0; i < evaluator->number_of_threads; i++) {
+        free_batch(evaluator->batches[i]);
+        free(evaluator->confusion_matrices[i]);
+    }
+    free(evaluator->batches);
+    free(evaluator->losses);
+    free(evaluator->successes);
+    free(evaluator->confusion_matrices);
+    free(evaluator->result.confusion_matrix);
+    free(evaluator);
+}
+
+// index of the largest value in a column
+static int column_max_index(Matrix *matrix, int col) {
+    int max_index = 0;
+    for (int i = 1; i < matrix->rows; i++) {
+        if (MATRIX_AT(matrix, i, col) > MATRIX_AT(matrix, max_index, col)) {
+            max_index = i;
+        }
+    }
+    return max_index;
+}
+
+static void evaluation_task(void *context, int thread_index, int number_of_threads) {
+    Evaluator *evaluator = context;
+    Network *network = evaluator->network;
+    Batch *batch = evaluator->batches[thread_index];
+    Matrix *outputs = batch->activations[network->number_of_layers - 1];
+    int classes = evaluator->result.number_of_classes;
+    long *confusion_matrix = evaluator->confusion_matrices[thread_index];
+    double loss = 0;
+    long successes = 0;
+    memset(confusion_matrix, 0, (size_t) classes * classes * sizeof(long));
+
+    int begin, end;
+    thread_range(evaluator->length_of_data, thread_index, number_of_threads, &begin, &end);
+    for (int start = begin; start < end; start += batch->capacity) {
+        int count = end - start < batch->capacity ? end - start : batch->capacity;
+        if (evaluator->rows != NULL) {
+            load_batch_rows(batch, evaluator->rows, start, count);
+        } else {
+            load_batch(batch, evaluator->data + start, count);
+        }
+        propagate_forward_batch(network, batch);
+        Matrix output_columns = matrix_view(outputs, 0, 0, classes, count);
+        Matrix target_columns = matrix_view(batch->targets, 0, 0, classes, count);
+        loss += layer_loss(network->loss, &output_columns, &target_columns);
+        for (int j = 0; j < count; j++) {
+            int predicted = column_max_index(outputs, j);
+            int target = column_max_index(batch->targets, j);
+            confusion_matrix[target * classes + predicted]++;
+            if (predicted == target) {
+                successes++;
+            }
+        }
+    }
+    evaluator->losses[thread_index] = loss;
+    evaluator->successes[thread_index] = successes;
+}
+
+// run the slices and sum the per-thread results
+static Evaluation *evaluate(Evaluator *evaluator) {
+    int length_of_data = evaluator->length_of_data;
+    if (evaluator->pool == NULL) {
+        evaluation_task(evaluator, 0, 1);
+    } else {
+        thread_pool_run(evaluator->pool, evaluation_task, evaluator);
+    }
+
+    Evaluation *result = &evaluator->result;
+    int classes = result->number_of_classes;
+    double loss = 0;
+    long successes = 0;
+    memset(result->confusion_matrix, 0, (size_t) classes * classes * sizeof(long));
+    for (int t = 0; t < evaluator->number_of_threads; t++) {
+        loss += evaluator->losses[t];
+        successes += evaluator->successes[t];
+        for (int i = 0; i < classes * classes; i++) {
+            result->confusion_matrix[i] += evaluator->confusion_matrices[t][i];
+        }
+    }
+    result->number_of_samples = length_of_data;
+    result->average_loss = length_of_data > 0 ? loss / length_of_data : 0;
+    result->success_rate = length_of_data > 0 ? (double) successes / length_of_data : 0;
+    return result;
+}
+
+Evaluation *evaluate_network(Evaluator *evaluator, TrainingDataPacket **data, int length_of_data) {
+    evaluator->data = data;
+    evaluator->rows = NULL;
+    evaluator->length_of_data = length_of_data;
+    return evaluate(evaluator);
+}
+
+Evaluation *evaluate_rows(Evaluator *evaluator, const SampleRows *rows) {
+    evaluator->data = NULL;
+    evaluator->rows = rows;
+    evaluator->length_of_data = rows->number_of_samples;
+    return evaluate(evaluator);
+}
+
+void print_confusion_matrix(Evaluation *evaluation) {
+    int classes = evaluation->number_of_classes;
+    printf("target \\ predicted\n");
+    printf("    ");
+    for (int j = 0; j < classes; j++) {
+        printf("%6d", j);
+    }
+    printf("\n");
+    for (int i = 0; i < classes; i++) {
+        printf("%4d", i);
+        for (int j = 0; j < classes; j++) {
+            printf("%6ld", evaluation->confusion_matrix[i * classes + j]);
+        }
+        printf("\n");
+    }
+}
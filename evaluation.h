@@ -0,0 +1,51 @@
+//
+// Loss, success rate and confusion matrix of a network over a data set in one batched pass.
+//
+
+#ifndef SEM2LAB2_EVALUATION_H
+#define SEM2LAB2_EVALUATION_H
+
+#include "network.h"
+#include "thread_pool.h"
+
+#define EVALUATION_BATCH_SIZE 512
+
+struct Evaluation {
+    int number_of_samples;
+    int number_of_classes;
+    double average_loss;
+    double success_rate;
+    //confusion_matrix[target * number_of_classes + predicted] counts the samples of each pair
+    long *confusion_matrix;
+} typedef Evaluation;
+
+struct Evaluator {
+    Network *network;
+    //borrowed, NULL evaluates on the calling thread only
+    ThreadPool *pool;
+    int number_of_threads;
+    Batch **batches;
+    //per-thread partial results, summed in thread order
+    double *losses;
+    long *successes;
+    long **confusion_matrices;
+    TrainingDataPacket **data;
+    const SampleRows *rows;
+    int length_of_data;
+    Evaluation result;
+} typedef Evaluator;
+
+// create an evaluator running on the threads of pool, which may be shared with a trainer
+Evaluator *create_evaluator(Network *network, ThreadPool *pool);
+
+void free_evaluator(Evaluator *evaluator);
+
+// forward pass over all samples, the result stays valid until the next call
+Evaluation *evaluate_network(Evaluator *evaluator, TrainingDataPacket **data, int length_of_data);
+
+// same as evaluate_network for samples stored as rows
+Evaluation *evaluate_rows(Evaluator *evaluator, const SampleRows *rows);
+
+void print_confusion_matrix(Evaluation *evaluation);
+
+#endif //SEM2LAB2_EVALUATION_H
@@ -0,0 +1,143 @@
+//
+// Life cycle of the gradient accumulators of a network, gradient norms, clipping and checks.
+//
+
+#include "gradients.h"
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include "evaluation.h"
+
+void zero_gradients(Network *network) {
+    for (int k = 1; k < network->number_of_layers; k++) {
+        fill_matrix(network->layers[k]->delta_weights, 0);
+        fill_matrix(network->layers[k]->delta_biases, 0);
+    }
+}
+
+double gradient_norm(Network *network, int number_of_samples) {
+    double sum = 0;
+    for (int k = 1; k < network->number_of_layers; k++) {
+        Layer *layer = network->layers[k];
+        for (int i = 0; i < layer->layer_size; i++) {
+            const MatrixValue *delta_weights_row = matrix_row(layer->delta_weights, i);
+            MatrixAccumulator row_sum = 0;
+            for (int j = 0; j < layer->input_size; j++) {
+                row_sum += (MatrixAccumulator) delta_weights_row[j] * delta_weights_row[j];
+            }
+            MatrixValue delta_bias = MATRIX_AT(layer->delta_biases, i, 0);
+            sum += (double) row_sum + (double) delta_bias * delta_bias;
+        }
+    }
+    //the accumulators hold sums over the samples
+    return sqrt(sum) / number_of_samples;
+}
+
+// multiply every accumulator by factor
+static void scale_gradients(Network *network, double factor) {
+    MatrixValue value_factor = (MatrixValue) factor;
+    for (int k = 1; k < network->number_of_layers; k++) {
+        Layer *layer = network->layers[k];
+        for (int i = 0; i < layer->layer_size; i++) {
+            MatrixValue *delta_weights_row = matrix_row(layer->delta_weights, i);
+            for (int j = 0; j < layer->input_size; j++) {
+                delta_weights_row[j] *= value_factor;
+            }
+            MATRIX_AT(layer->delta_biases, i, 0) *= value_factor;
+        }
+    }
+}
+
+double clip_gradients(Network *network, int number_of_samples, double max_norm) {
+    double norm = gradient_norm(network, number_of_samples);
+    if (max_norm > 0 && norm > max_norm && isfinite(norm)) {
+        scale_gradients(network, max_norm / norm);
+    }
+    return norm;
+}
+
+// central difference of the average loss over rows in one parameter, divided by the step actually
+// taken, which single precision rounds
+static double numeric_derivative(Evaluator *evaluator, const SampleRows *rows, MatrixValue *parameter,
+                                 double epsilon) {
+    MatrixValue saved = *parameter;
+    MatrixValue above = (MatrixValue) (saved + epsilon);
+    MatrixValue below = (MatrixValue) (saved - epsilon);
+    *parameter = above;
+    double loss_above = evaluate_rows(evaluator, rows)->average_loss;
+    *parameter = below;
+    double loss_below = evaluate_rows(evaluator, rows)->average_loss;
+    *parameter = saved;
+    return (loss_above - loss_below) / ((double) above - (double) below);
+}
+
+// |analytic - numeric| relative to their size, or to noise when both are smaller
+static double relative_error(double analytic, double numeric, double noise) {
+    double magnitude = fabs(analytic) + fabs(numeric);
+    return fabs(analytic - numeric) / (magnitude > noise ? magnitude : noise);
+}
+
+GradientCheck check_gradients(Network *network, const SampleRows *rows, int parameters_per_layer, double epsilon,
+                              double tolerance) {
+    GradientCheck result = {0, 0, 0, 0, 0, 0};
+    int number_of_samples = rows->number_of_samples;
+    //the analytic gradient of all samples in one batch
+    Batch *batch = create_batch(network, number_of_samples);
+    zero_gradients(network);
+    load_batch_rows(batch, rows, 0, number_of_samples);
+    propagate_forward_batch(network, batch);
+    propagate_backward_batch(network, batch);
+    free_batch(batch);
+
+    Evaluator *evaluator = create_evaluator(network, NULL);
+    //the rounding error of the loss summed over the samples, divided by the step, is the noise of the
+    //numeric derivative, derivatives below it are compared against it instead of against their own size
+    double value_epsilon = sizeof(MatrixValue) == sizeof(float) ? FLT_EPSILON : DBL_EPSILON;
+    double loss_noise = 10 * value_epsilon * sqrt(number_of_samples) * evaluate_rows(evaluator, rows)->average_loss;
+    for (int k = 1; k < network->number_of_layers; k++) {
+        Layer *layer = network->layers[k];
+        int number_of_weights = layer->layer_size * layer->input_size;
+        int number_of_parameters = number_of_weights + layer->layer_size;
+        int checks = parameters_per_layer < number_of_parameters ? parameters_per_layer : number_of_parameters;
+        for (int p = 0; p < checks; p++) {
+            //every parameter once when all of them are checked
+            int index = checks == number_of_parameters ? p : rand() % number_of_parameters;
+            MatrixValue *parameter;
+            double analytic;
+            if (index < number_of_weights) {
+                int row = index / layer->input_size, col = index % layer->input_size;
+                parameter = &MATRIX_AT(layer->weights, row, col);
+                analytic = MATRIX_AT(layer->delta_weights, row, col) / number_of_samples;
+            } else {
+                int row = index - number_of_weights;
+                parameter = &MATRIX_AT(layer->biases, row, 0);
+                analytic = MATRIX_AT(layer->delta_biases, row, 0) / number_of_samples;
+            }
+            double numeric = numeric_derivative(evaluator, rows, parameter, epsilon);
+            double error = relative_error(analytic, numeric, fmax(loss_noise / epsilon, 1e-8));
+            if (error > tolerance) {
+                //a step across the kink of Leaky ReLU for one sample changes the slope, a 100 times smaller
+                //one is usually short enough to stay on one side of it
+                double small_epsilon = epsilon / 100;
+                numeric = numeric_derivative(evaluator, rows, parameter, small_epsilon);
+                double small_error = relative_error(analytic, numeric, fmax(loss_noise / small_epsilon, 1e-8));
+                if (small_error <= tolerance) {
+                    result.kinks++;
+                }
+                error = fmin(error, small_error);
+            }
+            result.parameters_checked++;
+            if (error > tolerance) {
+                result.failures++;
+            }
+            if (error > result.max_relative_error) {
+                result.max_relative_error = error;
+                result.worst_layer = k;
+                result.worst_index = index < number_of_weights ? index : -1 - (index - number_of_weights);
+            }
+        }
+    }
+    free_evaluator(evaluator);
+    zero_gradients(network);
+    return result;
+}
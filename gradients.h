@@ -0,0 +1,45 @@
+//
+// Life cycle of the gradient accumulators of a network. A training step zeroes them, sums the
+// gradients of a mini-batch into them and applies them, which leaves them zeroed again. Between
+// the last two phases the gradient can be measured and clipped by its norm.
+//
+
+#ifndef SEM2LAB2_GRADIENTS_H
+#define SEM2LAB2_GRADIENTS_H
+
+#include "network.h"
+
+// result of check_gradients
+struct GradientCheck {
+    int parameters_checked;
+    //largest |analytic - numeric| / (|analytic| + |numeric|), where the sum is at least the noise
+    //of the numeric derivative
+    double max_relative_error;
+    //parameters whose relative error exceeded the tolerance
+    int failures;
+    //parameters that only agreed with a 100 times smaller step, near the kink of Leaky ReLU for some sample
+    int kinks;
+    //layer and index of the weight with max_relative_error, index is -1 - row for a bias
+    int worst_layer;
+    int worst_index;
+} typedef GradientCheck;
+
+// set the delta_weights and delta_biases of every layer to zero
+void zero_gradients(Network *network);
+
+// L2 norm of the accumulated gradients averaged over number_of_samples, over every weight and bias
+double gradient_norm(Network *network, int number_of_samples);
+
+// scale the accumulated gradients down so their averaged norm is at most max_norm, 0 never clips
+// returns the norm before clipping, which is not finite when the step diverged
+double clip_gradients(Network *network, int number_of_samples, double max_norm);
+
+// compare the gradient of the average loss over rows from propagate_backward_batch with central
+// differences (loss(w + epsilon) - loss(w - epsilon)) / 2 epsilon, for up to parameters_per_layer
+// weights and biases of every layer, chosen at random with rand(), a failing parameter is checked again
+// with a 100 times smaller step
+// the accumulators are zeroed afterwards and the weights are left as they were
+GradientCheck check_gradients(Network *network, const SampleRows *rows, int parameters_per_layer, double epsilon,
+                              double tolerance);
+
+#endif //SEM2LAB2_GRADIENTS_H
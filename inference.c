@@ -0,0 +1,159 @@
+//
+// Read-only inference engine. The weights of a trained network are copied once into one
+// frozen block and every call works in caller-owned scratch, so one model serves many
+// threads at the same time without a network copy per thread.
+//
+
+#include "inference.h"
+#include <stdlib.h>
+#include <string.h>
+
+InferenceModel *create_inference_model(Network *network) {
+    InferenceModel *model = malloc(sizeof(InferenceModel));
+    int number_of_layers = network->number_of_layers;
+    model->number_of_layers = number_of_layers;
+    model->layer_sizes = malloc(number_of_layers * sizeof(int));
+    model->weights = calloc(number_of_layers, sizeof(Matrix));
+    model->biases = calloc(number_of_layers, sizeof(Matrix));
+    model->activations = malloc(number_of_layers * sizeof(LayerActivation));
+    model->largest_layer = 0;
+
+    //one block holding every layer's weights followed by its biases, rows keep the matrix stride
+    size_t total = 0;
+    for (int i = 0; i < number_of_layers; i++) {
+        Layer *layer = network->layers[i];
+        model->layer_sizes[i] = layer->layer_size;
+        model->activations[i] = layer->activation;
+        if (layer->layer_size > model->largest_layer) {
+            model->largest_layer = layer->layer_size;
+        }
+        if (i > 0) {
+            total += (size_t) layer->layer_size * layer->weights->stride + layer->layer_size;
+            //keep every layer's weights aligned
+            total = (total + MATRIX_STRIDE_MULTIPLE - 1) / MATRIX_STRIDE_MULTIPLE * MATRIX_STRIDE_MULTIPLE;
+        }
+    }
+    model->parameters = aligned_malloc((total > 0 ? total : 1) * sizeof(MatrixValue));
+
+    MatrixValue *next = model->parameters;
+    for (int i = 1; i < number_of_layers; i++) {
+        Layer *layer = network->layers[i];
+        Matrix *weights = &model->weights[i];
+        *weights = *layer->weights;
+        weights->values = next;
+        weights->owns_values = 0;
+        memcpy(next, layer->weights->values, (size_t) layer->layer_size * layer->weights->stride * sizeof(MatrixValue));
+        next += (size_t) layer->layer_size * layer->weights->stride;
+
+        Matrix *biases = &model->biases[i];
+        biases->rows = layer->layer_size;
+        biases->cols = 1;
+        biases->stride = 1;
+        biases->values = next;
+        biases->owns_values = 0;
+        for (int j = 0; j < layer->layer_size; j++) {
+            next[j] = MATRIX_AT(layer->biases, j, 0);
+        }
+        next += layer->layer_size;
+        next = model->parameters + (next - model->parameters + MATRIX_STRIDE_MULTIPLE - 1) /
+                                   MATRIX_STRIDE_MULTIPLE * MATRIX_STRIDE_MULTIPLE;
+    }
+    return model;
+}
+
+void free_inference_model(InferenceModel *model) {
+    aligned_free(model->parameters);
+    free(model->weights);
+    free(model->biases);
+    free(model->activations);
+    free(model->layer_sizes);
+    free(model);
+}
+
+InferenceScratch *create_inference_scratch(const InferenceModel *model, int capacity) {
+    InferenceScratch *scratch = malloc(sizeof(InferenceScratch));
+    scratch->capacity = capacity > 0 ? capacity : 1;
+    //consecutive layers alternate between the two buffers
+    scratch->buffers[0] = create_matrix(model->largest_layer, scratch->capacity);
+    scratch->buffers[1] = create_matrix(model->largest_layer, scratch->capacity);
+    return scratch;
+}
+
+void free_inference_scratch(InferenceScratch *scratch) {
+    free_matrix(scratch->buffers[0]);
+    free_matrix(scratch->buffers[1]);
+    free(scratch);
+}
+
+// forward pass of count samples that fit into the scratch, returns the output layer with one sample per column
+static Matrix forward_pass(const InferenceModel *model, InferenceScratch *scratch, const MatrixValue *inputs,
+                           int count) {
+    //the (samples x features) inputs are read in place as the transposed first operand
+    Matrix input_rows = {.rows = count, .cols = model->layer_sizes[0], .stride = model->layer_sizes[0],
+                         .values = (MatrixValue *) inputs, .owns_values = 0, .in_arena = 0};
+    Matrix previous = {0};
+    for (int i = 1; i < model->number_of_layers; i++) {
+        Matrix sums = matrix_view(scratch->buffers[i % 2], 0, 0, model->layer_sizes[i], count);
+        //Z = W * A + b and f(Z) in place, only the activations are needed later
+        if (i == 1) {
+            layer_forward(model->activations[i], &model->weights[i], &input_rows, 1, &model->biases[i], &sums, &sums);
+        } else {
+            layer_forward(model->activations[i], &model->weights[i], &previous, 0, &model->biases[i], &sums, &sums);
+        }
+        previous = sums;
+    }
+    return previous;
+}
+
+// forward pass of count samples that fit into the scratch
+static void infer_pass(const InferenceModel *model, InferenceScratch *scratch, const MatrixValue *inputs, int count,
+                       MatrixValue *outputs) {
+    Matrix output = forward_pass(model, scratch, inputs, count);
+    //one output row per sample
+    int classes = output.rows;
+    for (int c = 0; c < classes; c++) {
+        const MatrixValue *row = matrix_row(&output, c);
+        for (int j = 0; j < count; j++) {
+            outputs[(size_t) j * classes + c] = row[j];
+        }
+    }
+}
+
+void infer_batch(const InferenceModel *model, InferenceScratch *scratch, const MatrixValue *inputs,
+                 int number_of_samples, MatrixValue *outputs) {
+    InferenceScratch *temporary = NULL;
+    if (scratch == NULL) {
+        temporary = create_inference_scratch(model, number_of_samples < INFERENCE_BATCH_SIZE ? number_of_samples
+                                                                                             : INFERENCE_BATCH_SIZE);
+        scratch = temporary;
+    }
+    int features = model->layer_sizes[0];
+    int classes = model->layer_sizes[model->number_of_layers - 1];
+    for (int first = 0; first < number_of_samples; first += scratch->capacity) {
+        int count = number_of_samples - first < scratch->capacity ? number_of_samples - first : scratch->capacity;
+        infer_pass(model, scratch, inputs + (size_t) first * features, count, outputs + (size_t) first * classes);
+    }
+    if (temporary != NULL) {
+        free_inference_scratch(temporary);
+    }
+}
+
+int infer_class(const InferenceModel *model, InferenceScratch *scratch, const MatrixValue *input) {
+    InferenceScratch *temporary = NULL;
+    if (scratch == NULL) {
+        temporary = create_inference_scratch(model, 1);
+        scratch = temporary;
+    }
+    //the class is read from the output layer in the scratch, no probabilities are copied out
+    Matrix output = forward_pass(model, scratch, input, 1);
+    int best = 0;
+    for (int c = 1; c < output.rows; c++) {
+        if (MATRIX_AT(&output, c, 0) > MATRIX_AT(&output, best, 0)) {
+            best = c;
+        }
+    }
+    if (temporary != NULL) {
+        free_inference_scratch(temporary);
+    }
+    return best;
+}
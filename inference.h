@@ -0,0 +1,51 @@
+//
+// Read-only inference engine. The weights of a trained network are copied once into one
+// frozen block and every call works in caller-owned scratch, so one model serves many
+// threads at the same time without a network copy per thread.
+//
+
+#ifndef SEM2LAB2_INFERENCE_H
+#define SEM2LAB2_INFERENCE_H
+
+#include "network.h"
+
+#define INFERENCE_BATCH_SIZE 256
+
+struct InferenceModel {
+    int number_of_layers;
+    int *layer_sizes;
+    //weights[i] and biases[i] of layer i, all views into parameters, layer 0 has none
+    Matrix *weights;
+    Matrix *biases;
+    LayerActivation *activations;
+    MatrixValue *parameters;
+    int largest_layer;
+} typedef InferenceModel;
+
+// per-call buffers, one per thread, never shared by concurrent calls
+struct InferenceScratch {
+    int capacity;
+    Matrix *buffers[2];
+} typedef InferenceScratch;
+
+// freeze a copy of the network's weights, the network can be freed or trained on afterwards
+InferenceModel *create_inference_model(Network *network);
+
+void free_inference_model(InferenceModel *model);
+
+// scratch for up to capacity samples per pass, larger calls are split into passes
+InferenceScratch *create_inference_scratch(const InferenceModel *model, int capacity);
+
+void free_inference_scratch(InferenceScratch *scratch);
+
+// class probabilities of number_of_samples inputs
+// inputs hold one sample per row of layer_sizes[0] values, outputs one row per sample of the output layer size
+// reentrant: the model is only read, scratch may be NULL to use a temporary one for this call
+void infer_batch(const InferenceModel *model, InferenceScratch *scratch, const MatrixValue *inputs,
+                 int number_of_samples, MatrixValue *outputs);
+
+// index of the most probable class of a single input
+// allocates nothing when scratch is given, NULL uses a temporary scratch as infer_batch does
+int infer_class(const InferenceModel *model, InferenceScratch *scratch, const MatrixValue *input);
+
+#endif //SEM2LAB2_INFERENCE_H
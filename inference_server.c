@@ -0,0 +1,558 @@
+//
+// Dynamic batching inference server and its client. The server is one thread polling the
+// listening socket and every connection, the forward passes run on that thread between polls.
+//
+
+#define _GNU_SOURCE
+
+#include "inference_server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+// requests a connection may have read but not yet queued, and responses it may have left unread
+#define CLIENT_BUFFERED_REQUESTS 64
+#define HELLO_BYTES 12
+
+struct ServerClient {
+    //-1 when the connection is closed, the slot is reused once its queued requests ran
+    int socket;
+    unsigned char *input;
+    size_t input_length;
+    unsigned char *output;
+    size_t output_length;
+    size_t output_capacity;
+    //requests of the connection waiting for the next batch
+    int pending;
+    //the peer shut down its sending side, the connection is closed once every response is sent
+    int input_closed;
+};
+
+InferenceServerOptions default_inference_server_options() {
+    InferenceServerOptions options;
+    options.max_batch_size = 64;
+    options.latency_budget_microseconds = 200;
+    options.max_clients = 256;
+    return options;
+}
+
+#ifdef _WIN32
+
+InferenceServer *create_inference_server(const InferenceModel *model, char *socket_path,
+                                         InferenceServerOptions options) {
+    printf("Error: The inference server needs Unix domain sockets!\n");
+    return NULL;
+}
+
+int run_inference_server(InferenceServer *server) {
+    return 1;
+}
+
+void stop_inference_server(InferenceServer *server) {
+}
+
+void free_inference_server(InferenceServer *server) {
+}
+
+InferenceClient *connect_inference_server(char *socket_path) {
+    printf("Error: The inference server needs Unix domain sockets!\n");
+    return NULL;
+}
+
+void close_inference_client(InferenceClient *client) {
+}
+
+int send_inference_request(InferenceClient *client, const double *input) {
+    return 1;
+}
+
+int receive_inference_response(InferenceClient *client, int32_t *class_index, double *probabilities) {
+    return 1;
+}
+
+int request_inference(InferenceClient *client, const double *input, int32_t *class_index, double *probabilities) {
+    return 1;
+}
+
+#else
+
+static double now_seconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec * 1e-9;
+}
+
+static size_t request_bytes(const InferenceModel *model) {
+    return (size_t) model->layer_sizes[0] * sizeof(double);
+}
+
+static size_t response_bytes(const InferenceModel *model) {
+    return sizeof(int32_t) + (size_t) model->layer_sizes[model->number_of_layers - 1] * sizeof(double);
+}
+
+static int set_nonblocking(int socket) {
+    int flags = fcntl(socket, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(socket, F_SETFL, flags | O_NONBLOCK);
+}
+
+// fill address with path, returns 0 when it fits
+static int socket_address(char *path, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        printf("Error: Socket path %s is too long!\n", path);
+        return 1;
+    }
+    strcpy(address->sun_path, path);
+    return 0;
+}
+
+InferenceServer *create_inference_server(const InferenceModel *model, char *socket_path,
+                                         InferenceServerOptions options) {
+    if (options.max_batch_size < 1 || options.latency_budget_microseconds < 0 || options.max_clients < 1) {
+        printf("Error: Batch size and clients must be positive and the latency budget not negative!\n");
+        return NULL;
+    }
+    struct sockaddr_un address;
+    if (socket_address(socket_path, &address) != 0) {
+        return NULL;
+    }
+    //only a socket left behind by an earlier server is replaced, never another file
+    struct stat status;
+    if (lstat(socket_path, &status) == 0) {
+        if (!S_ISSOCK(status.st_mode)) {
+            printf("Error: %s exists and is not a socket!\n", socket_path);
+            return NULL;
+        }
+        unlink(socket_path);
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0 ||
+        listen(listener, 128) != 0 || set_nonblocking(listener) != 0) {
+        printf("Error: Could not listen on %s!\n", socket_path);
+        if (listener >= 0) {
+            close(listener);
+        }
+        return NULL;
+    }
+
+    InferenceServer *server = calloc(1, sizeof(InferenceServer));
+    server->model = model;
+    server->options = options;
+    server->socket_path = malloc(strlen(socket_path) + 1);
+    strcpy(server->socket_path, socket_path);
+    server->listener = listener;
+    if (pipe(server->wake_pipe) != 0 || set_nonblocking(server->wake_pipe[0]) != 0 ||
+        set_nonblocking(server->wake_pipe[1]) != 0) {
+        printf("Error: Could not create a pipe!\n");
+        close(listener);
+        unlink(socket_path);
+        free(server->socket_path);
+        free(server);
+        return NULL;
+    }
+    server->clients = calloc(options.max_clients, sizeof(struct ServerClient));
+    for (int c = 0; c < options.max_clients; c++) {
+        server->clients[c].socket = -1;
+    }
+    int number_of_features = model->layer_sizes[0];
+    int number_of_classes = model->layer_sizes[model->number_of_layers - 1];
+    server->inputs = malloc(sizeof(MatrixValue) * options.max_batch_size * number_of_features);
+    server->outputs = malloc(sizeof(MatrixValue) * options.max_batch_size * number_of_classes);
+    server->owners = malloc(sizeof(int) * options.max_batch_size);
+    server->probabilities = malloc(sizeof(double) * number_of_classes);
+    server->scratch = create_inference_scratch(model, options.max_batch_size);
+    return server;
+}
+
+static void close_client(struct ServerClient *client) {
+    close(client->socket);
+    client->socket = -1;
+    client->input_length = 0;
+    client->output_length = 0;
+    client->input_closed = 0;
+}
+
+// append bytes to the client's output, sent by flush_client
+static void append_output(struct ServerClient *client, const void *bytes, size_t length) {
+    if (client->output_length + length > client->output_capacity) {
+        client->output_capacity = 2 * (client->output_length + length);
+        client->output = realloc(client->output, client->output_capacity);
+    }
+    memcpy(client->output + client->output_length, bytes, length);
+    client->output_length += length;
+}
+
+// send as much of the output as the socket takes without blocking
+static void flush_client(struct ServerClient *client) {
+    size_t sent = 0;
+    while (sent < client->output_length) {
+        ssize_t result = send(client->socket, client->output + sent, client->output_length - sent,
+                              MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                close_client(client);
+                return;
+            }
+            break;
+        }
+        sent += (size_t) result;
+    }
+    memmove(client->output, client->output + sent, client->output_length - sent);
+    client->output_length -= sent;
+}
+
+static void accept_clients(InferenceServer *server) {
+    const InferenceModel *model = server->model;
+    for (int c = 0; c < server->options.max_clients; c++) {
+        struct ServerClient *client = &server->clients[c];
+        if (client->socket >= 0 || client->pending > 0) {
+            continue;
+        }
+        int socket = accept(server->listener, NULL, NULL);
+        if (socket < 0) {
+            return;
+        }
+        if (set_nonblocking(socket) != 0) {
+            close(socket);
+            continue;
+        }
+        client->socket = socket;
+        if (client->input == NULL) {
+            client->input = malloc(CLIENT_BUFFERED_REQUESTS * request_bytes(model));
+        }
+        uint32_t sizes[2] = {(uint32_t) model->layer_sizes[0],
+                             (uint32_t) model->layer_sizes[model->number_of_layers - 1]};
+        append_output(client, INFERENCE_SERVER_MAGIC, 4);
+        append_output(client, sizes, sizeof(sizes));
+        flush_client(client);
+    }
+}
+
+static void read_client(InferenceServer *server, struct ServerClient *client) {
+    size_t capacity = CLIENT_BUFFERED_REQUESTS * request_bytes(server->model);
+    while (client->input_length < capacity) {
+        ssize_t result = recv(client->socket, client->input + client->input_length, capacity - client->input_length,
+                              MSG_DONTWAIT);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        //after a half close the requests already read are still answered
+        if (result == 0) {
+            client->input_closed = 1;
+            return;
+        }
+        if (result < 0) {
+            close_client(client);
+            return;
+        }
+        client->input_length += (size_t) result;
+    }
+}
+
+// forward pass of every queued request and their responses
+static void run_batch(InferenceServer *server) {
+    const InferenceModel *model = server->model;
+    int number_of_classes = model->layer_sizes[model->number_of_layers - 1];
+    int count = server->number_of_pending;
+    infer_batch(model, server->scratch, server->inputs, count, server->outputs);
+    double *probabilities = server->probabilities;
+    for (int i = 0; i < count; i++) {
+        struct ServerClient *client = &server->clients[server->owners[i]];
+        client->pending--;
+        //a closed connection's responses are dropped
+        if (client->socket < 0) {
+            continue;
+        }
+        const MatrixValue *output = server->outputs + (size_t) i * number_of_classes;
+        int32_t best = 0;
+        for (int c = 0; c < number_of_classes; c++) {
+            probabilities[c] = output[c];
+            if (output[c] > output[best]) {
+                best = c;
+            }
+        }
+        append_output(client, &best, sizeof(best));
+        append_output(client, probabilities, sizeof(double) * number_of_classes);
+    }
+    for (int c = 0; c < server->options.max_clients; c++) {
+        if (server->clients[c].socket >= 0 && server->clients[c].output_length > 0) {
+            flush_client(&server->clients[c]);
+        }
+    }
+    server->requests += count;
+    server->batches++;
+    server->number_of_pending = 0;
+}
+
+// move the complete requests of every connection into the batch, one per connection in turn
+static void queue_requests(InferenceServer *server) {
+    int number_of_features = server->model->layer_sizes[0];
+    size_t length = request_bytes(server->model);
+    size_t output_limit = CLIENT_BUFFERED_REQUESTS * response_bytes(server->model);
+    int queued = 1;
+    while (queued) {
+        queued = 0;
+        for (int c = 0; c < server->options.max_clients; c++) {
+            struct ServerClient *client = &server->clients[c];
+            //a connection that does not read its responses gets no more of them
+            if (client->socket < 0 || client->input_length < length ||
+                client->output_length + (client->pending + 1) * response_bytes(server->model) > output_limit) {
+                continue;
+            }
+            if (server->number_of_pending == 0) {
+                server->oldest_arrival = now_seconds();
+            }
+            MatrixValue *input = server->inputs + (size_t) server->number_of_pending * number_of_features;
+            for (int i = 0; i < number_of_features; i++) {
+                double value;
+                memcpy(&value, client->input + i * sizeof(double), sizeof(double));
+                input[i] = (MatrixValue) value;
+            }
+            memmove(client->input, client->input + length, client->input_length - length);
+            client->input_length -= length;
+            client->pending++;
+            server->owners[server->number_of_pending++] = c;
+            if (server->number_of_pending == server->options.max_batch_size) {
+                run_batch(server);
+            }
+            queued = 1;
+        }
+    }
+}
+
+// close the half closed connections whose every request was answered and sent
+static void close_finished_clients(InferenceServer *server) {
+    size_t length = request_bytes(server->model);
+    for (int c = 0; c < server->options.max_clients; c++) {
+        struct ServerClient *client = &server->clients[c];
+        //a partial request left after the half close can never be completed
+        if (client->socket >= 0 && client->input_closed && client->input_length < length && client->pending == 0 &&
+            client->output_length == 0) {
+            close_client(client);
+        }
+    }
+}
+
+int run_inference_server(InferenceServer *server) {
+    int max_clients = server->options.max_clients;
+    double budget = server->options.latency_budget_microseconds * 1e-6;
+    size_t input_capacity = CLIENT_BUFFERED_REQUESTS * request_bytes(server->model);
+    size_t output_limit = CLIENT_BUFFERED_REQUESTS * response_bytes(server->model);
+    struct pollfd *descriptors = malloc((2 + max_clients) * sizeof(struct pollfd));
+    int *slots = malloc((2 + max_clients) * sizeof(int));
+    int failed = 0;
+    while (!server->stopping) {
+        int count = 0;
+        int has_free_slot = 0;
+        descriptors[count++] = (struct pollfd) {server->wake_pipe[0], POLLIN, 0};
+        for (int c = 0; c < max_clients; c++) {
+            struct ServerClient *client = &server->clients[c];
+            if (client->socket < 0) {
+                has_free_slot |= client->pending == 0;
+                continue;
+            }
+            //requests are read only while the connection keeps up with its responses
+            int readable = !client->input_closed && client->input_length < input_capacity &&
+                           client->output_length < output_limit;
+            short events = (short) ((readable ? POLLIN : 0) |
+                                    (client->output_length > 0 ? POLLOUT : 0));
+            slots[count] = c;
+            descriptors[count++] = (struct pollfd) {client->socket, events, 0};
+        }
+        //new connections wait in the listen queue while every slot is taken
+        if (has_free_slot) {
+            descriptors[count++] = (struct pollfd) {server->listener, POLLIN, 0};
+        }
+
+        //wake up when the oldest queued request has waited for the budget
+        struct timespec timeout;
+        if (server->number_of_pending > 0) {
+            double remaining = server->oldest_arrival + budget - now_seconds();
+            remaining = remaining > 0 ? remaining : 0;
+            timeout.tv_sec = (time_t) remaining;
+            timeout.tv_nsec = (long) ((remaining - (double) timeout.tv_sec) * 1e9);
+        }
+        if (ppoll(descriptors, count, server->number_of_pending > 0 ? &timeout : NULL, NULL) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Error: Polling the connections failed!\n");
+            failed = 1;
+            break;
+        }
+
+        if (descriptors[0].revents != 0) {
+            char bytes[64];
+            while (read(server->wake_pipe[0], bytes, sizeof(bytes)) > 0) {
+            }
+        }
+        for (int d = 1; d < count; d++) {
+            if (descriptors[d].fd == server->listener) {
+                if (descriptors[d].revents != 0) {
+                    accept_clients(server);
+                }
+                continue;
+            }
+            struct ServerClient *client = &server->clients[slots[d]];
+            if (descriptors[d].revents & POLLOUT) {
+                flush_client(client);
+            }
+            //a hang up after the half close means the responses can no longer be delivered
+            if (client->socket >= 0 && client->input_closed && (descriptors[d].revents & (POLLHUP | POLLERR))) {
+                close_client(client);
+            }
+            if (client->socket >= 0 && (descriptors[d].revents & (POLLIN | POLLHUP | POLLERR))) {
+                read_client(server, client);
+            }
+        }
+        queue_requests(server);
+        if (server->number_of_pending > 0 && now_seconds() >= server->oldest_arrival + budget) {
+            run_batch(server);
+        }
+        close_finished_clients(server);
+    }
+    free(descriptors);
+    free(slots);
+    return failed;
+}
+
+void stop_inference_server(InferenceServer *server) {
+    server->stopping = 1;
+    ssize_t result = write(server->wake_pipe[1], "", 1);
+    (void) result;
+}
+
+void free_inference_server(InferenceServer *server) {
+    for (int c = 0; c < server->options.max_clients; c++) {
+        if (server->clients[c].socket >= 0) {
+            close(server->clients[c].socket);
+        }
+        free(server->clients[c].input);
+        free(server->clients[c].output);
+    }
+    close(server->listener);
+    close(server->wake_pipe[0]);
+    close(server->wake_pipe[1]);
+    unlink(server->socket_path);
+    free(server->socket_path);
+    free(server->clients);
+    free(server->inputs);
+    free(server->outputs);
+    free(server->owners);
+    free(server->probabilities);
+    free_inference_scratch(server->scratch);
+    free(server);
+}
+
+// returns 0 once all length bytes were sent
+static int send_fully(int socket, const void *bytes, size_t length) {
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t result = send(socket, (const char *) bytes + sent, length - sent, MSG_NOSIGNAL);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return 1;
+        }
+        sent += (size_t) result;
+    }
+    return 0;
+}
+
+// returns 0 once all length bytes arrived
+static int receive_fully(int socket, void *bytes, size_t length) {
+    size_t received = 0;
+    while (received < length) {
+        ssize_t result = recv(socket, (char *) bytes + received, length - received, 0);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return 1;
+        }
+        received += (size_t) result;
+    }
+    return 0;
+}
+
+InferenceClient *connect_inference_server(char *socket_path) {
+    struct sockaddr_un address;
+    if (socket_address(socket_path, &address) != 0) {
+        return NULL;
+    }
+    int socket_descriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket_descriptor < 0 || connect(socket_descriptor, (struct sockaddr *) &address, sizeof(address)) != 0) {
+        printf("Error: No inference server at %s!\n", socket_path);
+        if (socket_descriptor >= 0) {
+            close(socket_descriptor);
+        }
+        return NULL;
+    }
+    unsigned char hello[HELLO_BYTES];
+    uint32_t sizes[2];
+    if (receive_fully(socket_descriptor, hello, HELLO_BYTES) != 0 ||
+        memcmp(hello, INFERENCE_SERVER_MAGIC, 4) != 0) {
+        printf("Error: %s is not an inference server!\n", socket_path);
+        close(socket_descriptor);
+        return NULL;
+    }
+    memcpy(sizes, hello + 4, sizeof(sizes));
+    InferenceClient *client = malloc(sizeof(InferenceClient));
+    client->socket = socket_descriptor;
+    client->number_of_features = (int) sizes[0];
+    client->number_of_classes = (int) sizes[1];
+    size_t request = client->number_of_features * sizeof(double);
+    size_t response = sizeof(int32_t) + client->number_of_classes * sizeof(double);
+    client->buffer = malloc(request > response ? request : response);
+    return client;
+}
+
+void close_inference_client(InferenceClient *client) {
+    close(client->socket);
+    free(client->buffer);
+    free(client);
+}
+
+int send_inference_request(InferenceClient *client, const double *input) {
+    return send_fully(client->socket, input, client->number_of_features * sizeof(double));
+}
+
+int receive_inference_response(InferenceClient *client, int32_t *class_index, double *probabilities) {
+    size_t length = sizeof(int32_t) + client->number_of_classes * sizeof(double);
+    if (receive_fully(client->socket, client->buffer, length) != 0) {
+        return 1;
+    }
+    memcpy(class_index, client->buffer, sizeof(int32_t));
+    if (probabilities != NULL) {
+        memcpy(probabilities, client->buffer + sizeof(int32_t), client->number_of_classes * sizeof(double));
+    }
+    return 0;
+}
+
+int request_inference(InferenceClient *client, const double *input, int32_t *class_index, double *probabilities) {
+    if (send_inference_request(client, input) != 0) {
+        return 1;
+    }
+    return receive_inference_response(client, class_index, probabilities);
+}
+
+#endif
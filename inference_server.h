@@ -0,0 +1,93 @@
+//
+// Inference daemon on a Unix domain socket. The model is loaded once, requests arriving on any
+// connection are queued, and the queue is run through one batched forward pass when it is full
+// or when its oldest request has waited for the latency budget.
+//
+// Protocol, every number in the byte order of the host:
+// on connect the server sends INFERENCE_SERVER_MAGIC, then the uint32 input and output sizes;
+// a request is the input size of float64 values; its response is the int32 index of the most
+// probable class followed by the output size of float64 probabilities. A connection may send
+// further requests before the responses arrive, which come back in the order of the requests.
+//
+
+#ifndef SEM2LAB2_INFERENCE_SERVER_H
+#define SEM2LAB2_INFERENCE_SERVER_H
+
+#include <stdint.h>
+#include "inference.h"
+
+#define INFERENCE_SERVER_MAGIC "NNIS"
+
+struct InferenceServerOptions {
+    //requests of one forward pass
+    int max_batch_size;
+    //longest a request waits for others to join its batch
+    long latency_budget_microseconds;
+    //connections served at the same time, further ones wait in the listen queue
+    int max_clients;
+} typedef InferenceServerOptions;
+
+InferenceServerOptions default_inference_server_options();
+
+struct ServerClient;
+
+struct InferenceServer {
+    //borrowed
+    const InferenceModel *model;
+    InferenceServerOptions options;
+    char *socket_path;
+    int listener;
+    //stop_inference_server writes to wake_pipe[1], which the loop polls
+    int wake_pipe[2];
+    volatile int stopping;
+    struct ServerClient *clients;
+    //requests waiting for the next batch, one row each, and the client every row belongs to
+    MatrixValue *inputs;
+    MatrixValue *outputs;
+    int *owners;
+    //one response's probabilities as they are sent
+    double *probabilities;
+    int number_of_pending;
+    double oldest_arrival;
+    InferenceScratch *scratch;
+    //requests answered and forward passes run so far
+    long requests;
+    long batches;
+} typedef InferenceServer;
+
+// listen on socket_path, an existing socket file there is replaced, returns NULL on error
+InferenceServer *create_inference_server(const InferenceModel *model, char *socket_path,
+                                         InferenceServerOptions options);
+
+// serve requests until stop_inference_server, returns 0 when stopped that way
+int run_inference_server(InferenceServer *server);
+
+// make run_inference_server return, safe to call from a signal handler or another thread
+void stop_inference_server(InferenceServer *server);
+
+// close every connection and remove the socket file
+void free_inference_server(InferenceServer *server);
+
+// one connection to a server, not shared between threads
+struct InferenceClient {
+    int socket;
+    int number_of_features;
+    int number_of_classes;
+    unsigned char *buffer;
+} typedef InferenceClient;
+
+// returns NULL when there is no server at socket_path
+InferenceClient *connect_inference_server(char *socket_path);
+
+void close_inference_client(InferenceClient *client);
+
+// send one sample of number_of_features values without waiting for its response, returns 0 on success
+int send_inference_request(InferenceClient *client, const double *input);
+
+// the response to the oldest request without one, probabilities may be NULL, returns 0 on success
+int receive_inference_response(InferenceClient *client, int32_t *class_index, double *probabilities);
+
+// send one sample and wait for its class and probabilities, returns 0 on success
+int request_inference(InferenceClient *client, const double *input, int32_t *class_index, double *probabilities);
+
+#endif //SEM2LAB2_INFERENCE_SERVER_H
@@ -0,0 +1,323 @@
+//
+// Fused per-layer kernels. The forward kernel adds the bias and applies the activation while the
+// weighted sums are written, the backward kernels apply the activation derivative and add the
+// layer's weight and bias gradients in the same sweep over the deltas.
+//
+
+#include "layer_kernels.h"
+#include <math.h>
+#include "network.h"
+
+// columns whose softmax sums are kept at once
+#define SOFTMAX_BLOCK 256
+
+#ifdef LAYER_FAST_EXP
+#include <stdint.h>
+#include <string.h>
+
+// e^x as 2^n * e^r with n = round(x * log2(e)) and |r| <= ln(2) / 2, e^r from its Taylor series
+// n is rounded by adding 1.5 * 2^mantissa bits, which also leaves n in the low bits of the sum
+// relative error below 2e-7, no branches or calls so the loops around it vectorize
+#ifdef MATRIX_FLOAT32
+static inline MatrixValue value_exp(MatrixValue x) {
+    x = x < -87.0f ? -87.0f : x;
+    x = x > 88.0f ? 88.0f : x;
+    float shifted = x * 1.44269504f + 12582912.0f;
+    float n = shifted - 12582912.0f;
+    float r = x - n * 0.693147181f;
+    float p = 1 + r * (1 + r * (1.0f / 2 + r * (1.0f / 6 + r * (1.0f / 24 + r * (1.0f / 120 + r * (1.0f / 720))))));
+    int32_t bits;
+    memcpy(&bits, &shifted, sizeof(bits));
+    bits = (bits - 0x4B400000 + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+#else
+static inline MatrixValue value_exp(MatrixValue x) {
+    x = x < -708.0 ? -708.0 : x;
+    x = x > 709.0 ? 709.0 : x;
+    double shifted = x * 1.4426950408889634 + 6755399441055744.0;
+    double n = shifted - 6755399441055744.0;
+    double r = x - n * 0.6931471805599453;
+    double p = 1 + r * (1 + r * (1.0 / 2 + r * (1.0 / 6 + r * (1.0 / 24 + r * (1.0 / 120 + r * (1.0 / 720))))));
+    int64_t bits;
+    memcpy(&bits, &shifted, sizeof(bits));
+    bits = (bits - 0x4338000000000000 + 1023) << 52;
+    double scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+#endif
+#elif defined(MATRIX_FLOAT32)
+#define value_exp expf
+#else
+#define value_exp exp
+#endif
+
+#ifdef MATRIX_FLOAT32
+#define value_log logf
+#else
+#define value_log log
+#endif
+
+// smallest positive normal value, the cross entropy of a probability that rounded to 0 stays finite
+#ifdef MATRIX_FLOAT32
+#define SMALLEST_PROBABILITY 1.17549435e-38f
+#else
+#define SMALLEST_PROBABILITY 2.2250738585072014e-308
+#endif
+
+static inline MatrixValue leaky_relu(MatrixValue x) {
+    return x < 0 ? x * (MatrixValue) ReLU_A : x * (MatrixValue) ReLU_B;
+}
+
+// derivative of the activation at z, 1 for layers without one
+static inline MatrixValue activation_derivative(LayerActivation activation, MatrixValue z) {
+    if (activation == LAYER_ACTIVATION_LEAKY_RELU) {
+        return z >= 0 ? (MatrixValue) ReLU_B : (MatrixValue) ReLU_A;
+    }
+    return 1;
+}
+
+// values of a single sample if they are contiguous, NULL for batches and strided columns
+static const MatrixValue *single_sample(Matrix *input, int input_rows) {
+    if (input_rows) {
+        return input->rows == 1 ? input->values : NULL;
+    }
+    return input->cols == 1 && input->stride == 1 ? input->values : NULL;
+}
+
+// softmax of a single contiguous column
+static void softmax_vector(int n, const MatrixValue *z, MatrixValue *a) {
+    MatrixValue max = z[0];
+    for (int i = 1; i < n; i++) {
+        max = z[i] > max ? z[i] : max;
+    }
+    MatrixAccumulator sum = 0;
+    for (int i = 0; i < n; i++) {
+        a[i] = value_exp(z[i] - max);
+        sum += a[i];
+    }
+    MatrixValue inverse = (MatrixValue) (1 / sum);
+    for (int i = 0; i < n; i++) {
+        a[i] *= inverse;
+    }
+}
+
+void layer_softmax(Matrix *weighted_sums, Matrix *activations) {
+    if (weighted_sums->cols == 1 && weighted_sums->stride == 1 && activations->stride == 1) {
+        softmax_vector(weighted_sums->rows, weighted_sums->values, activations->values);
+        return;
+    }
+    //blocks of columns are swept row by row so every pass reads rows contiguously
+    MatrixValue maxima[SOFTMAX_BLOCK];
+    MatrixAccumulator sums[SOFTMAX_BLOCK];
+    for (int first = 0; first < weighted_sums->cols; first += SOFTMAX_BLOCK) {
+        int count = weighted_sums->cols - first < SOFTMAX_BLOCK ? weighted_sums->cols - first : SOFTMAX_BLOCK;
+        const MatrixValue *z = matrix_row(weighted_sums, 0) + first;
+        for (int j = 0; j < count; j++) {
+            maxima[j] = z[j];
+            sums[j] = 0;
+        }
+        for (int i = 1; i < weighted_sums->rows; i++) {
+            z = matrix_row(weighted_sums, i) + first;
+            for (int j = 0; j < count; j++) {
+                maxima[j] = z[j] > maxima[j] ? z[j] : maxima[j];
+            }
+        }
+        for (int i = 0; i < weighted_sums->rows; i++) {
+            z = matrix_row(weighted_sums, i) + first;
+            MatrixValue *a = matrix_row(activations, i) + first;
+            for (int j = 0; j < count; j++) {
+                a[j] = value_exp(z[j] - maxima[j]);
+                sums[j] += a[j];
+            }
+        }
+        //multiplying by the reciprocal replaces one division per element by one per column
+        for (int j = 0; j < count; j++) {
+            maxima[j] = (MatrixValue) (1 / sums[j]);
+        }
+        for (int i = 0; i < weighted_sums->rows; i++) {
+            MatrixValue *a = matrix_row(activations, i) + first;
+            for (int j = 0; j < count; j++) {
+                a[j] *= maxima[j];
+            }
+        }
+    }
+}
+
+double layer_loss(LossFunction loss, Matrix *activations, Matrix *targets) {
+    MatrixAccumulator sum = 0;
+    for (int i = 0; i < activations->rows; i++) {
+        const MatrixValue *a = matrix_row(activations, i);
+        const MatrixValue *y = matrix_row(targets, i);
+        if (loss == LOSS_CROSS_ENTROPY) {
+            //only the classes a sample belongs to contribute, one per column for one-hot targets
+            for (int j = 0; j < activations->cols; j++) {
+                if (y[j] != 0) {
+                    sum -= y[j] * value_log(a[j] > SMALLEST_PROBABILITY ? a[j] : SMALLEST_PROBABILITY);
+                }
+            }
+        } else {
+            for (int j = 0; j < activations->cols; j++) {
+                MatrixValue error = a[j] - y[j];
+                sum += error * error;
+            }
+        }
+    }
+    return (double) sum;
+}
+
+void layer_forward(LayerActivation activation, Matrix *weights, Matrix *input, int input_rows, Matrix *biases,
+                   Matrix *weighted_sums, Matrix *activations) {
+    const MatrixValue *sample = single_sample(input, input_rows);
+    if (sample != NULL && weighted_sums->cols == 1) {
+        //one dot product per output, bias and activation applied before moving on
+        for (int i = 0; i < weights->rows; i++) {
+            MatrixValue z = matrix_dot(weights->cols, matrix_row(weights, i), sample) + MATRIX_AT(biases, i, 0);
+            MATRIX_AT(weighted_sums, i, 0) = z;
+            if (activation == LAYER_ACTIVATION_LEAKY_RELU) {
+                MATRIX_AT(activations, i, 0) = leaky_relu(z);
+            }
+        }
+    } else {
+        //start every column from the bias so the product adds onto it
+        for (int i = 0; i < weighted_sums->rows; i++) {
+            MatrixValue *z = matrix_row(weighted_sums, i);
+            MatrixValue bias = MATRIX_AT(biases, i, 0);
+            for (int j = 0; j < weighted_sums->cols; j++) {
+                z[j] = bias;
+            }
+        }
+        matrix_gemm(weights, 0, input, input_rows, 1, 1, weighted_sums);
+        if (activation == LAYER_ACTIVATION_LEAKY_RELU) {
+            for (int i = 0; i < weighted_sums->rows; i++) {
+                const MatrixValue *z = matrix_row(weighted_sums, i);
+                MatrixValue *a = matrix_row(activations, i);
+                for (int j = 0; j < weighted_sums->cols; j++) {
+                    a[j] = leaky_relu(z[j]);
+                }
+            }
+        }
+    }
+    if (activation == LAYER_ACTIVATION_SOFTMAX) {
+        layer_softmax(weighted_sums, activations);
+    }
+}
+
+// adds the gradient of output i of a single sample, dW_i += delta * x and db_i += delta
+static inline void add_single_gradient(MatrixValue delta, const MatrixValue *sample, int inputs,
+                                       MatrixValue *delta_weights_row, MatrixValue *delta_bias) {
+    for (int k = 0; k < inputs; k++) {
+        delta_weights_row[k] += delta * sample[k];
+    }
+    *delta_bias += delta;
+}
+
+// dW += D * A_in^T for a batch, the row sums of D were added while D was written
+static void accumulate_batch(Matrix *deltas, Matrix *input, int input_rows, Matrix *delta_weights) {
+    //rows of samples already are A^T
+    matrix_gemm(deltas, 0, input, !input_rows, 1, 1, delta_weights);
+}
+
+// deltas of the output layer for every column: A - Y for softmax with cross entropy, for the squared
+// error the softmax Jacobian applied to its derivative, d_i = a_i (e_i - sum_k a_k e_k) with e = 2 (a - y)
+static void output_deltas(LossFunction loss, Matrix *activations, Matrix *targets, Matrix *deltas) {
+    if (loss == LOSS_CROSS_ENTROPY) {
+        for (int i = 0; i < deltas->rows; i++) {
+            const MatrixValue *a = matrix_row(activations, i);
+            const MatrixValue *y = matrix_row(targets, i);
+            MatrixValue *d = matrix_row(deltas, i);
+            for (int j = 0; j < deltas->cols; j++) {
+                d[j] = a[j] - y[j];
+            }
+        }
+        return;
+    }
+    //blocks of columns like layer_softmax, the sums over the classes run down the rows
+    MatrixAccumulator dots[SOFTMAX_BLOCK];
+    for (int first = 0; first < deltas->cols; first += SOFTMAX_BLOCK) {
+        int count = deltas->cols - first < SOFTMAX_BLOCK ? deltas->cols - first : SOFTMAX_BLOCK;
+        for (int j = 0; j < count; j++) {
+            dots[j] = 0;
+        }
+        for (int i = 0; i < deltas->rows; i++) {
+            const MatrixValue *a = matrix_row(activations, i) + first;
+            const MatrixValue *y = matrix_row(targets, i) + first;
+            MatrixValue *d = matrix_row(deltas, i) + first;
+            for (int j = 0; j < count; j++) {
+                d[j] = 2 * (a[j] - y[j]);
+                dots[j] += a[j] * d[j];
+            }
+        }
+        for (int i = 0; i < deltas->rows; i++) {
+            const MatrixValue *a = matrix_row(activations, i) + first;
+            MatrixValue *d = matrix_row(deltas, i) + first;
+            for (int j = 0; j < count; j++) {
+                d[j] = a[j] * (d[j] - (MatrixValue) dots[j]);
+            }
+        }
+    }
+}
+
+void layer_backward_output(LossFunction loss, Matrix *activations, Matrix *targets, Matrix *input, int input_rows,
+                           Matrix *deltas, Matrix *delta_weights, Matrix *delta_biases) {
+    output_deltas(loss, activations, targets, deltas);
+    const MatrixValue *sample = single_sample(input, input_rows);
+    if (sample != NULL && deltas->cols == 1) {
+        for (int i = 0; i < deltas->rows; i++) {
+            add_single_gradient(MATRIX_AT(deltas, i, 0), sample, delta_weights->cols, matrix_row(delta_weights, i),
+                                &MATRIX_AT(delta_biases, i, 0));
+        }
+        return;
+    }
+    for (int i = 0; i < deltas->rows; i++) {
+        const MatrixValue *d = matrix_row(deltas, i);
+        MatrixAccumulator sum = 0;
+        for (int j = 0; j < deltas->cols; j++) {
+            sum += d[j];
+        }
+        MATRIX_AT(delta_biases, i, 0) += sum;
+    }
+    accumulate_batch(deltas, input, input_rows, delta_weights);
+}
+
+void layer_backward_hidden(LayerActivation activation, Matrix *next_weights, Matrix *next_deltas,
+                           Matrix *weighted_sums, Matrix *input, int input_rows, Matrix *deltas,
+                           Matrix *delta_weights, Matrix *delta_biases) {
+    const MatrixValue *sample = single_sample(input, input_rows);
+    if (sample != NULL && deltas->cols == 1) {
+        //W_next^T * D_next summed over the contiguous rows of W_next
+        for (int i = 0; i < deltas->rows; i++) {
+            MATRIX_AT(deltas, i, 0) = 0;
+        }
+        for (int j = 0; j < next_weights->rows; j++) {
+            const MatrixValue *next_weights_row = matrix_row(next_weights, j);
+            MatrixValue next_delta = MATRIX_AT(next_deltas, j, 0);
+            for (int i = 0; i < deltas->rows; i++) {
+                MATRIX_AT(deltas, i, 0) += next_weights_row[i] * next_delta;
+            }
+        }
+        for (int i = 0; i < deltas->rows; i++) {
+            MatrixValue z = MATRIX_AT(weighted_sums, i, 0);
+            MatrixValue delta = MATRIX_AT(deltas, i, 0) * activation_derivative(activation, z);
+            MATRIX_AT(deltas, i, 0) = delta;
+            add_single_gradient(delta, sample, delta_weights->cols, matrix_row(delta_weights, i),
+                                &MATRIX_AT(delta_biases, i, 0));
+        }
+        return;
+    }
+    matrix_gemm(next_weights, 1, next_deltas, 0, 1, 0, deltas);
+    for (int i = 0; i < deltas->rows; i++) {
+        const MatrixValue *z = matrix_row(weighted_sums, i);
+        MatrixValue *d = matrix_row(deltas, i);
+        MatrixAccumulator sum = 0;
+        for (int j = 0; j < deltas->cols; j++) {
+            d[j] *= activation_derivative(activation, z[j]);
+            sum += d[j];
+        }
+        MATRIX_AT(delta_biases, i, 0) += sum;
+    }
+    accumulate_batch(deltas, input, input_rows, delta_weights);
+}
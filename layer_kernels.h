@@ -0,0 +1,54 @@
+//
+// Fused per-layer kernels. The forward kernel adds the bias and applies the activation while the
+// weighted sums are written, the backward kernels apply the activation derivative and add the
+// layer's weight and bias gradients in the same sweep over the deltas.
+//
+
+#ifndef SEM2LAB2_LAYER_KERNELS_H
+#define SEM2LAB2_LAYER_KERNELS_H
+
+#include "matrix_utils.h"
+
+// activation of a layer, picks the kernels used for it
+enum LayerActivation {
+    //the input layer only holds values
+    LAYER_ACTIVATION_NONE,
+    //Leaky ReLU with ReLU_A/ReLU_B
+    LAYER_ACTIVATION_LEAKY_RELU,
+    //softmax over every column
+    LAYER_ACTIVATION_SOFTMAX
+} typedef LayerActivation;
+
+// loss of the output layer, picks the output deltas
+enum LossFunction {
+    //sum of (a_i - y_i)^2, the deltas are e = 2 * (a - y) through the softmax Jacobian, a_i * (e_i - sum_k a_k * e_k)
+    LOSS_MEAN_SQUARED_ERROR,
+    //-sum of y_i * log(a_i) of the softmax outputs, whose exact gradient with respect to Z is a_i - y_i
+    LOSS_CROSS_ENTROPY
+} typedef LossFunction;
+
+// Z = W * op(A) + b and activations = f(Z), one sample per column of Z
+// input_rows set means input holds one sample per row and is used transposed
+// single samples take one pass of dot products that writes every output once
+void layer_forward(LayerActivation activation, Matrix *weights, Matrix *input, int input_rows, Matrix *biases,
+                   Matrix *weighted_sums, Matrix *activations);
+
+// softmax of every column of weighted_sums, the largest value of each column is subtracted before exp
+// result may be weighted_sums itself
+void layer_softmax(Matrix *weighted_sums, Matrix *activations);
+
+// loss of every column of activations against targets, summed over the columns
+double layer_loss(LossFunction loss, Matrix *activations, Matrix *targets);
+
+// deltas of the output layer, D = A - Y for softmax with cross entropy and for squared error
+// E = 2 * (A - Y) passed through the softmax, D = A .* (E - column sums of A .* E)
+// added to the gradients dW += D * A_in^T and db += row sums of D
+void layer_backward_output(LossFunction loss, Matrix *activations, Matrix *targets, Matrix *input, int input_rows,
+                           Matrix *deltas, Matrix *delta_weights, Matrix *delta_biases);
+
+// deltas of a hidden layer, D = (W_next^T * D_next) .* f'(Z), added to the gradients like layer_backward_output
+void layer_backward_hidden(LayerActivation activation, Matrix *next_weights, Matrix *next_deltas,
+                           Matrix *weighted_sums, Matrix *input, int input_rows, Matrix *deltas,
+                           Matrix *delta_weights, Matrix *delta_biases);
+
+#endif //SEM2LAB2_LAYER_KERNELS_H
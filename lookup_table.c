@@ -0,0 +1,260 @@
+//
+// Baking, saving and mapping Lab lookup tables.
+//
+
+#include "lookup_table.h"
+#include "model_io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// grid points classified per forward pass while baking
+#define BAKE_BATCH_SIZE 4096
+
+static size_t aligned_size(size_t size) {
+    return (size + LOOKUP_TABLE_ALIGNMENT - 1) / LOOKUP_TABLE_ALIGNMENT * LOOKUP_TABLE_ALIGNMENT;
+}
+
+static uint64_t number_of_points(const LookupTableHeader *header) {
+    return (uint64_t) header->resolution[0] * header->resolution[1] * header->resolution[2];
+}
+
+// the table around an image whose header was checked
+static LookupTable *table_from_image(unsigned char *image, size_t image_size, int mapped) {
+    LookupTable *table = malloc(sizeof(LookupTable));
+    const LookupTableHeader *header = (const LookupTableHeader *) image;
+    table->header = header;
+    table->number_of_classes = (int) header->number_of_classes;
+    for (int d = 0; d < 3; d++) {
+        table->resolution[d] = (int) header->resolution[d];
+        table->minimum[d] = header->minimum[d];
+        table->scale[d] = (header->resolution[d] - 1) / (header->maximum[d] - header->minimum[d]);
+    }
+    table->classes = image + header->classes_offset;
+    table->probabilities = header->has_probabilities ? (const uint16_t *) (image + header->probabilities_offset)
+                                                     : NULL;
+    table->image = image;
+    table->image_size = image_size;
+    table->mapped = mapped;
+    return table;
+}
+
+LookupTable *bake_lookup_table(const InferenceModel *model, const int resolution[3], const double minimum[3],
+                               const double maximum[3], int with_probabilities) {
+    int number_of_classes = model->layer_sizes[model->number_of_layers - 1];
+    if (model->layer_sizes[0] != 3 || number_of_classes > LOOKUP_TABLE_MAX_CLASSES) {
+        printf("Error: A lookup table needs a model with 3 inputs and at most %d classes!\n",
+               LOOKUP_TABLE_MAX_CLASSES);
+        return NULL;
+    }
+    for (int d = 0; d < 3; d++) {
+        if (resolution[d] < 2 || resolution[d] > LOOKUP_TABLE_MAX_RESOLUTION || !(maximum[d] > minimum[d])) {
+            printf("Error: Every axis needs 2 to %d grid points and a maximum above its minimum!\n",
+                   LOOKUP_TABLE_MAX_RESOLUTION);
+            return NULL;
+        }
+    }
+
+    LookupTableHeader header;
+    memset(&header, 0, sizeof(LookupTableHeader));
+    memcpy(header.magic, LOOKUP_TABLE_MAGIC, 4);
+    header.version = LOOKUP_TABLE_VERSION;
+    header.number_of_classes = (uint32_t) number_of_classes;
+    header.has_probabilities = with_probabilities != 0;
+    for (int d = 0; d < 3; d++) {
+        header.resolution[d] = (uint32_t) resolution[d];
+        header.minimum[d] = minimum[d];
+        header.maximum[d] = maximum[d];
+    }
+    size_t points = (size_t) number_of_points(&header);
+    header.classes_offset = aligned_size(sizeof(LookupTableHeader));
+    header.probabilities_offset = aligned_size(header.classes_offset + points);
+    header.file_size = header.has_probabilities
+                       ? header.probabilities_offset + points * number_of_classes * sizeof(uint16_t)
+                       : header.classes_offset + points;
+    unsigned char *image = aligned_calloc(header.file_size);
+    uint8_t *classes = image + header.classes_offset;
+    uint16_t *probabilities = (uint16_t *) (image + header.probabilities_offset);
+
+    //the grid points in index order, one batch after another
+    double step[3];
+    for (int d = 0; d < 3; d++) {
+        step[d] = (maximum[d] - minimum[d]) / (resolution[d] - 1);
+    }
+    InferenceScratch *scratch = create_inference_scratch(model, BAKE_BATCH_SIZE);
+    MatrixValue *inputs = malloc(sizeof(MatrixValue) * BAKE_BATCH_SIZE * 3);
+    MatrixValue *outputs = malloc(sizeof(MatrixValue) * BAKE_BATCH_SIZE * number_of_classes);
+    for (size_t first = 0; first < points; first += BAKE_BATCH_SIZE) {
+        int count = points - first < BAKE_BATCH_SIZE ? (int) (points - first) : BAKE_BATCH_SIZE;
+        for (int s = 0; s < count; s++) {
+            size_t point = first + s;
+            int k = (int) (point % resolution[2]);
+            int j = (int) (point / resolution[2] % resolution[1]);
+            int i = (int) (point / resolution[2] / resolution[1]);
+            inputs[s * 3] = (MatrixValue) (minimum[0] + i * step[0]);
+            inputs[s * 3 + 1] = (MatrixValue) (minimum[1] + j * step[1]);
+            inputs[s * 3 + 2] = (MatrixValue) (minimum[2] + k * step[2]);
+        }
+        infer_batch(model, scratch, inputs, count, outputs);
+        for (int s = 0; s < count; s++) {
+            const MatrixValue *output = outputs + (size_t) s * number_of_classes;
+            int best = 0;
+            for (int c = 0; c < number_of_classes; c++) {
+                if (output[c] > output[best]) {
+                    best = c;
+                }
+                if (header.has_probabilities) {
+                    double probability = output[c] < 0 ? 0 : (output[c] > 1 ? 1 : output[c]);
+                    probabilities[(first + s) * number_of_classes + c] =
+                            (uint16_t) (probability * LOOKUP_TABLE_PROBABILITY_SCALE + 0.5);
+                }
+            }
+            classes[first + s] = (uint8_t) best;
+        }
+    }
+    free(inputs);
+    free(outputs);
+    free_inference_scratch(scratch);
+
+    header.checksum = model_crc32(0, image + sizeof(LookupTableHeader),
+                                  header.file_size - sizeof(LookupTableHeader));
+    memcpy(image, &header, sizeof(LookupTableHeader));
+    return table_from_image(image, header.file_size, 0);
+}
+
+int save_lookup_table(LookupTable *table, char *file_name) {
+    FILE *file = fopen(file_name, "wb");
+    if (file == NULL) {
+        printf("Error: Could not create file!\n");
+        return 1;
+    }
+    int failed = fwrite(table->image, 1, table->image_size, file) != table->image_size;
+    failed |= fclose(file) != 0;
+    if (failed) {
+        printf("Error: Could not write %s!\n", file_name);
+    }
+    return failed;
+}
+
+static int valid_lookup_table(const unsigned char *image, size_t size, int verify_checksum) {
+    const LookupTableHeader *header = (const LookupTableHeader *) image;
+    if (size < sizeof(LookupTableHeader) || memcmp(header->magic, LOOKUP_TABLE_MAGIC, 4) != 0) {
+        printf("Error: Not a lookup table file!\n");
+        return 0;
+    }
+    if (header->version != LOOKUP_TABLE_VERSION || header->number_of_classes < 1 ||
+        header->number_of_classes > LOOKUP_TABLE_MAX_CLASSES) {
+        printf("Error: Unsupported lookup table version or classes!\n");
+        return 0;
+    }
+    for (int d = 0; d < 3; d++) {
+        if (header->resolution[d] < 2 || header->resolution[d] > LOOKUP_TABLE_MAX_RESOLUTION ||
+            !(header->maximum[d] > header->minimum[d])) {
+            printf("Error: Malformed lookup table grid!\n");
+            return 0;
+        }
+    }
+    //every bound is checked by subtraction from the size so that crafted offsets cannot wrap around
+    //points times classes times 2 stays below 2^58 with the resolutions and classes checked above
+    uint64_t points = number_of_points(header);
+    uint64_t file_size = size;
+    int fits = header->file_size == file_size && header->classes_offset >= sizeof(LookupTableHeader) &&
+               header->classes_offset <= file_size && points <= file_size - header->classes_offset;
+    if (fits && header->has_probabilities) {
+        fits = header->probabilities_offset <= file_size && header->probabilities_offset >= header->classes_offset &&
+               header->probabilities_offset - header->classes_offset >= points &&
+               header->probabilities_offset % sizeof(uint16_t) == 0 &&
+               points * header->number_of_classes * sizeof(uint16_t) <= file_size - header->probabilities_offset;
+    }
+    if (!fits) {
+        printf("Error: Lookup table file is truncated!\n");
+        return 0;
+    }
+    if (verify_checksum && model_crc32(0, image + sizeof(LookupTableHeader), size - sizeof(LookupTableHeader)) !=
+                           header->checksum) {
+        printf("Error: Lookup table checksum mismatch!\n");
+        return 0;
+    }
+    //lookups return the stored classes unchecked, so they are checked here with or without the checksum
+    const uint8_t *classes = image + header->classes_offset;
+    for (uint64_t p = 0; p < points; p++) {
+        if (classes[p] >= header->number_of_classes) {
+            printf("Error: Lookup table class out of range!\n");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+LookupTable *open_lookup_table(char *file_name, int verify_checksum) {
+    size_t size;
+    unsigned char *image = map_model(file_name, &size);
+    if (image == NULL) {
+        printf("Error: Could not open %s!\n", file_name);
+        return NULL;
+    }
+    if (!valid_lookup_table(image, size, verify_checksum)) {
+        unmap_model(image, size);
+        return NULL;
+    }
+    return table_from_image(image, size, 1);
+}
+
+void free_lookup_table(LookupTable *table) {
+    if (table->mapped) {
+        unmap_model(table->image, table->image_size);
+    } else {
+        aligned_free(table->image);
+    }
+    free(table);
+}
+
+int lookup_class_interpolated(const LookupTable *table, const double *input, double *probabilities) {
+    int number_of_classes = table->number_of_classes;
+    if (table->probabilities == NULL) {
+        int best = lookup_class(table, input);
+        if (probabilities != NULL) {
+            for (int c = 0; c < number_of_classes; c++) {
+                probabilities[c] = c == best;
+            }
+        }
+        return best;
+    }
+    //lower corner of the cell around the input and the position inside it
+    int corner[3];
+    double fraction[3];
+    for (int d = 0; d < 3; d++) {
+        double coordinate = lookup_coordinate(table, d, input[d]);
+        corner[d] = (int) coordinate;
+        if (corner[d] > table->resolution[d] - 2) {
+            corner[d] = table->resolution[d] - 2;
+        }
+        fraction[d] = coordinate - corner[d];
+    }
+    double sums[LOOKUP_TABLE_MAX_CLASSES];
+    for (int c = 0; c < number_of_classes; c++) {
+        sums[c] = 0;
+    }
+    for (int n = 0; n < 8; n++) {
+        int i = corner[0] + (n >> 2 & 1);
+        int j = corner[1] + (n >> 1 & 1);
+        int k = corner[2] + (n & 1);
+        double weight = (n >> 2 & 1 ? fraction[0] : 1 - fraction[0]) * (n >> 1 & 1 ? fraction[1] : 1 - fraction[1]) *
+                        (n & 1 ? fraction[2] : 1 - fraction[2]);
+        size_t index = ((size_t) i * table->resolution[1] + j) * table->resolution[2] + k;
+        const uint16_t *point = table->probabilities + index * number_of_classes;
+        for (int c = 0; c < number_of_classes; c++) {
+            sums[c] += weight * point[c];
+        }
+    }
+    int best = 0;
+    for (int c = 0; c < number_of_classes; c++) {
+        if (sums[c] > sums[best]) {
+            best = c;
+        }
+        if (probabilities != NULL) {
+            probabilities[c] = sums[c] / LOOKUP_TABLE_PROBABILITY_SCALE;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,97 @@
+//
+// Lookup table baked from a network with three bounded inputs, such as the Lab colour model
+// (L / 100 in [0, 1], a / 128 and b / 128 in [-1, 1]). The class of every point of a regular
+// 3D grid is precomputed, so classifying an input is one rounding and one memory access.
+// Tables may also keep every point's probabilities to interpolate them trilinearly between
+// the grid points. The file is the in-memory image of the table and is used mapped.
+//
+
+#ifndef SEM2LAB2_LOOKUP_TABLE_H
+#define SEM2LAB2_LOOKUP_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "inference.h"
+
+#define LOOKUP_TABLE_MAGIC "NNLT"
+#define LOOKUP_TABLE_VERSION 1
+#define LOOKUP_TABLE_ALIGNMENT 64
+// grid points along one axis, keeps the number of points and the file size far from overflowing
+#define LOOKUP_TABLE_MAX_RESOLUTION 65535
+// classes are stored as one byte per grid point
+#define LOOKUP_TABLE_MAX_CLASSES 256
+// probabilities are stored as fractions of this
+#define LOOKUP_TABLE_PROBABILITY_SCALE 65535
+
+// on-disk header, little endian, 128 bytes long
+// grid point (i, j, k) is at minimum + (i, j, k) * (maximum - minimum) / (resolution - 1), index (i * r1 + j) * r2 + k
+struct LookupTableHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t number_of_classes;
+    //1 when probabilities_offset holds number_of_classes uint16 fractions per grid point
+    uint32_t has_probabilities;
+    uint32_t resolution[3];
+    uint32_t reserved0;
+    double minimum[3];
+    double maximum[3];
+    //one uint8 class per grid point
+    uint64_t classes_offset;
+    uint64_t probabilities_offset;
+    uint64_t file_size;
+    //CRC-32 of every byte after the header
+    uint64_t checksum;
+    uint8_t reserved[16];
+} typedef LookupTableHeader;
+
+struct LookupTable {
+    //points at the start of image
+    const LookupTableHeader *header;
+    int resolution[3];
+    int number_of_classes;
+    double minimum[3];
+    //grid steps per input unit
+    double scale[3];
+    const uint8_t *classes;
+    //NULL when the table has no probabilities
+    const uint16_t *probabilities;
+    //the file image, mapped by open_lookup_table or allocated by bake_lookup_table
+    unsigned char *image;
+    size_t image_size;
+    int mapped;
+} typedef LookupTable;
+
+// classify every grid point of the box [minimum, maximum] with resolution[d] points along input d
+// the model must have three inputs and at most LOOKUP_TABLE_MAX_CLASSES classes, returns NULL otherwise
+LookupTable *bake_lookup_table(const InferenceModel *model, const int resolution[3], const double minimum[3],
+                               const double maximum[3], int with_probabilities);
+
+// write the table image, returns 0 on success
+int save_lookup_table(LookupTable *table, char *file_name);
+
+// map a saved table, returns NULL when missing or malformed
+// the classes are always read once to check their range, verify_checksum also reads the probabilities
+LookupTable *open_lookup_table(char *file_name, int verify_checksum);
+
+void free_lookup_table(LookupTable *table);
+
+// grid coordinate of an input value along one axis, clamped to the grid, NaN maps to 0
+static inline double lookup_coordinate(const LookupTable *table, int axis, double value) {
+    double coordinate = (value - table->minimum[axis]) * table->scale[axis];
+    double last = table->resolution[axis] - 1;
+    return !(coordinate >= 0) ? 0 : (coordinate > last ? last : coordinate);
+}
+
+// class of the grid point nearest to input
+static inline int lookup_class(const LookupTable *table, const double *input) {
+    int i = (int) (lookup_coordinate(table, 0, input[0]) + 0.5);
+    int j = (int) (lookup_coordinate(table, 1, input[1]) + 0.5);
+    int k = (int) (lookup_coordinate(table, 2, input[2]) + 0.5);
+    return table->classes[((size_t) i * table->resolution[1] + j) * table->resolution[2] + k];
+}
+
+// class with the highest probability interpolated trilinearly from the eight surrounding grid points
+// probabilities, when not NULL, receives all of them, falls back to lookup_class without stored probabilities
+int lookup_class_interpolated(const LookupTable *table, const double *input, double *probabilities);
+
+#endif //SEM2LAB2_LOOKUP_TABLE_H
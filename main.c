@@ -1,508 +1,1028 @@
+//
+// Command line front end of the neural_network library: train a network on a data set and save
+// it, or classify samples with a saved one. Everything that used to be compiled in (topology,
+// file paths, sample counts, iterations, class names) is an argument.
+//
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
+#include <string.h>
 #include <time.h>
-#include "matrix_utils.h"
-#include "training.h"
-
-#define ReLU_A 0.1
-#define ReLU_B 1
+#include <unistd.h>
+#include <sys/wait.h>
+#include "neural_network.h"
 
-// ReLU activation function
-double ReLU(double x) {
-    if (x < 0) {
-        return x * ReLU_A;
-    }
-    return x * ReLU_B;
-};
+#define MAX_LAYERS 64
+#define MAX_LABEL_LENGTH 64
+#define DEFAULT_PORT 29500
+#define MAX_LEARNING_RATES 64
 
-double ReLU_derivative(double x) {
-    if (x >= 0) {
-        return ReLU_B;
-    } else {
-        return ReLU_A;
-    }
+static void print_usage(char *program) {
+    printf("usage: %s train --data <file> --topology <sizes> [options]\n"
+           "       %s sweep --data <file> --topology <sizes> [options]\n"
+           "       %s predict --model <file> [options]\n"
+           "       %s serve --model <file> [options]\n"
+           "\n"
+           "train:\n"
+           "  --data FILE            text lines of \"values... class_index\" or a binary data set\n"
+           "  --topology A,B,...     layer sizes from the inputs to the classes, e.g. 3,10,16,20,16\n"
+           "  --init FILE            continue training a saved model instead of a new --topology\n"
+           "  --model FILE           where the trained model goes, binary when it ends in .bin (network.txt)\n"
+           "  --test-data FILE       progress is measured on this data set instead of the training data\n"
+           "  --samples N            text samples to read, every line by default\n"
+           "  --max-input X          text values are divided by X (1)\n"
+           "  --stream               read the data in the background instead of loading all of it\n"
+           "  --asynchronous         threads update the weights without waiting for each other (sgd only)\n"
+           "  --update-size N        samples per update of one thread with --asynchronous (16)\n"
+           "  --iterations N         training steps (10000)\n"
+           "  --batch-size N         samples per step (1000)\n"
+           "  --threads N            threads per step (all processors)\n"
+           "  --learning-rate X      (0.1)\n"
+           "  --optimizer NAME       sgd, momentum, nesterov, adam or adamw (sgd)\n"
+           "  --loss NAME            mse or cross-entropy (cross-entropy)\n"
+           "  --max-gradient-norm X  clip the gradient to this norm, 0 never clips (0)\n"
+           "  --evaluate-every N     iterations between progress reports (100)\n"
+           "  --seed N               seed of the weights and the sampler (the time)\n"
+           "  --profile FILE         CSV of the time spent in every phase\n"
+           "  --processes N          train in N processes on this host, each on its own shard of the data\n"
+           "  --world-size N         train in N processes started separately, each on its own shard\n"
+           "  --rank R               which of the --world-size processes this is, 0 saves the model\n"
+           "  --transport NAME       shm or tcp, how the processes sum their gradients (shm)\n"
+           "  --rendezvous NAME      shared memory name of the processes, the same for all of them\n"
+           "  --host HOST            address the processes listen on with tcp (127.0.0.1)\n"
+           "  --port N               process R listens on port N + R with tcp (29500)\n"
+           "\n"
+           "sweep, train networks of one topology side by side and save the best:\n"
+           "  --seeds N              members per learning rate, seeded --seed, --seed + 1, ... (8)\n"
+           "  --learning-rates X,... learning rate of each group of members (0.1)\n"
+           "  --data, --topology, --model, --test-data, --samples, --max-input, --iterations, --batch-size,\n"
+           "  --threads, --loss, --evaluate-every and --seed as for train\n"
+           "\n"
+           "predict:\n"
+           "  --model FILE           text or binary model\n"
+           "  --input FILE           one sample per line, standard input by default\n"
+           "  --output FILE          class and probabilities per line, standard output by default\n"
+           "  --labels FILE          class names, one per line, printed instead of the class index\n"
+           "  --batch-size N         samples per pass (256, 1 on standard input)\n"
+           "  --threads N            threads per pass (1)\n"
+           "\n"
+           "serve, answer requests on a Unix domain socket, see inference_server.h:\n"
+           "  --model FILE           text or binary model\n"
+           "  --socket PATH          where to listen (sem2lab2.sock)\n"
+           "  --max-batch N          requests of one forward pass (64)\n"
+           "  --latency-us N         longest a request waits for others to join its batch (200)\n"
+           "  --max-clients N        connections served at the same time (256)\n", program, program, program,
+           program);
 }
 
-#define ACTIVATION_FUNCTION ReLU
-#define ACTIVATION_FUNCTION_DERIVATIVE ReLU_derivative
-
-//normalized softmax function for the output layer
-void *softmax(Matrix *matrix, Matrix *result) {
-
-    //calculate sum for normalization
-    double sum = 0;
-    for (int i = 0; i < matrix->rows; i++) {
-        sum += exp(matrix->values[i][0]);
-    }
-
-    //calculate softmax
-    for (int i = 0; i < matrix->rows; i++) {
-        result->values[i][0] = exp(matrix->values[i][0]) / sum;
+// the value after option argv[*i], NULL after printing an error when it is missing
+static char *option_value(int argc, char **argv, int *i) {
+    if (*i + 1 >= argc) {
+        printf("Error: %s needs a value!\n", argv[*i]);
+        return NULL;
     }
+    (*i)++;
+    return argv[*i];
 }
 
-struct Layer {
-    int input_size;
-    int layer_size;
-    int output_size;
-    Matrix *input;
-    Matrix *weights;
-    Matrix *delta_weights;
-    Matrix *biases;
-    Matrix *delta_biases;
-    Matrix *weighted_sums;
-    Matrix *activations;
-    Matrix *deltas; //error of the layer
-} typedef Layer;
-
-// define network struct
-struct network {
-    Layer **layers;
-    int number_of_layers;
-} typedef Network;
-
-// create network
-Network *create_network(int number_of_layers, int *layer_sizes) {
-    // allocate memory for network
-    Network *network = malloc(sizeof(Network));
-
-    network->number_of_layers = number_of_layers;
-    // allocate memory for layers
-    network->layers = malloc(number_of_layers * sizeof(Layer *));
-    // create layers
-    for (int i = 0; i < number_of_layers; i++) {
-        network->layers[i] = malloc(sizeof(Layer));
-        network->layers[i]->layer_size = layer_sizes[i];
-        if (i == 0) {//input layer
-            network->layers[i]->input_size = 0;
-            network->layers[i]->input = create_matrix(0, 0);
-        } else {
-            network->layers[i]->input_size = layer_sizes[i - 1];
-            network->layers[i]->input = network->layers[i - 1]->activations;
+// parse "3,10,16" into layer_sizes, returns the number of layers or 0 when malformed
+static int parse_topology(char *text, int *layer_sizes) {
+    int number_of_layers = 0;
+    char *end = text;
+    while (*end != '\0') {
+        long size = strtol(text, &end, 10);
+        if (end == text || size <= 0 || number_of_layers == MAX_LAYERS || (*end != ',' && *end != '\0')) {
+            return 0;
         }
-        if (i == number_of_layers - 1) {//output layer
-            network->layers[i]->output_size = 0;
-        } else { //hidden layers
-            network->layers[i]->output_size = layer_sizes[i + 1];
-        }
-
-        network->layers[i]->weights = create_matrix(network->layers[i]->layer_size, network->layers[i]->input_size);
-        network->layers[i]->delta_weights = create_matrix(network->layers[i]->layer_size,
-                                                          network->layers[i]->input_size);
-        network->layers[i]->weighted_sums = create_matrix(network->layers[i]->layer_size, 1);
-        network->layers[i]->activations = create_matrix(network->layers[i]->layer_size, 1);
-        network->layers[i]->deltas = create_matrix(network->layers[i]->layer_size, 1);
-
-        //randomize weights
-        randomize_matrix(network->layers[i]->weights);
-
-        //initialize bias
-        network->layers[i]->biases = create_matrix(network->layers[i]->layer_size, 1);
-        network->layers[i]->delta_biases = create_matrix(network->layers[i]->layer_size, 1);
-//        randomize_matrix(network->layers[i]->biases);
-        fill_matrix(network->layers[i]->biases, 0.0);
+        layer_sizes[number_of_layers++] = (int) size;
+        text = *end == ',' ? end + 1 : end;
     }
-    return network;
+    return number_of_layers >= 2 ? number_of_layers : 0;
 }
 
-void free_network(Network *network) {
-    for (int i = 0; i < network->number_of_layers; i++) {
-        free_matrix(network->layers[i]->weights);
-        free_matrix(network->layers[i]->delta_weights);
-        free_matrix(network->layers[i]->biases);
-        free_matrix(network->layers[i]->delta_biases);
-        free_matrix(network->layers[i]->weighted_sums);
-        free_matrix(network->layers[i]->activations);
-        free_matrix(network->layers[i]->deltas);
-        free(network->layers[i]);
-    }
-    free(network->layers);
-    free(network);
+// parse "0.05,0.1" into values, returns how many there are or 0 when malformed
+static int parse_list(char *text, double *values, int capacity) {
+    int count = 0;
+    char *end = text;
+    while (*end != '\0') {
+        double value = strtod(text, &end);
+        if (end == text || value <= 0 || count == capacity || (*end != ',' && *end != '\0')) {
+            return 0;
+        }
+        values[count++] = value;
+        text = *end == ',' ? end + 1 : end;
+    }
+    return count;
 }
 
-// propagate forward through the network
-void propagate_forward(Network *network, Matrix *input) {
-    //assign input to the activations of the input layer
-    copy_matrix(input, network->layers[0]->activations);
-
-    //calculate weighted sums and activations for hidden layers and output layer (exclude input layer i=1)
-    for (int i = 1; i < network->number_of_layers - 1; i++) {
-        //calculate weighted sums for hidden layers
-        matrix_multiply(network->layers[i]->weights, network->layers[i]->input, network->layers[i]->weighted_sums);
-        //add bias
-        add_matrices(network->layers[i]->weighted_sums, network->layers[i]->biases,
-                     network->layers[i]->weighted_sums);
-
-        //calculate activations
-        matrix_apply_function(network->layers[i]->weighted_sums, ACTIVATION_FUNCTION, network->layers[i]->activations);
-        //set activations as input for next layer
-        network->layers[i + 1]->input = network->layers[i]->activations;
-    }
-    //calculate output layer weighted sums
-    matrix_multiply(network->layers[network->number_of_layers - 1]->weights,
-                    network->layers[network->number_of_layers - 1]->input,
-                    network->layers[network->number_of_layers - 1]->weighted_sums);
-    //add bias
-    add_matrices(network->layers[network->number_of_layers - 1]->weighted_sums,
-                 network->layers[network->number_of_layers - 1]->biases,
-                 network->layers[network->number_of_layers - 1]->weighted_sums);
-    //apply softmax
-    softmax(network->layers[network->number_of_layers - 1]->weighted_sums,
-            network->layers[network->number_of_layers - 1]->activations);
+static int parse_optimizer(char *name, OptimizerType *type) {
+    const char *names[] = {"sgd", "momentum", "nesterov", "adam", "adamw"};
+    OptimizerType types[] = {OPTIMIZER_SGD, OPTIMIZER_MOMENTUM, OPTIMIZER_NESTEROV, OPTIMIZER_ADAM,
+                             OPTIMIZER_ADAMW};
+    for (int i = 0; i < 5; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *type = types[i];
+            return 1;
+        }
+    }
+    return 0;
 }
 
-// print the entire structure of the network
-void print_network(Network *network) {
-    for (int i = 0; i < network->number_of_layers; i++) {
-        printf("Layer %d\n", i);
-        printf("Input size: %d\n", network->layers[i]->input_size);
-        printf("Layer size: %d\n", network->layers[i]->layer_size);
-        printf("Output size: %d\n", network->layers[i]->output_size);
-        printf("Input:\n");
-        print_matrix(network->layers[i]->input);
-        printf("Weights:\n");
-        print_matrix(network->layers[i]->weights);
-        printf("Weighted sums:\n");
-        print_matrix(network->layers[i]->weighted_sums);
-        printf("Activations:\n");
-        print_matrix(network->layers[i]->activations);
-        printf("\n");
+static int is_binary_dataset(char *file_name) {
+    char magic[4] = {0};
+    FILE *file = fopen(file_name, "rb");
+    if (file == NULL) {
+        return 0;
     }
+    size_t read = fread(magic, 1, 4, file);
+    fclose(file);
+    return read == 4 && memcmp(magic, DATASET_MAGIC, 4) == 0;
 }
 
-double calculate_loss(Matrix *output_layer, Matrix *target) {
-    double loss = 0;
-    for (int i = 0; i < output_layer->rows; i++) {
-        loss += pow(output_layer->values[i][0] - target->values[i][0], 2);
+// lines with at least one character, the sample count of a text data set
+static int count_lines(char *file_name) {
+    FILE *file = fopen(file_name, "r");
+    if (file == NULL) {
+        printf("Error: Could not open file!\n");
+        return -1;
+    }
+    int lines = 0;
+    int length = 0;
+    int c;
+    while ((c = fgetc(file)) != EOF) {
+        if (c == '\n') {
+            lines += length > 0;
+            length = 0;
+        } else if (c != '\r') {
+            length++;
+        }
     }
-    return loss;
+    lines += length > 0;
+    fclose(file);
+    return lines;
 }
 
-double calculate_average_loss(Network *network, TrainingDataPacket **training_data, int length_of_training_data) {
-    double loss = 0;
-    for (int j = 0; j < length_of_training_data; j++) {
-        //propagate forward
-        propagate_forward(network, training_data[j]->input);
-        //calculate loss
-        loss += calculate_loss(network->layers[network->number_of_layers - 1]->activations, training_data[j]->target);
+static void free_training_data(TrainingDataPacket **training_data, int length_of_training_data) {
+    for (int i = 0; i < length_of_training_data; i++) {
+        free_matrix(training_data[i]->input);
+        free_matrix(training_data[i]->target);
+        free(training_data[i]);
     }
-    //return average loss
-    return loss / length_of_training_data;
+    free(training_data);
 }
 
+// a text data set is read into packets, a binary one is mapped
+struct DataSource {
+    char *file_name;
+    Dataset *dataset;
+    SampleRows rows;
+    TrainingDataPacket **packets;
+    int length;
+    //rows of the text samples after source_rows
+    MatrixValue *features;
+    int32_t *labels;
+} typedef DataSource;
 
-// calculate average success rate of the network on the training values
-// by comparing the output to the target and counting the number of correct outputs
-double
-calculate_average_success_rate(Network *network, TrainingDataPacket **training_data, int length_of_training_data) {
-    double success_rate = 0;
-    for (int j = 0; j < length_of_training_data; j++) {
-        propagate_forward(network, training_data[j]->input);
-
-        //check if the output matches the target
-        if (vector_max_index(network->layers[network->number_of_layers - 1]->activations) ==
-            vector_max_index(training_data[j]->target)) {
-            success_rate++;
+// the shard-th of number_of_shards equal parts of the first samples of the file, all of them when samples is 0
+static int open_data_source(DataSource *source, char *file_name, int samples, int shard, int number_of_shards,
+                            int number_of_features, int number_of_classes, double max_value_of_input) {
+    memset(source, 0, sizeof(DataSource));
+    source->file_name = file_name;
+    if (is_binary_dataset(file_name)) {
+        source->dataset = open_dataset(file_name);
+        if (source->dataset == NULL) {
+            return 1;
         }
+        source->rows = dataset_rows(source->dataset);
+        if (samples > 0 && samples < source->rows.number_of_samples) {
+            source->rows.number_of_samples = samples;
+        }
+        int first = (int) ((long) source->rows.number_of_samples * shard / number_of_shards);
+        int last = (int) ((long) source->rows.number_of_samples * (shard + 1) / number_of_shards);
+        source->rows = dataset_slice(source->dataset, first, last - first);
+        if (source->rows.number_of_features != number_of_features ||
+            source->rows.number_of_classes > number_of_classes) {
+            printf("Error: %s has %d features and %d classes, the network %d inputs and %d outputs!\n", file_name,
+                   source->rows.number_of_features, source->rows.number_of_classes, number_of_features,
+                   number_of_classes);
+            return 1;
+        }
+        source->length = source->rows.number_of_samples;
+        return 0;
+    }
+    int length = samples > 0 ? samples : count_lines(file_name);
+    if (length < number_of_shards) {
+        printf("Error: Fewer samples than processes in %s!\n", file_name);
+        return 1;
     }
-    return success_rate / length_of_training_data;
+    source->packets = read_training_data_shard(file_name, length, shard, number_of_shards, number_of_features,
+                                               number_of_classes, max_value_of_input, &source->length);
+    return source->packets == NULL;
 }
 
-double output_node_cost_derivative(double output, double target) {
-    return 2 * (output - target);
+static void close_data_source(DataSource *source) {
+    if (source->dataset != NULL) {
+        close_dataset(source->dataset);
+    }
+    if (source->packets != NULL) {
+        free_training_data(source->packets, source->length);
+    }
+    free(source->features);
+    free(source->labels);
 }
 
-
-void calculate_deltas_for_layer(Network *network, int layer_index, Matrix *target) {
-    //calculate deltas for output layer
-    //for softmax the equation is delta_i = a_i - y_i
-    if (layer_index == network->number_of_layers - 1) {
-        //calculate deltas for each neuron in the output layer
-        for (int i = 0; i < network->layers[layer_index]->layer_size; i++) {
-            network->layers[layer_index]->deltas->values[i][0] = output_node_cost_derivative(
-                    network->layers[layer_index]->activations->values[i][0], target->values[i][0]);
-        }
-    } else {
-        //calculate deltas for each neuron in the hidden layer
-        //the equation is delta_i = sum(delta_j * w_ij) * ReLU'(z_i)
-        for (int i = 0; i < network->layers[layer_index]->layer_size; i++) {
-            double sum = 0;
-            //calculate the sum of the deltas of the neurons in the next layer multiplied by their weights
-            for (int j = 0; j < network->layers[layer_index + 1]->layer_size; j++) {
-                sum += network->layers[layer_index + 1]->weights->values[j][i] *
-                       network->layers[layer_index + 1]->deltas->values[j][0];
-            }
-            //multiply the sum by the derivative of the weighted sum of the current neuron
-            network->layers[layer_index]->deltas->values[i][0] = sum *
-                    ACTIVATION_FUNCTION_DERIVATIVE(
-                                                                         network->layers[layer_index]->weighted_sums->values[i][0]);
+// the samples as rows, text samples are copied into them once
+static SampleRows *source_rows(DataSource *source) {
+    if (source->dataset != NULL || source->features != NULL) {
+        return &source->rows;
+    }
+    int number_of_features = source->packets[0]->input->rows;
+    source->features = malloc((size_t) source->length * number_of_features * sizeof(MatrixValue));
+    source->labels = malloc(source->length * sizeof(int32_t));
+    for (int i = 0; i < source->length; i++) {
+        for (int j = 0; j < number_of_features; j++) {
+            source->features[(size_t) i * number_of_features + j] = MATRIX_AT(source->packets[i]->input, j, 0);
         }
+        source->labels[i] = vector_max_index(source->packets[i]->target);
     }
+    source->rows.number_of_samples = source->length;
+    source->rows.number_of_features = number_of_features;
+    source->rows.number_of_classes = source->packets[0]->target->rows;
+    source->rows.features = source->features;
+    source->rows.feature_stride = number_of_features;
+    source->rows.labels = source->labels;
+    source->rows.indices = NULL;
+    return &source->rows;
 }
 
-// add the delta weights for a layer for the current pass
-// the equation is delta_w_ij = delta_j * a_i
-void add_gradient_weights_for_layer(Network *network, int layer_index) {
-    for (int i = 0; i < network->layers[layer_index]->layer_size; i++) {
-        for (int j = 0; j < network->layers[layer_index]->input_size; j++) {
-            network->layers[layer_index]->delta_weights->values[i][j] +=
-                    network->layers[layer_index]->deltas->values[i][0] *
-                    network->layers[layer_index]->input->values[j][0];
+// fork the processes 1 to number_of_processes - 1, returns the rank of the calling process
+// the original process stays rank 0 and collects the others with wait_for_processes
+static int start_processes(int number_of_processes, pid_t *children) {
+    fflush(stdout);
+    for (int rank = 1; rank < number_of_processes; rank++) {
+        pid_t child = fork();
+        if (child == 0) {
+            return rank;
+        }
+        children[rank] = child;
+        if (child < 0) {
+            printf("Error: Could not start process %d!\n", rank);
         }
     }
+    return 0;
 }
 
-// add the delta biases for a layer for the current pass
-// the delta biases are the same as the deltas for the layer
-void add_gradient_biases_for_layer(Network *network, int layer_index) {
-    for (int i = 0; i < network->layers[layer_index]->layer_size; i++) {
-        network->layers[layer_index]->delta_biases->values[i][0] += network->layers[layer_index]->deltas->values[i][0];
+// returns 1 when one of the processes failed
+static int wait_for_processes(int number_of_processes, const pid_t *children) {
+    int failed = 0;
+    for (int rank = 1; rank < number_of_processes; rank++) {
+        int status;
+        if (children[rank] < 0 || waitpid(children[rank], &status, 0) < 0 || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0) {
+            failed = 1;
+        }
     }
+    return failed;
 }
 
-void average_gradient_weights_for_layer(Network *network, int layer_index, int length_of_training_data) {
-    for (int i = 0; i < network->layers[layer_index]->layer_size; i++) {
-        for (int j = 0; j < network->layers[layer_index]->input_size; j++) {
-            network->layers[layer_index]->delta_weights->values[i][j] /= length_of_training_data;
+// everything train was asked to do
+struct TrainSettings {
+    TrainingOptions options;
+    char *data_file;
+    char *test_file;
+    char *init_file;
+    char *model_file;
+    char *profile_file;
+    int layer_sizes[MAX_LAYERS];
+    int number_of_layers;
+    int samples;
+    double max_value_of_input;
+    int stream;
+    LossFunction loss;
+    //processes training together, on this host with --processes
+    int processes;
+    int world_size;
+    int rank;
+    char *transport;
+    char rendezvous[128];
+    char *host;
+    int port;
+} typedef TrainSettings;
+
+// one process of train, on the rank-th of world_size shards of the data
+static int train_process(TrainSettings *settings, int rank, int world_size) {
+    TrainingOptions options = settings->options;
+    Communicator *communicator = NULL;
+    if (world_size > 1) {
+        communicator = strcmp(settings->transport, "tcp") == 0
+                       ? create_tcp_communicator(settings->host, settings->port, rank, world_size)
+                       : create_shm_communicator(settings->rendezvous, rank, world_size);
+        if (communicator == NULL) {
+            return 1;
         }
+        options.communicator = communicator;
+        //each process samples its own shard, the seeds only have to differ
+        options.seed += rank;
     }
-}
 
-void average_gradient_biases_for_layer(Network *network, int layer_index, int length_of_training_data) {
-    for (int i = 0; i < network->layers[layer_index]->layer_size; i++) {
-        network->layers[layer_index]->delta_biases->values[i][0] /= length_of_training_data;
+    //the weights use rand() and the batch sampler its own generator
+    srand(options.seed);
+    Network *network = settings->init_file != NULL ? load_network_any(settings->init_file)
+                                                   : create_network(settings->number_of_layers, settings->layer_sizes);
+    if (network == NULL) {
+        free_communicator(communicator);
+        return 1;
     }
-}
+    network->loss = settings->loss;
+    //processes seeded at different times start from the weights of rank 0
+    if (communicator != NULL && broadcast_network(communicator, network) != 0) {
+        free_network(network);
+        free_communicator(communicator);
+        return 1;
+    }
+    int number_of_features = network->layers[0]->layer_size;
+    int number_of_classes = network->layers[network->number_of_layers - 1]->layer_size;
+    double max_value_of_input = settings->max_value_of_input;
 
-// move the weights in the direction of the -gradient in proportion to the learning rate
-void update_weights_for_layer(Network *network, int layer_index, double learning_rate) {
-    for (int i = 0; i < network->layers[layer_index]->layer_size; i++) {
-        for (int j = 0; j < network->layers[layer_index]->input_size; j++) {
-            network->layers[layer_index]->weights->values[i][j] -=
-                    learning_rate * network->layers[layer_index]->delta_weights->values[i][j];
+    int failed = 0;
+    DataSource test = {0};
+    if (settings->test_file != NULL) {
+        failed = open_data_source(&test, settings->test_file, 0, rank, world_size, number_of_features,
+                                  number_of_classes, max_value_of_input);
+        options.evaluation_data = test.packets;
+        options.length_of_evaluation_data = test.packets != NULL ? test.length : 0;
+        options.evaluation_rows = test.dataset != NULL ? &test.rows : NULL;
+    }
+    if (!failed && settings->profile_file != NULL && rank == 0) {
+        options.profiler = create_profiler(settings->profile_file, PROFILE_CSV, training_flops_per_sample(network));
+        failed = options.profiler == NULL;
+    }
+    if (!failed && settings->stream) {
+        if (options.asynchronous) {
+            printf("Error: --stream trains synchronously only!\n");
+            failed = 1;
+        } else if (settings->test_file != NULL && test.dataset == NULL) {
+            printf("Error: --stream measures progress on a binary --test-data only!\n");
+            failed = 1;
+        } else {
+            //a few batches ahead, shuffled within 16 batches, the file is read again at its end
+            StreamLoader *loader = open_stream_loader(settings->data_file, number_of_features, number_of_classes,
+                                                      max_value_of_input, options.split_size, 4,
+                                                      16 * options.split_size, 1, options.seed);
+            failed = loader == NULL;
+            if (!failed) {
+                train_stochastic_stream(network, loader, &options);
+                close_stream_loader(loader);
+            }
         }
+    } else if (!failed) {
+        DataSource training;
+        failed = open_data_source(&training, settings->data_file, settings->samples, rank, world_size,
+                                  number_of_features, number_of_classes, max_value_of_input);
+        if (!failed && training.dataset != NULL) {
+            //text test data is evaluated as rows of a binary set only
+            if (options.evaluation_data != NULL) {
+                printf("Error: --test-data must be binary when --data is!\n");
+                failed = 1;
+            } else {
+                train_stochastic_rows(network, &training.rows, &options);
+            }
+        } else if (!failed) {
+            if (options.evaluation_rows != NULL) {
+                printf("Error: --test-data must be text when --data is!\n");
+                failed = 1;
+            } else {
+                train_stochastic(network, training.packets, training.length, &options);
+            }
+        }
+        close_data_source(&training);
     }
-}
+    free_profiler(options.profiler);
+    close_data_source(&test);
 
-// move the biases in the direction of the -gradient in proportion to the learning rate
-void update_biases_for_layer(Network *network, int layer_index, double learning_rate) {
-    for (int i = 0; i < network->layers[layer_index]->layer_size; i++) {
-        network->layers[layer_index]->biases->values[i][0] -=
-                learning_rate * network->layers[layer_index]->delta_biases->values[i][0];
+    //the weights of every process are the same
+    if (!failed && rank == 0) {
+        failed = save_network_any(network, settings->model_file) != 0;
+        if (!failed) {
+            printf("saved %s\n", settings->model_file);
+        }
     }
+    free_network(network);
+    free_communicator(communicator);
+    return failed;
 }
 
-// train the network on the given training data for the given number of epochs
-void train_network(Network *network, TrainingDataPacket **training_data, int length_of_training_data, int epochs,
-                   double learning_rate) {
-
-    double last_loss = calculate_average_loss(network, training_data, length_of_training_data);
-    for (int i = 0; i < epochs; i++) {
-        for (int j = 0; j < length_of_training_data; j++) {
-            //propagate forward
-            propagate_forward(network, training_data[j]->input);
-            //calculate deltas for all layers (deltas being the error that is propagated backward)
-            for (int k = network->number_of_layers-1; k >= 0; k--) {
-                calculate_deltas_for_layer(network, k, training_data[j]->target);
-                add_gradient_weights_for_layer(network, k);
-                add_gradient_biases_for_layer(network, k);
-            }
-        }
+static int train_command(int argc, char **argv) {
+    TrainSettings settings;
+    memset(&settings, 0, sizeof(TrainSettings));
+    TrainingOptions *options = &settings.options;
+    *options = default_training_options();
+    options->seed = time(NULL);
+    settings.model_file = "network.txt";
+    settings.max_value_of_input = 1;
+    settings.loss = LOSS_CROSS_ENTROPY;
+    settings.processes = 1;
+    settings.world_size = 1;
+    settings.transport = "shm";
+    snprintf(settings.rendezvous, sizeof(settings.rendezvous), "sem2lab2_%ld", (long) getpid());
+    int rendezvous_given = 0;
+    settings.host = "127.0.0.1";
+    settings.port = DEFAULT_PORT;
+    OptimizerType optimizer = OPTIMIZER_SGD;
 
-        //calculate the gradient for all data:
-        //average delta weights and biases for all layers
-        for (int k = network->number_of_layers-1; k >= 0; k--) {
-            average_gradient_weights_for_layer(network, k, length_of_training_data);
-            average_gradient_biases_for_layer(network, k, length_of_training_data);
+    for (int i = 2; i < argc; i++) {
+        char *option = argv[i];
+        if (strcmp(option, "--stream") == 0) {
+            settings.stream = 1;
+            continue;
         }
-
-        //apply the gradient to the weights and biases:
-        //update weights and biases for all layers
-        for (int k = network->number_of_layers-1; k >= 0; k--) {
-            update_weights_for_layer(network, k, learning_rate);
-            update_biases_for_layer(network, k, learning_rate);
+        if (strcmp(option, "--asynchronous") == 0) {
+            options->asynchronous = 1;
+            continue;
         }
-
-        // calculate average loss and success rate every 10 epochs
-        if (i % 100 == 0) {
-            double loss = calculate_average_loss(network, training_data, length_of_training_data);
-            printf("avg loss: %f\n", loss);
-            double success_rate = calculate_average_success_rate(network, training_data, length_of_training_data);
-            printf("success rate: %f\n", success_rate);
-            if (loss > last_loss) {
-                learning_rate *= 0.96;
-                printf("learning rate: %f\n", learning_rate);
+        char *value = option_value(argc, argv, &i);
+        if (value == NULL) {
+            return 1;
+        }
+        if (strcmp(option, "--data") == 0) {
+            settings.data_file = value;
+        } else if (strcmp(option, "--test-data") == 0) {
+            settings.test_file = value;
+        } else if (strcmp(option, "--init") == 0) {
+            settings.init_file = value;
+        } else if (strcmp(option, "--model") == 0) {
+            settings.model_file = value;
+        } else if (strcmp(option, "--profile") == 0) {
+            settings.profile_file = value;
+        } else if (strcmp(option, "--processes") == 0) {
+            settings.processes = atoi(value);
+        } else if (strcmp(option, "--world-size") == 0) {
+            settings.world_size = atoi(value);
+        } else if (strcmp(option, "--rank") == 0) {
+            settings.rank = atoi(value);
+        } else if (strcmp(option, "--transport") == 0) {
+            settings.transport = value;
+        } else if (strcmp(option, "--rendezvous") == 0) {
+            snprintf(settings.rendezvous, sizeof(settings.rendezvous), "%s", value);
+            rendezvous_given = 1;
+        } else if (strcmp(option, "--host") == 0) {
+            settings.host = value;
+        } else if (strcmp(option, "--port") == 0) {
+            settings.port = atoi(value);
+        } else if (strcmp(option, "--topology") == 0) {
+            settings.number_of_layers = parse_topology(value, settings.layer_sizes);
+            if (settings.number_of_layers == 0) {
+                printf("Error: Invalid topology %s!\n", value);
+                return 1;
+            }
+        } else if (strcmp(option, "--samples") == 0) {
+            settings.samples = atoi(value);
+        } else if (strcmp(option, "--max-input") == 0) {
+            settings.max_value_of_input = atof(value);
+        } else if (strcmp(option, "--iterations") == 0) {
+            options->epochs = atoi(value);
+        } else if (strcmp(option, "--batch-size") == 0) {
+            options->split_size = atoi(value);
+        } else if (strcmp(option, "--update-size") == 0) {
+            options->asynchronous_update_size = atoi(value);
+        } else if (strcmp(option, "--threads") == 0) {
+            options->number_of_threads = atoi(value);
+        } else if (strcmp(option, "--learning-rate") == 0) {
+            options->learning_rate = atof(value);
+        } else if (strcmp(option, "--max-gradient-norm") == 0) {
+            options->max_gradient_norm = atof(value);
+        } else if (strcmp(option, "--evaluate-every") == 0) {
+            options->evaluation_interval = atoi(value);
+        } else if (strcmp(option, "--seed") == 0) {
+            options->seed = strtoull(value, NULL, 10);
+        } else if (strcmp(option, "--optimizer") == 0) {
+            if (!parse_optimizer(value, &optimizer)) {
+                printf("Error: Unknown optimizer %s!\n", value);
+                return 1;
+            }
+        } else if (strcmp(option, "--loss") == 0) {
+            if (strcmp(value, "mse") == 0) {
+                settings.loss = LOSS_MEAN_SQUARED_ERROR;
+            } else if (strcmp(value, "cross-entropy") == 0) {
+                settings.loss = LOSS_CROSS_ENTROPY;
+            } else {
+                printf("Error: Unknown loss %s!\n", value);
+                return 1;
             }
-            last_loss = loss;
+        } else {
+            printf("Error: Unknown option %s!\n", option);
+            return 1;
         }
     }
+    if (settings.data_file == NULL || (settings.number_of_layers == 0 && settings.init_file == NULL)) {
+        printf("Error: train needs --data and --topology or --init!\n");
+        return 1;
+    }
+    if (options->epochs <= 0 || options->split_size <= 0 || options->number_of_threads <= 0 ||
+        options->evaluation_interval <= 0 || options->asynchronous_update_size <= 0 ||
+        settings.max_value_of_input == 0) {
+        printf("Error: Iterations, batch size, threads, evaluation interval, update size and max input must be "
+               "positive!\n");
+        return 1;
+    }
+    if (options->asynchronous && optimizer != OPTIMIZER_SGD) {
+        printf("Error: --asynchronous applies plain gradient descent only!\n");
+        return 1;
+    }
+    if (settings.processes < 1 || settings.world_size < 1 || settings.rank < 0 ||
+        settings.rank >= settings.world_size || (settings.processes > 1 && settings.world_size > 1)) {
+        printf("Error: Use --processes or --world-size with a --rank below it!\n");
+        return 1;
+    }
+    if (strcmp(settings.transport, "shm") != 0 && strcmp(settings.transport, "tcp") != 0) {
+        printf("Error: Unknown transport %s!\n", settings.transport);
+        return 1;
+    }
+    if (settings.world_size > 1 && strcmp(settings.transport, "shm") == 0 && !rendezvous_given) {
+        printf("Error: Processes started separately need the same --rendezvous!\n");
+        return 1;
+    }
+    if ((settings.processes > 1 || settings.world_size > 1) && (options->asynchronous || settings.stream)) {
+        printf("Error: Several processes train synchronously on loaded shards only!\n");
+        return 1;
+    }
+    options->optimizer = default_optimizer_options(optimizer);
+
+    if (settings.processes == 1) {
+        return train_process(&settings, settings.rank, settings.world_size);
+    }
+    //every process continues from here with its own rank
+    pid_t *children = malloc(settings.processes * sizeof(pid_t));
+    int rank = start_processes(settings.processes, children);
+    int failed = train_process(&settings, rank, settings.processes);
+    if (rank == 0) {
+        failed |= wait_for_processes(settings.processes, children);
+    }
+    free(children);
+    return failed;
+}
+
+// best member so far on the evaluation samples
+static void report_sweep(Population *population, const SampleRows *rows, int iteration) {
+    population_evaluate(population, rows);
+    int best = population_best_member(population);
+    printf("iteration %d: best member %d (seed %llu, learning rate %g), loss %f, success rate %.2f%%\n", iteration,
+           best, (unsigned long long) population->seeds[best], population->learning_rates[best],
+           population->losses[best], population->success_rates[best] * 100);
 }
 
-// training function with no loss calculation for stochastic gradient descent
-void train_network_no_loss_calc(Network *network, TrainingDataPacket **training_data, int length_of_training_data,
-                                int epochs,
-                                double learning_rate) {
-    for (int i = 0; i < epochs; i++) {
-        for (int j = 0; j < length_of_training_data; j++) {
-            //propagate forward
-            propagate_forward(network, training_data[j]->input);
-            //calculate deltas for all layers (deltas being the error that is propagated backward)
-            for (int k = network->number_of_layers-1; k >= 0; k--) {
-                calculate_deltas_for_layer(network, k, training_data[j]->target);
-                add_gradient_weights_for_layer(network, k);
-                add_gradient_biases_for_layer(network, k);
+static int sweep_command(int argc, char **argv) {
+    char *data_file = NULL;
+    char *test_file = NULL;
+    char *model_file = "network.txt";
+    int layer_sizes[MAX_LAYERS];
+    int number_of_layers = 0;
+    int samples = 0;
+    double max_value_of_input = 1;
+    LossFunction loss = LOSS_CROSS_ENTROPY;
+    int iterations = 10000;
+    int batch_size = 1000;
+    int number_of_threads = default_thread_count();
+    int evaluation_interval = 100;
+    uint64_t seed = time(NULL);
+    int seeds_per_rate = 8;
+    double rates[MAX_LEARNING_RATES] = {0.1};
+    int number_of_rates = 1;
+
+    for (int i = 2; i < argc; i++) {
+        char *option = argv[i];
+        char *value = option_value(argc, argv, &i);
+        if (value == NULL) {
+            return 1;
+        }
+        if (strcmp(option, "--data") == 0) {
+            data_file = value;
+        } else if (strcmp(option, "--test-data") == 0) {
+            test_file = value;
+        } else if (strcmp(option, "--model") == 0) {
+            model_file = value;
+        } else if (strcmp(option, "--topology") == 0) {
+            number_of_layers = parse_topology(value, layer_sizes);
+            if (number_of_layers == 0) {
+                printf("Error: Invalid topology %s!\n", value);
+                return 1;
+            }
+        } else if (strcmp(option, "--learning-rates") == 0) {
+            number_of_rates = parse_list(value, rates, MAX_LEARNING_RATES);
+            if (number_of_rates == 0) {
+                printf("Error: Invalid learning rates %s!\n", value);
+                return 1;
+            }
+        } else if (strcmp(option, "--seeds") == 0) {
+            seeds_per_rate = atoi(value);
+        } else if (strcmp(option, "--samples") == 0) {
+            samples = atoi(value);
+        } else if (strcmp(option, "--max-input") == 0) {
+            max_value_of_input = atof(value);
+        } else if (strcmp(option, "--iterations") == 0) {
+            iterations = atoi(value);
+        } else if (strcmp(option, "--batch-size") == 0) {
+            batch_size = atoi(value);
+        } else if (strcmp(option, "--threads") == 0) {
+            number_of_threads = atoi(value);
+        } else if (strcmp(option, "--evaluate-every") == 0) {
+            evaluation_interval = atoi(value);
+        } else if (strcmp(option, "--seed") == 0) {
+            seed = strtoull(value, NULL, 10);
+        } else if (strcmp(option, "--loss") == 0) {
+            if (strcmp(value, "mse") == 0) {
+                loss = LOSS_MEAN_SQUARED_ERROR;
+            } else if (strcmp(value, "cross-entropy") == 0) {
+                loss = LOSS_CROSS_ENTROPY;
+            } else {
+                printf("Error: Unknown loss %s!\n", value);
+                return 1;
             }
+        } else {
+            printf("Error: Unknown option %s!\n", option);
+            return 1;
         }
+    }
+    if (data_file == NULL || number_of_layers == 0) {
+        printf("Error: sweep needs --data and --topology!\n");
+        return 1;
+    }
+    if (iterations <= 0 || batch_size <= 0 || number_of_threads <= 0 || evaluation_interval <= 0 ||
+        seeds_per_rate <= 0 || max_value_of_input == 0) {
+        printf("Error: Iterations, batch size, threads, evaluation interval, seeds and max input must be "
+               "positive!\n");
+        return 1;
+    }
 
-        //calculate the gradient for all data:
-        //average delta weights and biases for all layers
-        for (int k = network->number_of_layers-1; k >= 0; k--) {
-            average_gradient_weights_for_layer(network, k, length_of_training_data);
-            average_gradient_biases_for_layer(network, k, length_of_training_data);
-        }
+    int number_of_features = layer_sizes[0];
+    int number_of_classes = layer_sizes[number_of_layers - 1];
+    DataSource training;
+    DataSource test = {0};
+    int failed = open_data_source(&training, data_file, samples, 0, 1, number_of_features, number_of_classes,
+                                  max_value_of_input);
+    if (!failed && test_file != NULL) {
+        failed = open_data_source(&test, test_file, 0, 0, 1, number_of_features, number_of_classes,
+                                  max_value_of_input);
+    }
+    if (failed) {
+        close_data_source(&training);
+        close_data_source(&test);
+        return 1;
+    }
+    SampleRows *training_rows = source_rows(&training);
+    SampleRows *evaluation_rows = test_file != NULL ? source_rows(&test) : training_rows;
+
+    //members are grouped by learning rate, the seeds repeat in every group
+    int number_of_members = seeds_per_rate * number_of_rates;
+    uint64_t *seeds = malloc(number_of_members * sizeof(uint64_t));
+    double *learning_rates = malloc(number_of_members * sizeof(double));
+    for (int m = 0; m < number_of_members; m++) {
+        seeds[m] = seed + m % seeds_per_rate;
+        learning_rates[m] = rates[m / seeds_per_rate];
+    }
+    Population *population = create_population(number_of_layers, layer_sizes, number_of_members, seeds,
+                                                learning_rates, batch_size, number_of_threads);
+    free(seeds);
+    free(learning_rates);
+    if (population == NULL) {
+        close_data_source(&training);
+        close_data_source(&test);
+        return 1;
+    }
+    population->loss = loss;
 
-        //apply the gradient to the weights and biases:
-        //update weights and biases for all layers
-        for (int k = network->number_of_layers-1; k >= 0; k--) {
-            update_weights_for_layer(network, k, learning_rate);
-            update_biases_for_layer(network, k, learning_rate);
+    //every member trains on the same batches
+    Sampler *sampler = create_sampler(training_rows->number_of_samples, batch_size, seed);
+    SampleRows batch = *training_rows;
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        if (iteration % evaluation_interval == 0) {
+            report_sweep(population, evaluation_rows, iteration);
         }
+        batch.indices = sampler_next_batch(sampler, &batch.number_of_samples);
+        train_population_rows(population, &batch);
     }
+    free_sampler(sampler);
+
+    population_evaluate(population, evaluation_rows);
+    printf("member  seed                  learning rate  loss        success rate\n");
+    for (int m = 0; m < number_of_members; m++) {
+        printf("%6d  %-20llu  %13g  %-10f  %11.2f%%\n", m, (unsigned long long) population->seeds[m],
+               population->learning_rates[m], population->losses[m], population->success_rates[m] * 100);
+    }
+    int best = population_best_member(population);
+    printf("best member %d, success rate %.2f%%\n", best, population->success_rates[best] * 100);
+    Network *network = population_member_network(population, best);
+    failed = save_network_to_file(network, model_file) != 0;
+    if (!failed) {
+        printf("saved %s\n", model_file);
+    }
+    free_network(network);
+    free_population(population);
+    close_data_source(&training);
+    close_data_source(&test);
+    return failed;
 }
 
-//split the training data into packets randomly and train on that
-void train_stochastic(Network *network, TrainingDataPacket **training_data, int length_of_training_data, int epochs,
-                      int split_size,
-                      double learning_rate) {
-    double last_loss = calculate_average_loss(network, training_data, length_of_training_data);
-    for (int i = 0; i < epochs; i++) {
-        TrainingDataPacket **packets = malloc(sizeof(TrainingDataPacket *) * split_size);
-        for (int j = 0; j < split_size; j++) {
-            packets[j] = training_data[rand() % length_of_training_data];
-        }
-        train_network_no_loss_calc(network, packets, split_size, 1, learning_rate);
-        free(packets);
-        //calculate average loss and success rate every 10 epochs
-        if (i % 100 == 0) {
-            printf("____________________________________________________\n");
-            //print finished percentage
-            printf("finished: %.2f%%\n", (double) i / epochs * 100);
-            //print the average loss and success rate
-            double loss = calculate_average_loss(network, training_data, length_of_training_data);
-            printf("avg loss: %f\n", loss);
-            double success_rate = calculate_average_success_rate(network, training_data, length_of_training_data);
-            //print succes rate in green color
-            printf("\033[0;32m");
-            printf("success rate: %.2f%%\n", success_rate * 100);
-            printf("\033[0m");
-            if (loss > last_loss) {
-                learning_rate *= 0.96;
-                printf("learning rate: %f\n", learning_rate);
-            }
-            last_loss = loss;
+// class names, one per line, NULL when the file cannot be read
+static char **read_labels(char *file_name, int number_of_classes) {
+    FILE *file = fopen(file_name, "r");
+    if (file == NULL) {
+        printf("Error: Could not open file!\n");
+        return NULL;
+    }
+    char **labels = calloc(number_of_classes, sizeof(char *));
+    char line[MAX_LABEL_LENGTH];
+    for (int i = 0; i < number_of_classes; i++) {
+        labels[i] = malloc(MAX_LABEL_LENGTH);
+        if (fgets(line, sizeof(line), file) == NULL) {
+            //classes without a name keep their index
+            snprintf(labels[i], MAX_LABEL_LENGTH, "%d", i);
+            continue;
         }
+        line[strcspn(line, "\r\n")] = '\0';
+        snprintf(labels[i], MAX_LABEL_LENGTH, "%s", line);
     }
+    fclose(file);
+    return labels;
 }
 
-//save the network configuration and the weights and biases to a file
-void save_network_to_file(Network *network) {
-    FILE *file = fopen("C:\\Users\\Szymon\\CLionProjects\\Sem2Lab2\\network.txt", "w");
-    fprintf(file, "%d\n", network->number_of_layers);
-    for (int i = 0; i < network->number_of_layers; i++) {
-        fprintf(file, "%d\n", network->layers[i]->layer_size);
-    }
-    for (int i = 1; i < network->number_of_layers; i++) {
-        for (int j = 0; j < network->layers[i]->layer_size; j++) {
-            for (int k = 0; k < network->layers[i]->input_size; k++) {
-                fprintf(file, "%f\n", network->layers[i]->weights->values[j][k]);
-            }
+// one pass of predict, every thread infers its own range of the samples with its own scratch
+struct PredictPass {
+    const InferenceModel *model;
+    InferenceScratch **scratches;
+    const MatrixValue *inputs;
+    MatrixValue *outputs;
+    int number_of_samples;
+} typedef PredictPass;
+
+static void predict_task(void *context, int thread_index, int number_of_threads) {
+    PredictPass *pass = context;
+    int begin, end;
+    thread_range(pass->number_of_samples, thread_index, number_of_threads, &begin, &end);
+    if (end > begin) {
+        int inputs = pass->model->layer_sizes[0];
+        int outputs = pass->model->layer_sizes[pass->model->number_of_layers - 1];
+        infer_batch(pass->model, pass->scratches[thread_index], pass->inputs + (size_t) begin * inputs,
+                    end - begin, pass->outputs + (size_t) begin * outputs);
+    }
+}
+
+static int predict_command(int argc, char **argv) {
+    char *model_file = NULL;
+    char *input_file = NULL;
+    char *output_file = NULL;
+    char *labels_file = NULL;
+    int batch_size = 0;
+    int number_of_threads = 1;
+    for (int i = 2; i < argc; i++) {
+        char *option = argv[i];
+        char *value = option_value(argc, argv, &i);
+        if (value == NULL) {
+            return 1;
+        }
+        if (strcmp(option, "--model") == 0) {
+            model_file = value;
+        } else if (strcmp(option, "--input") == 0) {
+            input_file = value;
+        } else if (strcmp(option, "--output") == 0) {
+            output_file = value;
+        } else if (strcmp(option, "--labels") == 0) {
+            labels_file = value;
+        } else if (strcmp(option, "--batch-size") == 0) {
+            batch_size = atoi(value);
+        } else if (strcmp(option, "--threads") == 0) {
+            number_of_threads = atoi(value);
+        } else {
+            printf("Error: Unknown option %s!\n", option);
+            return 1;
         }
     }
-    for (int i = 1; i < network->number_of_layers; i++) {
-        for (int j = 0; j < network->layers[i]->layer_size; j++) {
-            fprintf(file, "%f\n", network->layers[i]->biases->values[j][0]);
+    if (model_file == NULL) {
+        printf("Error: predict needs --model!\n");
+        return 1;
+    }
+    if (number_of_threads <= 0 || batch_size < 0) {
+        printf("Error: Threads and batch size must be positive!\n");
+        return 1;
+    }
+    //answer every line at once when a person is typing them
+    if (batch_size == 0) {
+        batch_size = input_file == NULL ? 1 : INFERENCE_BATCH_SIZE;
+    }
+
+    //the training state is not needed to answer the queries, only the frozen weights
+    Network *network = load_network_any(model_file);
+    if (network == NULL) {
+        return 1;
+    }
+    InferenceModel *model = create_inference_model(network);
+    free_network(network);
+    int number_of_features = model->layer_sizes[0];
+    int number_of_classes = model->layer_sizes[model->number_of_layers - 1];
+
+    FILE *input = stdin;
+    FILE *output = stdout;
+    char **labels = NULL;
+    int failed = 0;
+    if (input_file != NULL && (input = fopen(input_file, "r")) == NULL) {
+        printf("Error: Could not open file!\n");
+        failed = 1;
+    }
+    if (!failed && output_file != NULL && (output = fopen(output_file, "w")) == NULL) {
+        printf("Error: Could not create file!\n");
+        failed = 1;
+    }
+    if (!failed && labels_file != NULL) {
+        labels = read_labels(labels_file, number_of_classes);
+        failed = labels == NULL;
+    }
+    if (failed) {
+        if (input != NULL && input != stdin) {
+            fclose(input);
         }
+        if (output != NULL && output != stdout) {
+            fclose(output);
+        }
+        free_inference_model(model);
+        return 1;
     }
-    fclose(file);
-}
 
-//load the network configuration and the weights and biases from a file
-Network *load_network_from_file(char file_name[]) {
-    FILE *file = fopen(file_name, "r");
-    int number_of_layers;
-    fscanf(file, "%d", &number_of_layers);
-    int *layer_sizes = malloc(sizeof(int) * number_of_layers);
-    for (int i = 0; i < number_of_layers; i++) {
-        fscanf(file, "%d", &layer_sizes[i]);
-    }
-    Network *network = create_network(number_of_layers, layer_sizes);
-    for (int i = 1; i < network->number_of_layers; i++) {
-        for (int j = 0; j < network->layers[i]->layer_size; j++) {
-            for (int k = 0; k < network->layers[i]->input_size; k++) {
-                fscanf(file, "%lf", &network->layers[i]->weights->values[j][k]);
+    int capacity = batch_size * number_of_threads;
+    MatrixValue *inputs = malloc(sizeof(MatrixValue) * capacity * number_of_features);
+    MatrixValue *outputs = malloc(sizeof(MatrixValue) * capacity * number_of_classes);
+    ThreadPool *pool = number_of_threads > 1 ? create_thread_pool(number_of_threads) : NULL;
+    InferenceScratch **scratches = malloc(sizeof(InferenceScratch *) * number_of_threads);
+    for (int t = 0; t < number_of_threads; t++) {
+        scratches[t] = create_inference_scratch(model, batch_size);
+    }
+    PredictPass pass = {model, scratches, inputs, outputs, 0};
+    long predicted = 0;
+    int finished = 0;
+    while (!finished) {
+        pass.number_of_samples = 0;
+        while (pass.number_of_samples < capacity) {
+            MatrixValue *sample = inputs + (size_t) pass.number_of_samples * number_of_features;
+            int values = 0;
+            double value;
+            while (values < number_of_features && fscanf(input, "%lf", &value) == 1) {
+                sample[values++] = (MatrixValue) value;
+            }
+            if (values < number_of_features) {
+                if (values > 0 || !feof(input)) {
+                    printf("Error: Sample %ld is not %d numbers!\n", predicted + pass.number_of_samples + 1,
+                           number_of_features);
+                    failed = 1;
+                }
+                finished = 1;
+                break;
+            }
+            pass.number_of_samples++;
+            if (input == stdin && pass.number_of_samples == batch_size) {
+                break;
             }
         }
-    }
-    for (int i = 1; i < network->number_of_layers; i++) {
-        for (int j = 0; j < network->layers[i]->layer_size; j++) {
-            fscanf(file, "%lf", &network->layers[i]->biases->values[j][0]);
+        if (pass.number_of_samples == 0) {
+            break;
+        }
+        if (pool != NULL) {
+            thread_pool_run(pool, predict_task, &pass);
+        } else {
+            predict_task(&pass, 0, 1);
+        }
+        for (int s = 0; s < pass.number_of_samples; s++) {
+            const MatrixValue *probabilities = outputs + (size_t) s * number_of_classes;
+            int best = 0;
+            for (int c = 1; c < number_of_classes; c++) {
+                if (probabilities[c] > probabilities[best]) {
+                    best = c;
+                }
+            }
+            if (labels != NULL) {
+                fprintf(output, "%s", labels[best]);
+            } else {
+                fprintf(output, "%d", best);
+            }
+            for (int c = 0; c < number_of_classes; c++) {
+                fprintf(output, " %f", probabilities[c]);
+            }
+            fprintf(output, "\n");
         }
+        fflush(output);
+        predicted += pass.number_of_samples;
     }
-    fclose(file);
-    return network;
-}
 
-//function for using the network
-void use_network(Network *network, Matrix *input) {
-    propagate_forward(network, input);
-    char colors[16][25] = {"white", "gray", "black", "red", "pink", "dark red", "orange",
-                           "brown", "yellow", "green", "dark green",
-                           "teal", "light blue", "blue", "dark blue", "purple"};
-    printf("output: %s\n",
-           colors[vector_max_index(network->layers[network->number_of_layers - 1]->activations)]);
+    for (int t = 0; t < number_of_threads; t++) {
+        free_inference_scratch(scratches[t]);
+    }
+    free(scratches);
+    if (pool != NULL) {
+        free_thread_pool(pool);
+    }
+    free(inputs);
+    free(outputs);
+    if (labels != NULL) {
+        for (int i = 0; i < number_of_classes; i++) {
+            free(labels[i]);
+        }
+        free(labels);
+    }
+    if (input != stdin) {
+        fclose(input);
+    }
+    if (output != stdout) {
+        fclose(output);
+    }
+    free_inference_model(model);
+    return failed;
 }
 
-int main() {
-    //seed the random number generator
-    srand(time(NULL));
+// the server SIGINT and SIGTERM stop
+static InferenceServer *running_server = NULL;
 
-    //create the network
-    Network *network = create_network(5, (int[]) {3,10,16,20,16});
-
-    //Network *network = load_network_from_file("C:\\Users\\Szymon\\CLionProjects\\Sem2Lab2\\network_90.02acc_lab.txt");
-    //read the training data
-    int length_of_training_data = 60000;
-    TrainingDataPacket **training_data = read_training_data(
-            "C:\\Users\\Szymon\\CLionProjects\\Sem2Lab2\\training_lab.txt",
-            length_of_training_data, 3, 16, 1);
+static void stop_server(int signal_number) {
+    (void) signal_number;
+    if (running_server != NULL) {
+        stop_inference_server(running_server);
+    }
+}
 
-    //train the network
-    //train_network(network, training_data, 60000, 2000, 1);
-    train_stochastic(network, training_data, length_of_training_data, 10000, 1000, 0.1);
-    // free the training data
-    for (int i = 0; i < length_of_training_data; i++) {
-        free_matrix(training_data[i]->input);
-        free_matrix(training_data[i]->target);
-        free(training_data[i]);
+static int serve_command(int argc, char **argv) {
+    char *model_file = NULL;
+    char *socket_path = "sem2lab2.sock";
+    InferenceServerOptions options = default_inference_server_options();
+    for (int i = 2; i < argc; i++) {
+        char *option = argv[i];
+        char *value = option_value(argc, argv, &i);
+        if (value == NULL) {
+            return 1;
+        }
+        if (strcmp(option, "--model") == 0) {
+            model_file = value;
+        } else if (strcmp(option, "--socket") == 0) {
+            socket_path = value;
+        } else if (strcmp(option, "--max-batch") == 0) {
+            options.max_batch_size = atoi(value);
+        } else if (strcmp(option, "--latency-us") == 0) {
+            options.latency_budget_microseconds = atol(value);
+        } else if (strcmp(option, "--max-clients") == 0) {
+            options.max_clients = atoi(value);
+        } else {
+            printf("Error: Unknown option %s!\n", option);
+            return 1;
+        }
+    }
+    if (model_file == NULL) {
+        printf("Error: serve needs --model!\n");
+        return 1;
     }
-    free(training_data);
 
-    //save the network to a file
-    save_network_to_file(network);
-
-    //get input from user
-    Matrix *input = create_matrix(3, 1);
-    do {
-        printf("Enter 3 numbers: ");
-        scanf("%lf %lf %lf", &input->values[0][0], &input->values[1][0], &input->values[2][0]);
-        use_network(network, input);
-        print_matrix(network->layers[network->number_of_layers - 1]->activations);
-        printf("want to continue? (Y/n)");
-    } while (getchar() != 'N' && getchar() != 'n');
-    free_matrix(input);
-    //free the network
+    Network *network = load_network_any(model_file);
+    if (network == NULL) {
+        return 1;
+    }
+    InferenceModel *model = create_inference_model(network);
     free_network(network);
+    InferenceServer *server = create_inference_server(model, socket_path, options);
+    if (server == NULL) {
+        free_inference_model(model);
+        return 1;
+    }
+    running_server = server;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_server;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    printf("serving %s on %s, batches of up to %d requests within %ld us\n", model_file, socket_path,
+           options.max_batch_size, options.latency_budget_microseconds);
+    fflush(stdout);
 
-    return 0;
-}
\ No newline at end of file
+    int failed = run_inference_server(server);
+    printf("answered %ld requests in %ld batches, %.2f per batch\n", server->requests, server->batches,
+           server->batches > 0 ? (double) server->requests / server->batches : 0);
+    running_server = NULL;
+    free_inference_server(server);
+    free_inference_model(model);
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "train") == 0) {
+        return train_command(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "sweep") == 0) {
+        return sweep_command(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "predict") == 0) {
+        return predict_command(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "serve") == 0) {
+        return serve_command(argc, argv);
+    }
+    print_usage(argv[0]);
+    return argc > 1 && strcmp(argv[1], "-h") != 0 && strcmp(argv[1], "--help") != 0;
+}
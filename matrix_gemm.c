@@ -0,0 +1,651 @@
+//
+// Cache blocked matrix product behind matrix_gemm and matrix_multiply.
+//
+// op(m1) and op(m2) are packed block by block into contiguous panels so that the
+// transposed variants share one micro-kernel. The micro-kernel is picked once at
+// runtime from the instruction sets reported by CPUID: AVX2+FMA, SSE2 or plain C.
+// Single precision builds (MATRIX_FLOAT32) get float kernels with twice the lanes.
+//
+
+#include "matrix_utils.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define MATRIX_GEMM_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+// block sizes: KC rows of a packed B panel stay in L1, MC x KC of packed A in L2
+#define GEMM_KC 256
+#define GEMM_MC 72
+#define GEMM_NC 512
+// largest register tile of any kernel
+#define GEMM_MAX_MR 6
+#ifdef MATRIX_FLOAT32
+#define GEMM_MAX_NR 16
+#else
+#define GEMM_MAX_NR 8
+#endif
+// below this many multiply-adds packing costs more than it saves
+#define GEMM_SMALL_WORK 2048
+
+// c[MR x NR] += alpha * a[kc x MR]^T * b[kc x NR]
+typedef void (*GemmKernel)(int kc, const MatrixValue *a, const MatrixValue *b, MatrixValue *c, int ldc, double alpha);
+
+// dot product of two contiguous vectors
+typedef MatrixAccumulator (*DotKernel)(int n, const MatrixValue *a, const MatrixValue *b);
+
+struct GemmImplementation {
+    MatrixIsa isa;
+    int mr;
+    int nr;
+    GemmKernel kernel;
+    DotKernel dot;
+} typedef GemmImplementation;
+
+static void kernel_scalar(int kc, const MatrixValue *a, const MatrixValue *b, MatrixValue *c, int ldc, double alpha) {
+    MatrixAccumulator tile[4][4] = {{0}};
+    for (int k = 0; k < kc; k++) {
+        for (int r = 0; r < 4; r++) {
+            for (int s = 0; s < 4; s++) {
+                tile[r][s] += a[r] * b[s];
+            }
+        }
+        a += 4;
+        b += 4;
+    }
+    for (int r = 0; r < 4; r++) {
+        for (int s = 0; s < 4; s++) {
+            c[r * ldc + s] += (MatrixValue) (alpha * tile[r][s]);
+        }
+    }
+}
+
+static MatrixAccumulator dot_scalar(int n, const MatrixValue *a, const MatrixValue *b) {
+    // independent partial sums hide the add latency
+    MatrixAccumulator sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        sum0 += (MatrixAccumulator) a[i] * b[i];
+        sum1 += (MatrixAccumulator) a[i + 1] * b[i + 1];
+        sum2 += (MatrixAccumulator) a[i + 2] * b[i + 2];
+        sum3 += (MatrixAccumulator) a[i + 3] * b[i + 3];
+    }
+    for (; i < n; i++) {
+        sum0 += (MatrixAccumulator) a[i] * b[i];
+    }
+    return (sum0 + sum1) + (sum2 + sum3);
+}
+
+#ifdef MATRIX_GEMM_X86
+
+#ifndef MATRIX_FLOAT32
+
+__attribute__((target("sse2")))
+static void kernel_sse2(int kc, const double *a, const double *b, double *c, int ldc, double alpha) {
+    __m128d c00 = _mm_setzero_pd(), c01 = _mm_setzero_pd();
+    __m128d c10 = _mm_setzero_pd(), c11 = _mm_setzero_pd();
+    __m128d c20 = _mm_setzero_pd(), c21 = _mm_setzero_pd();
+    __m128d c30 = _mm_setzero_pd(), c31 = _mm_setzero_pd();
+    for (int k = 0; k < kc; k++) {
+        __m128d b0 = _mm_load_pd(b);
+        __m128d b1 = _mm_load_pd(b + 2);
+        __m128d a0 = _mm_load1_pd(a);
+        c00 = _mm_add_pd(c00, _mm_mul_pd(a0, b0));
+        c01 = _mm_add_pd(c01, _mm_mul_pd(a0, b1));
+        __m128d a1 = _mm_load1_pd(a + 1);
+        c10 = _mm_add_pd(c10, _mm_mul_pd(a1, b0));
+        c11 = _mm_add_pd(c11, _mm_mul_pd(a1, b1));
+        __m128d a2 = _mm_load1_pd(a + 2);
+        c20 = _mm_add_pd(c20, _mm_mul_pd(a2, b0));
+        c21 = _mm_add_pd(c21, _mm_mul_pd(a2, b1));
+        __m128d a3 = _mm_load1_pd(a + 3);
+        c30 = _mm_add_pd(c30, _mm_mul_pd(a3, b0));
+        c31 = _mm_add_pd(c31, _mm_mul_pd(a3, b1));
+        a += 4;
+        b += 4;
+    }
+    __m128d scale = _mm_set1_pd(alpha);
+    __m128d rows[4][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}};
+    for (int r = 0; r < 4; r++) {
+        double *row = c + r * ldc;
+        _mm_storeu_pd(row, _mm_add_pd(_mm_loadu_pd(row), _mm_mul_pd(scale, rows[r][0])));
+        _mm_storeu_pd(row + 2, _mm_add_pd(_mm_loadu_pd(row + 2), _mm_mul_pd(scale, rows[r][1])));
+    }
+}
+
+__attribute__((target("sse2")))
+static double dot_sse2(int n, const double *a, const double *b) {
+    __m128d sum0 = _mm_setzero_pd(), sum1 = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        sum0 = _mm_add_pd(sum0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        sum1 = _mm_add_pd(sum1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(sum0, sum1));
+    double sum = lanes[0] + lanes[1];
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static void kernel_avx2(int kc, const double *a, const double *b, double *c, int ldc, double alpha) {
+    __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+    __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+    __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+    __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+    __m256d c40 = _mm256_setzero_pd(), c41 = _mm256_setzero_pd();
+    __m256d c50 = _mm256_setzero_pd(), c51 = _mm256_setzero_pd();
+    for (int k = 0; k < kc; k++) {
+        __m256d b0 = _mm256_load_pd(b);
+        __m256d b1 = _mm256_load_pd(b + 4);
+        __m256d a0 = _mm256_broadcast_sd(a);
+        c00 = _mm256_fmadd_pd(a0, b0, c00);
+        c01 = _mm256_fmadd_pd(a0, b1, c01);
+        __m256d a1 = _mm256_broadcast_sd(a + 1);
+        c10 = _mm256_fmadd_pd(a1, b0, c10);
+        c11 = _mm256_fmadd_pd(a1, b1, c11);
+        __m256d a2 = _mm256_broadcast_sd(a + 2);
+        c20 = _mm256_fmadd_pd(a2, b0, c20);
+        c21 = _mm256_fmadd_pd(a2, b1, c21);
+        __m256d a3 = _mm256_broadcast_sd(a + 3);
+        c30 = _mm256_fmadd_pd(a3, b0, c30);
+        c31 = _mm256_fmadd_pd(a3, b1, c31);
+        __m256d a4 = _mm256_broadcast_sd(a + 4);
+        c40 = _mm256_fmadd_pd(a4, b0, c40);
+        c41 = _mm256_fmadd_pd(a4, b1, c41);
+        __m256d a5 = _mm256_broadcast_sd(a + 5);
+        c50 = _mm256_fmadd_pd(a5, b0, c50);
+        c51 = _mm256_fmadd_pd(a5, b1, c51);
+        a += 6;
+        b += 8;
+    }
+    __m256d scale = _mm256_set1_pd(alpha);
+    __m256d rows[6][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}, {c40, c41}, {c50, c51}};
+    for (int r = 0; r < 6; r++) {
+        double *row = c + r * ldc;
+        _mm256_storeu_pd(row, _mm256_fmadd_pd(scale, rows[r][0], _mm256_loadu_pd(row)));
+        _mm256_storeu_pd(row + 4, _mm256_fmadd_pd(scale, rows[r][1], _mm256_loadu_pd(row + 4)));
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static double dot_avx2(int n, const double *a, const double *b) {
+    __m256d sum0 = _mm256_setzero_pd(), sum1 = _mm256_setzero_pd();
+    __m256d sum2 = _mm256_setzero_pd(), sum3 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        sum0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), sum0);
+        sum1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4), sum1);
+        sum2 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 8), _mm256_loadu_pd(b + i + 8), sum2);
+        sum3 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 12), _mm256_loadu_pd(b + i + 12), sum3);
+    }
+    for (; i + 4 <= n; i += 4) {
+        sum0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), sum0);
+    }
+    __m256d total = _mm256_add_pd(_mm256_add_pd(sum0, sum1), _mm256_add_pd(sum2, sum3));
+    __m128d half = _mm_add_pd(_mm256_castpd256_pd128(total), _mm256_extractf128_pd(total, 1));
+    double sum = _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+#else
+
+__attribute__((target("sse2")))
+static void kernel_sse2(int kc, const float *a, const float *b, float *c, int ldc, double alpha) {
+    __m128 c00 = _mm_setzero_ps(), c01 = _mm_setzero_ps();
+    __m128 c10 = _mm_setzero_ps(), c11 = _mm_setzero_ps();
+    __m128 c20 = _mm_setzero_ps(), c21 = _mm_setzero_ps();
+    __m128 c30 = _mm_setzero_ps(), c31 = _mm_setzero_ps();
+    for (int k = 0; k < kc; k++) {
+        __m128 b0 = _mm_load_ps(b);
+        __m128 b1 = _mm_load_ps(b + 4);
+        __m128 a0 = _mm_set1_ps(a[0]);
+        c00 = _mm_add_ps(c00, _mm_mul_ps(a0, b0));
+        c01 = _mm_add_ps(c01, _mm_mul_ps(a0, b1));
+        __m128 a1 = _mm_set1_ps(a[1]);
+        c10 = _mm_add_ps(c10, _mm_mul_ps(a1, b0));
+        c11 = _mm_add_ps(c11, _mm_mul_ps(a1, b1));
+        __m128 a2 = _mm_set1_ps(a[2]);
+        c20 = _mm_add_ps(c20, _mm_mul_ps(a2, b0));
+        c21 = _mm_add_ps(c21, _mm_mul_ps(a2, b1));
+        __m128 a3 = _mm_set1_ps(a[3]);
+        c30 = _mm_add_ps(c30, _mm_mul_ps(a3, b0));
+        c31 = _mm_add_ps(c31, _mm_mul_ps(a3, b1));
+        a += 4;
+        b += 8;
+    }
+    __m128 scale = _mm_set1_ps((float) alpha);
+    __m128 rows[4][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}};
+    for (int r = 0; r < 4; r++) {
+        float *row = c + r * ldc;
+        _mm_storeu_ps(row, _mm_add_ps(_mm_loadu_ps(row), _mm_mul_ps(scale, rows[r][0])));
+        _mm_storeu_ps(row + 4, _mm_add_ps(_mm_loadu_ps(row + 4), _mm_mul_ps(scale, rows[r][1])));
+    }
+}
+
+__attribute__((target("sse2")))
+static MatrixAccumulator dot_sse2(int n, const float *a, const float *b) {
+    int i = 0;
+#ifdef MATRIX_FLOAT64_ACCUMULATION
+    // products of pairs of floats widened to double before they are summed
+    __m128d sum0 = _mm_setzero_pd(), sum1 = _mm_setzero_pd();
+    for (; i + 4 <= n; i += 4) {
+        __m128 products = _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        sum0 = _mm_add_pd(sum0, _mm_cvtps_pd(products));
+        sum1 = _mm_add_pd(sum1, _mm_cvtps_pd(_mm_movehl_ps(products, products)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(sum0, sum1));
+    double sum = lanes[0] + lanes[1];
+    for (; i < n; i++) {
+        sum += (double) a[i] * b[i];
+    }
+#else
+    __m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(sum0, sum1));
+    float sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+#endif
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static void kernel_avx2(int kc, const float *a, const float *b, float *c, int ldc, double alpha) {
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+    for (int k = 0; k < kc; k++) {
+        __m256 b0 = _mm256_load_ps(b);
+        __m256 b1 = _mm256_load_ps(b + 8);
+        __m256 a0 = _mm256_broadcast_ss(a);
+        c00 = _mm256_fmadd_ps(a0, b0, c00);
+        c01 = _mm256_fmadd_ps(a0, b1, c01);
+        __m256 a1 = _mm256_broadcast_ss(a + 1);
+        c10 = _mm256_fmadd_ps(a1, b0, c10);
+        c11 = _mm256_fmadd_ps(a1, b1, c11);
+        __m256 a2 = _mm256_broadcast_ss(a + 2);
+        c20 = _mm256_fmadd_ps(a2, b0, c20);
+        c21 = _mm256_fmadd_ps(a2, b1, c21);
+        __m256 a3 = _mm256_broadcast_ss(a + 3);
+        c30 = _mm256_fmadd_ps(a3, b0, c30);
+        c31 = _mm256_fmadd_ps(a3, b1, c31);
+        __m256 a4 = _mm256_broadcast_ss(a + 4);
+        c40 = _mm256_fmadd_ps(a4, b0, c40);
+        c41 = _mm256_fmadd_ps(a4, b1, c41);
+        __m256 a5 = _mm256_broadcast_ss(a + 5);
+        c50 = _mm256_fmadd_ps(a5, b0, c50);
+        c51 = _mm256_fmadd_ps(a5, b1, c51);
+        a += 6;
+        b += 16;
+    }
+    __m256 scale = _mm256_set1_ps((float) alpha);
+    __m256 rows[6][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}, {c40, c41}, {c50, c51}};
+    for (int r = 0; r < 6; r++) {
+        float *row = c + r * ldc;
+        _mm256_storeu_ps(row, _mm256_fmadd_ps(scale, rows[r][0], _mm256_loadu_ps(row)));
+        _mm256_storeu_ps(row + 8, _mm256_fmadd_ps(scale, rows[r][1], _mm256_loadu_ps(row + 8)));
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static MatrixAccumulator dot_avx2(int n, const float *a, const float *b) {
+    int i = 0;
+#ifdef MATRIX_FLOAT64_ACCUMULATION
+    // four floats at a time widened to double, multiplied and summed in double
+    __m256d sum0 = _mm256_setzero_pd(), sum1 = _mm256_setzero_pd();
+    for (; i + 8 <= n; i += 8) {
+        sum0 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm_loadu_ps(a + i)), _mm256_cvtps_pd(_mm_loadu_ps(b + i)), sum0);
+        sum1 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm_loadu_ps(a + i + 4)), _mm256_cvtps_pd(_mm_loadu_ps(b + i + 4)),
+                               sum1);
+    }
+    __m256d total = _mm256_add_pd(sum0, sum1);
+    __m128d half = _mm_add_pd(_mm256_castpd256_pd128(total), _mm256_extractf128_pd(total, 1));
+    double sum = _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+    for (; i < n; i++) {
+        sum += (double) a[i] * b[i];
+    }
+#else
+    __m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+    __m256 sum2 = _mm256_setzero_ps(), sum3 = _mm256_setzero_ps();
+    for (; i + 32 <= n; i += 32) {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+        sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), sum1);
+        sum2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), sum2);
+        sum3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), sum3);
+    }
+    for (; i + 8 <= n; i += 8) {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+    }
+    __m256 total = _mm256_add_ps(_mm256_add_ps(sum0, sum1), _mm256_add_ps(sum2, sum3));
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(total), _mm256_extractf128_ps(total, 1));
+    half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+    float sum = _mm_cvtss_f32(_mm_add_ss(half, _mm_shuffle_ps(half, half, 1)));
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+#endif
+    return sum;
+}
+
+#endif
+
+// CPUID leaf 1 and 7 feature bits, AVX additionally needs the OS to save ymm state
+static MatrixIsa detect_isa() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return MATRIX_ISA_SCALAR;
+    }
+    int has_sse2 = (edx >> 26) & 1;
+    int has_fma = (ecx >> 12) & 1;
+    int has_osxsave = (ecx >> 27) & 1;
+    int has_avx = (ecx >> 28) & 1;
+    int has_avx2 = 0;
+    if (__get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        has_avx2 = (ebx >> 5) & 1;
+    }
+    int ymm_enabled = 0;
+    if (has_osxsave) {
+        unsigned int xcr0_low, xcr0_high;
+        __asm__ volatile("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+        ymm_enabled = (xcr0_low & 6) == 6;
+    }
+    if (has_avx && has_avx2 && has_fma && ymm_enabled) {
+        return MATRIX_ISA_AVX2;
+    }
+    if (has_sse2) {
+        return MATRIX_ISA_SSE2;
+    }
+    return MATRIX_ISA_SCALAR;
+}
+
+#else
+
+static MatrixIsa detect_isa() {
+    return MATRIX_ISA_SCALAR;
+}
+
+#endif
+
+static const GemmImplementation implementations[] = {
+        {MATRIX_ISA_SCALAR, 4, 4, kernel_scalar, dot_scalar},
+#ifdef MATRIX_GEMM_X86
+#ifdef MATRIX_FLOAT32
+        {MATRIX_ISA_SSE2,   4, 8, kernel_sse2,   dot_sse2},
+        {MATRIX_ISA_AVX2,   6, 16, kernel_avx2,  dot_avx2},
+#else
+        {MATRIX_ISA_SSE2,   4, 4, kernel_sse2,   dot_sse2},
+        {MATRIX_ISA_AVX2,   6, 8, kernel_avx2,   dot_avx2},
+#endif
+#endif
+};
+
+static const GemmImplementation *active_implementation = NULL;
+static MatrixIsa supported_isa = MATRIX_ISA_SCALAR;
+static pthread_once_t detection_once = PTHREAD_ONCE_INIT;
+
+// packing buffers of one thread, allocated on its first packed product and freed when it exits
+struct GemmBuffers {
+    MatrixValue *packed_a;
+    MatrixValue *packed_b;
+    //columns of m2 gathered for gemv, grown to the longest one seen
+    MatrixValue *vector;
+    size_t vector_capacity;
+} typedef GemmBuffers;
+
+static pthread_key_t buffers_key;
+
+static void free_gemm_buffers(void *pointer) {
+    GemmBuffers *buffers = pointer;
+    aligned_free(buffers->packed_a);
+    aligned_free(buffers->packed_b);
+    free(buffers->vector);
+    free(buffers);
+}
+
+static const GemmImplementation *implementation_for(MatrixIsa isa) {
+    const GemmImplementation *best = &implementations[0];
+    for (size_t i = 0; i < sizeof(implementations) / sizeof(implementations[0]); i++) {
+        if (implementations[i].isa <= isa && implementations[i].isa >= best->isa) {
+            best = &implementations[i];
+        }
+    }
+    return best;
+}
+
+static void detect_implementation() {
+    pthread_key_create(&buffers_key, free_gemm_buffers);
+    supported_isa = detect_isa();
+    active_implementation = implementation_for(supported_isa);
+}
+
+// the first call of any thread detects the instruction sets, the others wait for it
+static const GemmImplementation *gemm_implementation() {
+    pthread_once(&detection_once, detect_implementation);
+    return active_implementation;
+}
+
+MatrixIsa matrix_select_isa(MatrixIsa isa) {
+    gemm_implementation();
+    if (isa > supported_isa) {
+        isa = supported_isa;
+    }
+    active_implementation = implementation_for(isa);
+    return active_implementation->isa;
+}
+
+MatrixIsa matrix_active_isa() {
+    return gemm_implementation()->isa;
+}
+
+const char *matrix_isa_name(MatrixIsa isa) {
+    switch (isa) {
+        case MATRIX_ISA_AVX2:
+            return "avx2+fma";
+        case MATRIX_ISA_SSE2:
+            return "sse2";
+        default:
+            return "scalar";
+    }
+}
+
+MatrixAccumulator matrix_dot(int n, const MatrixValue *a, const MatrixValue *b) {
+    return gemm_implementation()->dot(n, a, b);
+}
+
+// element (i, j) of op(matrix)
+static inline MatrixValue op_at(const Matrix *matrix, int transpose, int i, int j) {
+    return transpose ? MATRIX_AT(matrix, j, i) : MATRIX_AT(matrix, i, j);
+}
+
+// pack rows [row, row + mc) and inner [inner, inner + kc) of op(m1) into MR-row panels, zero padded
+static void pack_a(const Matrix *m1, int transpose, int row, int mc, int inner, int kc, int mr, MatrixValue *packed) {
+    for (int panel = 0; panel < mc; panel += mr) {
+        int rows = mc - panel < mr ? mc - panel : mr;
+        for (int k = 0; k < kc; k++) {
+            for (int r = 0; r < rows; r++) {
+                packed[r] = op_at(m1, transpose, row + panel + r, inner + k);
+            }
+            for (int r = rows; r < mr; r++) {
+                packed[r] = 0;
+            }
+            packed += mr;
+        }
+    }
+}
+
+// pack inner [inner, inner + kc) and cols [col, col + nc) of op(m2) into NR-column panels, zero padded
+static void pack_b(const Matrix *m2, int transpose, int inner, int kc, int col, int nc, int nr, MatrixValue *packed) {
+    for (int panel = 0; panel < nc; panel += nr) {
+        int cols = nc - panel < nr ? nc - panel : nr;
+        for (int k = 0; k < kc; k++) {
+            if (!transpose) {
+                memcpy(packed, matrix_row(m2, inner + k) + col + panel, (size_t) cols * sizeof(MatrixValue));
+            } else {
+                for (int s = 0; s < cols; s++) {
+                    packed[s] = MATRIX_AT(m2, col + panel + s, inner + k);
+                }
+            }
+            for (int s = cols; s < nr; s++) {
+                packed[s] = 0;
+            }
+            packed += nr;
+        }
+    }
+}
+
+static void scale_result(Matrix *result, double beta) {
+    if (beta == 1) {
+        return;
+    }
+    for (int i = 0; i < result->rows; i++) {
+        MatrixValue *row = matrix_row(result, i);
+        for (int j = 0; j < result->cols; j++) {
+            // beta == 0 overwrites, so garbage or NaN in result does not leak through
+            row[j] = beta == 0 ? 0 : (MatrixValue) (beta * row[j]);
+        }
+    }
+}
+
+// straightforward loops for products too small to amortise packing
+static void gemm_small(Matrix *m1, int transpose_m1, Matrix *m2, int transpose_m2, double alpha, Matrix *result,
+                       int inner) {
+    for (int i = 0; i < result->rows; i++) {
+        MatrixValue *result_row = matrix_row(result, i);
+        for (int j = 0; j < result->cols; j++) {
+            MatrixAccumulator sum = 0;
+            for (int k = 0; k < inner; k++) {
+                sum += (MatrixAccumulator) op_at(m1, transpose_m1, i, k) * op_at(m2, transpose_m2, k, j);
+            }
+            result_row[j] += alpha * sum;
+        }
+    }
+}
+
+// the calling thread's buffers, gemm_implementation must have run before
+static GemmBuffers *gemm_buffers() {
+    GemmBuffers *buffers = pthread_getspecific(buffers_key);
+    if (buffers == NULL) {
+        buffers = calloc(1, sizeof(GemmBuffers));
+        buffers->packed_a = aligned_malloc((size_t) GEMM_MC * GEMM_KC * sizeof(MatrixValue));
+        buffers->packed_b = aligned_malloc((size_t) GEMM_KC * (GEMM_NC + GEMM_MAX_NR) * sizeof(MatrixValue));
+        pthread_setspecific(buffers_key, buffers);
+    }
+    return buffers;
+}
+
+// matrix-vector product with contiguous rows of m1, the per-sample forward pass
+static void gemv(const GemmImplementation *implementation, Matrix *m1, Matrix *m2, int transpose_m2, double alpha,
+                 Matrix *result, int inner) {
+    MatrixValue buffer[1024];
+    MatrixValue *vector;
+    if (transpose_m2 || m2->stride == 1) {
+        // a row of m2 or a dense column vector is already contiguous
+        vector = m2->values;
+    } else {
+        if (inner <= 1024) {
+            vector = buffer;
+        } else {
+            GemmBuffers *buffers = gemm_buffers();
+            if (buffers->vector_capacity < (size_t) inner) {
+                free(buffers->vector);
+                buffers->vector = malloc((size_t) inner * sizeof(MatrixValue));
+                buffers->vector_capacity = (size_t) inner;
+            }
+            vector = buffers->vector;
+        }
+        for (int k = 0; k < inner; k++) {
+            vector[k] = MATRIX_AT(m2, k, 0);
+        }
+    }
+    for (int i = 0; i < result->rows; i++) {
+        MATRIX_AT(result, i, 0) += alpha * implementation->dot(inner, matrix_row(m1, i), vector);
+    }
+}
+
+// result = alpha * op(m1) * op(m2) + beta * result
+void matrix_gemm(Matrix *m1, int transpose_m1, Matrix *m2, int transpose_m2, double alpha, double beta,
+                 Matrix *result) {
+    int rows = transpose_m1 ? m1->cols : m1->rows;
+    int inner = transpose_m1 ? m1->rows : m1->cols;
+    int inner_m2 = transpose_m2 ? m2->cols : m2->rows;
+    int cols = transpose_m2 ? m2->rows : m2->cols;
+    if (inner != inner_m2 || result->rows != rows || result->cols != cols) {
+        printf("Error: Matrix dimensions do not match!\n");
+        return;
+    }
+    scale_result(result, beta);
+    if (rows == 0 || cols == 0 || inner == 0 || alpha == 0) {
+        return;
+    }
+    const GemmImplementation *implementation = gemm_implementation();
+    if (cols == 1 && !transpose_m1) {
+        gemv(implementation, m1, m2, transpose_m2, alpha, result, inner);
+        return;
+    }
+    if ((size_t) rows * cols * inner < GEMM_SMALL_WORK) {
+        gemm_small(m1, transpose_m1, m2, transpose_m2, alpha, result, inner);
+        return;
+    }
+
+    int mr = implementation->mr;
+    int nr = implementation->nr;
+    GemmBuffers *buffers = gemm_buffers();
+    MatrixValue *packed_a = buffers->packed_a;
+    MatrixValue *packed_b = buffers->packed_b;
+    MatrixValue edge[GEMM_MAX_MR * GEMM_MAX_NR];
+
+    for (int col = 0; col < cols; col += GEMM_NC) {
+        int nc = cols - col < GEMM_NC ? cols - col : GEMM_NC;
+        for (int k = 0; k < inner; k += GEMM_KC) {
+            int kc = inner - k < GEMM_KC ? inner - k : GEMM_KC;
+            pack_b(m2, transpose_m2, k, kc, col, nc, nr, packed_b);
+            for (int row = 0; row < rows; row += GEMM_MC) {
+                int mc = rows - row < GEMM_MC ? rows - row : GEMM_MC;
+                pack_a(m1, transpose_m1, row, mc, k, kc, mr, packed_a);
+                for (int jr = 0; jr < nc; jr += nr) {
+                    int tile_cols = nc - jr < nr ? nc - jr : nr;
+                    const MatrixValue *b_panel = packed_b + (size_t) jr * kc;
+                    for (int ir = 0; ir < mc; ir += mr) {
+                        int tile_rows = mc - ir < mr ? mc - ir : mr;
+                        const MatrixValue *a_panel = packed_a + (size_t) ir * kc;
+                        MatrixValue *c = matrix_row(result, row + ir) + col + jr;
+                        if (tile_rows == mr && tile_cols == nr) {
+                            implementation->kernel(kc, a_panel, b_panel, c, result->stride, alpha);
+                            continue;
+                        }
+                        // partial tiles go through a full size scratch tile
+                        memset(edge, 0, sizeof(edge));
+                        implementation->kernel(kc, a_panel, b_panel, edge, nr, alpha);
+                        for (int r = 0; r < tile_rows; r++) {
+                            for (int s = 0; s < tile_cols; s++) {
+                                c[(size_t) r * result->stride + s] += edge[r * nr + s];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
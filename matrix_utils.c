@@ -2,55 +2,106 @@
 // Created by szymc on 01.05.2023.
 //
 
+// posix_memalign
+#define _POSIX_C_SOURCE 200112L
+
 #include "matrix_utils.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 void fill_matrix(Matrix *matrix, double value) {
     for (int i = 0; i < matrix->rows; i++) {
+        MatrixValue *row = matrix_row(matrix, i);
         for (int j = 0; j < matrix->cols; j++) {
-            matrix->values[i][j] = value;
+            row[j] = value;
         }
     }
 }
 
+void *aligned_malloc(size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+    // round up so the whole last cache line belongs to the buffer
+    size = (size + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+#ifdef _WIN32
+    void *pointer = _aligned_malloc(size, MATRIX_ALIGNMENT);
+#else
+    void *pointer = NULL;
+    if (posix_memalign(&pointer, MATRIX_ALIGNMENT, size) != 0) {
+        pointer = NULL;
+    }
+#endif
+    if (pointer == NULL) {
+        printf("Error: Could not allocate memory!\n");
+        exit(1);
+    }
+    return pointer;
+}
+
+void *aligned_calloc(size_t size) {
+    void *pointer = aligned_malloc(size);
+    if (pointer != NULL) {
+        memset(pointer, 0, size);
+    }
+    return pointer;
+}
+
+void aligned_free(void *pointer) {
+#ifdef _WIN32
+    _aligned_free(pointer);
+#else
+    free(pointer);
+#endif
+}
+
+// row length in memory, single column vectors are kept dense
+int matrix_stride_for(int cols) {
+    if (cols <= 1) {
+        return cols;
+    }
+    return (cols + MATRIX_STRIDE_MULTIPLE - 1) / MATRIX_STRIDE_MULTIPLE * MATRIX_STRIDE_MULTIPLE;
+}
+
 // create matrix with given dimensions
 Matrix *create_matrix(int rows, int cols) {
     Matrix *matrix = malloc(sizeof(Matrix));
     matrix->rows = rows;
     matrix->cols = cols;
-    // allocate memory for matrix
-    matrix->values = malloc(rows * sizeof(double *));
-    for (int i = 0; i < rows; i++) {
-        matrix->values[i] = malloc(cols * sizeof(double));
-    }
-    fill_matrix(matrix, 0);
+    matrix->stride = matrix_stride_for(cols);
+    // one zeroed buffer for the whole matrix
+    matrix->values = aligned_calloc((size_t) rows * matrix->stride * sizeof(MatrixValue));
+    matrix->owns_values = 1;
+    matrix->in_arena = 0;
     return matrix;
 }
 
 void free_matrix(Matrix *matrix) {
-    for (int i = 0; i < matrix->rows; i++) {
-        free(matrix->values[i]);
+    //released together with the arena
+    if (matrix->in_arena) {
+        return;
+    }
+    if (matrix->owns_values) {
+        aligned_free(matrix->values);
     }
-    free(matrix->values);
     free(matrix);
 }
 
+Matrix matrix_view(Matrix *matrix, int first_row, int first_col, int rows, int cols) {
+    Matrix view;
+    view.rows = rows;
+    view.cols = cols;
+    view.stride = matrix->stride;
+    view.values = matrix->values + (size_t) first_row * matrix->stride + first_col;
+    view.owns_values = 0;
+    view.in_arena = 0;
+    return view;
+}
+
 // multiply two matrices
 void matrix_multiply(Matrix *m1, Matrix *m2, Matrix *result) {
-    if (m1->cols != m2->rows) {
-        printf("Error: Matrix dimensions do not match!\n");
-        return;
-    }
-    for (int i = 0; i < m1->rows; i++) {
-        for (int j = 0; j < m2->cols; j++) {
-            double sum = 0;
-            for (int k = 0; k < m1->cols; k++) {
-                sum += m1->values[i][k] * m2->values[k][j];
-            }
-            result->values[i][j] = sum;
-        }
-    }
+    matrix_gemm(m1, 0, m2, 0, 1, 0, result);
 }
 
 // add two matrices
@@ -60,8 +111,11 @@ void add_matrices(Matrix *m1, Matrix *m2, Matrix *result) {
         return;
     }
     for (int i = 0; i < m1->rows; i++) {
+        const MatrixValue *m1_row = matrix_row(m1, i);
+        const MatrixValue *m2_row = matrix_row(m2, i);
+        MatrixValue *result_row = matrix_row(result, i);
         for (int j = 0; j < m1->cols; j++) {
-            result->values[i][j] = m1->values[i][j] + m2->values[i][j];
+            result_row[j] = m1_row[j] + m2_row[j];
         }
     }
 }
@@ -72,27 +126,66 @@ void matrix_subtract(Matrix *m1, Matrix *m2, Matrix *result) {
         return;
     }
     for (int i = 0; i < m1->rows; i++) {
+        const MatrixValue *m1_row = matrix_row(m1, i);
+        const MatrixValue *m2_row = matrix_row(m2, i);
+        MatrixValue *result_row = matrix_row(result, i);
         for (int j = 0; j < m1->cols; j++) {
-            result->values[i][j] = m1->values[i][j] - m2->values[i][j];
+            result_row[j] = m1_row[j] - m2_row[j];
         }
     }
 }
 
-Matrix matrix_transpose(Matrix *matrix) {
-    Matrix *result = create_matrix(matrix->cols, matrix->rows);
+void matrix_transpose(Matrix *matrix, Matrix *result) {
+    if (matrix->rows != result->cols || matrix->cols != result->rows) {
+        printf("Error: Matrix dimensions do not match!\n");
+        return;
+    }
+    for (int i = 0; i < matrix->rows; i++) {
+        const MatrixValue *row = matrix_row(matrix, i);
+        for (int j = 0; j < matrix->cols; j++) {
+            MATRIX_AT(result, j, i) = row[j];
+        }
+    }
+}
+
+// add the column vector to every column of the matrix
+void add_column_vector(Matrix *matrix, Matrix *vector, Matrix *result) {
+    if (matrix->rows != vector->rows) {
+        printf("Error: Matrix dimensions do not match!\n");
+        return;
+    }
     for (int i = 0; i < matrix->rows; i++) {
+        const MatrixValue *row = matrix_row(matrix, i);
+        MatrixValue *result_row = matrix_row(result, i);
+        MatrixValue value = MATRIX_AT(vector, i, 0);
         for (int j = 0; j < matrix->cols; j++) {
-            result->values[j][i] = matrix->values[i][j];
+            result_row[j] = row[j] + value;
         }
     }
-    return *result;
+}
+
+// add the sum of every row of the matrix to the column vector
+void add_row_sums(Matrix *matrix, Matrix *vector) {
+    if (matrix->rows != vector->rows) {
+        printf("Error: Matrix dimensions do not match!\n");
+        return;
+    }
+    for (int i = 0; i < matrix->rows; i++) {
+        const MatrixValue *row = matrix_row(matrix, i);
+        MatrixAccumulator sum = 0;
+        for (int j = 0; j < matrix->cols; j++) {
+            sum += row[j];
+        }
+        MATRIX_AT(vector, i, 0) += sum;
+    }
 }
 
 //add a number to a matrix
 void matrix_add_scalar(Matrix *matrix, double scalar, Matrix *result) {
     for (int i = 0; i < matrix->rows; i++) {
+        MatrixValue *result_row = matrix_row(result, i);
         for (int j = 0; j < matrix->cols; j++) {
-            result->values[i][j] += scalar;
+            result_row[j] += scalar;
         }
     }
 }
@@ -100,8 +193,10 @@ void matrix_add_scalar(Matrix *matrix, double scalar, Matrix *result) {
 // apply function to each element of matrix
 void matrix_apply_function(Matrix *matrix, double (*function)(double), Matrix *result) {
     for (int i = 0; i < matrix->rows; i++) {
+        const MatrixValue *row = matrix_row(matrix, i);
+        MatrixValue *result_row = matrix_row(result, i);
         for (int j = 0; j < matrix->cols; j++) {
-            result->values[i][j] = function(matrix->values[i][j]);
+            result_row[j] = function(row[j]);
         }
     }
 }
@@ -111,7 +206,7 @@ void print_matrix(Matrix *matrix) {
     for (int i = 0; i < matrix->rows; i++) {
         printf("[");
         for (int j = 0; j < matrix->cols; j++) {
-            printf("%f", matrix->values[i][j]);
+            printf("%f", MATRIX_AT(matrix, i, j));
             if (j < matrix->cols - 1) {
                 printf(", ");
             }
@@ -128,7 +223,7 @@ void print_matrix(Matrix *matrix) {
 int vector_max_index(Matrix *matrix) {
     int max_index = 0;
     for (int i = 0; i < matrix->rows; i++) {
-        if (matrix->values[i][0] > matrix->values[max_index][0]) {
+        if (MATRIX_AT(matrix, i, 0) > MATRIX_AT(matrix, max_index, 0)) {
             max_index = i;
         }
     }
@@ -139,8 +234,9 @@ int vector_max_index(Matrix *matrix) {
 // fill matrix with random values
 void randomize_matrix(Matrix *matrix) {
     for (int i = 0; i < matrix->rows; i++) {
+        MatrixValue *row = matrix_row(matrix, i);
         for (int j = 0; j < matrix->cols; j++) {
-            matrix->values[i][j] = (double) rand() / RAND_MAX * 2.0 - 1.0;
+            row[j] = (MatrixValue) ((double) rand() / RAND_MAX * 2.0 - 1.0);
         }
     }
 }
@@ -151,16 +247,18 @@ void element_wise_multiply(Matrix *m1, Matrix *m2, Matrix *result) {
         return;
     }
     for (int i = 0; i < m1->rows; i++) {
+        const MatrixValue *m1_row = matrix_row(m1, i);
+        const MatrixValue *m2_row = matrix_row(m2, i);
+        MatrixValue *result_row = matrix_row(result, i);
         for (int j = 0; j < m1->cols; j++) {
-            result->values[i][j] = m1->values[i][j] * m2->values[i][j];
+            result_row[j] = m1_row[j] * m2_row[j];
         }
     }
 }
 
 void copy_matrix(Matrix *matrix, Matrix *destination) {
+    // rows are contiguous, copy them whole
     for (int i = 0; i < matrix->rows; i++) {
-        for (int j = 0; j < matrix->cols; j++) {
-            destination->values[i][j] = matrix->values[i][j];
-        }
+        memcpy(matrix_row(destination, i), matrix_row(matrix, i), (size_t) matrix->cols * sizeof(MatrixValue));
     }
-}
\ No newline at end of file
+}
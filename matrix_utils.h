@@ -5,25 +5,108 @@
 #ifndef SEM2LAB2_MATRIX_UTILS_H
 #define SEM2LAB2_MATRIX_UTILS_H
 
+#include <stddef.h>
+
+// every matrix buffer starts on a cache line boundary
+#define MATRIX_ALIGNMENT 64
+// MATRIX_FLOAT32 stores matrices in single precision, set by the NN_FLOAT32 build option
+// MATRIX_FLOAT64_ACCUMULATION keeps sums over many values such as the gradient
+// reductions in double precision even then
+#ifdef MATRIX_FLOAT32
+typedef float MatrixValue;
+#else
+typedef double MatrixValue;
+#endif
+
+#if defined(MATRIX_FLOAT32) && !defined(MATRIX_FLOAT64_ACCUMULATION)
+typedef float MatrixAccumulator;
+#else
+typedef double MatrixAccumulator;
+#endif
+
+// rows of multi-column matrices are padded to a multiple of this many values, 32 bytes
+#define MATRIX_STRIDE_MULTIPLE ((int) (32 / sizeof(MatrixValue)))
+
+// instruction sets the matrix product kernels are written for, in increasing order
+enum MatrixIsa {
+    MATRIX_ISA_SCALAR,
+    MATRIX_ISA_SSE2,
+    MATRIX_ISA_AVX2
+} typedef MatrixIsa;
+
+// row-major matrix stored in one contiguous buffer
+// element (i, j) lives at values[i * stride + j], stride >= cols
 struct Matrix {
     int rows;
     int cols;
-    double **values;
+    int stride;
+    MatrixValue *values;
+    //views and matrices over memory owned elsewhere leave values alone in free_matrix
+    int owns_values;
+    //the struct itself belongs to an arena, see arena.h
+    int in_arena;
 } typedef Matrix;
 
+// pointer to the first element of a row
+static inline MatrixValue *matrix_row(const Matrix *matrix, int row) {
+    return matrix->values + (size_t) row * matrix->stride;
+}
+
+// element access usable both as a value and as an assignment target
+#define MATRIX_AT(matrix, row, col) ((matrix)->values[(size_t) (row) * (matrix)->stride + (col)])
+
 void fill_matrix(Matrix *matrix, double value);
 
+// row length in memory of a matrix with cols columns, single column vectors are kept dense
+int matrix_stride_for(int cols);
+
 Matrix *create_matrix(int rows, int cols);
 
 void free_matrix(Matrix *matrix);
 
+// allocate a MATRIX_ALIGNMENT aligned buffer, release it with aligned_free
+void *aligned_malloc(size_t size);
+
+// same as aligned_malloc but the buffer is zeroed
+void *aligned_calloc(size_t size);
+
+void aligned_free(void *pointer);
+
+// a window into another matrix sharing its buffer, must not be passed to free_matrix
+Matrix matrix_view(Matrix *matrix, int first_row, int first_col, int rows, int cols);
+
 void matrix_multiply(Matrix *m1, Matrix *m2, Matrix *result);
 
+// general matrix product: result = alpha * op(m1) * op(m2) + beta * result
+// op transposes its argument when the corresponding flag is non zero
+void matrix_gemm(Matrix *m1, int transpose_m1, Matrix *m2, int transpose_m2, double alpha, double beta,
+                 Matrix *result);
+
+// dot product of two contiguous vectors with the kernels of the active instruction set
+MatrixAccumulator matrix_dot(int n, const MatrixValue *a, const MatrixValue *b);
+
+// force the kernels of a given instruction set, clamped to what the CPU supports
+// returns the instruction set actually in use
+// not thread-safe: call it before any other thread multiplies matrices
+MatrixIsa matrix_select_isa(MatrixIsa isa);
+
+// instruction set chosen for the matrix product kernels, detected on first use
+MatrixIsa matrix_active_isa();
+
+const char *matrix_isa_name(MatrixIsa isa);
+
 void add_matrices(Matrix *m1, Matrix *m2, Matrix *result);
 
 void matrix_subtract(Matrix *m1, Matrix *m2, Matrix *result);
 
-Matrix matrix_transpose(Matrix *matrix);
+// write the transpose of matrix into result, which must be cols x rows and must not overlap it
+void matrix_transpose(Matrix *matrix, Matrix *result);
+
+// add the column vector to every column of the matrix
+void add_column_vector(Matrix *matrix, Matrix *vector, Matrix *result);
+
+// add the sum of every row of the matrix to the column vector
+void add_row_sums(Matrix *matrix, Matrix *vector);
 
 void matrix_add_scalar(Matrix *matrix, double scalar, Matrix *result);
 
@@ -0,0 +1,271 @@
+//
+// Versioned binary model format. The header and a per-layer table are followed by the weight
+// and bias blobs, each aligned to 64 bytes and stored with the row stride of the in-memory
+// matrices, so a mapped file is used as the layers' weight buffers directly.
+//
+
+#include "model_io.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define MODEL_NO_MMAP
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void fill_crc_table() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+uint32_t model_crc32(uint32_t crc, const unsigned char *data, size_t length) {
+    //threads loading models at the same time wait for the one filling the table
+    pthread_once(&crc_table_once, fill_crc_table);
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + MODEL_ALIGNMENT - 1) / MODEL_ALIGNMENT * MODEL_ALIGNMENT;
+}
+
+int save_network_binary(Network *network, char *file_name) {
+    int number_of_layers = network->number_of_layers;
+    ModelHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MODEL_MAGIC, 4);
+    header.version = MODEL_VERSION;
+    header.number_of_layers = number_of_layers;
+    header.activation = MODEL_ACTIVATION_LEAKY_RELU_SOFTMAX;
+    header.dtype = MODEL_VALUE_DTYPE;
+
+    //lay out the blobs after the layer table
+    ModelLayerEntry *entries = calloc(number_of_layers, sizeof(ModelLayerEntry));
+    uint64_t offset = align_offset(sizeof(ModelHeader) + number_of_layers * sizeof(ModelLayerEntry));
+    for (int i = 0; i < number_of_layers; i++) {
+        Layer *layer = network->layers[i];
+        entries[i].layer_size = layer->layer_size;
+        entries[i].input_size = layer->input_size;
+        entries[i].weights_stride = layer->weights->stride;
+        entries[i].weights_offset = offset;
+        offset = align_offset(offset + (uint64_t) layer->layer_size * layer->weights->stride * sizeof(MatrixValue));
+        entries[i].biases_offset = offset;
+        offset = align_offset(offset + (uint64_t) layer->layer_size * sizeof(MatrixValue));
+    }
+    header.file_size = offset;
+
+    //build the file in memory so the checksum covers exactly what is written
+    unsigned char *image = calloc(1, offset);
+    memcpy(image + sizeof(ModelHeader), entries, number_of_layers * sizeof(ModelLayerEntry));
+    for (int i = 0; i < number_of_layers; i++) {
+        Layer *layer = network->layers[i];
+        if (layer->layer_size * layer->weights->stride > 0) {
+            memcpy(image + entries[i].weights_offset, layer->weights->values,
+                   (size_t) layer->layer_size * layer->weights->stride * sizeof(MatrixValue));
+        }
+        for (int j = 0; j < layer->layer_size; j++) {
+            ((MatrixValue *) (image + entries[i].biases_offset))[j] = MATRIX_AT(layer->biases, j, 0);
+        }
+    }
+    header.checksum = model_crc32(0, image + sizeof(ModelHeader), offset - sizeof(ModelHeader));
+    memcpy(image, &header, sizeof(header));
+
+    FILE *file = fopen(file_name, "wb");
+    int result = -1;
+    if (file == NULL) {
+        printf("Error: Could not open file!\n");
+    } else {
+        result = fwrite(image, 1, offset, file) == offset ? 0 : -1;
+        fclose(file);
+    }
+    free(image);
+    free(entries);
+    return result;
+}
+
+void *map_model(char *file_name, size_t *size) {
+#ifdef MODEL_NO_MMAP
+    FILE *file = fopen(file_name, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    void *buffer = aligned_malloc(*size);
+    if (buffer == NULL || fread(buffer, 1, *size, file) != *size) {
+        aligned_free(buffer);
+        buffer = NULL;
+    }
+    fclose(file);
+    return buffer;
+#else
+    int descriptor = open(file_name, O_RDONLY);
+    if (descriptor < 0) {
+        return NULL;
+    }
+    struct stat status;
+    fstat(descriptor, &status);
+    *size = status.st_size;
+    void *mapping = *size == 0 ? MAP_FAILED :
+                    mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    return mapping == MAP_FAILED ? NULL : mapping;
+#endif
+}
+
+void unmap_model(void *mapping, size_t mapping_size) {
+#ifdef MODEL_NO_MMAP
+    (void) mapping_size;
+    aligned_free(mapping);
+#else
+    munmap(mapping, mapping_size);
+#endif
+}
+
+// whether count values of value_size bytes starting at offset lie in the image, without overflowing
+static int block_fits(uint64_t offset, uint64_t count, uint64_t value_size, size_t size) {
+    return offset <= size && count <= (size - offset) / value_size;
+}
+
+static int valid_model(const unsigned char *image, size_t size, int verify_checksum) {
+    const ModelHeader *header = (const ModelHeader *) image;
+    if (size < sizeof(ModelHeader) || memcmp(header->magic, MODEL_MAGIC, 4) != 0) {
+        printf("Error: Not a model file!\n");
+        return 0;
+    }
+    if (header->version != MODEL_VERSION || (header->dtype != MODEL_FLOAT64 && header->dtype != MODEL_FLOAT32) ||
+        header->activation != MODEL_ACTIVATION_LEAKY_RELU_SOFTMAX) {
+        printf("Error: Unsupported model version, dtype or activation!\n");
+        return 0;
+    }
+    if (header->file_size != size || header->number_of_layers < 2 ||
+        !block_fits(sizeof(ModelHeader), header->number_of_layers, sizeof(ModelLayerEntry), size)) {
+        printf("Error: Model file is truncated!\n");
+        return 0;
+    }
+    const ModelLayerEntry *entries = (const ModelLayerEntry *) (image + sizeof(ModelHeader));
+    uint64_t value_size = header->dtype == MODEL_FLOAT32 ? sizeof(float) : sizeof(double);
+    for (uint32_t i = 0; i < header->number_of_layers; i++) {
+        //layer_size times weights_stride, both 32 bits, fits in 64 bits
+        if (!block_fits(entries[i].weights_offset, (uint64_t) entries[i].layer_size * entries[i].weights_stride,
+                        value_size, size) ||
+            !block_fits(entries[i].biases_offset, entries[i].layer_size, value_size, size) ||
+            entries[i].weights_offset % MODEL_ALIGNMENT != 0 || entries[i].biases_offset % value_size != 0 ||
+            entries[i].weights_stride < entries[i].input_size ||
+            (i > 0 && entries[i].input_size != entries[i - 1].layer_size)) {
+            printf("Error: Model layer table is corrupt!\n");
+            return 0;
+        }
+    }
+    if (verify_checksum &&
+        model_crc32(0, image + sizeof(ModelHeader), size - sizeof(ModelHeader)) != header->checksum) {
+        printf("Error: Model checksum does not match!\n");
+        return 0;
+    }
+    return 1;
+}
+
+Network *load_network_binary(char *file_name, int verify_checksum) {
+    size_t size = 0;
+    unsigned char *image = map_model(file_name, &size);
+    if (image == NULL) {
+        printf("Error: Could not open file!\n");
+        return NULL;
+    }
+    if (!valid_model(image, size, verify_checksum)) {
+        unmap_model(image, size);
+        return NULL;
+    }
+    const ModelHeader *header = (const ModelHeader *) image;
+    const ModelLayerEntry *entries = (const ModelLayerEntry *) (image + sizeof(ModelHeader));
+    int number_of_layers = (int) header->number_of_layers;
+    int *layer_sizes = malloc(number_of_layers * sizeof(int));
+    for (int i = 0; i < number_of_layers; i++) {
+        layer_sizes[i] = (int) entries[i].layer_size;
+    }
+    Network *network = create_network(number_of_layers, layer_sizes);
+    free(layer_sizes);
+
+    if (header->dtype != MODEL_VALUE_DTYPE) {
+        //values of the other precision are converted one by one, the file is not needed afterwards
+        for (int i = 1; i < number_of_layers; i++) {
+            Layer *layer = network->layers[i];
+            const unsigned char *weights = image + entries[i].weights_offset;
+            const unsigned char *biases = image + entries[i].biases_offset;
+            for (int j = 0; j < layer->layer_size; j++) {
+                for (int k = 0; k < layer->input_size; k++) {
+                    size_t index = (size_t) j * entries[i].weights_stride + k;
+                    MATRIX_AT(layer->weights, j, k) = (MatrixValue) (header->dtype == MODEL_FLOAT32
+                                                                     ? ((const float *) weights)[index]
+                                                                     : ((const double *) weights)[index]);
+                }
+                MATRIX_AT(layer->biases, j, 0) = (MatrixValue) (header->dtype == MODEL_FLOAT32
+                                                                ? ((const float *) biases)[j]
+                                                                : ((const double *) biases)[j]);
+            }
+        }
+        unmap_model(image, size);
+        return network;
+    }
+
+    //swap the freshly allocated weights and biases for the mapped blobs
+    for (int i = 0; i < number_of_layers; i++) {
+        Matrix *weights = network->layers[i]->weights;
+        Matrix *biases = network->layers[i]->biases;
+        if (weights->owns_values) {
+            aligned_free(weights->values);
+        }
+        if (biases->owns_values) {
+            aligned_free(biases->values);
+        }
+        weights->values = (MatrixValue *) (image + entries[i].weights_offset);
+        weights->stride = (int) entries[i].weights_stride;
+        weights->owns_values = 0;
+        biases->values = (MatrixValue *) (image + entries[i].biases_offset);
+        biases->owns_values = 0;
+    }
+    network->mapping = image;
+    network->mapping_size = size;
+    return network;
+}
+
+Network *load_network_any(char *file_name) {
+    char magic[4] = {0};
+    FILE *file = fopen(file_name, "rb");
+    if (file == NULL) {
+        printf("Error: Could not open file!\n");
+        return NULL;
+    }
+    size_t read = fread(magic, 1, 4, file);
+    fclose(file);
+    if (read == 4 && memcmp(magic, MODEL_MAGIC, 4) == 0) {
+        return load_network_binary(file_name, 1);
+    }
+    return load_network_from_file(file_name);
+}
+
+int save_network_any(Network *network, char *file_name) {
+    size_t length = strlen(file_name);
+    if (length >= 4 && strcmp(file_name + length - 4, ".bin") == 0) {
+        return save_network_binary(network, file_name);
+    }
+    return save_network_to_file(network, file_name);
+}
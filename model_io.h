@@ -0,0 +1,85 @@
+//
+// Versioned binary model format. The header and a per-layer table are followed by the weight
+// and bias blobs, each aligned to 64 bytes and stored with the row stride of the in-memory
+// matrices, so a mapped file is used as the layers' weight buffers directly.
+//
+
+#ifndef SEM2LAB2_MODEL_IO_H
+#define SEM2LAB2_MODEL_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "network.h"
+
+#define MODEL_MAGIC "NNMD"
+#define MODEL_VERSION 1
+#define MODEL_ALIGNMENT 64
+
+enum ModelActivation {
+    //Leaky ReLU with ReLU_A/ReLU_B in hidden layers, softmax in the output layer
+    MODEL_ACTIVATION_LEAKY_RELU_SOFTMAX = 1
+} typedef ModelActivation;
+
+enum ModelDtype {
+    MODEL_FLOAT64 = 1,
+    MODEL_FLOAT32 = 2
+} typedef ModelDtype;
+
+// models are saved in the precision of the matrices
+#ifdef MATRIX_FLOAT32
+#define MODEL_VALUE_DTYPE MODEL_FLOAT32
+#else
+#define MODEL_VALUE_DTYPE MODEL_FLOAT64
+#endif
+
+// on-disk header, little endian, MODEL_ALIGNMENT bytes long
+struct ModelHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t number_of_layers;
+    uint32_t activation;
+    uint32_t dtype;
+    uint32_t reserved0;
+    //CRC-32 of every byte after the header
+    uint64_t checksum;
+    uint64_t file_size;
+    uint8_t reserved[24];
+} typedef ModelHeader;
+
+// one entry per layer right after the header, the input layer has no weights
+struct ModelLayerEntry {
+    uint32_t layer_size;
+    uint32_t input_size;
+    uint32_t weights_stride;
+    uint32_t reserved;
+    uint64_t weights_offset;
+    uint64_t biases_offset;
+} typedef ModelLayerEntry;
+
+// write the network in the binary format, returns 0 on success
+int save_network_binary(Network *network, char *file_name);
+
+// map a binary model, the layers' weights and biases point into the private mapping
+// writes such as training stay in memory and never reach the file
+// models saved in the other precision are converted into the network's own buffers instead
+// verify_checksum reads the whole file once to compare the CRC-32
+// returns NULL when the file is missing or malformed
+Network *load_network_binary(char *file_name, int verify_checksum);
+
+// load a binary model, recognized by its magic and checked against its CRC-32, or a text model
+Network *load_network_any(char *file_name);
+
+// save in the binary format when file_name ends in ".bin", in the text format otherwise, returns 0 on success
+int save_network_any(Network *network, char *file_name);
+
+// CRC-32 of length bytes continuing from crc, 0 starts a new checksum
+uint32_t model_crc32(uint32_t crc, const unsigned char *data, size_t length);
+
+// map the whole file copy-on-write, returns NULL on failure
+// also used for the other model formats, release it with unmap_model
+void *map_model(char *file_name, size_t *size);
+
+// release the mapping of a network created by load_network_binary, called by free_network
+void unmap_model(void *mapping, size_t mapping_size);
+
+#endif //SEM2LAB2_MODEL_IO_H
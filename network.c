@@ -0,0 +1,884 @@
+//
+// Created by szymc on 01.05.2023.
+//
+
+#include "network.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "matrix_utils.h"
+#include "training.h"
+#include "parallel_training.h"
+#include "async_training.h"
+#include "distributed.h"
+#include "evaluation.h"
+#include "thread_pool.h"
+#include "stream_loader.h"
+#include "sampler.h"
+#include "model_io.h"
+#include "arena.h"
+#include "gradients.h"
+
+// ReLU activation function
+double ReLU(double x) {
+    if (x < 0) {
+        return x * ReLU_A;
+    }
+    return x * ReLU_B;
+};
+
+double ReLU_derivative(double x) {
+    if (x >= 0) {
+        return ReLU_B;
+    } else {
+        return ReLU_A;
+    }
+}
+
+//normalized softmax function for the output layer
+void softmax(Matrix *matrix, Matrix *result) {
+    layer_softmax(matrix, result);
+}
+
+// bytes of the arena holding a network with this topology
+static size_t network_arena_size(int number_of_layers, int *layer_sizes) {
+    size_t size = arena_size_of(sizeof(Network)) + arena_size_of(number_of_layers * sizeof(Layer *));
+    for (int i = 0; i < number_of_layers; i++) {
+        int input_size = i == 0 ? 0 : layer_sizes[i - 1];
+        size += arena_size_of(sizeof(Layer));
+        //weights and delta_weights, then biases, delta_biases, weighted_sums, activations and deltas
+        size += 2 * arena_size_of_matrix(layer_sizes[i], input_size) + 5 * arena_size_of_matrix(layer_sizes[i], 1);
+        if (i == 0) {
+            size += arena_size_of_matrix(0, 0);
+        }
+    }
+    return size;
+}
+
+// create network, every buffer lives in one arena
+Network *create_network(int number_of_layers, int *layer_sizes) {
+    Arena *arena = create_arena(network_arena_size(number_of_layers, layer_sizes));
+    Network *network = arena_alloc(arena, sizeof(Network));
+    network->arena = arena;
+
+    network->number_of_layers = number_of_layers;
+    network->mapping = NULL;
+    network->mapping_size = 0;
+    network->loss = LOSS_CROSS_ENTROPY;
+    network->layers = arena_alloc(arena, number_of_layers * sizeof(Layer *));
+    // create layers
+    for (int i = 0; i < number_of_layers; i++) {
+        network->layers[i] = arena_alloc(arena, sizeof(Layer));
+        network->layers[i]->layer_size = layer_sizes[i];
+        if (i == 0) {//input layer
+            network->layers[i]->input_size = 0;
+            network->layers[i]->input = arena_create_matrix(arena, 0, 0);
+        } else {
+            network->layers[i]->input_size = layer_sizes[i - 1];
+            network->layers[i]->input = network->layers[i - 1]->activations;
+        }
+        if (i == number_of_layers - 1) {//output layer
+            network->layers[i]->output_size = 0;
+            network->layers[i]->activation = LAYER_ACTIVATION_SOFTMAX;
+        } else { //hidden layers
+            network->layers[i]->output_size = layer_sizes[i + 1];
+            network->layers[i]->activation = i == 0 ? LAYER_ACTIVATION_NONE : LAYER_ACTIVATION_LEAKY_RELU;
+        }
+
+        network->layers[i]->weights = arena_create_matrix(arena, network->layers[i]->layer_size,
+                                                          network->layers[i]->input_size);
+        network->layers[i]->delta_weights = arena_create_matrix(arena, network->layers[i]->layer_size,
+                                                                network->layers[i]->input_size);
+        network->layers[i]->weighted_sums = arena_create_matrix(arena, network->layers[i]->layer_size, 1);
+        network->layers[i]->activations = arena_create_matrix(arena, network->layers[i]->layer_size, 1);
+        network->layers[i]->deltas = arena_create_matrix(arena, network->layers[i]->layer_size, 1);
+
+        //randomize weights
+        randomize_matrix(network->layers[i]->weights);
+
+        //initialize bias, the arena hands out zeroed memory
+        network->layers[i]->biases = arena_create_matrix(arena, network->layers[i]->layer_size, 1);
+        network->layers[i]->delta_biases = arena_create_matrix(arena, network->layers[i]->layer_size, 1);
+//        randomize_matrix(network->layers[i]->biases);
+    }
+    return network;
+}
+
+void free_network(Network *network) {
+    if (network->mapping != NULL) {
+        unmap_model(network->mapping, network->mapping_size);
+    }
+    //the network struct itself lives in the arena
+    free_arena(network->arena);
+}
+
+// propagate forward through the network
+void propagate_forward(Network *network, Matrix *input) {
+    //assign input to the activations of the input layer
+    copy_matrix(input, network->layers[0]->activations);
+
+    //weighted sums, bias and activation of every layer after the input layer in one pass each
+    for (int i = 1; i < network->number_of_layers; i++) {
+        Layer *layer = network->layers[i];
+        layer_forward(layer->activation, layer->weights, layer->input, 0, layer->biases, layer->weighted_sums,
+                      layer->activations);
+    }
+}
+
+// propagate the last sample passed to propagate_forward backward and add its gradient to the layers' accumulators
+void propagate_backward(Network *network, Matrix *target) {
+    int output_layer = network->number_of_layers - 1;
+    for (int k = output_layer; k >= 1; k--) {
+        Layer *layer = network->layers[k];
+        if (k == output_layer) {
+            layer_backward_output(network->loss, layer->activations, target, layer->input, 0, layer->deltas,
+                                  layer->delta_weights, layer->delta_biases);
+        } else {
+            layer_backward_hidden(layer->activation, network->layers[k + 1]->weights,
+                                  network->layers[k + 1]->deltas, layer->weighted_sums, layer->input, 0,
+                                  layer->deltas, layer->delta_weights, layer->delta_biases);
+        }
+    }
+}
+
+// print the entire structure of the network
+void print_network(Network *network) {
+    for (int i = 0; i < network->number_of_layers; i++) {
+        printf("Layer %d\n", i);
+        printf("Input size: %d\n", network->layers[i]->input_size);
+        printf("Layer size: %d\n", network->layers[i]->layer_size);
+        printf("Output size: %d\n", network->layers[i]->output_size);
+        printf("Input:\n");
+        print_matrix(network->layers[i]->input);
+        printf("Weights:\n");
+        print_matrix(network->layers[i]->weights);
+        printf("Weighted sums:\n");
+        print_matrix(network->layers[i]->weighted_sums);
+        printf("Activations:\n");
+        print_matrix(network->layers[i]->activations);
+        printf("\n");
+    }
+}
+
+double calculate_loss(Matrix *output_layer, Matrix *target) {
+    return layer_loss(LOSS_MEAN_SQUARED_ERROR, output_layer, target);
+}
+
+double calculate_average_loss(Network *network, TrainingDataPacket **training_data, int length_of_training_data) {
+    double loss = 0;
+    for (int j = 0; j < length_of_training_data; j++) {
+        //propagate forward
+        propagate_forward(network, training_data[j]->input);
+        //calculate loss
+        loss += layer_loss(network->loss, network->layers[network->number_of_layers - 1]->activations,
+                           training_data[j]->target);
+    }
+    //return average loss
+    return loss / length_of_training_data;
+}
+
+
+// calculate average success rate of the network on the training values
+// by comparing the output to the target and counting the number of correct outputs
+double
+calculate_average_success_rate(Network *network, TrainingDataPacket **training_data, int length_of_training_data) {
+    double success_rate = 0;
+    for (int j = 0; j < length_of_training_data; j++) {
+        propagate_forward(network, training_data[j]->input);
+
+        //check if the output matches the target
+        if (vector_max_index(network->layers[network->number_of_layers - 1]->activations) ==
+            vector_max_index(training_data[j]->target)) {
+            success_rate++;
+        }
+    }
+    return success_rate / length_of_training_data;
+}
+
+double output_node_cost_derivative(LossFunction loss, double output, double target) {
+    return loss == LOSS_CROSS_ENTROPY ? output - target : 2 * (output - target);
+}
+
+
+void calculate_deltas_for_layer(Network *network, int layer_index, Matrix *target) {
+    //calculate deltas for output layer
+    //for softmax with cross entropy the equation is delta_i = a_i - y_i
+    if (layer_index == network->number_of_layers - 1) {
+        Layer *layer = network->layers[layer_index];
+        //calculate deltas for each neuron in the output layer
+        MatrixAccumulator dot = 0;
+        for (int i = 0; i < layer->layer_size; i++) {
+            MATRIX_AT(layer->deltas, i, 0) = output_node_cost_derivative(network->loss,
+                    MATRIX_AT(layer->activations, i, 0), MATRIX_AT(target, i, 0));
+            dot += MATRIX_AT(layer->activations, i, 0) * MATRIX_AT(layer->deltas, i, 0);
+        }
+        //other losses are differentiated through the softmax: delta_i = a_i * (e_i - sum_k a_k * e_k)
+        if (network->loss != LOSS_CROSS_ENTROPY) {
+            for (int i = 0; i < layer->layer_size; i++) {
+                MATRIX_AT(layer->deltas, i, 0) = MATRIX_AT(layer->activations, i, 0) *
+                                                 (MATRIX_AT(layer->deltas, i, 0) - (MatrixValue) dot);
+            }
+        }
+    } else {
+        //calculate deltas for each neuron in the hidden layer
+        //the equation is delta_i = sum(delta_j * w_ij) * ReLU'(z_i)
+        for (int i = 0; i < network->layers[layer_index]->layer_size; i++) {
+            MatrixAccumulator sum = 0;
+            //calculate the sum of the deltas of the neurons in the next layer multiplied by their weights
+            for (int j = 0; j < network->layers[layer_index + 1]->layer_size; j++) {
+                sum += MATRIX_AT(network->layers[layer_index + 1]->weights, j, i) *
+                       MATRIX_AT(network->layers[layer_index + 1]->deltas, j, 0);
+            }
+            //multiply the sum by the derivative of the weighted sum of the current neuron
+            MATRIX_AT(network->layers[layer_index]->deltas, i, 0) = sum *
+                    ACTIVATION_FUNCTION_DERIVATIVE(
+                                                                         MATRIX_AT(network->layers[layer_index]->weighted_sums, i, 0));
+        }
+    }
+}
+
+// add the delta weights for a layer for the current pass
+// the equation is delta_w_ij = delta_j * a_i
+void add_gradient_weights_for_layer(Network *network, int layer_index) {
+    for (int i = 0; i < network->layers[layer_index]->layer_size; i++) {
+        MatrixValue *delta_weights_row = matrix_row(network->layers[layer_index]->delta_weights, i);
+        MatrixValue delta = MATRIX_AT(network->layers[layer_index]->deltas, i, 0);
+        for (int j = 0; j < network->layers[layer_index]->input_size; j++) {
+            delta_weights_row[j] += delta * MATRIX_AT(network->layers[layer_index]->input, j, 0);
+        }
+    }
+}
+
+// add the delta biases for a layer for the current pass
+// the delta biases are the same as the deltas for the layer
+void add_gradient_biases_for_layer(Network *network, int layer_index) {
+    for (int i = 0; i < network->layers[layer_index]->layer_size; i++) {
+        MATRIX_AT(network->layers[layer_index]->delta_biases, i, 0) += MATRIX_AT(network->layers[layer_index]->deltas, i, 0);
+    }
+}
+
+void average_gradient_weights_for_layer(Network *network, int layer_index, int length_of_training_data) {
+    for (int i = 0; i < network->layers[layer_index]->layer_size; i++) {
+        MatrixValue *delta_weights_row = matrix_row(network->layers[layer_index]->delta_weights, i);
+        for (int j = 0; j < network->layers[layer_index]->input_size; j++) {
+            delta_weights_row[j] /= length_of_training_data;
+        }
+    }
+}
+
+void average_gradient_biases_for_layer(Network *network, int layer_index, int length_of_training_data) {
+    for (int i = 0; i < network->layers[layer_index]->layer_size; i++) {
+        MATRIX_AT(network->layers[layer_index]->delta_biases, i, 0) /= length_of_training_data;
+    }
+}
+
+// move the weights in the direction of the -gradient in proportion to the learning rate
+void update_weights_for_layer(Network *network, int layer_index, double learning_rate) {
+    for (int i = 0; i < network->layers[layer_index]->layer_size; i++) {
+        MatrixValue *weights_row = matrix_row(network->layers[layer_index]->weights, i);
+        const MatrixValue *delta_weights_row = matrix_row(network->layers[layer_index]->delta_weights, i);
+        for (int j = 0; j < network->layers[layer_index]->input_size; j++) {
+            weights_row[j] -= learning_rate * delta_weights_row[j];
+        }
+    }
+}
+
+// move the biases in the direction of the -gradient in proportion to the learning rate
+void update_biases_for_layer(Network *network, int layer_index, double learning_rate) {
+    for (int i = 0; i < network->layers[layer_index]->layer_size; i++) {
+        MATRIX_AT(network->layers[layer_index]->biases, i, 0) -=
+                learning_rate * MATRIX_AT(network->layers[layer_index]->delta_biases, i, 0);
+    }
+}
+
+// train the network on the given training data for the given number of epochs
+void train_network(Network *network, TrainingDataPacket **training_data, int length_of_training_data, int epochs,
+                   double learning_rate) {
+
+    Evaluator *evaluator = create_evaluator(network, NULL);
+    double last_loss = evaluate_network(evaluator, training_data, length_of_training_data)->average_loss;
+    zero_gradients(network);
+    for (int i = 0; i < epochs; i++) {
+        for (int j = 0; j < length_of_training_data; j++) {
+            //propagate forward, then the deltas (the error that is propagated backward) and gradients of all layers
+            propagate_forward(network, training_data[j]->input);
+            propagate_backward(network, training_data[j]->target);
+        }
+
+        //average the gradient of all data, apply it to the weights and biases and zero it for the next epoch
+        apply_gradients(network, length_of_training_data, learning_rate);
+
+        // calculate average loss and success rate every 10 epochs
+        if (i % 100 == 0) {
+            Evaluation *evaluation = evaluate_network(evaluator, training_data, length_of_training_data);
+            double loss = evaluation->average_loss;
+            printf("avg loss: %f\n", loss);
+            printf("success rate: %f\n", evaluation->success_rate);
+            if (loss > last_loss) {
+                learning_rate *= 0.96;
+                printf("learning rate: %f\n", learning_rate);
+            }
+            last_loss = loss;
+        }
+    }
+    free_evaluator(evaluator);
+}
+
+// training function with no loss calculation for stochastic gradient descent
+void train_network_no_loss_calc(Network *network, TrainingDataPacket **training_data, int length_of_training_data,
+                                int epochs,
+                                double learning_rate) {
+    zero_gradients(network);
+    for (int i = 0; i < epochs; i++) {
+        for (int j = 0; j < length_of_training_data; j++) {
+            //propagate forward
+            propagate_forward(network, training_data[j]->input);
+            //calculate deltas for all layers (deltas being the error that is propagated backward)
+            for (int k = network->number_of_layers-1; k >= 0; k--) {
+                calculate_deltas_for_layer(network, k, training_data[j]->target);
+                add_gradient_weights_for_layer(network, k);
+                add_gradient_biases_for_layer(network, k);
+            }
+        }
+
+        //average the gradient of all data, apply it to the weights and biases and zero it for the next epoch
+        apply_gradients(network, length_of_training_data, learning_rate);
+    }
+}
+
+// batch buffers in one arena, with private gradient accumulators if with_gradients is set
+static Batch *allocate_batch(Network *network, int capacity, int with_gradients) {
+    int number_of_layers = network->number_of_layers;
+    int output_size = network->layers[number_of_layers - 1]->layer_size;
+    size_t size = arena_size_of(sizeof(Batch)) + 5 * arena_size_of(number_of_layers * sizeof(Matrix *)) +
+                  arena_size_of_matrix(output_size, capacity);
+    for (int i = 0; i < number_of_layers; i++) {
+        size += 3 * arena_size_of_matrix(network->layers[i]->layer_size, capacity);
+        if (with_gradients) {
+            size += arena_size_of_matrix(network->layers[i]->layer_size, network->layers[i]->input_size) +
+                    arena_size_of_matrix(network->layers[i]->layer_size, 1);
+        }
+    }
+    Arena *arena = create_arena(size);
+    Batch *batch = arena_alloc(arena, sizeof(Batch));
+    batch->arena = arena;
+    batch->capacity = capacity;
+    batch->size = 0;
+    batch->number_of_layers = number_of_layers;
+    batch->weighted_sums = arena_alloc(arena, number_of_layers * sizeof(Matrix *));
+    batch->activations = arena_alloc(arena, number_of_layers * sizeof(Matrix *));
+    batch->deltas = arena_alloc(arena, number_of_layers * sizeof(Matrix *));
+    for (int i = 0; i < number_of_layers; i++) {
+        batch->weighted_sums[i] = arena_create_matrix(arena, network->layers[i]->layer_size, capacity);
+        batch->activations[i] = arena_create_matrix(arena, network->layers[i]->layer_size, capacity);
+        batch->deltas[i] = arena_create_matrix(arena, network->layers[i]->layer_size, capacity);
+    }
+    batch->targets = arena_create_matrix(arena, output_size, capacity);
+    batch->delta_weights = arena_alloc(arena, number_of_layers * sizeof(Matrix *));
+    batch->delta_biases = arena_alloc(arena, number_of_layers * sizeof(Matrix *));
+    for (int i = 0; i < number_of_layers; i++) {
+        if (with_gradients) {
+            batch->delta_weights[i] = arena_create_matrix(arena, network->layers[i]->layer_size,
+                                                          network->layers[i]->input_size);
+            batch->delta_biases[i] = arena_create_matrix(arena, network->layers[i]->layer_size, 1);
+        } else {
+            batch->delta_weights[i] = network->layers[i]->delta_weights;
+            batch->delta_biases[i] = network->layers[i]->delta_biases;
+        }
+    }
+    batch->owns_gradients = with_gradients;
+    batch->uses_input_rows = 0;
+    return batch;
+}
+
+// create batch buffers for up to capacity samples
+Batch *create_batch(Network *network, int capacity) {
+    return allocate_batch(network, capacity, 0);
+}
+
+// create batch buffers that sum gradients into private accumulators instead of the layers' ones
+Batch *create_batch_with_gradients(Network *network, int capacity) {
+    return allocate_batch(network, capacity, 1);
+}
+
+void free_batch(Batch *batch) {
+    free_arena(batch->arena);
+}
+
+// set the batch gradient accumulators to zero
+void zero_batch_gradients(Batch *batch) {
+    for (int i = 0; i < batch->number_of_layers; i++) {
+        fill_matrix(batch->delta_weights[i], 0);
+        fill_matrix(batch->delta_biases[i], 0);
+    }
+}
+
+// copy the inputs and targets of the packets into the columns of the batch
+void load_batch(Batch *batch, TrainingDataPacket **packets, int number_of_packets) {
+    if (number_of_packets > batch->capacity) {
+        printf("Error: Batch is too small!\n");
+        number_of_packets = batch->capacity;
+    }
+    batch->size = number_of_packets;
+    batch->uses_input_rows = 0;
+    for (int j = 0; j < number_of_packets; j++) {
+        for (int i = 0; i < packets[j]->input->rows; i++) {
+            MATRIX_AT(batch->activations[0], i, j) = MATRIX_AT(packets[j]->input, i, 0);
+        }
+        for (int i = 0; i < packets[j]->target->rows; i++) {
+            MATRIX_AT(batch->targets, i, j) = MATRIX_AT(packets[j]->target, i, 0);
+        }
+    }
+}
+
+// load count samples starting at sample first, contiguous rows are used in place without copying
+// targets are one-hot encoded from the class indices
+void load_batch_rows(Batch *batch, const SampleRows *rows, int first, int count) {
+    if (count > batch->capacity) {
+        printf("Error: Batch is too small!\n");
+        count = batch->capacity;
+    }
+    batch->size = count;
+    if (rows->indices == NULL) {
+        //the forward pass multiplies by the transposed rows directly
+        batch->uses_input_rows = 1;
+        batch->input_rows.rows = count;
+        batch->input_rows.cols = rows->number_of_features;
+        batch->input_rows.stride = rows->feature_stride;
+        batch->input_rows.values = (MatrixValue *) rows->features + (size_t) first * rows->feature_stride;
+        batch->input_rows.owns_values = 0;
+        batch->input_rows.in_arena = 0;
+    } else {
+        //scattered samples are gathered into the columns of activations[0]
+        batch->uses_input_rows = 0;
+        for (int j = 0; j < count; j++) {
+            const MatrixValue *sample = rows->features + (size_t) rows->indices[first + j] * rows->feature_stride;
+            for (int i = 0; i < rows->number_of_features; i++) {
+                MATRIX_AT(batch->activations[0], i, j) = sample[i];
+            }
+        }
+    }
+    Matrix targets = matrix_view(batch->targets, 0, 0, batch->targets->rows, count);
+    fill_matrix(&targets, 0);
+    for (int j = 0; j < count; j++) {
+        int sample = rows->indices == NULL ? first + j : rows->indices[first + j];
+        MATRIX_AT(batch->targets, rows->labels[sample], j) = 1;
+    }
+}
+
+// softmax of every column of the matrix
+void softmax_columns(Matrix *matrix, Matrix *result) {
+    layer_softmax(matrix, result);
+}
+
+// forward pass of the loaded samples, one matrix-matrix product per layer
+void propagate_forward_batch(Network *network, Batch *batch) {
+    for (int i = 1; i < network->number_of_layers; i++) {
+        Layer *layer = network->layers[i];
+        //only the first batch->size columns hold samples
+        Matrix input = matrix_view(batch->activations[i - 1], 0, 0, layer->input_size, batch->size);
+        Matrix weighted_sums = matrix_view(batch->weighted_sums[i], 0, 0, layer->layer_size, batch->size);
+        Matrix activations = matrix_view(batch->activations[i], 0, 0, layer->layer_size, batch->size);
+
+        //Z = W * A + b and f(Z) for all samples at once
+        if (i == 1 && batch->uses_input_rows) {
+            layer_forward(layer->activation, layer->weights, &batch->input_rows, 1, layer->biases, &weighted_sums,
+                          &activations);
+        } else {
+            layer_forward(layer->activation, layer->weights, &input, 0, layer->biases, &weighted_sums,
+                          &activations);
+        }
+    }
+}
+
+// backward pass of the loaded samples, adds the summed gradients to the batch gradient accumulators
+void propagate_backward_batch(Network *network, Batch *batch) {
+    int output_layer = network->number_of_layers - 1;
+    for (int k = output_layer; k >= 1; k--) {
+        Layer *layer = network->layers[k];
+        Matrix deltas = matrix_view(batch->deltas[k], 0, 0, layer->layer_size, batch->size);
+        //the gradient is dW += D_k * A_k-1^T, the first layer can read the rows of samples as A^T
+        int input_rows = k == 1 && batch->uses_input_rows;
+        Matrix input = input_rows ? batch->input_rows
+                                  : matrix_view(batch->activations[k - 1], 0, 0, layer->input_size, batch->size);
+        if (k == output_layer) {
+            //delta_i = 2 * (a_i - y_i) or a_i - y_i for every sample, depending on the loss
+            Matrix activations = matrix_view(batch->activations[k], 0, 0, layer->layer_size, batch->size);
+            Matrix targets = matrix_view(batch->targets, 0, 0, layer->layer_size, batch->size);
+            layer_backward_output(network->loss, &activations, &targets, &input, input_rows, &deltas, batch->delta_weights[k],
+                                  batch->delta_biases[k]);
+        } else {
+            //D_k = (W_k+1^T * D_k+1) .* ReLU'(Z_k)
+            Matrix next_deltas = matrix_view(batch->deltas[k + 1], 0, 0, network->layers[k + 1]->layer_size,
+                                             batch->size);
+            Matrix weighted_sums = matrix_view(batch->weighted_sums[k], 0, 0, layer->layer_size, batch->size);
+            layer_backward_hidden(layer->activation, network->layers[k + 1]->weights, &next_deltas,
+                                  &weighted_sums, &input, input_rows, &deltas, batch->delta_weights[k],
+                                  batch->delta_biases[k]);
+        }
+    }
+}
+
+// average the accumulated gradients over number_of_samples, move the weights and biases against them and
+// zero the accumulators for the next step
+void apply_gradients(Network *network, int number_of_samples, double learning_rate) {
+    //average delta weights and biases for all layers
+    for (int k = network->number_of_layers - 1; k >= 1; k--) {
+        average_gradient_weights_for_layer(network, k, number_of_samples);
+        average_gradient_biases_for_layer(network, k, number_of_samples);
+    }
+
+    //update weights and biases for all layers
+    for (int k = network->number_of_layers - 1; k >= 1; k--) {
+        update_weights_for_layer(network, k, learning_rate);
+        update_biases_for_layer(network, k, learning_rate);
+    }
+    zero_gradients(network);
+}
+
+// same step as train_network_no_loss_calc computed on the whole mini-batch at once
+void train_network_batched(Network *network, Batch *batch, TrainingDataPacket **training_data,
+                           int length_of_training_data, double learning_rate) {
+    zero_gradients(network);
+    load_batch(batch, training_data, length_of_training_data);
+    propagate_forward_batch(network, batch);
+    propagate_backward_batch(network, batch);
+    apply_gradients(network, batch->size, learning_rate);
+}
+
+TrainingOptions default_training_options() {
+    TrainingOptions options;
+    options.epochs = 10000;
+    options.split_size = 1000;
+    options.learning_rate = 0.1;
+    options.number_of_threads = default_thread_count();
+    options.evaluation_data = NULL;
+    options.length_of_evaluation_data = 0;
+    options.evaluation_rows = NULL;
+    options.evaluation_interval = 100;
+    options.seed = 1;
+    options.optimizer = default_optimizer_options(OPTIMIZER_SGD);
+    options.schedule = default_learning_rate_schedule();
+    options.max_gradient_norm = 0;
+    options.profiler = NULL;
+    options.asynchronous = 0;
+    options.asynchronous_update_size = 16;
+    options.communicator = NULL;
+    return options;
+}
+
+// only the first of several processes training together prints its progress
+static int prints_progress(const TrainingOptions *options) {
+    return options->communicator == NULL || options->communicator->rank == 0;
+}
+
+// with a communicator the evaluation of this process's samples becomes the one of every process's samples,
+// so the loss decay schedules of all processes lower the learning rate together
+static Evaluation *gather_evaluation(const TrainingOptions *options, Evaluation *evaluation) {
+    if (options->communicator != NULL && all_reduce_evaluation(options->communicator, evaluation) != 0) {
+        printf("Error: Could not combine the evaluations of the processes!\n");
+        exit(1);
+    }
+    return evaluation;
+}
+
+// print the progress block of the stochastic training loops, loss decay schedules lower the learning rate
+// when the loss rose
+static void report_progress(Evaluation *evaluation, int iteration, const TrainingOptions *options,
+                            double gradient_norm, long skipped_steps, double *learning_rate, double *last_loss) {
+    double loss = evaluation->average_loss;
+    if (prints_progress(options)) {
+        printf("____________________________________________________\n");
+        //print finished percentage
+        printf("finished: %.2f%%\n", (double) iteration / options->epochs * 100);
+        //print the average loss and success rate
+        printf("avg loss: %f\n", loss);
+        //print succes rate in green color
+        printf("\033[0;32m");
+        printf("success rate: %.2f%%\n", evaluation->success_rate * 100);
+        printf("\033[0m");
+        printf("gradient norm: %f\n", gradient_norm);
+        if (skipped_steps > 0) {
+            printf("skipped steps: %ld\n", skipped_steps);
+        }
+    }
+    profiler_record(options->profiler, iteration, loss, evaluation->success_rate);
+    double decayed = schedule_loss_decay(&options->schedule, *learning_rate, loss, *last_loss);
+    if (decayed != *learning_rate) {
+        *learning_rate = decayed;
+        if (prints_progress(options)) {
+            printf("learning rate: %f\n", *learning_rate);
+        }
+    }
+    *last_loss = loss;
+}
+
+// the trainer of the stochastic training loops with the optimizer, clipping and profiler of the options
+static ParallelTrainer *create_stochastic_trainer(Network *network, int batch_capacity,
+                                                  const TrainingOptions *options) {
+    ParallelTrainer *trainer = create_parallel_trainer(network, batch_capacity, options->number_of_threads);
+    trainer->optimizer = create_optimizer(network, options->optimizer);
+    trainer->max_gradient_norm = options->max_gradient_norm;
+    trainer->profiler = options->profiler;
+    trainer->communicator = options->communicator;
+    return trainer;
+}
+
+static void free_stochastic_trainer(ParallelTrainer *trainer) {
+    free_optimizer(trainer->optimizer);
+    free_parallel_trainer(trainer);
+}
+
+static void report_final_result(Evaluation *evaluation, const TrainingOptions *options) {
+    if (!prints_progress(options)) {
+        return;
+    }
+    printf("____________________________________________________\n");
+    printf("final success rate: %.2f%%\n", evaluation->success_rate * 100);
+    print_confusion_matrix(evaluation);
+}
+
+// the held-out samples of the options when there are any, the training data otherwise
+static Evaluation *evaluate_progress(Evaluator *evaluator, TrainingDataPacket **training_data,
+                                     int length_of_training_data, const SampleRows *training_rows,
+                                     const TrainingOptions *options) {
+    if (training_rows != NULL) {
+        return evaluate_rows(evaluator, options->evaluation_rows != NULL ? options->evaluation_rows : training_rows);
+    }
+    if (options->evaluation_data != NULL) {
+        return evaluate_network(evaluator, options->evaluation_data, options->length_of_evaluation_data);
+    }
+    return evaluate_network(evaluator, training_data, length_of_training_data);
+}
+
+// train_stochastic and train_stochastic_rows with options->asynchronous, on packets unless training_rows is set
+// the threads only meet for the progress reports, in between each of them updates the weights on its own
+static void train_stochastic_asynchronous(Network *network, TrainingDataPacket **training_data,
+                                          int length_of_training_data, const SampleRows *training_rows,
+                                          TrainingOptions *options) {
+    if (options->optimizer.type != OPTIMIZER_SGD) {
+        printf("Error: Asynchronous training only applies plain gradient descent!\n");
+        return;
+    }
+    if (options->communicator != NULL) {
+        printf("Error: Asynchronous training runs in a single process only!\n");
+        return;
+    }
+    double learning_rate = options->learning_rate;
+    AsyncTrainer *trainer = create_async_trainer(network, options->asynchronous_update_size,
+                                                 options->number_of_threads, options->seed);
+    trainer->max_gradient_norm = options->max_gradient_norm;
+    trainer->profiler = options->profiler;
+    Evaluator *evaluator = create_evaluator(network, trainer->pool);
+    Evaluation *evaluation = evaluate_progress(evaluator, training_data, length_of_training_data, training_rows,
+                                               options);
+    double last_loss = evaluation->average_loss;
+    for (int i = 0; i < options->epochs; i += options->evaluation_interval) {
+        int iterations = options->epochs - i < options->evaluation_interval ? options->epochs - i
+                                                                            : options->evaluation_interval;
+        if (training_rows != NULL) {
+            train_async_round_rows(trainer, training_rows, i, iterations, options->split_size, learning_rate,
+                                   &options->schedule);
+        } else {
+            train_async_round(trainer, training_data, length_of_training_data, i, iterations, options->split_size,
+                              learning_rate, &options->schedule);
+        }
+        double begin = profile_begin(options->profiler);
+        evaluation = evaluate_progress(evaluator, training_data, length_of_training_data, training_rows, options);
+        profile_end(options->profiler, PROFILE_EVALUATION, begin);
+        report_progress(evaluation, i + iterations, options, trainer->gradient_norm, trainer->skipped_steps,
+                        &learning_rate, &last_loss);
+    }
+    report_final_result(evaluation, options);
+    free_evaluator(evaluator);
+    free_async_trainer(trainer);
+}
+
+//split the training data into packets randomly and train on that
+void train_stochastic(Network *network, TrainingDataPacket **training_data, int length_of_training_data,
+                      TrainingOptions *options) {
+    if (options->asynchronous) {
+        train_stochastic_asynchronous(network, training_data, length_of_training_data, NULL, options);
+        return;
+    }
+    int split_size = options->split_size;
+    double learning_rate = options->learning_rate;
+    //progress is measured on the held-out samples when there are any
+    TrainingDataPacket **evaluation_data = training_data;
+    int length_of_evaluation_data = length_of_training_data;
+    if (options->evaluation_data != NULL) {
+        evaluation_data = options->evaluation_data;
+        length_of_evaluation_data = options->length_of_evaluation_data;
+    }
+    ParallelTrainer *trainer = create_stochastic_trainer(network, split_size, options);
+    //evaluation runs on the trainer's threads between steps
+    Evaluator *evaluator = create_evaluator(network, trainer->pool);
+    Evaluation *evaluation = gather_evaluation(options, evaluate_network(evaluator, evaluation_data,
+                                                                         length_of_evaluation_data));
+    double last_loss = evaluation->average_loss;
+    //every epoch walks a fresh permutation of the training data
+    Sampler *sampler = create_sampler(length_of_training_data, split_size, options->seed);
+    TrainingDataPacket **packets = malloc(sizeof(TrainingDataPacket *) * split_size);
+    for (int i = 0; i < options->epochs; i++) {
+        double begin = profile_begin(options->profiler);
+        int count;
+        const int *indices = sampler_next_batch(sampler, &count);
+        for (int j = 0; j < count; j++) {
+            packets[j] = training_data[indices[j]];
+        }
+        profile_end(options->profiler, PROFILE_SAMPLING, begin);
+        double rate = scheduled_learning_rate(&options->schedule, learning_rate, i);
+        train_network_parallel(trainer, packets, count, rate);
+        //calculate average loss and success rate every evaluation_interval iterations
+        if (i % options->evaluation_interval == 0) {
+            //the average loss and success rate come from a single pass over the data
+            begin = profile_begin(options->profiler);
+            evaluation = gather_evaluation(options, evaluate_network(evaluator, evaluation_data,
+                                                                     length_of_evaluation_data));
+            profile_end(options->profiler, PROFILE_EVALUATION, begin);
+            report_progress(evaluation, i, options, trainer->gradient_norm, trainer->skipped_steps, &learning_rate,
+                            &last_loss);
+        }
+    }
+    evaluation = gather_evaluation(options, evaluate_network(evaluator, evaluation_data,
+                                                             length_of_evaluation_data));
+    report_final_result(evaluation, options);
+    free(packets);
+    free_sampler(sampler);
+    free_evaluator(evaluator);
+    free_stochastic_trainer(trainer);
+}
+
+// train_stochastic for samples stored as rows, e.g. a memory mapped binary data set
+void train_stochastic_rows(Network *network, const SampleRows *training_rows, TrainingOptions *options) {
+    if (options->asynchronous) {
+        train_stochastic_asynchronous(network, NULL, 0, training_rows, options);
+        return;
+    }
+    int split_size = options->split_size;
+    double learning_rate = options->learning_rate;
+    const SampleRows *evaluation_rows = options->evaluation_rows != NULL ? options->evaluation_rows : training_rows;
+    ParallelTrainer *trainer = create_stochastic_trainer(network, split_size, options);
+    Evaluator *evaluator = create_evaluator(network, trainer->pool);
+    Evaluation *evaluation = gather_evaluation(options, evaluate_rows(evaluator, evaluation_rows));
+    double last_loss = evaluation->average_loss;
+    //the sampled rows are gathered through slices of the sampler's permutation
+    Sampler *sampler = create_sampler(training_rows->number_of_samples, split_size, options->seed);
+    SampleRows packets = *training_rows;
+    for (int i = 0; i < options->epochs; i++) {
+        double begin = profile_begin(options->profiler);
+        packets.indices = sampler_next_batch(sampler, &packets.number_of_samples);
+        profile_end(options->profiler, PROFILE_SAMPLING, begin);
+        double rate = scheduled_learning_rate(&options->schedule, learning_rate, i);
+        train_network_parallel_rows(trainer, &packets, rate);
+        if (i % options->evaluation_interval == 0) {
+            begin = profile_begin(options->profiler);
+            evaluation = gather_evaluation(options, evaluate_rows(evaluator, evaluation_rows));
+            profile_end(options->profiler, PROFILE_EVALUATION, begin);
+            report_progress(evaluation, i, options, trainer->gradient_norm, trainer->skipped_steps, &learning_rate,
+                            &last_loss);
+        }
+    }
+    evaluation = gather_evaluation(options, evaluate_rows(evaluator, evaluation_rows));
+    report_final_result(evaluation, options);
+    free_sampler(sampler);
+    free_evaluator(evaluator);
+    free_stochastic_trainer(trainer);
+}
+
+// train_stochastic fed by a streaming loader, one iteration per loaded batch
+// without evaluation_rows the progress is measured on the batch that was just trained on
+void train_stochastic_stream(Network *network, struct StreamLoader *loader, TrainingOptions *options) {
+    double learning_rate = options->learning_rate;
+    ParallelTrainer *trainer = create_stochastic_trainer(network, loader->batch_size, options);
+    Evaluator *evaluator = create_evaluator(network, trainer->pool);
+    double last_loss = 1e300;
+    const SampleRows *rows = NULL;
+    for (int i = 0; i < options->epochs; i++) {
+        double begin = profile_begin(options->profiler);
+        rows = stream_loader_next(loader);
+        profile_end(options->profiler, PROFILE_SAMPLING, begin);
+        if (rows == NULL) {
+            printf("data exhausted after %d iterations\n", i);
+            break;
+        }
+        double rate = scheduled_learning_rate(&options->schedule, learning_rate, i);
+        train_network_parallel_rows(trainer, rows, rate);
+        if (i % options->evaluation_interval == 0) {
+            begin = profile_begin(options->profiler);
+            const SampleRows *evaluation_rows = options->evaluation_rows != NULL ? options->evaluation_rows : rows;
+            Evaluation *evaluation = gather_evaluation(options, evaluate_rows(evaluator, evaluation_rows));
+            profile_end(options->profiler, PROFILE_EVALUATION, begin);
+            report_progress(evaluation, i, options, trainer->gradient_norm, trainer->skipped_steps, &learning_rate,
+                            &last_loss);
+        }
+    }
+    if (options->evaluation_rows != NULL) {
+        Evaluation *evaluation = gather_evaluation(options, evaluate_rows(evaluator, options->evaluation_rows));
+        report_final_result(evaluation, options);
+    }
+    free_evaluator(evaluator);
+    free_stochastic_trainer(trainer);
+}
+
+//save the network configuration and the weights and biases to a file
+int save_network_to_file(Network *network, char file_name[]) {
+    FILE *file = fopen(file_name, "w");
+    if (file == NULL) {
+        printf("Error: Could not create file!\n");
+        return 1;
+    }
+    fprintf(file, "%d\n", network->number_of_layers);
+    for (int i = 0; i < network->number_of_layers; i++) {
+        fprintf(file, "%d\n", network->layers[i]->layer_size);
+    }
+    for (int i = 1; i < network->number_of_layers; i++) {
+        for (int j = 0; j < network->layers[i]->layer_size; j++) {
+            for (int k = 0; k < network->layers[i]->input_size; k++) {
+                fprintf(file, "%f\n", MATRIX_AT(network->layers[i]->weights, j, k));
+            }
+        }
+    }
+    for (int i = 1; i < network->number_of_layers; i++) {
+        for (int j = 0; j < network->layers[i]->layer_size; j++) {
+            fprintf(file, "%f\n", MATRIX_AT(network->layers[i]->biases, j, 0));
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+//load the network configuration and the weights and biases from a file
+Network *load_network_from_file(char file_name[]) {
+    FILE *file = fopen(file_name, "r");
+    if (file == NULL) {
+        printf("Error: Could not open file!\n");
+        return NULL;
+    }
+    int number_of_layers;
+    fscanf(file, "%d", &number_of_layers);
+    int *layer_sizes = malloc(sizeof(int) * number_of_layers);
+    for (int i = 0; i < number_of_layers; i++) {
+        fscanf(file, "%d", &layer_sizes[i]);
+    }
+    Network *network = create_network(number_of_layers, layer_sizes);
+    free(layer_sizes);
+    for (int i = 1; i < network->number_of_layers; i++) {
+        for (int j = 0; j < network->layers[i]->layer_size; j++) {
+            for (int k = 0; k < network->layers[i]->input_size; k++) {
+                double value;
+                fscanf(file, "%lf", &value);
+                MATRIX_AT(network->layers[i]->weights, j, k) = (MatrixValue) value;
+            }
+        }
+    }
+    for (int i = 1; i < network->number_of_layers; i++) {
+        for (int j = 0; j < network->layers[i]->layer_size; j++) {
+            double value;
+            fscanf(file, "%lf", &value);
+            MATRIX_AT(network->layers[i]->biases, j, 0) = (MatrixValue) value;
+        }
+    }
+    fclose(file);
+    return network;
+}
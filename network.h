@@ -0,0 +1,225 @@
+//
+// Created by szymc on 01.05.2023.
+//
+
+#ifndef SEM2LAB2_NETWORK_H
+#define SEM2LAB2_NETWORK_H
+
+#include <stdint.h>
+#include "matrix_utils.h"
+#include "training.h"
+#include "arena.h"
+#include "layer_kernels.h"
+#include "optimizer.h"
+
+#define ReLU_A 0.1
+#define ReLU_B 1
+
+#define ACTIVATION_FUNCTION ReLU
+#define ACTIVATION_FUNCTION_DERIVATIVE ReLU_derivative
+
+struct Layer {
+    int input_size;
+    int layer_size;
+    int output_size;
+    Matrix *input;
+    Matrix *weights;
+    Matrix *delta_weights;
+    Matrix *biases;
+    Matrix *delta_biases;
+    Matrix *weighted_sums;
+    Matrix *activations;
+    Matrix *deltas; //error of the layer
+    //selects the fused kernels of the layer
+    LayerActivation activation;
+} typedef Layer;
+
+// define network struct
+struct network {
+    Layer **layers;
+    int number_of_layers;
+    //file the weights are mapped from by load_network_binary, NULL otherwise
+    void *mapping;
+    size_t mapping_size;
+    //owns the network struct and every layer buffer
+    Arena *arena;
+    //loss the output deltas and the evaluations use, cross-entropy unless changed after create_network
+    //squared error is differentiated through the softmax and trains the softmax output more slowly
+    LossFunction loss;
+} typedef Network;
+
+// samples stored one per row with their class index, the layout of binary data sets
+struct SampleRows {
+    int number_of_samples;
+    int number_of_features;
+    int number_of_classes;
+    //row i starts at features + i * feature_stride
+    const MatrixValue *features;
+    int feature_stride;
+    const int32_t *labels;
+    //optional, sample j is row indices[j] instead of row j
+    const int *indices;
+} typedef SampleRows;
+
+// buffers for a whole mini-batch, every sample is one column
+// activations[0] holds the inputs, activations[number_of_layers - 1] the outputs
+struct Batch {
+    int capacity;
+    int size;
+    int number_of_layers;
+    Matrix **weighted_sums;
+    Matrix **activations;
+    Matrix **deltas;
+    Matrix *targets;
+    //where propagate_backward_batch sums the gradients, the layers' own accumulators by default
+    Matrix **delta_weights;
+    Matrix **delta_biases;
+    int owns_gradients;
+    //(samples x features) inputs read in place instead of copying them into activations[0]
+    Matrix input_rows;
+    int uses_input_rows;
+    //owns the batch struct and its buffers
+    Arena *arena;
+} typedef Batch;
+
+// Leaky ReLU activation function
+double ReLU(double x);
+
+double ReLU_derivative(double x);
+
+//normalized softmax function for the output layer, computed as layer_softmax
+void softmax(Matrix *matrix, Matrix *result);
+
+// softmax of every column of the matrix, one sample per column
+void softmax_columns(Matrix *matrix, Matrix *result);
+
+Network *create_network(int number_of_layers, int *layer_sizes);
+
+void free_network(Network *network);
+
+// propagate a single column vector forward through the network
+void propagate_forward(Network *network, Matrix *input);
+
+// propagate the last sample passed to propagate_forward backward and add its gradient to the layers' accumulators
+void propagate_backward(Network *network, Matrix *target);
+
+void print_network(Network *network);
+
+// squared error of a single output
+double calculate_loss(Matrix *output_layer, Matrix *target);
+
+// average loss of the network's loss function over the data
+double calculate_average_loss(Network *network, TrainingDataPacket **training_data, int length_of_training_data);
+
+double calculate_average_success_rate(Network *network, TrainingDataPacket **training_data, int length_of_training_data);
+
+void calculate_deltas_for_layer(Network *network, int layer_index, Matrix *target);
+
+void add_gradient_weights_for_layer(Network *network, int layer_index);
+
+void add_gradient_biases_for_layer(Network *network, int layer_index);
+
+void average_gradient_weights_for_layer(Network *network, int layer_index, int length_of_training_data);
+
+void average_gradient_biases_for_layer(Network *network, int layer_index, int length_of_training_data);
+
+void update_weights_for_layer(Network *network, int layer_index, double learning_rate);
+
+void update_biases_for_layer(Network *network, int layer_index, double learning_rate);
+
+void train_network(Network *network, TrainingDataPacket **training_data, int length_of_training_data, int epochs,
+                   double learning_rate);
+
+// per-sample reference implementation of one gradient descent step
+void train_network_no_loss_calc(Network *network, TrainingDataPacket **training_data, int length_of_training_data,
+                                int epochs, double learning_rate);
+
+// create batch buffers for up to capacity samples
+Batch *create_batch(Network *network, int capacity);
+
+// create batch buffers that sum gradients into private accumulators instead of the layers' ones
+Batch *create_batch_with_gradients(Network *network, int capacity);
+
+void free_batch(Batch *batch);
+
+// set the batch gradient accumulators to zero
+void zero_batch_gradients(Batch *batch);
+
+// copy the inputs and targets of the packets into the columns of the batch
+void load_batch(Batch *batch, TrainingDataPacket **packets, int number_of_packets);
+
+// load count samples starting at sample first, contiguous rows are used in place without copying
+// targets are one-hot encoded from the class indices
+void load_batch_rows(Batch *batch, const SampleRows *rows, int first, int count);
+
+// forward pass of the loaded samples, one matrix-matrix product per layer
+void propagate_forward_batch(Network *network, Batch *batch);
+
+// backward pass of the loaded samples, adds the summed gradients to the batch gradient accumulators
+void propagate_backward_batch(Network *network, Batch *batch);
+
+// average the accumulated gradients over number_of_samples, move the weights and biases against them
+// and zero the accumulators for the next step
+void apply_gradients(Network *network, int number_of_samples, double learning_rate);
+
+// same step as train_network_no_loss_calc computed on the whole mini-batch at once
+void train_network_batched(Network *network, Batch *batch, TrainingDataPacket **training_data,
+                           int length_of_training_data, double learning_rate);
+
+struct Profiler;
+struct Communicator;
+
+// settings of train_stochastic
+struct TrainingOptions {
+    int epochs;
+    //samples per iteration
+    int split_size;
+    double learning_rate;
+    int number_of_threads;
+    //samples progress is measured on, the training data itself when NULL
+    TrainingDataPacket **evaluation_data;
+    int length_of_evaluation_data;
+    //the same for train_stochastic_rows
+    const SampleRows *evaluation_rows;
+    //iterations between progress reports
+    int evaluation_interval;
+    //seed of the batch sampler, equal seeds give equal runs
+    uint64_t seed;
+    //how the gradients are applied, plain gradient descent by default
+    OptimizerOptions optimizer;
+    //how learning_rate changes over the iterations, decayed when the loss rose by default
+    LearningRateSchedule schedule;
+    //the averaged gradient is scaled down to this L2 norm when it is longer, 0 disables clipping
+    double max_gradient_norm;
+    //borrowed, times every phase of the steps and writes a record with every progress report when set
+    struct Profiler *profiler;
+    //train_stochastic and train_stochastic_rows without a barrier per step: every thread draws its own samples
+    //and updates the shared weights after each asynchronous_update_size of them, plain gradient descent only
+    int asynchronous;
+    int asynchronous_update_size;
+    //borrowed, sums the gradients of every step over the processes training together on their own shards
+    //every process has to run the same iterations, only the first one prints its progress
+    struct Communicator *communicator;
+} typedef TrainingOptions;
+
+TrainingOptions default_training_options();
+
+// every iteration trains on split_size random samples, spread over number_of_threads threads
+void train_stochastic(Network *network, TrainingDataPacket **training_data, int length_of_training_data,
+                      TrainingOptions *options);
+
+// train_stochastic for samples stored as rows, e.g. a memory mapped binary data set
+void train_stochastic_rows(Network *network, const SampleRows *training_rows, TrainingOptions *options);
+
+struct StreamLoader;
+
+// train_stochastic fed by a streaming loader, one iteration per loaded batch
+// without evaluation_rows the progress is measured on the batch that was just trained on
+void train_stochastic_stream(Network *network, struct StreamLoader *loader, TrainingOptions *options);
+
+// write the text format load_network_from_file reads, returns 0 on success
+int save_network_to_file(Network *network, char file_name[]);
+
+Network *load_network_from_file(char file_name[]);
+
+#endif //SEM2LAB2_NETWORK_H
@@ -0,0 +1,32 @@
+//
+// Public header of the neural_network library: creating, training, evaluating, saving and
+// serving networks. Programs built on the library include this header only.
+//
+
+#ifndef SEM2LAB2_NEURAL_NETWORK_H
+#define SEM2LAB2_NEURAL_NETWORK_H
+
+#include "matrix_utils.h"
+#include "arena.h"
+#include "training.h"
+#include "network.h"
+#include "layer_kernels.h"
+#include "optimizer.h"
+#include "gradients.h"
+#include "thread_pool.h"
+#include "parallel_training.h"
+#include "async_training.h"
+#include "distributed.h"
+#include "population.h"
+#include "evaluation.h"
+#include "sampler.h"
+#include "dataset.h"
+#include "stream_loader.h"
+#include "model_io.h"
+#include "inference.h"
+#include "inference_server.h"
+#include "lookup_table.h"
+#include "quantization.h"
+#include "profiler.h"
+
+#endif //SEM2LAB2_NEURAL_NETWORK_H
@@ -0,0 +1,227 @@
+//
+// Optimizers applying the accumulated gradients of a network, and learning rate schedules.
+//
+
+#include "optimizer.h"
+#include <stdlib.h>
+#include <math.h>
+#include "network.h"
+
+#ifdef MATRIX_FLOAT32
+#define value_sqrt sqrtf
+#else
+#define value_sqrt sqrt
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+OptimizerOptions default_optimizer_options(OptimizerType type) {
+    OptimizerOptions options;
+    options.type = type;
+    options.momentum = 0.9;
+    options.beta1 = 0.9;
+    options.beta2 = 0.999;
+    options.epsilon = 1e-8;
+    options.weight_decay = 0;
+    return options;
+}
+
+static int uses_moments(OptimizerType type) {
+    return type != OPTIMIZER_SGD;
+}
+
+static int uses_squares(OptimizerType type) {
+    return type == OPTIMIZER_ADAM || type == OPTIMIZER_ADAMW;
+}
+
+Optimizer *create_optimizer(Network *network, OptimizerOptions options) {
+    int buffers = uses_moments(options.type) + uses_squares(options.type);
+    size_t size = arena_size_of(sizeof(Optimizer)) + arena_size_of(sizeof(OptimizerState) * network->number_of_layers);
+    for (int i = 1; i < network->number_of_layers; i++) {
+        Layer *layer = network->layers[i];
+        size += buffers * (arena_size_of_matrix(layer->layer_size, layer->input_size) +
+                           arena_size_of_matrix(layer->layer_size, 1));
+    }
+    Arena *arena = create_arena(size);
+    Optimizer *optimizer = arena_alloc(arena, sizeof(Optimizer));
+    optimizer->options = options;
+    optimizer->network = network;
+    optimizer->layers = arena_alloc(arena, sizeof(OptimizerState) * network->number_of_layers);
+    optimizer->steps = 0;
+    optimizer->arena = arena;
+    //arena_alloc zeroes, so unused buffers stay NULL
+    for (int i = 1; i < network->number_of_layers; i++) {
+        Layer *layer = network->layers[i];
+        OptimizerState *state = &optimizer->layers[i];
+        if (uses_moments(options.type)) {
+            state->weight_moments = arena_create_matrix(arena, layer->layer_size, layer->input_size);
+            state->bias_moments = arena_create_matrix(arena, layer->layer_size, 1);
+        }
+        if (uses_squares(options.type)) {
+            state->weight_squares = arena_create_matrix(arena, layer->layer_size, layer->input_size);
+            state->bias_squares = arena_create_matrix(arena, layer->layer_size, 1);
+        }
+    }
+    return optimizer;
+}
+
+void free_optimizer(Optimizer *optimizer) {
+    //the optimizer struct lives in its own arena
+    free_arena(optimizer->arena);
+}
+
+void reset_optimizer(Optimizer *optimizer) {
+    for (int i = 1; i < optimizer->network->number_of_layers; i++) {
+        OptimizerState *state = &optimizer->layers[i];
+        Matrix *buffers[] = {state->weight_moments, state->bias_moments, state->weight_squares, state->bias_squares};
+        for (int b = 0; b < 4; b++) {
+            if (buffers[b] != NULL) {
+                fill_matrix(buffers[b], 0);
+            }
+        }
+    }
+    optimizer->steps = 0;
+}
+
+// constants of one step shared by every buffer
+struct StepConstants {
+    //1 / number of samples, turns the summed gradient into the average
+    MatrixValue scale;
+    MatrixValue rate;
+    MatrixValue momentum;
+    MatrixValue beta1;
+    MatrixValue beta2;
+    MatrixValue epsilon;
+    //added to the gradient (L2) or, for AdamW, taken off the parameters directly
+    MatrixValue decay;
+    //rate / (1 - beta1^t) and 1 / (1 - beta2^t)
+    MatrixValue corrected_rate;
+    MatrixValue square_correction;
+} typedef StepConstants;
+
+// the fused update of count parameters: average the gradients, update the state and the
+// parameters and zero the gradients in one pass, decay is 0 for biases
+static void update_span(OptimizerType type, const StepConstants *c, MatrixValue decay,
+                        MatrixValue *restrict parameters, MatrixValue *restrict gradients,
+                        MatrixValue *restrict moments, MatrixValue *restrict squares, int count) {
+    switch (type) {
+        case OPTIMIZER_SGD:
+            for (int j = 0; j < count; j++) {
+                MatrixValue g = gradients[j] * c->scale + decay * parameters[j];
+                parameters[j] -= c->rate * g;
+                gradients[j] = 0;
+            }
+            break;
+        case OPTIMIZER_MOMENTUM:
+            for (int j = 0; j < count; j++) {
+                MatrixValue g = gradients[j] * c->scale + decay * parameters[j];
+                moments[j] = c->momentum * moments[j] + g;
+                parameters[j] -= c->rate * moments[j];
+                gradients[j] = 0;
+            }
+            break;
+        case OPTIMIZER_NESTEROV:
+            for (int j = 0; j < count; j++) {
+                MatrixValue g = gradients[j] * c->scale + decay * parameters[j];
+                moments[j] = c->momentum * moments[j] + g;
+                parameters[j] -= c->rate * (g + c->momentum * moments[j]);
+                gradients[j] = 0;
+            }
+            break;
+        case OPTIMIZER_ADAM:
+        case OPTIMIZER_ADAMW:
+            for (int j = 0; j < count; j++) {
+                MatrixValue g = gradients[j] * c->scale;
+                if (type == OPTIMIZER_ADAM) {
+                    g += decay * parameters[j];
+                } else {
+                    parameters[j] -= c->rate * decay * parameters[j];
+                }
+                moments[j] = c->beta1 * moments[j] + (1 - c->beta1) * g;
+                squares[j] = c->beta2 * squares[j] + (1 - c->beta2) * g * g;
+                parameters[j] -= c->corrected_rate * moments[j] /
+                                 (value_sqrt(squares[j] * c->square_correction) + c->epsilon);
+                gradients[j] = 0;
+            }
+            break;
+    }
+}
+
+void optimizer_step(Optimizer *optimizer, int number_of_samples, double learning_rate) {
+    const OptimizerOptions *options = &optimizer->options;
+    Network *network = optimizer->network;
+    optimizer->steps++;
+    StepConstants c;
+    c.scale = (MatrixValue) (1.0 / number_of_samples);
+    c.rate = (MatrixValue) learning_rate;
+    c.momentum = (MatrixValue) options->momentum;
+    c.beta1 = (MatrixValue) options->beta1;
+    c.beta2 = (MatrixValue) options->beta2;
+    c.epsilon = (MatrixValue) options->epsilon;
+    c.decay = (MatrixValue) options->weight_decay;
+    c.corrected_rate = (MatrixValue) (learning_rate / (1 - pow(options->beta1, (double) optimizer->steps)));
+    c.square_correction = (MatrixValue) (1 / (1 - pow(options->beta2, (double) optimizer->steps)));
+
+    for (int k = 1; k < network->number_of_layers; k++) {
+        Layer *layer = network->layers[k];
+        OptimizerState *state = &optimizer->layers[k];
+        for (int i = 0; i < layer->layer_size; i++) {
+            update_span(options->type, &c, c.decay, matrix_row(layer->weights, i), matrix_row(layer->delta_weights, i),
+                        state->weight_moments != NULL ? matrix_row(state->weight_moments, i) : NULL,
+                        state->weight_squares != NULL ? matrix_row(state->weight_squares, i) : NULL,
+                        layer->input_size);
+        }
+        //bias vectors are dense, one span per layer
+        update_span(options->type, &c, 0, layer->biases->values, layer->delta_biases->values,
+                    state->bias_moments != NULL ? state->bias_moments->values : NULL,
+                    state->bias_squares != NULL ? state->bias_squares->values : NULL, layer->layer_size);
+    }
+}
+
+LearningRateSchedule default_learning_rate_schedule() {
+    LearningRateSchedule schedule;
+    schedule.type = SCHEDULE_LOSS_DECAY;
+    schedule.warmup_iterations = 0;
+    schedule.step_interval = 1000;
+    schedule.decay_factor = 0.96;
+    schedule.total_iterations = 0;
+    schedule.minimum_learning_rate = 0;
+    return schedule;
+}
+
+double scheduled_learning_rate(const LearningRateSchedule *schedule, double base_learning_rate, int iteration) {
+    if (iteration < schedule->warmup_iterations) {
+        return base_learning_rate * (iteration + 1) / schedule->warmup_iterations;
+    }
+    //the decay starts once the warmup is over
+    int decay_iteration = iteration - schedule->warmup_iterations;
+    switch (schedule->type) {
+        case SCHEDULE_STEP:
+            if (schedule->step_interval < 1) {
+                return base_learning_rate;
+            }
+            return base_learning_rate * pow(schedule->decay_factor, decay_iteration / schedule->step_interval);
+        case SCHEDULE_COSINE: {
+            int length = schedule->total_iterations - schedule->warmup_iterations;
+            if (length < 1) {
+                return base_learning_rate;
+            }
+            double progress = decay_iteration < length ? (double) decay_iteration / length : 1;
+            return schedule->minimum_learning_rate +
+                   (base_learning_rate - schedule->minimum_learning_rate) * 0.5 * (1 + cos(M_PI * progress));
+        }
+        case SCHEDULE_LOSS_DECAY:
+        default:
+            return base_learning_rate;
+    }
+}
+
+double schedule_loss_decay(const LearningRateSchedule *schedule, double base_learning_rate, double loss,
+                           double last_loss) {
+    if (schedule->type == SCHEDULE_LOSS_DECAY && loss > last_loss) {
+        return base_learning_rate * schedule->decay_factor;
+    }
+    return base_learning_rate;
+}
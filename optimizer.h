@@ -0,0 +1,104 @@
+//
+// Optimizers applying the accumulated gradients of a network, and learning rate schedules.
+// Every optimizer keeps its state in buffers shaped like the layers' weights and biases, and
+// one fused sweep per buffer averages the gradient, updates the state and the parameters and
+// zeroes the gradient accumulator for the next step.
+//
+
+#ifndef SEM2LAB2_OPTIMIZER_H
+#define SEM2LAB2_OPTIMIZER_H
+
+#include "matrix_utils.h"
+#include "arena.h"
+
+struct network;
+
+enum OptimizerType {
+    //w -= rate * g
+    OPTIMIZER_SGD,
+    //v = momentum * v + g, w -= rate * v
+    OPTIMIZER_MOMENTUM,
+    //v = momentum * v + g, w -= rate * (g + momentum * v)
+    OPTIMIZER_NESTEROV,
+    //bias corrected first and second moments, weight decay is added to the gradient
+    OPTIMIZER_ADAM,
+    //Adam with the weight decay applied to the weights directly
+    OPTIMIZER_ADAMW
+} typedef OptimizerType;
+
+struct OptimizerOptions {
+    OptimizerType type;
+    double momentum;
+    double beta1;
+    double beta2;
+    double epsilon;
+    //only applied to weights, never to biases
+    double weight_decay;
+} typedef OptimizerOptions;
+
+// state of one layer, NULL where the optimizer needs no buffer
+struct OptimizerState {
+    //velocity or first moment
+    Matrix *weight_moments;
+    Matrix *bias_moments;
+    //second moment
+    Matrix *weight_squares;
+    Matrix *bias_squares;
+} typedef OptimizerState;
+
+struct Optimizer {
+    OptimizerOptions options;
+    struct network *network;
+    //one entry per layer, the input layer has none
+    OptimizerState *layers;
+    //steps taken, for the Adam bias correction
+    long steps;
+    Arena *arena;
+} typedef Optimizer;
+
+enum ScheduleType {
+    //the rate is multiplied by decay_factor whenever the evaluated loss rose, the former behaviour
+    SCHEDULE_LOSS_DECAY,
+    //the rate is multiplied by decay_factor every step_interval iterations
+    SCHEDULE_STEP,
+    //half a cosine from the rate down to minimum_learning_rate over total_iterations
+    SCHEDULE_COSINE
+} typedef ScheduleType;
+
+struct LearningRateSchedule {
+    ScheduleType type;
+    //the rate grows linearly from 0 over the first warmup_iterations, before any other schedule applies
+    int warmup_iterations;
+    int step_interval;
+    double decay_factor;
+    int total_iterations;
+    double minimum_learning_rate;
+} typedef LearningRateSchedule;
+
+// the usual hyperparameters of each optimizer: momentum 0.9, betas 0.9 and 0.999, no weight decay
+OptimizerOptions default_optimizer_options(OptimizerType type);
+
+// allocate the state buffers of every layer of the network, zeroed
+Optimizer *create_optimizer(struct network *network, OptimizerOptions options);
+
+void free_optimizer(Optimizer *optimizer);
+
+// zero the state, e.g. when training restarts from other weights
+void reset_optimizer(Optimizer *optimizer);
+
+// average the gradients accumulated over number_of_samples, update the weights and biases
+// and set the accumulators back to zero, one sweep per buffer
+void optimizer_step(Optimizer *optimizer, int number_of_samples, double learning_rate);
+
+// no warmup and a decay by 0.96 whenever the loss rose
+LearningRateSchedule default_learning_rate_schedule();
+
+// learning rate of iteration, counted from 0, for the given base rate
+// loss decay schedules only apply the warmup, their decay happens in schedule_loss_decay
+double scheduled_learning_rate(const LearningRateSchedule *schedule, double base_learning_rate, int iteration);
+
+// the loss decay step, returns the new base rate after an evaluation that measured loss
+double schedule_loss_decay(const LearningRateSchedule *schedule, double base_learning_rate, double loss,
+                           double last_loss);
+
+#endif //SEM2LAB2_OPTIMIZER_H
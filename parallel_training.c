@@ -0,0 +1,179 @@
+//
+// Data parallel mini-batch training: every thread of a pool runs the forward and backward
+// pass on its own slice of the mini-batch, the per-thread gradients are then summed pairwise.
+//
+
+#include "parallel_training.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "gradients.h"
+#include "distributed.h"
+
+ParallelTrainer *create_parallel_trainer(Network *network, int batch_capacity, int number_of_threads) {
+    if (number_of_threads < 1) {
+        number_of_threads = 1;
+    }
+    ParallelTrainer *trainer = malloc(sizeof(ParallelTrainer));
+    trainer->network = network;
+    trainer->number_of_threads = number_of_threads;
+    trainer->pool = create_thread_pool(number_of_threads);
+    trainer->batches = malloc(number_of_threads * sizeof(Batch *));
+    int slice_capacity = (batch_capacity + number_of_threads - 1) / number_of_threads;
+    for (int i = 0; i < number_of_threads; i++) {
+        trainer->batches[i] = create_batch_with_gradients(network, slice_capacity);
+    }
+    trainer->packets = NULL;
+    trainer->rows = NULL;
+    trainer->number_of_packets = 0;
+    trainer->reduction_stride = 0;
+    trainer->optimizer = NULL;
+    trainer->max_gradient_norm = 0;
+    trainer->gradient_norm = 0;
+    trainer->skipped_steps = 0;
+    trainer->profiler = NULL;
+    trainer->communicator = NULL;
+    trainer->thread_seconds = calloc(3 * number_of_threads, sizeof(double));
+    return trainer;
+}
+
+void free_parallel_trainer(ParallelTrainer *trainer) {
+    for (int i = 0; i < trainer->number_of_threads; i++) {
+        free_batch(trainer->batches[i]);
+    }
+    free(trainer->batches);
+    free(trainer->thread_seconds);
+    free_thread_pool(trainer->pool);
+    free(trainer);
+}
+
+// forward and backward pass of one thread's slice into its own accumulators
+static void gradient_task(void *context, int thread_index, int number_of_threads) {
+    ParallelTrainer *trainer = context;
+    Batch *batch = trainer->batches[thread_index];
+    double *seconds = trainer->thread_seconds + 3 * thread_index;
+    double mark = profile_begin(trainer->profiler);
+    int begin, end;
+    thread_range(trainer->number_of_packets, thread_index, number_of_threads, &begin, &end);
+    zero_batch_gradients(batch);
+    if (trainer->rows != NULL) {
+        load_batch_rows(batch, trainer->rows, begin, end - begin);
+    } else {
+        load_batch(batch, trainer->packets + begin, end - begin);
+    }
+    seconds[0] = profile_lap(trainer->profiler, &mark);
+    seconds[1] = seconds[2] = 0;
+    if (batch->size == 0) {
+        return;
+    }
+    propagate_forward_batch(trainer->network, batch);
+    seconds[1] = profile_lap(trainer->profiler, &mark);
+    propagate_backward_batch(trainer->network, batch);
+    seconds[2] = profile_lap(trainer->profiler, &mark);
+}
+
+// one level of the reduction tree: thread i adds the gradients of thread i + stride to its own
+static void reduction_task(void *context, int thread_index, int number_of_threads) {
+    ParallelTrainer *trainer = context;
+    int stride = trainer->reduction_stride;
+    if (thread_index % (2 * stride) != 0 || thread_index + stride >= number_of_threads) {
+        return;
+    }
+    Batch *destination = trainer->batches[thread_index];
+    Batch *source = trainer->batches[thread_index + stride];
+    for (int k = 1; k < destination->number_of_layers; k++) {
+        add_matrices(destination->delta_weights[k], source->delta_weights[k], destination->delta_weights[k]);
+        add_matrices(destination->delta_biases[k], source->delta_biases[k], destination->delta_biases[k]);
+    }
+}
+
+// run the slices and sum the per-thread gradients into the layers' accumulators
+static void accumulate_gradients(ParallelTrainer *trainer) {
+    thread_pool_run(trainer->pool, gradient_task, trainer);
+    Profiler *profiler = trainer->profiler;
+    if (profiler != NULL) {
+        //the slowest thread holds up the step
+        ProfilePhase phases[] = {PROFILE_SAMPLING, PROFILE_FORWARD, PROFILE_BACKWARD};
+        for (int p = 0; p < 3; p++) {
+            double slowest = 0;
+            for (int i = 0; i < trainer->number_of_threads; i++) {
+                double seconds = trainer->thread_seconds[3 * i + p];
+                slowest = seconds > slowest ? seconds : slowest;
+            }
+            profile_add(profiler, phases[p], slowest);
+        }
+    }
+    double begin = profile_begin(profiler);
+
+    //pairwise sums in log2(threads) levels, the total ends up in thread 0's accumulators
+    for (int stride = 1; stride < trainer->number_of_threads; stride *= 2) {
+        trainer->reduction_stride = stride;
+        thread_pool_run(trainer->pool, reduction_task, trainer);
+    }
+
+    Network *network = trainer->network;
+    Batch *total = trainer->batches[0];
+    for (int k = 1; k < network->number_of_layers; k++) {
+        add_matrices(network->layers[k]->delta_weights, total->delta_weights[k], network->layers[k]->delta_weights);
+        add_matrices(network->layers[k]->delta_biases, total->delta_biases[k], network->layers[k]->delta_biases);
+    }
+    profile_end(profiler, PROFILE_REDUCTION, begin);
+}
+
+void accumulate_gradients_parallel(ParallelTrainer *trainer, TrainingDataPacket **packets, int number_of_packets) {
+    trainer->packets = packets;
+    trainer->rows = NULL;
+    trainer->number_of_packets = number_of_packets;
+    accumulate_gradients(trainer);
+}
+
+void accumulate_gradients_parallel_rows(ParallelTrainer *trainer, const SampleRows *rows) {
+    trainer->packets = NULL;
+    trainer->rows = rows;
+    trainer->number_of_packets = rows->number_of_samples;
+    accumulate_gradients(trainer);
+}
+
+// apply the accumulated gradients, which leaves the accumulators zeroed
+static void apply_step(ParallelTrainer *trainer, int number_of_samples, double learning_rate) {
+    trainer->gradient_norm = clip_gradients(trainer->network, number_of_samples, trainer->max_gradient_norm);
+    if (!isfinite(trainer->gradient_norm)) {
+        //an overflowed gradient would turn every weight into NaN
+        zero_gradients(trainer->network);
+        trainer->skipped_steps++;
+        return;
+    }
+    if (trainer->optimizer != NULL) {
+        optimizer_step(trainer->optimizer, number_of_samples, learning_rate);
+    } else {
+        apply_gradients(trainer->network, number_of_samples, learning_rate);
+    }
+}
+
+// the step with its time and samples counted
+static void step(ParallelTrainer *trainer, int number_of_samples, double learning_rate) {
+    double begin = profile_begin(trainer->profiler);
+    if (trainer->communicator != NULL) {
+        //every process applies the same sum over all of their samples
+        if (all_reduce_gradients(trainer->communicator, trainer->network, &number_of_samples) != 0) {
+            printf("Error: Could not exchange the gradients with the other processes!\n");
+            exit(1);
+        }
+        profile_end(trainer->profiler, PROFILE_REDUCTION, begin);
+        begin = profile_begin(trainer->profiler);
+    }
+    apply_step(trainer, number_of_samples, learning_rate);
+    profile_end(trainer->profiler, PROFILE_UPDATE, begin);
+    profile_step(trainer->profiler, number_of_samples);
+}
+
+void train_network_parallel(ParallelTrainer *trainer, TrainingDataPacket **packets, int number_of_packets,
+                            double learning_rate) {
+    accumulate_gradients_parallel(trainer, packets, number_of_packets);
+    step(trainer, number_of_packets, learning_rate);
+}
+
+void train_network_parallel_rows(ParallelTrainer *trainer, const SampleRows *rows, double learning_rate) {
+    accumulate_gradients_parallel_rows(trainer, rows);
+    step(trainer, rows->number_of_samples, learning_rate);
+}
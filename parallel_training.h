@@ -0,0 +1,61 @@
+//
+// Data parallel mini-batch training: every thread of a pool runs the forward and backward
+// pass on its own slice of the mini-batch, the per-thread gradients are then summed pairwise.
+//
+
+#ifndef SEM2LAB2_PARALLEL_TRAINING_H
+#define SEM2LAB2_PARALLEL_TRAINING_H
+
+#include "network.h"
+#include "thread_pool.h"
+#include "profiler.h"
+
+struct Communicator;
+
+struct ParallelTrainer {
+    Network *network;
+    ThreadPool *pool;
+    int number_of_threads;
+    //one batch with private gradient accumulators per thread
+    Batch **batches;
+    //state of the step currently being run
+    TrainingDataPacket **packets;
+    const SampleRows *rows;
+    int number_of_packets;
+    int reduction_stride;
+    //applies the summed gradients, apply_gradients when NULL
+    Optimizer *optimizer;
+    //gradients are clipped to this norm before they are applied, 0 disables clipping
+    double max_gradient_norm;
+    //norm of the last step's averaged gradient before clipping
+    double gradient_norm;
+    //steps whose gradient was not finite and were dropped instead of applied
+    long skipped_steps;
+    //borrowed, times the phases of every step when set
+    Profiler *profiler;
+    //borrowed, the gradients are summed over every process of it before they are applied when set
+    struct Communicator *communicator;
+    //sampling, forward and backward seconds of every thread in the current step
+    double *thread_seconds;
+} typedef ParallelTrainer;
+
+// create a trainer for mini-batches of up to batch_capacity samples
+ParallelTrainer *create_parallel_trainer(Network *network, int batch_capacity, int number_of_threads);
+
+void free_parallel_trainer(ParallelTrainer *trainer);
+
+// sum the gradients of the packets into the layers' delta_weights and delta_biases, which a step leaves zeroed
+// the summation order only depends on the number of threads, so results are reproducible
+void accumulate_gradients_parallel(ParallelTrainer *trainer, TrainingDataPacket **packets, int number_of_packets);
+
+// same as accumulate_gradients_parallel for samples stored as rows
+void accumulate_gradients_parallel_rows(ParallelTrainer *trainer, const SampleRows *rows);
+
+// one step of the trainer's optimizer on the packets, same update as train_network_batched without one
+void train_network_parallel(ParallelTrainer *trainer, TrainingDataPacket **packets, int number_of_packets,
+                            double learning_rate);
+
+// one gradient descent step on all samples of rows
+void train_network_parallel_rows(ParallelTrainer *trainer, const SampleRows *rows, double learning_rate);
+
+#endif //SEM2LAB2_PARALLEL_TRAINING_H
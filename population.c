@@ -0,0 +1,332 @@
+//
+// Population training, every thread runs the forward pass, the backward pass and the update of
+// its own range of members, so the members never wait for each other within a step.
+//
+
+#include "population.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// rows of member's part of a stacked per-layer matrix
+static Matrix member_rows(Matrix *matrix, int member, int rows_per_member, int cols) {
+    return matrix_view(matrix, member * rows_per_member, 0, rows_per_member, cols);
+}
+
+Population *create_population(int number_of_layers, int *layer_sizes, int number_of_members, const uint64_t *seeds,
+                              const double *learning_rates, int capacity, int number_of_threads) {
+    if (number_of_layers < 2 || number_of_members < 1 || capacity < 1) {
+        printf("Error: A population needs two layers, a member and a batch!\n");
+        return NULL;
+    }
+    if (number_of_threads > number_of_members) {
+        number_of_threads = number_of_members;
+    }
+    if (number_of_threads < 1) {
+        number_of_threads = 1;
+    }
+    int output_size = layer_sizes[number_of_layers - 1];
+    size_t size = arena_size_of(sizeof(Population)) + 7 * arena_size_of(number_of_layers * sizeof(Matrix *)) +
+                  arena_size_of(number_of_layers * sizeof(int)) + arena_size_of(number_of_members * sizeof(uint64_t)) +
+                  3 * arena_size_of(number_of_members * sizeof(double)) +
+                  arena_size_of(number_of_members * sizeof(long)) + arena_size_of_matrix(layer_sizes[0], capacity) +
+                  arena_size_of_matrix(output_size, capacity);
+    for (int k = 1; k < number_of_layers; k++) {
+        int rows = number_of_members * layer_sizes[k];
+        size += 2 * arena_size_of_matrix(rows, layer_sizes[k - 1]) + 2 * arena_size_of_matrix(rows, 1) +
+                3 * arena_size_of_matrix(rows, capacity);
+    }
+    Arena *arena = create_arena(size);
+    Population *population = arena_alloc(arena, sizeof(Population));
+    population->arena = arena;
+    population->number_of_members = number_of_members;
+    population->number_of_layers = number_of_layers;
+    population->layer_sizes = arena_alloc(arena, number_of_layers * sizeof(int));
+    memcpy(population->layer_sizes, layer_sizes, number_of_layers * sizeof(int));
+    population->loss = LOSS_CROSS_ENTROPY;
+    population->capacity = capacity;
+    population->batch_size = 0;
+    population->uses_input_rows = 0;
+    population->training = 0;
+
+    //the input layer has no weights, its entries stay NULL
+    Matrix ***per_layer[] = {&population->weights, &population->biases, &population->delta_weights,
+                             &population->delta_biases, &population->weighted_sums, &population->activations,
+                             &population->deltas};
+    for (int i = 0; i < 7; i++) {
+        *per_layer[i] = arena_alloc(arena, number_of_layers * sizeof(Matrix *));
+    }
+    for (int k = 1; k < number_of_layers; k++) {
+        int rows = number_of_members * layer_sizes[k];
+        population->weights[k] = arena_create_matrix(arena, rows, layer_sizes[k - 1]);
+        population->delta_weights[k] = arena_create_matrix(arena, rows, layer_sizes[k - 1]);
+        population->biases[k] = arena_create_matrix(arena, rows, 1);
+        population->delta_biases[k] = arena_create_matrix(arena, rows, 1);
+        population->weighted_sums[k] = arena_create_matrix(arena, rows, capacity);
+        population->activations[k] = arena_create_matrix(arena, rows, capacity);
+        population->deltas[k] = arena_create_matrix(arena, rows, capacity);
+    }
+    population->input = arena_create_matrix(arena, layer_sizes[0], capacity);
+    population->targets = arena_create_matrix(arena, output_size, capacity);
+    population->seeds = arena_alloc(arena, number_of_members * sizeof(uint64_t));
+    population->learning_rates = arena_alloc(arena, number_of_members * sizeof(double));
+    population->losses = arena_alloc(arena, number_of_members * sizeof(double));
+    population->success_rates = arena_alloc(arena, number_of_members * sizeof(double));
+    population->successes = arena_alloc(arena, number_of_members * sizeof(long));
+
+    //every member starts where a network created with its seed would
+    for (int m = 0; m < number_of_members; m++) {
+        population->seeds[m] = seeds[m];
+        population->learning_rates[m] = learning_rates[m];
+        srand(seeds[m]);
+        Network *network = create_network(number_of_layers, layer_sizes);
+        for (int k = 1; k < number_of_layers; k++) {
+            Matrix weights = member_rows(population->weights[k], m, layer_sizes[k], layer_sizes[k - 1]);
+            Matrix biases = member_rows(population->biases[k], m, layer_sizes[k], 1);
+            copy_matrix(network->layers[k]->weights, &weights);
+            copy_matrix(network->layers[k]->biases, &biases);
+        }
+        free_network(network);
+    }
+
+    population->number_of_threads = number_of_threads;
+    population->pool = number_of_threads > 1 ? create_thread_pool(number_of_threads) : NULL;
+    return population;
+}
+
+void free_population(Population *population) {
+    if (population->pool != NULL) {
+        free_thread_pool(population->pool);
+    }
+    free_arena(population->arena);
+}
+
+// load count samples starting at sample first, like load_batch_rows
+static void load_samples(Population *population, const SampleRows *rows, int first, int count) {
+    population->batch_size = count;
+    if (rows->indices == NULL) {
+        population->uses_input_rows = 1;
+        population->input_rows.rows = count;
+        population->input_rows.cols = rows->number_of_features;
+        population->input_rows.stride = rows->feature_stride;
+        population->input_rows.values = (MatrixValue *) rows->features + (size_t) first * rows->feature_stride;
+        population->input_rows.owns_values = 0;
+        population->input_rows.in_arena = 0;
+    } else {
+        population->uses_input_rows = 0;
+        for (int j = 0; j < count; j++) {
+            const MatrixValue *sample = rows->features + (size_t) rows->indices[first + j] * rows->feature_stride;
+            for (int i = 0; i < rows->number_of_features; i++) {
+                MATRIX_AT(population->input, i, j) = sample[i];
+            }
+        }
+    }
+    Matrix targets = matrix_view(population->targets, 0, 0, population->targets->rows, count);
+    fill_matrix(&targets, 0);
+    for (int j = 0; j < count; j++) {
+        int sample = rows->indices == NULL ? first + j : rows->indices[first + j];
+        MATRIX_AT(population->targets, rows->labels[sample], j) = 1;
+    }
+}
+
+// input of the first layer, one sample per column or per row
+static Matrix shared_input(Population *population, int *input_rows) {
+    *input_rows = population->uses_input_rows;
+    return population->uses_input_rows ? population->input_rows
+                                       : matrix_view(population->input, 0, 0, population->layer_sizes[0],
+                                                     population->batch_size);
+}
+
+static LayerActivation activation_of(Population *population, int layer) {
+    return layer == population->number_of_layers - 1 ? LAYER_ACTIVATION_SOFTMAX : LAYER_ACTIVATION_LEAKY_RELU;
+}
+
+// forward pass of the members [begin, end)
+static void forward_members(Population *population, int begin, int end) {
+    int *sizes = population->layer_sizes;
+    int size = population->batch_size;
+    int input_rows;
+    Matrix input = shared_input(population, &input_rows);
+    for (int k = 1; k < population->number_of_layers; k++) {
+        LayerActivation activation = activation_of(population, k);
+        if (k == 1 && activation != LAYER_ACTIVATION_SOFTMAX) {
+            //all members read the same input, their stacked weights make one product
+            int rows = (end - begin) * sizes[1];
+            Matrix weights = matrix_view(population->weights[1], begin * sizes[1], 0, rows, sizes[0]);
+            Matrix biases = matrix_view(population->biases[1], begin * sizes[1], 0, rows, 1);
+            Matrix weighted_sums = matrix_view(population->weighted_sums[1], begin * sizes[1], 0, rows, size);
+            Matrix activations = matrix_view(population->activations[1], begin * sizes[1], 0, rows, size);
+            layer_forward(activation, &weights, &input, input_rows, &biases, &weighted_sums, &activations);
+            continue;
+        }
+        //the softmax runs over one member's outputs and deeper layers read each member's own activations
+        for (int m = begin; m < end; m++) {
+            Matrix member_input = k == 1 ? input : member_rows(population->activations[k - 1], m, sizes[k - 1], size);
+            Matrix weights = member_rows(population->weights[k], m, sizes[k], sizes[k - 1]);
+            Matrix biases = member_rows(population->biases[k], m, sizes[k], 1);
+            Matrix weighted_sums = member_rows(population->weighted_sums[k], m, sizes[k], size);
+            Matrix activations = member_rows(population->activations[k], m, sizes[k], size);
+            layer_forward(activation, &weights, &member_input, k == 1 && input_rows, &biases, &weighted_sums,
+                          &activations);
+        }
+    }
+}
+
+// values -= scale * gradients, then the gradients are zeroed for the next step
+static void descend(Matrix *values, Matrix *gradients, double scale) {
+    for (int i = 0; i < values->rows; i++) {
+        MatrixValue *value = matrix_row(values, i);
+        MatrixValue *gradient = matrix_row(gradients, i);
+        for (int j = 0; j < values->cols; j++) {
+            value[j] -= (MatrixValue) (scale * gradient[j]);
+            gradient[j] = 0;
+        }
+    }
+}
+
+// backward pass and gradient descent step of one member
+static void train_member(Population *population, int member) {
+    int *sizes = population->layer_sizes;
+    int size = population->batch_size;
+    int output_layer = population->number_of_layers - 1;
+    int shared_rows;
+    Matrix shared = shared_input(population, &shared_rows);
+    for (int k = output_layer; k >= 1; k--) {
+        int input_rows = k == 1 && shared_rows;
+        Matrix input = k == 1 ? shared : member_rows(population->activations[k - 1], member, sizes[k - 1], size);
+        Matrix deltas = member_rows(population->deltas[k], member, sizes[k], size);
+        Matrix delta_weights = member_rows(population->delta_weights[k], member, sizes[k], sizes[k - 1]);
+        Matrix delta_biases = member_rows(population->delta_biases[k], member, sizes[k], 1);
+        if (k == output_layer) {
+            Matrix activations = member_rows(population->activations[k], member, sizes[k], size);
+            Matrix targets = matrix_view(population->targets, 0, 0, sizes[k], size);
+            layer_backward_output(population->loss, &activations, &targets, &input, input_rows, &deltas,
+                                  &delta_weights, &delta_biases);
+        } else {
+            Matrix next_weights = member_rows(population->weights[k + 1], member, sizes[k + 1], sizes[k]);
+            Matrix next_deltas = member_rows(population->deltas[k + 1], member, sizes[k + 1], size);
+            Matrix weighted_sums = member_rows(population->weighted_sums[k], member, sizes[k], size);
+            layer_backward_hidden(activation_of(population, k), &next_weights, &next_deltas, &weighted_sums, &input,
+                                  input_rows, &deltas, &delta_weights, &delta_biases);
+        }
+    }
+
+    //the averaged gradient with the member's own learning rate
+    double scale = population->learning_rates[member] / size;
+    for (int k = 1; k <= output_layer; k++) {
+        Matrix weights = member_rows(population->weights[k], member, sizes[k], sizes[k - 1]);
+        Matrix delta_weights = member_rows(population->delta_weights[k], member, sizes[k], sizes[k - 1]);
+        Matrix biases = member_rows(population->biases[k], member, sizes[k], 1);
+        Matrix delta_biases = member_rows(population->delta_biases[k], member, sizes[k], 1);
+        descend(&weights, &delta_weights, scale);
+        descend(&biases, &delta_biases, scale);
+    }
+}
+
+// index of the largest value in a column
+static int column_max_index(Matrix *matrix, int col) {
+    int max_index = 0;
+    for (int i = 1; i < matrix->rows; i++) {
+        if (MATRIX_AT(matrix, i, col) > MATRIX_AT(matrix, max_index, col)) {
+            max_index = i;
+        }
+    }
+    return max_index;
+}
+
+// add the loss and the successes of one member on the loaded samples
+static void score_member(Population *population, int member) {
+    int output_layer = population->number_of_layers - 1;
+    int classes = population->layer_sizes[output_layer];
+    int size = population->batch_size;
+    Matrix outputs = member_rows(population->activations[output_layer], member, classes, size);
+    Matrix targets = matrix_view(population->targets, 0, 0, classes, size);
+    population->losses[member] += layer_loss(population->loss, &outputs, &targets);
+    for (int j = 0; j < size; j++) {
+        if (column_max_index(&outputs, j) == column_max_index(&targets, j)) {
+            population->successes[member]++;
+        }
+    }
+}
+
+static void population_task(void *context, int thread_index, int number_of_threads) {
+    Population *population = context;
+    int begin, end;
+    thread_range(population->number_of_members, thread_index, number_of_threads, &begin, &end);
+    if (begin == end) {
+        return;
+    }
+    forward_members(population, begin, end);
+    for (int m = begin; m < end; m++) {
+        if (population->training) {
+            train_member(population, m);
+        } else {
+            score_member(population, m);
+        }
+    }
+}
+
+// run the loaded samples through every member
+static void run(Population *population, int training) {
+    population->training = training;
+    if (population->pool == NULL) {
+        population_task(population, 0, 1);
+    } else {
+        thread_pool_run(population->pool, population_task, population);
+    }
+}
+
+void train_population_rows(Population *population, const SampleRows *rows) {
+    if (rows->number_of_samples > population->capacity) {
+        printf("Error: Batch is too small!\n");
+        return;
+    }
+    load_samples(population, rows, 0, rows->number_of_samples);
+    run(population, 1);
+}
+
+void population_evaluate(Population *population, const SampleRows *rows) {
+    int number_of_members = population->number_of_members;
+    for (int m = 0; m < number_of_members; m++) {
+        population->losses[m] = 0;
+        population->successes[m] = 0;
+    }
+    for (int start = 0; start < rows->number_of_samples; start += population->capacity) {
+        int count = rows->number_of_samples - start;
+        load_samples(population, rows, start, count < population->capacity ? count : population->capacity);
+        run(population, 0);
+    }
+    int length = rows->number_of_samples;
+    for (int m = 0; m < number_of_members; m++) {
+        population->losses[m] = length > 0 ? population->losses[m] / length : 0;
+        population->success_rates[m] = length > 0 ? (double) population->successes[m] / length : 0;
+    }
+}
+
+int population_best_member(Population *population) {
+    int best = 0;
+    for (int m = 1; m < population->number_of_members; m++) {
+        double rate = population->success_rates[m];
+        double best_rate = population->success_rates[best];
+        //a diverged member's loss is not finite and never wins a tie
+        if (rate > best_rate || (rate == best_rate && isfinite(population->losses[m]) &&
+                                 !(population->losses[m] >= population->losses[best]))) {
+            best = m;
+        }
+    }
+    return best;
+}
+
+Network *population_member_network(Population *population, int member) {
+    int *sizes = population->layer_sizes;
+    Network *network = create_network(population->number_of_layers, sizes);
+    network->loss = population->loss;
+    for (int k = 1; k < population->number_of_layers; k++) {
+        Matrix weights = member_rows(population->weights[k], member, sizes[k], sizes[k - 1]);
+        Matrix biases = member_rows(population->biases[k], member, sizes[k], 1);
+        copy_matrix(&weights, network->layers[k]->weights);
+        copy_matrix(&biases, network->layers[k]->biases);
+    }
+    return network;
+}
@@ -0,0 +1,72 @@
+//
+// Population training: many networks of one topology, e.g. the seeds and learning rates of a
+// sweep, trained side by side on the same mini-batches. The weights of every layer are stacked
+// member after member into one matrix, so the first layer, whose input all members share, is
+// one matrix product over the stacked weights instead of one small product per member.
+//
+
+#ifndef SEM2LAB2_POPULATION_H
+#define SEM2LAB2_POPULATION_H
+
+#include <stdint.h>
+#include "network.h"
+#include "thread_pool.h"
+
+struct Population {
+    int number_of_members;
+    int number_of_layers;
+    int *layer_sizes;
+    //cross-entropy unless changed after create_population, as for a network
+    LossFunction loss;
+    //member m's layer k is rows [m * layer_sizes[k], (m + 1) * layer_sizes[k]) of every per-layer matrix
+    Matrix **weights;
+    Matrix **biases;
+    Matrix **delta_weights;
+    Matrix **delta_biases;
+    //mini-batch buffers, one sample per column
+    int capacity;
+    Matrix **weighted_sums;
+    Matrix **activations;
+    Matrix **deltas;
+    //inputs and one-hot targets of the loaded samples, shared by every member
+    Matrix *input;
+    Matrix *targets;
+    Matrix input_rows;
+    int uses_input_rows;
+    int batch_size;
+    //per member
+    uint64_t *seeds;
+    double *learning_rates;
+    //loss and success rate of every member after population_evaluate
+    double *losses;
+    double *success_rates;
+    long *successes;
+    //NULL runs every member on the calling thread, each thread owns a range of members otherwise
+    ThreadPool *pool;
+    int number_of_threads;
+    //state of the pass currently being run
+    int training;
+    //owns every matrix above
+    Arena *arena;
+} typedef Population;
+
+// number_of_members networks, member m starts from the weights create_network makes after srand(seeds[m])
+// and trains with learning_rates[m], mini-batches hold up to capacity samples
+Population *create_population(int number_of_layers, int *layer_sizes, int number_of_members, const uint64_t *seeds,
+                              const double *learning_rates, int capacity, int number_of_threads);
+
+void free_population(Population *population);
+
+// one gradient descent step of every member on the same samples of rows
+void train_population_rows(Population *population, const SampleRows *rows);
+
+// loss and success rate of every member over all samples of rows, written to losses and success_rates
+void population_evaluate(Population *population, const SampleRows *rows);
+
+// index of the member with the highest success rate, the lower loss breaks ties
+int population_best_member(Population *population);
+
+// copy of member's weights and biases as a network of its own
+Network *population_member_network(Population *population, int member);
+
+#endif //SEM2LAB2_POPULATION_H
@@ -0,0 +1,139 @@
+//
+// Where the time of training goes: phase timers, throughput and peak memory.
+//
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "profiler.h"
+#include <stdlib.h>
+#include <time.h>
+#include "network.h"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+static const char *phase_names[PROFILE_PHASES] = {"sampling", "forward", "backward", "reduction", "update",
+                                                  "evaluation"};
+
+double profiler_now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec * 1e-9;
+}
+
+Profiler *create_profiler(char *file_name, ProfileFormat format, double flops_per_sample) {
+    FILE *file = stdout;
+    if (file_name != NULL) {
+        file = fopen(file_name, "w");
+        if (file == NULL) {
+            printf("Error: Could not create file!\n");
+            return NULL;
+        }
+    }
+    Profiler *profiler = calloc(1, sizeof(Profiler));
+    profiler->file = file;
+    profiler->owns_file = file_name != NULL;
+    profiler->format = format;
+    profiler->flops_per_sample = flops_per_sample;
+    profiler->start = profiler_now();
+    profiler->interval_start = profiler->start;
+    if (format == PROFILE_CSV) {
+        fprintf(file, "record,iteration,seconds");
+        for (int p = 0; p < PROFILE_PHASES; p++) {
+            fprintf(file, ",%s", phase_names[p]);
+        }
+        fprintf(file, ",samples,samples_per_second,gflops,peak_rss_mb,loss,success_rate\n");
+    }
+    return profiler;
+}
+
+double training_flops_per_sample(Network *network) {
+    double weights = 0;
+    for (int i = 1; i < network->number_of_layers; i++) {
+        weights += (double) network->layers[i]->layer_size * network->layers[i]->input_size;
+    }
+    //a multiply-add per weight forward, two backward
+    return 2 * weights * 3;
+}
+
+size_t peak_resident_bytes() {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return (size_t) usage.ru_maxrss;
+#else
+    //kilobytes on Linux and the BSDs
+    return (size_t) usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+// one line for the given phase times, throughput is measured on the time not spent evaluating
+static void write_record(Profiler *profiler, const char *record, int iteration, const double *seconds,
+                         long samples, double elapsed, double loss, double success_rate) {
+    double training_seconds = elapsed - seconds[PROFILE_EVALUATION];
+    double samples_per_second = training_seconds > 0 ? samples / training_seconds : 0;
+    double gflops = samples_per_second * profiler->flops_per_sample * 1e-9;
+    double peak_rss_mb = peak_resident_bytes() / (1024.0 * 1024.0);
+    FILE *file = profiler->file;
+    if (profiler->format == PROFILE_CSV) {
+        fprintf(file, "%s,%d,%.6f", record, iteration, elapsed);
+        for (int p = 0; p < PROFILE_PHASES; p++) {
+            fprintf(file, ",%.6f", seconds[p]);
+        }
+        fprintf(file, ",%ld,%.1f,%.4f,%.1f,%.6f,%.6f\n", samples, samples_per_second, gflops, peak_rss_mb, loss,
+                success_rate);
+    } else {
+        fprintf(file, "{\"record\":\"%s\",\"iteration\":%d,\"seconds\":%.6f", record, iteration, elapsed);
+        for (int p = 0; p < PROFILE_PHASES; p++) {
+            fprintf(file, ",\"%s\":%.6f", phase_names[p], seconds[p]);
+        }
+        fprintf(file, ",\"samples\":%ld,\"samples_per_second\":%.1f,\"gflops\":%.4f,\"peak_rss_mb\":%.1f,"
+                      "\"loss\":%.6f,\"success_rate\":%.6f}\n", samples, samples_per_second, gflops, peak_rss_mb,
+                loss, success_rate);
+    }
+    fflush(file);
+}
+
+void profiler_record(Profiler *profiler, int iteration, double loss, double success_rate) {
+    if (profiler == NULL) {
+        return;
+    }
+    double now = profiler_now();
+    write_record(profiler, "interval", iteration, profiler->phase_seconds, profiler->samples,
+                 now - profiler->interval_start, loss, success_rate);
+    for (int p = 0; p < PROFILE_PHASES; p++) {
+        profiler->total_seconds[p] += profiler->phase_seconds[p];
+        profiler->phase_seconds[p] = 0;
+    }
+    profiler->total_samples += profiler->samples;
+    profiler->samples = 0;
+    profiler->iterations = 0;
+    profiler->interval_start = now;
+    profiler->last_loss = loss;
+    profiler->last_success_rate = success_rate;
+    profiler->last_iteration = iteration;
+}
+
+void free_profiler(Profiler *profiler) {
+    if (profiler == NULL) {
+        return;
+    }
+    //steps after the last record still count towards the totals
+    for (int p = 0; p < PROFILE_PHASES; p++) {
+        profiler->total_seconds[p] += profiler->phase_seconds[p];
+    }
+    profiler->total_samples += profiler->samples;
+    write_record(profiler, "total", profiler->last_iteration, profiler->total_seconds, profiler->total_samples,
+                 profiler_now() - profiler->start, profiler->last_loss, profiler->last_success_rate);
+    if (profiler->owns_file) {
+        fclose(profiler->file);
+    }
+    free(profiler);
+}
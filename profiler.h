@@ -0,0 +1,112 @@
+//
+// Where the time of training goes: monotonic timers around every phase of a training step,
+// samples and floating point operations per second and peak memory, written as CSV or JSON
+// lines. Everything takes a Profiler that may be NULL, which turns each timer into one branch.
+//
+
+#ifndef SEM2LAB2_PROFILER_H
+#define SEM2LAB2_PROFILER_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+struct network;
+
+enum ProfilePhase {
+    //drawing the batch indices and loading the samples into the batches
+    PROFILE_SAMPLING,
+    PROFILE_FORWARD,
+    PROFILE_BACKWARD,
+    //summing the per-thread gradients
+    PROFILE_REDUCTION,
+    //clipping and applying the gradients
+    PROFILE_UPDATE,
+    PROFILE_EVALUATION,
+    PROFILE_PHASES
+} typedef ProfilePhase;
+
+enum ProfileFormat {
+    //a header line, then one line of comma separated values per record
+    PROFILE_CSV,
+    //one JSON object per record and line
+    PROFILE_JSON_LINES
+} typedef ProfileFormat;
+
+struct Profiler {
+    FILE *file;
+    int owns_file;
+    ProfileFormat format;
+    //work of training on one sample, see training_flops_per_sample
+    double flops_per_sample;
+    //since the last record
+    double phase_seconds[PROFILE_PHASES];
+    long samples;
+    long iterations;
+    double interval_start;
+    //since create_profiler
+    double total_seconds[PROFILE_PHASES];
+    long total_samples;
+    double start;
+    //measured at the last record, repeated in the summary
+    int last_iteration;
+    double last_loss;
+    double last_success_rate;
+} typedef Profiler;
+
+// seconds of a monotonic clock, only differences are meaningful
+double profiler_now();
+
+// write records to file_name, stdout when it is NULL, returns NULL when the file cannot be created
+Profiler *create_profiler(char *file_name, ProfileFormat format, double flops_per_sample);
+
+// write the summary record of the whole run and close the file
+void free_profiler(Profiler *profiler);
+
+// floating point operations of the forward and backward pass of one sample, counting a multiply-add as 2
+// the forward pass takes one per weight, the backward pass two: the deltas and the weight gradients
+double training_flops_per_sample(struct network *network);
+
+// largest resident set of the process so far, 0 where it is not known
+size_t peak_resident_bytes();
+
+// start of a timed phase, 0 without a profiler
+static inline double profile_begin(const Profiler *profiler) {
+    return profiler != NULL ? profiler_now() : 0;
+}
+
+// add the time since begin to phase
+static inline void profile_end(Profiler *profiler, ProfilePhase phase, double begin) {
+    if (profiler != NULL) {
+        profiler->phase_seconds[phase] += profiler_now() - begin;
+    }
+}
+
+// seconds since *mark, which is moved to now, 0 without a profiler
+static inline double profile_lap(const Profiler *profiler, double *mark) {
+    if (profiler == NULL) {
+        return 0;
+    }
+    double now = profiler_now();
+    double elapsed = now - *mark;
+    *mark = now;
+    return elapsed;
+}
+
+static inline void profile_add(Profiler *profiler, ProfilePhase phase, double seconds) {
+    if (profiler != NULL) {
+        profiler->phase_seconds[phase] += seconds;
+    }
+}
+
+// count one training step on number_of_samples samples
+static inline void profile_step(Profiler *profiler, int number_of_samples) {
+    if (profiler != NULL) {
+        profiler->samples += number_of_samples;
+        profiler->iterations++;
+    }
+}
+
+// write one record of everything since the previous one with the loss and success rate measured at iteration
+void profiler_record(Profiler *profiler, int iteration, double loss, double success_rate);
+
+#endif //SEM2LAB2_PROFILER_H
@@ -0,0 +1,508 @@
+//
+// Post-training int8 quantization. Weights are rounded to int8 with one scale per layer or
+// per row, and the inputs of every layer with one scale calibrated on sample data. Inference
+// multiplies int8 by int8 into int32 sums that are turned back into real values, passed
+// through Leaky ReLU and requantized for the next layer in one sweep.
+//
+
+#include "quantization.h"
+#include "model_io.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define QUANTIZED_X86
+#include <immintrin.h>
+#endif
+
+#define CALIBRATION_BATCH_SIZE 512
+
+// sum of a[i] * b[i], n is a multiple of QUANTIZED_ROW_MULTIPLE
+typedef int32_t (*QuantizedDot)(int n, const int8_t *a, const int8_t *b);
+
+// Leaky ReLU of sums[r] * scales[r] + biases[r] requantized with inverse_scale, the hidden layer epilogue
+typedef void (*QuantizedEpilogue)(int n, const int32_t *sums, const float *scales, const float *biases,
+                                  float inverse_scale, int8_t *result);
+
+// round values * inverse_scale to int8
+typedef void (*QuantizeValues)(int n, const MatrixValue *values, float inverse_scale, int8_t *result);
+
+struct QuantizedKernels {
+    MatrixIsa isa;
+    QuantizedDot dot;
+    QuantizedEpilogue epilogue;
+    QuantizeValues quantize;
+} typedef QuantizedKernels;
+
+static inline int8_t saturate(float value) {
+    if (value > QUANTIZED_MAX) {
+        return QUANTIZED_MAX;
+    }
+    if (value < -QUANTIZED_MAX) {
+        return -QUANTIZED_MAX;
+    }
+    //round half to even like the vector conversions
+    return (int8_t) lrintf(value);
+}
+
+static int32_t dot_scalar(int n, const int8_t *a, const int8_t *b) {
+    int32_t sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += (int32_t) a[i] * b[i];
+    }
+    return sum;
+}
+
+static void epilogue_scalar(int n, const int32_t *sums, const float *scales, const float *biases, float inverse_scale,
+                            int8_t *result) {
+    for (int r = 0; r < n; r++) {
+        float value = (float) sums[r] * scales[r] + biases[r];
+        value *= value >= 0 ? (float) ReLU_B : (float) ReLU_A;
+        result[r] = saturate(value * inverse_scale);
+    }
+}
+
+static void quantize_scalar(int n, const MatrixValue *values, float inverse_scale, int8_t *result) {
+    for (int i = 0; i < n; i++) {
+        result[i] = saturate((float) values[i] * inverse_scale);
+    }
+}
+
+#ifdef QUANTIZED_X86
+
+__attribute__((target("sse2")))
+static int32_t dot_sse2(int n, const int8_t *a, const int8_t *b) {
+    __m128i sum = _mm_setzero_si128();
+    for (int i = 0; i < n; i += 16) {
+        __m128i x = _mm_load_si128((const __m128i *) (a + i));
+        __m128i y = _mm_load_si128((const __m128i *) (b + i));
+        //sign extend to int16 by unpacking every byte into the high half and shifting it back down
+        __m128i x_low = _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8);
+        __m128i x_high = _mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8);
+        __m128i y_low = _mm_srai_epi16(_mm_unpacklo_epi8(y, y), 8);
+        __m128i y_high = _mm_srai_epi16(_mm_unpackhi_epi8(y, y), 8);
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(x_low, y_low));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(x_high, y_high));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("avx2")))
+static int32_t dot_avx2(int n, const int8_t *a, const int8_t *b) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < n; i += 32) {
+        __m256i x = _mm256_load_si256((const __m256i *) (a + i));
+        __m256i y = _mm256_load_si256((const __m256i *) (b + i));
+        //maddubs wants an unsigned operand: |x| * (y with the sign of x), a pair stays below 2 * 127 * 127
+        __m256i pairs = _mm256_maddubs_epi16(_mm256_sign_epi8(x, x), _mm256_sign_epi8(y, x));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(pairs, ones));
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+    return _mm_cvtsi128_si32(half);
+}
+
+// clamp, round and narrow 8 floats to 8 int8
+__attribute__((target("avx2")))
+static inline void store_saturated_avx2(__m256 values, int8_t *result) {
+    const __m256 limit = _mm256_set1_ps(QUANTIZED_MAX);
+    values = _mm256_min_ps(_mm256_max_ps(values, _mm256_sub_ps(_mm256_setzero_ps(), limit)), limit);
+    __m256i integers = _mm256_cvtps_epi32(values);
+    __m128i shorts = _mm_packs_epi32(_mm256_castsi256_si128(integers), _mm256_extracti128_si256(integers, 1));
+    _mm_storel_epi64((__m128i *) result, _mm_packs_epi16(shorts, shorts));
+}
+
+__attribute__((target("avx2,fma")))
+static void epilogue_avx2(int n, const int32_t *sums, const float *scales, const float *biases, float inverse_scale,
+                          int8_t *result) {
+    const __m256 negative_slope = _mm256_set1_ps((float) ReLU_A);
+    const __m256 positive_slope = _mm256_set1_ps((float) ReLU_B);
+    const __m256 inverse = _mm256_set1_ps(inverse_scale);
+    int r = 0;
+    for (; r + 8 <= n; r += 8) {
+        __m256 value = _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *) (sums + r))),
+                                       _mm256_loadu_ps(scales + r), _mm256_loadu_ps(biases + r));
+        __m256 positive = _mm256_cmp_ps(value, _mm256_setzero_ps(), _CMP_GE_OQ);
+        value = _mm256_mul_ps(value, _mm256_blendv_ps(negative_slope, positive_slope, positive));
+        store_saturated_avx2(_mm256_mul_ps(value, inverse), result + r);
+    }
+    epilogue_scalar(n - r, sums + r, scales + r, biases + r, inverse_scale, result + r);
+}
+
+__attribute__((target("avx2")))
+static void quantize_avx2(int n, const MatrixValue *values, float inverse_scale, int8_t *result) {
+    const __m256 inverse = _mm256_set1_ps(inverse_scale);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+#ifdef MATRIX_FLOAT32
+        __m256 chunk = _mm256_loadu_ps(values + i);
+#else
+        __m256 chunk = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(_mm256_loadu_pd(values + i))),
+                                            _mm256_cvtpd_ps(_mm256_loadu_pd(values + i + 4)), 1);
+#endif
+        store_saturated_avx2(_mm256_mul_ps(chunk, inverse), result + i);
+    }
+    quantize_scalar(n - i, values + i, inverse_scale, result + i);
+}
+
+#endif
+
+static const QuantizedKernels kernels_table[] = {
+        {MATRIX_ISA_SCALAR, dot_scalar, epilogue_scalar, quantize_scalar},
+#ifdef QUANTIZED_X86
+        {MATRIX_ISA_SSE2,   dot_sse2,   epilogue_scalar, quantize_scalar},
+        {MATRIX_ISA_AVX2,   dot_avx2,   epilogue_avx2,   quantize_avx2},
+#endif
+};
+
+// follows the instruction set picked for matrix_gemm, including matrix_select_isa
+static const QuantizedKernels *active_kernels() {
+    MatrixIsa isa = matrix_active_isa();
+    const QuantizedKernels *best = &kernels_table[0];
+    for (size_t i = 0; i < sizeof(kernels_table) / sizeof(kernels_table[0]); i++) {
+        if (kernels_table[i].isa <= isa && kernels_table[i].isa >= best->isa) {
+            best = &kernels_table[i];
+        }
+    }
+    return best;
+}
+
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + MODEL_ALIGNMENT - 1) / MODEL_ALIGNMENT * MODEL_ALIGNMENT;
+}
+
+static int padded_size(int size) {
+    return (size + QUANTIZED_ROW_MULTIPLE - 1) / QUANTIZED_ROW_MULTIPLE * QUANTIZED_ROW_MULTIPLE;
+}
+
+static float scale_for_range(double range) {
+    return range > 0 ? (float) (range / QUANTIZED_MAX) : 1.0f;
+}
+
+// scale of the inputs of every layer from the largest magnitude seen over the calibration rows
+static void calibrate(Network *network, const SampleRows *rows, float *input_scales) {
+    int number_of_layers = network->number_of_layers;
+    double *ranges = calloc(number_of_layers, sizeof(double));
+    Batch *batch = create_batch(network, CALIBRATION_BATCH_SIZE);
+    for (int first = 0; first < rows->number_of_samples; first += CALIBRATION_BATCH_SIZE) {
+        int count = rows->number_of_samples - first < CALIBRATION_BATCH_SIZE ? rows->number_of_samples - first
+                                                                              : CALIBRATION_BATCH_SIZE;
+        for (int j = 0; j < count; j++) {
+            int sample = rows->indices == NULL ? first + j : rows->indices[first + j];
+            const MatrixValue *features = rows->features + (size_t) sample * rows->feature_stride;
+            for (int k = 0; k < rows->number_of_features; k++) {
+                ranges[1] = fmax(ranges[1], fabs(features[k]));
+            }
+        }
+        load_batch_rows(batch, rows, first, count);
+        propagate_forward_batch(network, batch);
+        //the output layer is dequantized and never feeds another layer
+        for (int i = 2; i < number_of_layers; i++) {
+            Matrix *activations = batch->activations[i - 1];
+            for (int r = 0; r < network->layers[i - 1]->layer_size; r++) {
+                const MatrixValue *row = matrix_row(activations, r);
+                for (int j = 0; j < count; j++) {
+                    ranges[i] = fmax(ranges[i], fabs(row[j]));
+                }
+            }
+        }
+    }
+    for (int i = 0; i < number_of_layers; i++) {
+        input_scales[i] = scale_for_range(ranges[i]);
+    }
+    free_batch(batch);
+    free(ranges);
+}
+
+static int valid_quantized(const unsigned char *image, size_t size, int verify_checksum) {
+    const QuantizedHeader *header = (const QuantizedHeader *) image;
+    if (size < sizeof(QuantizedHeader) || memcmp(header->magic, QUANTIZED_MAGIC, 4) != 0) {
+        printf("Error: Not a quantized model file!\n");
+        return 0;
+    }
+    if (header->version != QUANTIZED_VERSION ||
+        (header->granularity != QUANTIZE_PER_LAYER && header->granularity != QUANTIZE_PER_ROW)) {
+        printf("Error: Unsupported quantized model version or granularity!\n");
+        return 0;
+    }
+    if (header->file_size != size || header->number_of_layers < 2 ||
+        sizeof(QuantizedHeader) + header->number_of_layers * sizeof(QuantizedLayerEntry) > size) {
+        printf("Error: Model file is truncated!\n");
+        return 0;
+    }
+    const QuantizedLayerEntry *entries = (const QuantizedLayerEntry *) (image + sizeof(QuantizedHeader));
+    for (uint32_t i = 1; i < header->number_of_layers; i++) {
+        uint64_t weights_end = entries[i].weights_offset + (uint64_t) entries[i].layer_size * entries[i].weights_stride;
+        uint64_t scales_end = entries[i].scales_offset + (uint64_t) entries[i].layer_size * sizeof(float);
+        uint64_t biases_end = entries[i].biases_offset + (uint64_t) entries[i].layer_size * sizeof(float);
+        if (weights_end > size || scales_end > size || biases_end > size ||
+            entries[i].weights_offset % MODEL_ALIGNMENT != 0 ||
+            entries[i].weights_stride != (uint32_t) padded_size((int) entries[i].input_size) ||
+            entries[i].input_size != entries[i - 1].layer_size || !(entries[i].input_scale > 0)) {
+            printf("Error: Model layer table is corrupt!\n");
+            return 0;
+        }
+    }
+    if (verify_checksum &&
+        model_crc32(0, image + sizeof(QuantizedHeader), size - sizeof(QuantizedHeader)) != header->checksum) {
+        printf("Error: Model checksum does not match!\n");
+        return 0;
+    }
+    return 1;
+}
+
+// point a model at the layers of a validated image, which the model owns from now on
+static QuantizedModel *attach_image(unsigned char *image, size_t size, int mapped) {
+    const QuantizedHeader *header = (const QuantizedHeader *) image;
+    const QuantizedLayerEntry *entries = (const QuantizedLayerEntry *) (image + sizeof(QuantizedHeader));
+    QuantizedModel *model = malloc(sizeof(QuantizedModel));
+    int number_of_layers = (int) header->number_of_layers;
+    model->number_of_layers = number_of_layers;
+    model->granularity = (QuantizationGranularity) header->granularity;
+    model->layer_sizes = malloc(number_of_layers * sizeof(int));
+    model->layers = calloc(number_of_layers, sizeof(QuantizedLayer));
+    model->largest_stride = 0;
+    model->image = image;
+    model->image_size = size;
+    model->mapped = mapped;
+    for (int i = 0; i < number_of_layers; i++) {
+        QuantizedLayer *layer = &model->layers[i];
+        layer->layer_size = (int) entries[i].layer_size;
+        layer->input_size = (int) entries[i].input_size;
+        layer->stride = (int) entries[i].weights_stride;
+        layer->input_scale = entries[i].input_scale;
+        layer->activation = i == 0 ? LAYER_ACTIVATION_NONE : i == number_of_layers - 1 ? LAYER_ACTIVATION_SOFTMAX
+                                                                                        : LAYER_ACTIVATION_LEAKY_RELU;
+        if (i > 0) {
+            layer->weights = (const int8_t *) (image + entries[i].weights_offset);
+            layer->scales = (const float *) (image + entries[i].scales_offset);
+            layer->biases = (const float *) (image + entries[i].biases_offset);
+        }
+        model->layer_sizes[i] = layer->layer_size;
+        if (padded_size(layer->layer_size) > model->largest_stride) {
+            model->largest_stride = padded_size(layer->layer_size);
+        }
+    }
+    return model;
+}
+
+QuantizedModel *quantize_network(Network *network, const SampleRows *calibration_rows,
+                                 QuantizationGranularity granularity) {
+    int number_of_layers = network->number_of_layers;
+    float *input_scales = malloc(number_of_layers * sizeof(float));
+    calibrate(network, calibration_rows, input_scales);
+
+    QuantizedHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, QUANTIZED_MAGIC, 4);
+    header.version = QUANTIZED_VERSION;
+    header.number_of_layers = number_of_layers;
+    header.granularity = granularity;
+
+    //lay out the blobs after the layer table
+    QuantizedLayerEntry *entries = calloc(number_of_layers, sizeof(QuantizedLayerEntry));
+    uint64_t offset = align_offset(sizeof(QuantizedHeader) + number_of_layers * sizeof(QuantizedLayerEntry));
+    for (int i = 0; i < number_of_layers; i++) {
+        Layer *layer = network->layers[i];
+        entries[i].layer_size = layer->layer_size;
+        entries[i].input_size = layer->input_size;
+        if (i == 0) {
+            continue;
+        }
+        entries[i].weights_stride = padded_size(layer->input_size);
+        entries[i].input_scale = input_scales[i];
+        entries[i].weights_offset = offset;
+        offset = align_offset(offset + (uint64_t) layer->layer_size * entries[i].weights_stride);
+        entries[i].scales_offset = offset;
+        offset = align_offset(offset + (uint64_t) layer->layer_size * sizeof(float));
+        entries[i].biases_offset = offset;
+        offset = align_offset(offset + (uint64_t) layer->layer_size * sizeof(float));
+    }
+    header.file_size = offset;
+
+    //zeroed, so the padding of every weight row is 0 and adds nothing to the sums
+    unsigned char *image = aligned_calloc(offset);
+    memcpy(image + sizeof(QuantizedHeader), entries, number_of_layers * sizeof(QuantizedLayerEntry));
+    for (int i = 1; i < number_of_layers; i++) {
+        Layer *layer = network->layers[i];
+        int8_t *weights = (int8_t *) (image + entries[i].weights_offset);
+        float *scales = (float *) (image + entries[i].scales_offset);
+        float *biases = (float *) (image + entries[i].biases_offset);
+        double layer_range = 0;
+        for (int r = 0; r < layer->layer_size; r++) {
+            const MatrixValue *row = matrix_row(layer->weights, r);
+            for (int k = 0; k < layer->input_size; k++) {
+                layer_range = fmax(layer_range, fabs(row[k]));
+            }
+        }
+        for (int r = 0; r < layer->layer_size; r++) {
+            const MatrixValue *row = matrix_row(layer->weights, r);
+            double range = layer_range;
+            if (granularity == QUANTIZE_PER_ROW) {
+                range = 0;
+                for (int k = 0; k < layer->input_size; k++) {
+                    range = fmax(range, fabs(row[k]));
+                }
+            }
+            float weight_scale = scale_for_range(range);
+            for (int k = 0; k < layer->input_size; k++) {
+                weights[(size_t) r * entries[i].weights_stride + k] = saturate((float) (row[k] / weight_scale));
+            }
+            scales[r] = weight_scale * input_scales[i];
+            biases[r] = (float) MATRIX_AT(layer->biases, r, 0);
+        }
+    }
+    header.checksum = model_crc32(0, image + sizeof(QuantizedHeader), offset - sizeof(QuantizedHeader));
+    memcpy(image, &header, sizeof(header));
+    free(entries);
+    free(input_scales);
+    return attach_image(image, offset, 0);
+}
+
+void free_quantized_model(QuantizedModel *model) {
+    if (model->mapped) {
+        unmap_model(model->image, model->image_size);
+    } else {
+        aligned_free(model->image);
+    }
+    free(model->layers);
+    free(model->layer_sizes);
+    free(model);
+}
+
+int save_quantized_model(QuantizedModel *model, char *file_name) {
+    FILE *file = fopen(file_name, "wb");
+    if (file == NULL) {
+        printf("Error: Could not open file!\n");
+        return -1;
+    }
+    int result = fwrite(model->image, 1, model->image_size, file) == model->image_size ? 0 : -1;
+    fclose(file);
+    return result;
+}
+
+QuantizedModel *load_quantized_model(char *file_name, int verify_checksum) {
+    size_t size = 0;
+    unsigned char *image = map_model(file_name, &size);
+    if (image == NULL) {
+        printf("Error: Could not open file!\n");
+        return NULL;
+    }
+    if (!valid_quantized(image, size, verify_checksum)) {
+        unmap_model(image, size);
+        return NULL;
+    }
+    return attach_image(image, size, 1);
+}
+
+size_t quantized_parameter_bytes(const QuantizedModel *model) {
+    size_t bytes = 0;
+    for (int i = 1; i < model->number_of_layers; i++) {
+        const QuantizedLayer *layer = &model->layers[i];
+        bytes += (size_t) layer->layer_size * layer->stride + 2 * layer->layer_size * sizeof(float);
+    }
+    return bytes;
+}
+
+QuantizedScratch *create_quantized_scratch(const QuantizedModel *model) {
+    QuantizedScratch *scratch = malloc(sizeof(QuantizedScratch));
+    //zeroed so the padding of the activation vectors never holds garbage
+    scratch->activations[0] = aligned_calloc(model->largest_stride);
+    scratch->activations[1] = aligned_calloc(model->largest_stride);
+    scratch->sums = aligned_calloc(model->largest_stride * sizeof(int32_t));
+    scratch->outputs = aligned_calloc(model->largest_stride * sizeof(float));
+    return scratch;
+}
+
+void free_quantized_scratch(QuantizedScratch *scratch) {
+    aligned_free(scratch->activations[0]);
+    aligned_free(scratch->activations[1]);
+    aligned_free(scratch->sums);
+    aligned_free(scratch->outputs);
+    free(scratch);
+}
+
+// forward pass of one sample, layer i reads activations[(i - 1) % 2] and writes activations[i % 2]
+// the probabilities are left in scratch->outputs and also copied to output when it is not NULL
+static void infer_sample(const QuantizedModel *model, const QuantizedKernels *kernels, QuantizedScratch *scratch,
+                         const MatrixValue *input, MatrixValue *output) {
+    int output_layer = model->number_of_layers - 1;
+    kernels->quantize(model->layer_sizes[0], input, 1.0f / model->layers[1].input_scale, scratch->activations[0]);
+    for (int i = 1; i < output_layer; i++) {
+        const QuantizedLayer *layer = &model->layers[i];
+        const int8_t *inputs = scratch->activations[(i - 1) % 2];
+        for (int r = 0; r < layer->layer_size; r++) {
+            scratch->sums[r] = kernels->dot(layer->stride, layer->weights + (size_t) r * layer->stride, inputs);
+        }
+        kernels->epilogue(layer->layer_size, scratch->sums, layer->scales, layer->biases,
+                          1.0f / model->layers[i + 1].input_scale, scratch->activations[i % 2]);
+    }
+
+    //the output layer is dequantized for the softmax
+    const QuantizedLayer *layer = &model->layers[output_layer];
+    const int8_t *inputs = scratch->activations[(output_layer - 1) % 2];
+    float max = -INFINITY;
+    for (int r = 0; r < layer->layer_size; r++) {
+        int32_t sum = kernels->dot(layer->stride, layer->weights + (size_t) r * layer->stride, inputs);
+        scratch->outputs[r] = (float) sum * layer->scales[r] + layer->biases[r];
+        max = scratch->outputs[r] > max ? scratch->outputs[r] : max;
+    }
+    float sum = 0;
+    for (int r = 0; r < layer->layer_size; r++) {
+        scratch->outputs[r] = expf(scratch->outputs[r] - max);
+        sum += scratch->outputs[r];
+    }
+    for (int r = 0; r < layer->layer_size; r++) {
+        scratch->outputs[r] /= sum;
+    }
+    if (output != NULL) {
+        for (int r = 0; r < layer->layer_size; r++) {
+            output[r] = (MatrixValue) scratch->outputs[r];
+        }
+    }
+}
+
+void infer_batch_quantized(const QuantizedModel *model, QuantizedScratch *scratch, const MatrixValue *inputs,
+                           int number_of_samples, MatrixValue *outputs) {
+    QuantizedScratch *temporary = NULL;
+    if (scratch == NULL) {
+        temporary = create_quantized_scratch(model);
+        scratch = temporary;
+    }
+    const QuantizedKernels *kernels = active_kernels();
+    int features = model->layer_sizes[0];
+    int classes = model->layer_sizes[model->number_of_layers - 1];
+    for (int j = 0; j < number_of_samples; j++) {
+        infer_sample(model, kernels, scratch, inputs + (size_t) j * features, outputs + (size_t) j * classes);
+    }
+    if (temporary != NULL) {
+        free_quantized_scratch(temporary);
+    }
+}
+
+int infer_class_quantized(const QuantizedModel *model, QuantizedScratch *scratch, const MatrixValue *input) {
+    QuantizedScratch *temporary = NULL;
+    if (scratch == NULL) {
+        temporary = create_quantized_scratch(model);
+        scratch = temporary;
+    }
+    //the class is read from the probabilities in the scratch, nothing is copied out
+    infer_sample(model, active_kernels(), scratch, input, NULL);
+    int classes = model->layer_sizes[model->number_of_layers - 1];
+    int best = 0;
+    for (int c = 1; c < classes; c++) {
+        if (scratch->outputs[c] > scratch->outputs[best]) {
+            best = c;
+        }
+    }
+    if (temporary != NULL) {
+        free_quantized_scratch(temporary);
+    }
+    return best;
+}
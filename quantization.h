@@ -0,0 +1,118 @@
+//
+// Post-training int8 quantization. Weights are rounded to int8 with one scale per layer or
+// per row, and the inputs of every layer with one scale calibrated on sample data. Inference
+// multiplies int8 by int8 into int32 sums that are turned back into real values, passed
+// through Leaky ReLU and requantized for the next layer in one sweep.
+//
+// The quantized model is one image in the file layout below, mapped read-only when loaded.
+//
+
+#ifndef SEM2LAB2_QUANTIZATION_H
+#define SEM2LAB2_QUANTIZATION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "network.h"
+
+#define QUANTIZED_MAGIC "NNQ8"
+#define QUANTIZED_VERSION 1
+// int8 weight rows and activation vectors are padded with zeros to a multiple of this many values
+#define QUANTIZED_ROW_MULTIPLE 32
+// samples quantized as int8 range over [-QUANTIZED_MAX, QUANTIZED_MAX], symmetric around 0
+#define QUANTIZED_MAX 127
+
+enum QuantizationGranularity {
+    //one weight scale for the whole layer
+    QUANTIZE_PER_LAYER = 1,
+    //one weight scale for every row, i.e. every neuron
+    QUANTIZE_PER_ROW = 2
+} typedef QuantizationGranularity;
+
+// on-disk header, little endian, 64 bytes long like the one of model_io.h
+struct QuantizedHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t number_of_layers;
+    uint32_t granularity;
+    //CRC-32 of every byte after the header
+    uint64_t checksum;
+    uint64_t file_size;
+    uint8_t reserved[32];
+} typedef QuantizedHeader;
+
+// one entry per layer right after the header, the input layer only records its size
+struct QuantizedLayerEntry {
+    uint32_t layer_size;
+    uint32_t input_size;
+    uint32_t weights_stride;
+    //real value of one int8 step of the layer's inputs
+    float input_scale;
+    //int8 weights, layer_size rows of weights_stride values
+    uint64_t weights_offset;
+    //float per row, turns the int32 sum of the row into a real value: weight scale * input_scale
+    uint64_t scales_offset;
+    //float per row
+    uint64_t biases_offset;
+} typedef QuantizedLayerEntry;
+
+struct QuantizedLayer {
+    int layer_size;
+    int input_size;
+    int stride;
+    float input_scale;
+    const int8_t *weights;
+    const float *scales;
+    const float *biases;
+    LayerActivation activation;
+} typedef QuantizedLayer;
+
+struct QuantizedModel {
+    int number_of_layers;
+    int *layer_sizes;
+    QuantizationGranularity granularity;
+    //layers[0] is the input layer and has no weights
+    QuantizedLayer *layers;
+    //largest padded layer, sizes the scratch
+    int largest_stride;
+    //the file image every layer points into, mapped by load_quantized_model or built in memory
+    unsigned char *image;
+    size_t image_size;
+    int mapped;
+} typedef QuantizedModel;
+
+// per-call buffers, one per thread
+struct QuantizedScratch {
+    int8_t *activations[2];
+    int32_t *sums;
+    float *outputs;
+} typedef QuantizedScratch;
+
+// quantize the weights of the network, activation ranges are taken from a forward pass over calibration_rows
+QuantizedModel *quantize_network(Network *network, const SampleRows *calibration_rows,
+                                 QuantizationGranularity granularity);
+
+void free_quantized_model(QuantizedModel *model);
+
+// write the model image, returns 0 on success
+int save_quantized_model(QuantizedModel *model, char *file_name);
+
+// map a quantized model, returns NULL when the file is missing or malformed
+QuantizedModel *load_quantized_model(char *file_name, int verify_checksum);
+
+// bytes of int8 weights plus their scales and biases
+size_t quantized_parameter_bytes(const QuantizedModel *model);
+
+QuantizedScratch *create_quantized_scratch(const QuantizedModel *model);
+
+void free_quantized_scratch(QuantizedScratch *scratch);
+
+// class probabilities of number_of_samples inputs, laid out like infer_batch
+// reentrant: the model is only read, scratch may be NULL to use a temporary one for this call
+void infer_batch_quantized(const QuantizedModel *model, QuantizedScratch *scratch, const MatrixValue *inputs,
+                           int number_of_samples, MatrixValue *outputs);
+
+// index of the most probable class of a single input
+// allocates nothing when scratch is given, NULL uses a temporary scratch as infer_batch_quantized does
+int infer_class_quantized(const QuantizedModel *model, QuantizedScratch *scratch, const MatrixValue *input);
+
+#endif //SEM2LAB2_QUANTIZATION_H
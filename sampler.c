@@ -0,0 +1,100 @@
+//
+// Random numbers and mini-batch sampling without the global libc generator.
+// Random is a xoshiro256** generator owned by its user, so every thread can keep its own.
+// Sampler walks a Fisher-Yates permutation of the data set, one contiguous slice per batch.
+//
+
+#include "sampler.h"
+#include <stdlib.h>
+
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t rotate_left(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+void random_seed(Random *random, uint64_t seed, uint64_t stream) {
+    //splitmix64 spreads the seed over the whole state, it is never all zero
+    uint64_t x = seed ^ (stream * 0xD1B54A32D192ED03ULL);
+    for (int i = 0; i < 4; i++) {
+        random->state[i] = splitmix64(&x);
+    }
+}
+
+uint64_t random_next(Random *random) {
+    uint64_t *s = random->state;
+    uint64_t result = rotate_left(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotate_left(s[3], 45);
+    return result;
+}
+
+uint32_t random_below(Random *random, uint32_t bound) {
+    //Lemire's multiply and reject
+    uint64_t product = (random_next(random) >> 32) * bound;
+    uint32_t low = (uint32_t) product;
+    if (low < bound) {
+        uint32_t threshold = -bound % bound;
+        while (low < threshold) {
+            product = (random_next(random) >> 32) * bound;
+            low = (uint32_t) product;
+        }
+    }
+    return (uint32_t) (product >> 32);
+}
+
+double random_uniform(Random *random) {
+    return (double) (random_next(random) >> 11) * 0x1.0p-53;
+}
+
+// Fisher-Yates shuffle of the permutation in place
+static void shuffle(Sampler *sampler) {
+    for (int i = sampler->number_of_samples - 1; i > 0; i--) {
+        int j = (int) random_below(&sampler->random, (uint32_t) i + 1);
+        int swap = sampler->permutation[i];
+        sampler->permutation[i] = sampler->permutation[j];
+        sampler->permutation[j] = swap;
+    }
+    sampler->position = 0;
+}
+
+Sampler *create_sampler(int number_of_samples, int batch_size, uint64_t seed) {
+    Sampler *sampler = malloc(sizeof(Sampler));
+    sampler->number_of_samples = number_of_samples;
+    sampler->batch_size = batch_size > number_of_samples ? number_of_samples : batch_size;
+    sampler->permutation = malloc(number_of_samples * sizeof(int));
+    for (int i = 0; i < number_of_samples; i++) {
+        sampler->permutation[i] = i;
+    }
+    random_seed(&sampler->random, seed, 0);
+    sampler->epoch = 0;
+    shuffle(sampler);
+    return sampler;
+}
+
+void free_sampler(Sampler *sampler) {
+    free(sampler->permutation);
+    free(sampler);
+}
+
+const int *sampler_next_batch(Sampler *sampler, int *count) {
+    //the incomplete tail of an epoch is skipped, it is reshuffled into the next one
+    if (sampler->position + sampler->batch_size > sampler->number_of_samples) {
+        shuffle(sampler);
+        sampler->epoch++;
+    }
+    const int *batch = sampler->permutation + sampler->position;
+    sampler->position += sampler->batch_size;
+    *count = sampler->batch_size;
+    return batch;
+}
@@ -0,0 +1,45 @@
+//
+// Random numbers and mini-batch sampling without the global libc generator.
+// Random is a xoshiro256** generator owned by its user, so every thread can keep its own.
+// Sampler walks a Fisher-Yates permutation of the data set, one contiguous slice per batch.
+//
+
+#ifndef SEM2LAB2_SAMPLER_H
+#define SEM2LAB2_SAMPLER_H
+
+#include <stdint.h>
+
+struct Random {
+    uint64_t state[4];
+} typedef Random;
+
+// seed the generator, different streams of one seed give independent sequences
+void random_seed(Random *random, uint64_t seed, uint64_t stream);
+
+uint64_t random_next(Random *random);
+
+// uniform integer in [0, bound) without modulo bias
+uint32_t random_below(Random *random, uint32_t bound);
+
+// uniform double in [0, 1)
+double random_uniform(Random *random);
+
+struct Sampler {
+    int number_of_samples;
+    int batch_size;
+    //current epoch's order of the samples, batches are consecutive slices of it
+    int *permutation;
+    int position;
+    int epoch;
+    Random random;
+} typedef Sampler;
+
+Sampler *create_sampler(int number_of_samples, int batch_size, uint64_t seed);
+
+void free_sampler(Sampler *sampler);
+
+// indices of the next batch, valid until the next call
+// a new permutation is drawn when fewer than batch_size samples are left in the epoch
+const int *sampler_next_batch(Sampler *sampler, int *count);
+
+#endif //SEM2LAB2_SAMPLER_H
@@ -0,0 +1,254 @@
+//
+// Streaming data loader: a background thread reads samples from a text or binary data set file,
+// shuffles them within a window and fills a ring of pre-allocated batch buffers, so training
+// never needs the whole data set in memory.
+//
+
+#define _POSIX_C_SOURCE 200112L
+//off_t of fseeko is 64 bits even on 32-bit systems
+#define _FILE_OFFSET_BITS 64
+
+#include "stream_loader.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dataset.h"
+
+// seek to an offset from the start of the file, which may lie beyond 2 GB, returns 0 on success
+static int seek_to(FILE *file, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(file, (__int64) offset, SEEK_SET);
+#else
+    return fseeko(file, (off_t) offset, SEEK_SET);
+#endif
+}
+
+// position the reader at the first sample, returns 0 when the file is malformed
+static int rewind_source(StreamLoader *loader) {
+    rewind(loader->file);
+    if (!loader->binary) {
+        return 1;
+    }
+    DatasetHeader header;
+    if (fread(&header, sizeof(header), 1, loader->file) != 1 || memcmp(header.magic, DATASET_MAGIC, 4) != 0 ||
+        header.dtype != DATASET_VALUE_DTYPE || (int) header.number_of_features != loader->number_of_features ||
+        header.feature_stride != header.number_of_features) {
+        printf("Error: Not a data set file!\n");
+        return 0;
+    }
+    if (header.number_of_classes == 0 || (int) header.number_of_classes > loader->number_of_classes) {
+        printf("Error: The data set has %u classes, the network %d outputs!\n", header.number_of_classes,
+               loader->number_of_classes);
+        return 0;
+    }
+    if (seek_to(loader->file, header.features_offset) != 0 || seek_to(loader->labels_file, header.labels_offset) != 0) {
+        printf("Error: Could not seek in the data set file!\n");
+        return 0;
+    }
+    loader->binary_samples_left = (long) header.number_of_samples;
+    return 1;
+}
+
+// read one sample, returns 0 at the end of the data
+static int read_sample(StreamLoader *loader, MatrixValue *features, int32_t *label) {
+    if (loader->binary) {
+        if (loader->binary_samples_left == 0 ||
+            fread(features, sizeof(MatrixValue), loader->number_of_features, loader->file) !=
+            (size_t) loader->number_of_features || fread(label, sizeof(int32_t), 1, loader->labels_file) != 1) {
+            return 0;
+        }
+        if (*label < 0 || *label >= loader->number_of_classes) {
+            printf("Error: Class index %d is out of range!\n", (int) *label);
+            return 0;
+        }
+        loader->binary_samples_left--;
+        return 1;
+    }
+    for (int j = 0; j < loader->number_of_features; j++) {
+        double value;
+        if (fscanf(loader->file, "%lf", &value) != 1) {
+            return 0;
+        }
+        features[j] = (MatrixValue) (value / loader->max_value_of_input);
+    }
+    int value;
+    if (fscanf(loader->file, "%d", &value) != 1) {
+        return 0;
+    }
+    if (value < 0 || value >= loader->number_of_classes) {
+        printf("Error: Class index %d is out of range!\n", value);
+        return 0;
+    }
+    *label = value;
+    return 1;
+}
+
+// read a sample into a window slot, wrapping around the file when repeating
+static int read_into_window(StreamLoader *loader, int slot) {
+    MatrixValue *features = loader->window_features + (size_t) slot * loader->number_of_features;
+    if (read_sample(loader, features, &loader->window_labels[slot])) {
+        return 1;
+    }
+    if (!loader->repeat || !rewind_source(loader)) {
+        return 0;
+    }
+    return read_sample(loader, features, &loader->window_labels[slot]);
+}
+
+// fill one batch buffer from the shuffle window, returns the number of samples written
+static int fill_buffer(StreamLoader *loader, StreamBuffer *buffer) {
+    int count = 0;
+    while (count < loader->batch_size && loader->window_fill > 0) {
+        int slot = (int) random_below(&loader->random, (uint32_t) loader->window_fill);
+        memcpy(buffer->features + (size_t) count * loader->number_of_features,
+               loader->window_features + (size_t) slot * loader->number_of_features,
+               loader->number_of_features * sizeof(MatrixValue));
+        buffer->labels[count] = loader->window_labels[slot];
+        count++;
+        //refill the slot from the file, or shrink the window once the file is exhausted
+        if (!read_into_window(loader, slot)) {
+            int last = --loader->window_fill;
+            memcpy(loader->window_features + (size_t) slot * loader->number_of_features,
+                   loader->window_features + (size_t) last * loader->number_of_features,
+                   loader->number_of_features * sizeof(MatrixValue));
+            loader->window_labels[slot] = loader->window_labels[last];
+        }
+    }
+    buffer->rows.number_of_samples = count;
+    return count;
+}
+
+static void *reader_loop(void *argument) {
+    StreamLoader *loader = argument;
+    while (loader->window_fill < loader->shuffle_window && read_into_window(loader, loader->window_fill)) {
+        loader->window_fill++;
+    }
+    pthread_mutex_lock(&loader->mutex);
+    while (!loader->stopping) {
+        //the published buffers, including the one the consumer is reading, occupy count slots
+        while (!loader->stopping && loader->count >= loader->number_of_buffers) {
+            pthread_cond_wait(&loader->not_full, &loader->mutex);
+        }
+        if (loader->stopping) {
+            break;
+        }
+        int tail = (loader->head + loader->count) % loader->number_of_buffers;
+        pthread_mutex_unlock(&loader->mutex);
+
+        //the reader owns the tail buffer until it is published
+        int filled = fill_buffer(loader, &loader->buffers[tail]);
+
+        pthread_mutex_lock(&loader->mutex);
+        if (filled == 0) {
+            break;
+        }
+        loader->count++;
+        pthread_cond_signal(&loader->not_empty);
+    }
+    loader->finished = 1;
+    pthread_cond_broadcast(&loader->not_empty);
+    pthread_mutex_unlock(&loader->mutex);
+    return NULL;
+}
+
+StreamLoader *open_stream_loader(char *file_name, int number_of_features, int number_of_classes,
+                                 double max_value_of_input, int batch_size, int number_of_buffers,
+                                 int shuffle_window, int repeat, uint64_t seed) {
+    FILE *file = fopen(file_name, "rb");
+    if (file == NULL) {
+        printf("Error: Could not open file!\n");
+        return NULL;
+    }
+    StreamLoader *loader = calloc(1, sizeof(StreamLoader));
+    loader->file = file;
+    //binary data sets start with the magic, everything else is parsed as text
+    char magic[4] = {0};
+    loader->binary = fread(magic, 1, 4, file) == 4 && memcmp(magic, DATASET_MAGIC, 4) == 0;
+    if (loader->binary) {
+        loader->labels_file = fopen(file_name, "rb");
+    }
+    loader->number_of_features = number_of_features;
+    loader->number_of_classes = number_of_classes;
+    loader->max_value_of_input = max_value_of_input;
+    loader->repeat = repeat;
+    if (!rewind_source(loader)) {
+        fclose(file);
+        if (loader->labels_file != NULL) {
+            fclose(loader->labels_file);
+        }
+        free(loader);
+        return NULL;
+    }
+
+    loader->shuffle_window = shuffle_window < 1 ? 1 : shuffle_window;
+    loader->window_features = malloc((size_t) loader->shuffle_window * number_of_features * sizeof(MatrixValue));
+    loader->window_labels = malloc(loader->shuffle_window * sizeof(int32_t));
+    random_seed(&loader->random, seed, 0);
+
+    loader->batch_size = batch_size;
+    //at least one buffer for the consumer and one being filled
+    loader->number_of_buffers = number_of_buffers < 2 ? 2 : number_of_buffers;
+    loader->buffers = malloc(loader->number_of_buffers * sizeof(StreamBuffer));
+    for (int i = 0; i < loader->number_of_buffers; i++) {
+        StreamBuffer *buffer = &loader->buffers[i];
+        buffer->features = aligned_malloc((size_t) batch_size * number_of_features * sizeof(MatrixValue));
+        buffer->labels = malloc(batch_size * sizeof(int32_t));
+        buffer->rows.number_of_samples = 0;
+        buffer->rows.number_of_features = number_of_features;
+        buffer->rows.number_of_classes = number_of_classes;
+        buffer->rows.features = buffer->features;
+        buffer->rows.feature_stride = number_of_features;
+        buffer->rows.labels = buffer->labels;
+        buffer->rows.indices = NULL;
+    }
+    loader->in_use = 0;
+    pthread_mutex_init(&loader->mutex, NULL);
+    pthread_cond_init(&loader->not_empty, NULL);
+    pthread_cond_init(&loader->not_full, NULL);
+    pthread_create(&loader->thread, NULL, reader_loop, loader);
+    return loader;
+}
+
+const SampleRows *stream_loader_next(StreamLoader *loader) {
+    pthread_mutex_lock(&loader->mutex);
+    if (loader->in_use) {
+        //give back the buffer from the previous call
+        loader->head = (loader->head + 1) % loader->number_of_buffers;
+        loader->count--;
+        loader->in_use = 0;
+        pthread_cond_signal(&loader->not_full);
+    }
+    while (loader->count == 0 && !loader->finished) {
+        pthread_cond_wait(&loader->not_empty, &loader->mutex);
+    }
+    const SampleRows *rows = NULL;
+    if (loader->count > 0) {
+        loader->in_use = 1;
+        rows = &loader->buffers[loader->head].rows;
+    }
+    pthread_mutex_unlock(&loader->mutex);
+    return rows;
+}
+
+void close_stream_loader(StreamLoader *loader) {
+    pthread_mutex_lock(&loader->mutex);
+    loader->stopping = 1;
+    pthread_cond_broadcast(&loader->not_full);
+    pthread_mutex_unlock(&loader->mutex);
+    pthread_join(loader->thread, NULL);
+    for (int i = 0; i < loader->number_of_buffers; i++) {
+        aligned_free(loader->buffers[i].features);
+        free(loader->buffers[i].labels);
+    }
+    free(loader->buffers);
+    free(loader->window_features);
+    free(loader->window_labels);
+    fclose(loader->file);
+    if (loader->labels_file != NULL) {
+        fclose(loader->labels_file);
+    }
+    pthread_mutex_destroy(&loader->mutex);
+    pthread_cond_destroy(&loader->not_empty);
+    pthread_cond_destroy(&loader->not_full);
+    free(loader);
+}
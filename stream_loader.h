@@ -0,0 +1,70 @@
+//
+// Streaming data loader: a background thread reads samples from a text or binary data set file,
+// shuffles them within a window and fills a ring of pre-allocated batch buffers, so training
+// never needs the whole data set in memory.
+//
+
+#ifndef SEM2LAB2_STREAM_LOADER_H
+#define SEM2LAB2_STREAM_LOADER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "network.h"
+#include "sampler.h"
+
+struct StreamBuffer {
+    MatrixValue *features;
+    int32_t *labels;
+    SampleRows rows;
+} typedef StreamBuffer;
+
+struct StreamLoader {
+    //source, a text file of "values... class_index" lines or a binary data set
+    FILE *file;
+    FILE *labels_file;
+    int binary;
+    long binary_samples_left;
+    int number_of_features;
+    int number_of_classes;
+    double max_value_of_input;
+    //rewind at the end of the file instead of finishing
+    int repeat;
+
+    //samples are drawn at random from a window that is refilled from the file
+    int shuffle_window;
+    int window_fill;
+    MatrixValue *window_features;
+    int32_t *window_labels;
+    Random random;
+
+    //ring of batches, filled by the reader thread and consumed by stream_loader_next
+    int batch_size;
+    int number_of_buffers;
+    StreamBuffer *buffers;
+    int head;
+    int count;
+    //the buffer handed out by the last stream_loader_next call, returned to the ring on the next one
+    int in_use;
+    int finished;
+    int stopping;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} typedef StreamLoader;
+
+// start reading file_name in the background
+// number_of_buffers batches of batch_size samples are kept ready, shuffle_window samples are mixed
+// returns NULL when the file cannot be opened
+StreamLoader *open_stream_loader(char *file_name, int number_of_features, int number_of_classes,
+                                 double max_value_of_input, int batch_size, int number_of_buffers,
+                                 int shuffle_window, int repeat, uint64_t seed);
+
+// wait for the next batch, NULL once the file is exhausted
+// the rows stay valid until the next call or close_stream_loader
+const SampleRows *stream_loader_next(StreamLoader *loader);
+
+void close_stream_loader(StreamLoader *loader);
+
+#endif //SEM2LAB2_STREAM_LOADER_H
@@ -0,0 +1,125 @@
+//
+// Fixed pool of worker threads that all run the same task and then wait for the next one.
+//
+
+#include "thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct Worker {
+    ThreadPool *pool;
+    int index;
+} typedef Worker;
+
+int default_thread_count() {
+#ifdef _SC_NPROCESSORS_ONLN
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count > 0) {
+        return (int) count;
+    }
+#endif
+    return 1;
+}
+
+static void *worker_loop(void *argument) {
+    Worker *worker = argument;
+    ThreadPool *pool = worker->pool;
+    unsigned long seen_generation = 0;
+    pthread_mutex_lock(&pool->mutex);
+    while (1) {
+        while (!pool->stopping && pool->generation == seen_generation) {
+            pthread_cond_wait(&pool->task_ready, &pool->mutex);
+        }
+        if (pool->stopping) {
+            break;
+        }
+        seen_generation = pool->generation;
+        ThreadTask task = pool->task;
+        void *context = pool->context;
+        pthread_mutex_unlock(&pool->mutex);
+
+        task(context, worker->index, pool->number_of_threads);
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->running--;
+        if (pool->running == 0) {
+            pthread_cond_signal(&pool->task_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    free(worker);
+    return NULL;
+}
+
+ThreadPool *create_thread_pool(int number_of_threads) {
+    if (number_of_threads < 1) {
+        number_of_threads = 1;
+    }
+    ThreadPool *pool = malloc(sizeof(ThreadPool));
+    pool->number_of_threads = number_of_threads;
+    pool->threads = malloc(number_of_threads * sizeof(pthread_t));
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->task_ready, NULL);
+    pthread_cond_init(&pool->task_done, NULL);
+    pool->task = NULL;
+    pool->context = NULL;
+    pool->generation = 0;
+    pool->running = 0;
+    pool->stopping = 0;
+    //thread 0 is the caller of thread_pool_run
+    for (int i = 1; i < number_of_threads; i++) {
+        Worker *worker = malloc(sizeof(Worker));
+        worker->pool = pool;
+        worker->index = i;
+        if (pthread_create(&pool->threads[i], NULL, worker_loop, worker) != 0) {
+            printf("Error: Could not start worker thread!\n");
+            exit(1);
+        }
+    }
+    return pool;
+}
+
+void free_thread_pool(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->task_ready);
+    pthread_mutex_unlock(&pool->mutex);
+    for (int i = 1; i < pool->number_of_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->task_ready);
+    pthread_cond_destroy(&pool->task_done);
+    free(pool->threads);
+    free(pool);
+}
+
+void thread_pool_run(ThreadPool *pool, ThreadTask task, void *context) {
+    if (pool->number_of_threads == 1) {
+        task(context, 0, 1);
+        return;
+    }
+    pthread_mutex_lock(&pool->mutex);
+    pool->task = task;
+    pool->context = context;
+    pool->running = pool->number_of_threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->task_ready);
+    pthread_mutex_unlock(&pool->mutex);
+
+    task(context, 0, pool->number_of_threads);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->running > 0) {
+        pthread_cond_wait(&pool->task_done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void thread_range(int count, int thread_index, int number_of_threads, int *begin, int *end) {
+    int base = count / number_of_threads;
+    int remainder = count % number_of_threads;
+    *begin = thread_index * base + (thread_index < remainder ? thread_index : remainder);
+    *end = *begin + base + (thread_index < remainder ? 1 : 0);
+}
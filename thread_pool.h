@@ -0,0 +1,40 @@
+//
+// Fixed pool of worker threads that all run the same task and then wait for the next one.
+//
+
+#ifndef SEM2LAB2_THREAD_POOL_H
+#define SEM2LAB2_THREAD_POOL_H
+
+#include <pthread.h>
+
+// task run by every thread of the pool, thread_index goes from 0 to number_of_threads - 1
+typedef void (*ThreadTask)(void *context, int thread_index, int number_of_threads);
+
+struct ThreadPool {
+    int number_of_threads;
+    pthread_t *threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t task_ready;
+    pthread_cond_t task_done;
+    ThreadTask task;
+    void *context;
+    unsigned long generation;
+    int running;
+    int stopping;
+} typedef ThreadPool;
+
+// number of online processors, at least 1
+int default_thread_count();
+
+// the calling thread takes part in every task as thread 0, so number_of_threads - 1 workers are started
+ThreadPool *create_thread_pool(int number_of_threads);
+
+void free_thread_pool(ThreadPool *pool);
+
+// run task on every thread of the pool and return once all of them finished
+void thread_pool_run(ThreadPool *pool, ThreadTask task, void *context);
+
+// split count items into number_of_threads contiguous ranges, returns the range of thread_index
+void thread_range(int count, int thread_index, int number_of_threads, int *begin, int *end);
+
+#endif //SEM2LAB2_THREAD_POOL_H
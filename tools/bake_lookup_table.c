@@ -0,0 +1,228 @@
+//
+// Bake a 3-input model such as the Lab colour classifier into a lookup table (lookup_table.h)
+// and report how often the table agrees with the network, on random points of the box and on
+// the samples of a binary data set, along with the time per classification of each.
+// bake_lookup_table <model> <table.lut> [resolution or r0,r1,r2] [probabilities 0|1] [data.bin]
+// The box is the normalised Lab range of the training data: L in [0, 1], a and b in [-1, 1].
+//
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../lookup_table.h"
+#include "../model_io.h"
+#include "../dataset.h"
+#include "../sampler.h"
+
+#define RANDOM_POINTS 200000
+
+// the timed classifications are added here so they are not optimised away
+static volatile long sink;
+
+struct Agreement {
+    long samples;
+    //predictions equal to the network's
+    long nearest;
+    long interpolated;
+    //predictions equal to the labels, when there are labels
+    long network_correct;
+    long nearest_correct;
+    long interpolated_correct;
+} typedef Agreement;
+
+static double now_seconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec * 1e-9;
+}
+
+static int max_index(const MatrixValue *values, int count) {
+    int best = 0;
+    for (int i = 1; i < count; i++) {
+        if (values[i] > values[best]) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// compare the table with the network on number_of_samples inputs, labels may be NULL
+static Agreement compare(const LookupTable *table, const InferenceModel *model, const MatrixValue *inputs,
+                         const int32_t *labels, int number_of_samples) {
+    int classes = table->number_of_classes;
+    Agreement agreement = {number_of_samples, 0, 0, 0, 0, 0};
+    MatrixValue *outputs = malloc(sizeof(MatrixValue) * number_of_samples * classes);
+    infer_batch(model, NULL, inputs, number_of_samples, outputs);
+    for (int s = 0; s < number_of_samples; s++) {
+        double input[3] = {inputs[s * 3], inputs[s * 3 + 1], inputs[s * 3 + 2]};
+        int network = max_index(outputs + (size_t) s * classes, classes);
+        int nearest = lookup_class(table, input);
+        int interpolated = lookup_class_interpolated(table, input, NULL);
+        agreement.nearest += nearest == network;
+        agreement.interpolated += interpolated == network;
+        if (labels != NULL) {
+            agreement.network_correct += network == labels[s];
+            agreement.nearest_correct += nearest == labels[s];
+            agreement.interpolated_correct += interpolated == labels[s];
+        }
+    }
+    free(outputs);
+    return agreement;
+}
+
+static void print_agreement(const char *name, const Agreement *agreement, int has_labels, int has_probabilities) {
+    double samples = (double) agreement->samples;
+    printf("%s, %ld samples: nearest agrees with the network on %.3f%%", name, agreement->samples,
+           agreement->nearest / samples * 100);
+    if (has_probabilities) {
+        printf(", interpolated on %.3f%%", agreement->interpolated / samples * 100);
+    }
+    printf("\n");
+    if (has_labels) {
+        printf("  accuracy: network %.3f%%, nearest %.3f%%", agreement->network_correct / samples * 100,
+               agreement->nearest_correct / samples * 100);
+        if (has_probabilities) {
+            printf(", interpolated %.3f%%", agreement->interpolated_correct / samples * 100);
+        }
+        printf("\n");
+    }
+}
+
+// nanoseconds per classification of the inputs one at a time
+static double time_lookups(const LookupTable *table, const MatrixValue *inputs, int number_of_samples,
+                           int interpolated) {
+    long sum = 0;
+    double start = now_seconds();
+    for (int s = 0; s < number_of_samples; s++) {
+        double input[3] = {inputs[s * 3], inputs[s * 3 + 1], inputs[s * 3 + 2]};
+        sum += interpolated ? lookup_class_interpolated(table, input, NULL) : lookup_class(table, input);
+    }
+    double seconds = now_seconds() - start;
+    sink += sum;
+    return seconds / number_of_samples * 1e9;
+}
+
+static double time_network(const InferenceModel *model, const MatrixValue *inputs, int number_of_samples,
+                           int batched) {
+    long sum = 0;
+    InferenceScratch *scratch = create_inference_scratch(model, INFERENCE_BATCH_SIZE);
+    int classes = model->layer_sizes[model->number_of_layers - 1];
+    MatrixValue *outputs = malloc(sizeof(MatrixValue) * INFERENCE_BATCH_SIZE * classes);
+    double start = now_seconds();
+    if (batched) {
+        for (int first = 0; first < number_of_samples; first += INFERENCE_BATCH_SIZE) {
+            int count = number_of_samples - first < INFERENCE_BATCH_SIZE ? number_of_samples - first
+                                                                        : INFERENCE_BATCH_SIZE;
+            infer_batch(model, scratch, inputs + (size_t) first * 3, count, outputs);
+            for (int s = 0; s < count; s++) {
+                sum += max_index(outputs + (size_t) s * classes, classes);
+            }
+        }
+    } else {
+        for (int s = 0; s < number_of_samples; s++) {
+            sum += infer_class(model, scratch, inputs + (size_t) s * 3);
+        }
+    }
+    double seconds = now_seconds() - start;
+    sink += sum;
+    free(outputs);
+    free_inference_scratch(scratch);
+    return seconds / number_of_samples * 1e9;
+}
+
+// "64" or "32,64,64"
+static int parse_resolution(char *text, int resolution[3]) {
+    int count = sscanf(text, "%d,%d,%d", &resolution[0], &resolution[1], &resolution[2]);
+    if (count == 1) {
+        resolution[1] = resolution[2] = resolution[0];
+    }
+    return count == 1 || count == 3;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("usage: %s <model> <table.lut> [resolution or r0,r1,r2] [probabilities 0|1] [data.bin]\n", argv[0]);
+        return 1;
+    }
+    int resolution[3] = {64, 64, 64};
+    if (argc > 3 && !parse_resolution(argv[3], resolution)) {
+        printf("Error: Invalid resolution %s!\n", argv[3]);
+        return 1;
+    }
+    int with_probabilities = argc > 4 && atoi(argv[4]) != 0;
+    double minimum[3] = {0, -1, -1};
+    double maximum[3] = {1, 1, 1};
+
+    Network *network = load_network_any(argv[1]);
+    if (network == NULL) {
+        return 1;
+    }
+    InferenceModel *model = create_inference_model(network);
+    free_network(network);
+    double start = now_seconds();
+    LookupTable *baked = bake_lookup_table(model, resolution, minimum, maximum, with_probabilities);
+    if (baked == NULL || save_lookup_table(baked, argv[2]) != 0) {
+        if (baked != NULL) {
+            free_lookup_table(baked);
+        }
+        free_inference_model(model);
+        return 1;
+    }
+    printf("baked %d x %d x %d points%s in %.3f s, %zu bytes\n", resolution[0], resolution[1], resolution[2],
+           with_probabilities ? " with probabilities" : "", now_seconds() - start, baked->image_size);
+    free_lookup_table(baked);
+
+    //everything below uses the table as a program serving it would, mapped from the file
+    LookupTable *table = open_lookup_table(argv[2], 1);
+    if (table == NULL) {
+        free_inference_model(model);
+        return 1;
+    }
+    MatrixValue *points = malloc(sizeof(MatrixValue) * RANDOM_POINTS * 3);
+    Random random;
+    random_seed(&random, 1, 0);
+    for (int s = 0; s < RANDOM_POINTS; s++) {
+        for (int d = 0; d < 3; d++) {
+            points[s * 3 + d] = (MatrixValue) (minimum[d] + random_uniform(&random) * (maximum[d] - minimum[d]));
+        }
+    }
+    Agreement agreement = compare(table, model, points, NULL, RANDOM_POINTS);
+    print_agreement("random points of the box", &agreement, 0, with_probabilities);
+
+    int failed = 0;
+    if (argc > 5) {
+        Dataset *dataset = open_dataset(argv[5]);
+        if (dataset == NULL || dataset->header.number_of_features != 3) {
+            printf("Error: %s is not a data set of 3 features!\n", argv[5]);
+            failed = 1;
+        } else {
+            SampleRows rows = dataset_rows(dataset);
+            //the rows are read in place, their stride is padded to the matrices'
+            MatrixValue *inputs = malloc(sizeof(MatrixValue) * rows.number_of_samples * 3);
+            for (int s = 0; s < rows.number_of_samples; s++) {
+                for (int d = 0; d < 3; d++) {
+                    inputs[s * 3 + d] = rows.features[(size_t) s * rows.feature_stride + d];
+                }
+            }
+            agreement = compare(table, model, inputs, rows.labels, rows.number_of_samples);
+            print_agreement(argv[5], &agreement, 1, with_probabilities);
+            free(inputs);
+        }
+        if (dataset != NULL) {
+            close_dataset(dataset);
+        }
+    }
+
+    printf("per classification: nearest %.1f ns", time_lookups(table, points, RANDOM_POINTS, 0));
+    if (with_probabilities) {
+        printf(", interpolated %.1f ns", time_lookups(table, points, RANDOM_POINTS, 1));
+    }
+    printf(", network %.1f ns one at a time and %.1f ns batched\n", time_network(model, points, RANDOM_POINTS, 0),
+           time_network(model, points, RANDOM_POINTS, 1));
+    free(points);
+    free_lookup_table(table);
+    free_inference_model(model);
+    return failed;
+}
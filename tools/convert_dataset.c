@@ -0,0 +1,22 @@
+//
+// Convert a text data set ("values... class_index" per line) into the binary format of dataset.h
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../dataset.h"
+
+int main(int argc, char **argv) {
+    if (argc < 5) {
+        printf("usage: %s <input.txt> <output.bin> <number_of_features> <number_of_classes> [max_value_of_input]\n",
+               argv[0]);
+        return 1;
+    }
+    double max_value_of_input = argc > 5 ? atof(argv[5]) : 1;
+    long samples = convert_text_dataset(argv[1], argv[2], atoi(argv[3]), atoi(argv[4]), max_value_of_input);
+    if (samples < 0) {
+        return 1;
+    }
+    printf("converted %ld samples\n", samples);
+    return 0;
+}
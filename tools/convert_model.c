@@ -0,0 +1,31 @@
+//
+// Convert a text model written by save_network_to_file (network_*.txt) into the binary format of model_io.h
+//
+
+#include <stdio.h>
+#include "../network.h"
+#include "../model_io.h"
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("usage: %s <network.txt> <network.bin>\n", argv[0]);
+        return 1;
+    }
+    Network *network = load_network_from_file(argv[1]);
+    if (network == NULL) {
+        return 1;
+    }
+    int result = save_network_binary(network, argv[2]);
+    if (result == 0) {
+        //read the file back to make sure it is complete
+        Network *check = load_network_binary(argv[2], 1);
+        if (check == NULL) {
+            result = 1;
+        } else {
+            free_network(check);
+            printf("converted %d layers\n", network->number_of_layers);
+        }
+    }
+    free_network(network);
+    return result == 0 ? 0 : 1;
+}
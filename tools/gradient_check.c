@@ -0,0 +1,110 @@
+//
+// Check the gradients of backpropagation against finite differences of the loss, for both
+// loss functions or one of them, on samples of a binary data set or on random ones ("-").
+// Exits with 1 when a parameter's relative error exceeds the tolerance, ctest runs it for each loss.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../network.h"
+#include "../dataset.h"
+#include "../gradients.h"
+
+// central differences lose about half of the digits, far more in single precision
+// larger steps would cross the kink of Leaky ReLU for more samples
+// correct gradients give errors around 1e-6 in double precision, a wrong one errors near 1
+#ifdef MATRIX_FLOAT32
+#define CHECK_EPSILON 1e-3
+#define CHECK_TOLERANCE 5e-2
+#else
+#define CHECK_EPSILON 1e-5
+#define CHECK_TOLERANCE 1e-3
+#endif
+
+// random inputs in [0, 1] with random classes, stored like a binary data set
+static SampleRows random_rows(int number_of_samples, int number_of_features, int number_of_classes,
+                              MatrixValue **features, int32_t **labels) {
+    *features = malloc(sizeof(MatrixValue) * number_of_samples * number_of_features);
+    *labels = malloc(sizeof(int32_t) * number_of_samples);
+    for (int i = 0; i < number_of_samples * number_of_features; i++) {
+        (*features)[i] = (MatrixValue) rand() / RAND_MAX;
+    }
+    for (int i = 0; i < number_of_samples; i++) {
+        (*labels)[i] = rand() % number_of_classes;
+    }
+    SampleRows rows;
+    rows.number_of_samples = number_of_samples;
+    rows.number_of_features = number_of_features;
+    rows.number_of_classes = number_of_classes;
+    rows.features = *features;
+    rows.feature_stride = number_of_features;
+    rows.labels = *labels;
+    rows.indices = NULL;
+    return rows;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "-h") == 0) {
+        printf("usage: %s [samples] [parameters per layer] [data.bin or -] [mse, cross-entropy or both]\n", argv[0]);
+        return 0;
+    }
+    int check_loss[] = {1, 1};
+    if (argc > 4) {
+        check_loss[0] = strcmp(argv[4], "mse") == 0 || strcmp(argv[4], "both") == 0;
+        check_loss[1] = strcmp(argv[4], "cross-entropy") == 0 || strcmp(argv[4], "both") == 0;
+        if (!check_loss[0] && !check_loss[1]) {
+            printf("Error: Unknown loss %s!\n", argv[4]);
+            return 1;
+        }
+    }
+    int number_of_samples = argc > 1 ? atoi(argv[1]) : 32;
+    int parameters_per_layer = argc > 2 ? atoi(argv[2]) : 200;
+    srand(1);
+
+    MatrixValue *features = NULL;
+    int32_t *labels = NULL;
+    Dataset *dataset = NULL;
+    SampleRows rows;
+    if (argc > 3 && strcmp(argv[3], "-") != 0) {
+        dataset = open_dataset(argv[3]);
+        if (dataset == NULL) {
+            return 1;
+        }
+        rows = dataset_rows(dataset);
+        if (number_of_samples > rows.number_of_samples) {
+            number_of_samples = rows.number_of_samples;
+        }
+        rows = dataset_slice(dataset, 0, number_of_samples);
+    } else {
+        rows = random_rows(number_of_samples, 3, 16, &features, &labels);
+    }
+    //the lab topology, sized to the data
+    int layer_sizes[] = {rows.number_of_features, 10, 16, 20, rows.number_of_classes};
+
+    int failed = 0;
+    LossFunction losses[] = {LOSS_MEAN_SQUARED_ERROR, LOSS_CROSS_ENTROPY};
+    const char *names[] = {"squared error", "cross entropy"};
+    for (int l = 0; l < 2; l++) {
+        if (!check_loss[l]) {
+            continue;
+        }
+        Network *network = create_network(5, layer_sizes);
+        network->loss = losses[l];
+        GradientCheck check = check_gradients(network, &rows, parameters_per_layer, CHECK_EPSILON, CHECK_TOLERANCE);
+        printf("%-14s %d parameters over %d samples: max relative error %.2e (layer %d, %s %d), %d above %.0e, "
+               "%d near a kink\n",
+               names[l], check.parameters_checked, number_of_samples, check.max_relative_error, check.worst_layer,
+               check.worst_index < 0 ? "bias" : "weight", check.worst_index < 0 ? -1 - check.worst_index
+                                                                                : check.worst_index,
+               check.failures, CHECK_TOLERANCE, check.kinks);
+        failed |= check.failures > 0;
+        free_network(network);
+    }
+    free(features);
+    free(labels);
+    if (dataset != NULL) {
+        close_dataset(dataset);
+    }
+    return failed;
+}
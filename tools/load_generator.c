@@ -0,0 +1,135 @@
+//
+// Load generator for `Sem2Lab2 serve`: every client thread keeps a number of requests in flight
+// on its own connection and times each one from sending it to receiving its response.
+// load_generator <socket> [clients] [requests per client] [requests in flight per client]
+// The inputs are random values in [-1, 1], the range of the Lab training data.
+//
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../inference_server.h"
+#include "../thread_pool.h"
+#include "../sampler.h"
+
+struct Load {
+    char *socket_path;
+    int requests_per_client;
+    int in_flight;
+    //latencies[client][request] in seconds
+    double **latencies;
+    int *failed;
+} typedef Load;
+
+static double now_seconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec * 1e-9;
+}
+
+static void client_task(void *context, int thread_index, int number_of_threads) {
+    (void) number_of_threads;
+    Load *load = context;
+    InferenceClient *client = connect_inference_server(load->socket_path);
+    if (client == NULL) {
+        load->failed[thread_index] = 1;
+        return;
+    }
+    Random random;
+    random_seed(&random, 1, thread_index);
+    double *input = malloc(sizeof(double) * client->number_of_features);
+    //sending times of the requests in flight, oldest first
+    double *sent = malloc(sizeof(double) * load->in_flight);
+    double *latencies = load->latencies[thread_index];
+    int requests = load->requests_per_client;
+    int number_sent = 0;
+    for (int r = 0; r < requests; r++) {
+        while (number_sent < requests && number_sent - r < load->in_flight) {
+            for (int i = 0; i < client->number_of_features; i++) {
+                input[i] = 2 * random_uniform(&random) - 1;
+            }
+            sent[number_sent % load->in_flight] = now_seconds();
+            if (send_inference_request(client, input) != 0) {
+                load->failed[thread_index] = 1;
+                break;
+            }
+            number_sent++;
+        }
+        int32_t class_index;
+        if (load->failed[thread_index] || receive_inference_response(client, &class_index, NULL) != 0) {
+            load->failed[thread_index] = 1;
+            break;
+        }
+        latencies[r] = now_seconds() - sent[r % load->in_flight];
+    }
+    free(input);
+    free(sent);
+    close_inference_client(client);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// the value below which a fraction of the sorted values lie
+static double percentile(const double *sorted, long count, double fraction) {
+    long index = (long) (fraction * (double) (count - 1) + 0.5);
+    return sorted[index];
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("usage: %s <socket> [clients] [requests per client] [requests in flight per client]\n", argv[0]);
+        return 1;
+    }
+    int number_of_clients = argc > 2 ? atoi(argv[2]) : 8;
+    Load load;
+    load.socket_path = argv[1];
+    load.requests_per_client = argc > 3 ? atoi(argv[3]) : 10000;
+    load.in_flight = argc > 4 ? atoi(argv[4]) : 1;
+    if (number_of_clients < 1 || load.requests_per_client < 1 || load.in_flight < 1) {
+        printf("Error: Clients, requests and requests in flight must be positive!\n");
+        return 1;
+    }
+    load.latencies = malloc(sizeof(double *) * number_of_clients);
+    load.failed = calloc(number_of_clients, sizeof(int));
+    for (int c = 0; c < number_of_clients; c++) {
+        load.latencies[c] = malloc(sizeof(double) * load.requests_per_client);
+    }
+
+    //one pool thread per client, all connected while the others already send
+    ThreadPool *pool = create_thread_pool(number_of_clients);
+    double start = now_seconds();
+    thread_pool_run(pool, client_task, &load);
+    double seconds = now_seconds() - start;
+    free_thread_pool(pool);
+
+    int failed = 0;
+    long count = (long) number_of_clients * load.requests_per_client;
+    double *all = malloc(sizeof(double) * count);
+    for (int c = 0; c < number_of_clients; c++) {
+        failed |= load.failed[c];
+        for (int r = 0; r < load.requests_per_client; r++) {
+            all[(long) c * load.requests_per_client + r] = load.latencies[c][r];
+        }
+        free(load.latencies[c]);
+    }
+    if (failed) {
+        printf("Error: A client lost its connection!\n");
+    } else {
+        qsort(all, count, sizeof(double), compare_doubles);
+        printf("%d clients, %d requests in flight each, %ld requests in %.3f s\n", number_of_clients, load.in_flight,
+               count, seconds);
+        printf("throughput %.0f requests/s\n", count / seconds);
+        printf("latency p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n", percentile(all, count, 0.5) * 1e6,
+               percentile(all, count, 0.9) * 1e6, percentile(all, count, 0.99) * 1e6, all[count - 1] * 1e6);
+    }
+    free(all);
+    free(load.latencies);
+    free(load.failed);
+    return failed;
+}
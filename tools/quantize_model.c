@@ -0,0 +1,168 @@
+//
+// Quantize a trained model to int8 weights calibrated on the first samples of a binary data set
+// and report the accuracy lost against the latency and memory won on the remaining samples.
+//
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../network.h"
+#include "../model_io.h"
+#include "../dataset.h"
+#include "../inference.h"
+#include "../quantization.h"
+
+static double now_seconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec * 1e-9;
+}
+
+static int argmax(const MatrixValue *values, int count) {
+    int best = 0;
+    for (int i = 1; i < count; i++) {
+        if (values[i] > values[best]) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// microseconds per sample of inferring count samples per call, repeated for at least min_seconds
+static double time_float(const InferenceModel *model, InferenceScratch *scratch, const SampleRows *rows, int count,
+                         MatrixValue *outputs, double min_seconds) {
+    long samples = 0;
+    double start = now_seconds();
+    double elapsed = 0;
+    while (elapsed < min_seconds) {
+        for (int first = 0; first + count <= rows->number_of_samples; first += count) {
+            infer_batch(model, scratch, rows->features + (size_t) first * rows->feature_stride, count, outputs);
+            samples += count;
+        }
+        elapsed = now_seconds() - start;
+    }
+    return elapsed / samples * 1e6;
+}
+
+static double time_quantized(const QuantizedModel *model, QuantizedScratch *scratch, const SampleRows *rows,
+                             int count, MatrixValue *outputs, double min_seconds) {
+    long samples = 0;
+    double start = now_seconds();
+    double elapsed = 0;
+    while (elapsed < min_seconds) {
+        for (int first = 0; first + count <= rows->number_of_samples; first += count) {
+            infer_batch_quantized(model, scratch, rows->features + (size_t) first * rows->feature_stride, count,
+                                  outputs);
+            samples += count;
+        }
+        elapsed = now_seconds() - start;
+    }
+    return elapsed / samples * 1e6;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        printf("usage: %s <network.txt|network.bin> <data.bin> <network.q8> [calibration samples] [per-row|per-layer]\n",
+               argv[0]);
+        return 1;
+    }
+    int calibration_samples = argc > 4 ? atoi(argv[4]) : 1000;
+    QuantizationGranularity granularity = argc > 5 && strcmp(argv[5], "per-layer") == 0 ? QUANTIZE_PER_LAYER
+                                                                                           : QUANTIZE_PER_ROW;
+    Network *network = load_network_any(argv[1]);
+    if (network == NULL) {
+        return 1;
+    }
+    Dataset *dataset = open_dataset(argv[2]);
+    if (dataset == NULL) {
+        free_network(network);
+        return 1;
+    }
+    SampleRows rows = dataset_rows(dataset);
+    if (rows.number_of_features != network->layers[0]->layer_size) {
+        printf("Error: Data set does not fit the network!\n");
+        close_dataset(dataset);
+        free_network(network);
+        return 1;
+    }
+    if (calibration_samples < 1 || calibration_samples > rows.number_of_samples) {
+        calibration_samples = rows.number_of_samples;
+    }
+    //the report is measured on the samples not used for calibration, if there are any
+    SampleRows calibration = dataset_slice(dataset, 0, calibration_samples);
+    SampleRows test = calibration_samples < rows.number_of_samples
+                      ? dataset_slice(dataset, calibration_samples, rows.number_of_samples - calibration_samples)
+                      : rows;
+
+    QuantizedModel *quantized = quantize_network(network, &calibration, granularity);
+    if (save_quantized_model(quantized, argv[3]) != 0) {
+        return 1;
+    }
+    free_quantized_model(quantized);
+    //everything below runs on the file as it was written
+    quantized = load_quantized_model(argv[3], 1);
+    if (quantized == NULL) {
+        return 1;
+    }
+    InferenceModel *model = create_inference_model(network);
+    size_t float_bytes = 0;
+    for (int i = 1; i < network->number_of_layers; i++) {
+        Layer *layer = network->layers[i];
+        float_bytes += ((size_t) layer->layer_size * layer->input_size + layer->layer_size) * sizeof(MatrixValue);
+    }
+    free_network(network);
+
+    int classes = model->layer_sizes[model->number_of_layers - 1];
+    MatrixValue *float_outputs = malloc(sizeof(MatrixValue) * classes * test.number_of_samples);
+    MatrixValue *quantized_outputs = malloc(sizeof(MatrixValue) * classes * test.number_of_samples);
+    InferenceScratch *scratch = create_inference_scratch(model, INFERENCE_BATCH_SIZE);
+    QuantizedScratch *quantized_scratch = create_quantized_scratch(quantized);
+    infer_batch(model, scratch, test.features, test.number_of_samples, float_outputs);
+    infer_batch_quantized(quantized, quantized_scratch, test.features, test.number_of_samples, quantized_outputs);
+
+    long float_correct = 0, quantized_correct = 0, agreeing = 0;
+    double max_difference = 0;
+    for (int j = 0; j < test.number_of_samples; j++) {
+        int float_class = argmax(float_outputs + (size_t) j * classes, classes);
+        int quantized_class = argmax(quantized_outputs + (size_t) j * classes, classes);
+        float_correct += float_class == test.labels[j];
+        quantized_correct += quantized_class == test.labels[j];
+        agreeing += float_class == quantized_class;
+        for (int c = 0; c < classes; c++) {
+            double difference = fabs(float_outputs[(size_t) j * classes + c] -
+                                     quantized_outputs[(size_t) j * classes + c]);
+            max_difference = difference > max_difference ? difference : max_difference;
+        }
+    }
+    double float_single = time_float(model, scratch, &test, 1, float_outputs, 0.5);
+    double quantized_single = time_quantized(quantized, quantized_scratch, &test, 1, quantized_outputs, 0.5);
+    int batch = test.number_of_samples < INFERENCE_BATCH_SIZE ? test.number_of_samples : INFERENCE_BATCH_SIZE;
+    double float_batch = time_float(model, scratch, &test, batch, float_outputs, 0.5);
+    double quantized_batch = time_quantized(quantized, quantized_scratch, &test, batch, quantized_outputs, 0.5);
+
+    size_t quantized_bytes = quantized_parameter_bytes(quantized);
+    printf("calibrated on %d samples, %s scales, evaluated on %d samples\n", calibration_samples,
+           granularity == QUANTIZE_PER_ROW ? "per-row" : "per-layer", test.number_of_samples);
+    printf("               %12s %12s\n", sizeof(MatrixValue) == sizeof(float) ? "float32" : "float64", "int8");
+    printf("accuracy       %11.2f%% %11.2f%%\n", 100.0 * float_correct / test.number_of_samples,
+           100.0 * quantized_correct / test.number_of_samples);
+    printf("us/sample n=1  %12.3f %12.3f\n", float_single, quantized_single);
+    printf("us/sample n=%-3d%12.3f %12.3f\n", batch, float_batch, quantized_batch);
+    printf("weight bytes   %12zu %12zu\n", float_bytes, quantized_bytes);
+    printf("class agreement %.2f%%, max probability difference %.4f, %.1fx smaller, file %zu bytes\n",
+           100.0 * agreeing / test.number_of_samples, max_difference, (double) float_bytes / quantized_bytes,
+           quantized->image_size);
+
+    free(float_outputs);
+    free(quantized_outputs);
+    free_inference_scratch(scratch);
+    free_quantized_scratch(quantized_scratch);
+    free_inference_model(model);
+    free_quantized_model(quantized);
+    close_dataset(dataset);
+    return 0;
+}
@@ -39,11 +39,48 @@ TrainingDataPacket **read_training_data(char *file_name, int lenght_of_training_
         for (int j = 0; j < packet_size; j++) {
             double value;
             fscanf(file, "%lf", &value);
-            training_data[i]->input->values[j][0] = value/max_value_of_input;
+            MATRIX_AT(training_data[i]->input, j, 0) = (MatrixValue) (value / max_value_of_input);
         }
         int target_index;
         fscanf(file, "%d", &target_index);
-        training_data[i]->target->values[target_index][0] = 1;
+        MATRIX_AT(training_data[i]->target, target_index, 0) = 1;
+    }
+    fclose(file);
+    return training_data;
+}
+
+//read the shard-th of number_of_shards contiguous parts of the first lenght_of_training_data samples
+//the samples of the other shards are parsed and skipped, never stored
+TrainingDataPacket **read_training_data_shard(char *file_name, int lenght_of_training_data, int shard,
+                                              int number_of_shards, int packet_size, int output_size,
+                                              double max_value_of_input, int *length_of_shard) {
+    int first = (int) ((long) lenght_of_training_data * shard / number_of_shards);
+    int last = (int) ((long) lenght_of_training_data * (shard + 1) / number_of_shards);
+    *length_of_shard = last - first;
+    FILE *file = fopen(file_name, "r");
+    if (file == NULL) {
+        printf("Error: Could not open file!\n");
+        return NULL;
+    }
+    for (int i = 0; i < first; i++) {
+        double value;
+        int target_index;
+        for (int j = 0; j < packet_size; j++) {
+            fscanf(file, "%lf", &value);
+        }
+        fscanf(file, "%d", &target_index);
+    }
+    TrainingDataPacket **training_data = malloc(*length_of_shard * sizeof(TrainingDataPacket *));
+    for (int i = 0; i < *length_of_shard; i++) {
+        training_data[i] = create_training_data_packet(packet_size, output_size);
+        for (int j = 0; j < packet_size; j++) {
+            double value;
+            fscanf(file, "%lf", &value);
+            MATRIX_AT(training_data[i]->input, j, 0) = (MatrixValue) (value / max_value_of_input);
+        }
+        int target_index;
+        fscanf(file, "%d", &target_index);
+        MATRIX_AT(training_data[i]->target, target_index, 0) = 1;
     }
     fclose(file);
     return training_data;
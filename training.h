@@ -22,4 +22,10 @@ TrainingDataPacket *create_training_data_packet();
 // 0.1 0.3 0.3 14
 TrainingDataPacket **read_training_data(char file_name[], int lenght_of_training_data, int packet_size, int output_size,double max_value_of_input);
 
+//read only the shard-th of number_of_shards equal parts of the samples, for one of several training processes
+//stores the number of samples read in length_of_shard
+TrainingDataPacket **read_training_data_shard(char file_name[], int lenght_of_training_data, int shard,
+                                              int number_of_shards, int packet_size, int output_size,
+                                              double max_value_of_input, int *length_of_shard);
+
 #endif //SEM2LAB2_TRAINING_H